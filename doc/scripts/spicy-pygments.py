@@ -60,7 +60,7 @@ class SpicyLexer(RegexLexer):
                     'originator', 'parse-at', 'parse-from', 'priority',
                     'requires', 'responder', 'size', 'static', 'synchronize',
                     'transient', 'try', 'type', 'until', 'until-including',
-                    'while', 'have_prototype'),
+                    'view', 'while', 'have_prototype'),
                 prefix=r'&', suffix=r'\b'),
              Keyword.Pseudo),
         ],
@@ -29,6 +29,12 @@ struct Configuration {
     /** Max. number of fibers cached for reuse. */
     unsigned int fiber_cache_size = 200;
 
+    /**
+     * Max. number of fibers kept in a global pool for reuse by any thread
+     * running with migratable fibers, in addition to each thread's own cache.
+     */
+    unsigned int fiber_global_cache_size = 200;
+
     /**
      * Minimum stack size that a fiber must have left for use at beginning of a
      * function's execution. This should leave enough headroom for (1) the
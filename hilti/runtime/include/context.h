@@ -59,6 +59,13 @@ struct Context {
     /** A user-defined cookie value that's carried around with the context. */
     void* cookie = nullptr;
 
+    /**
+     * If set, output stream for `hilti::print()` executing inside this
+     * context, overriding `Configuration::cout`. Output silenced through the
+     * configuration remains silenced.
+     */
+    std::ostream* cout = nullptr;
+
     /** Current indent level for debug messages. */
     uint64_t debug_indent{};
 };
@@ -147,6 +154,53 @@ private:
     void* _old;
 };
 
+/**
+ * Utility class that creates a new context for the current hardware thread
+ * and installs it as the thread's current context during its life-time. This
+ * is the supported way for a host application to run HILTI/Spicy code on
+ * additional threads: create one instance on each worker thread before
+ * executing any runtime functionality there, and keep it alive as long as
+ * that thread may access runtime state, including any `Resumable` it has
+ * created (which are bound to the thread's context). Each context comes with
+ * its own set of HILTI globals and its own fiber cache; for the globals to
+ * be separate, generated code must be compiled with dynamic globals enabled.
+ *
+ * The runtime must have been initialized through `hilti::rt::init()` on the
+ * main thread before, and `hilti::rt::done()` must not be called before all
+ * instances have been destroyed.
+ *
+ * By default, a `Resumable` must always be resumed on the thread that
+ * created it. If a context is created with migratable fibers, its fibers
+ * will use individual stacks instead of the shared stack, which allows a
+ * suspended `Resumable` to be resumed on any other thread that has a context
+ * with migratable fibers as well, as long as only one thread accesses it at
+ * a time. Note that the resumed code will then see the HILTI globals of
+ * the thread it's running on.
+ */
+class ThreadContext {
+public:
+    /**
+     * Constructor.
+     *
+     * @param migratable if true, the context uses migratable fibers
+     * @throws UsageError if the runtime has not been initialized yet, or if
+     * the current thread already has a context installed
+     */
+    ThreadContext(bool migratable = false);
+    ~ThreadContext();
+
+    ThreadContext(const ThreadContext&) = delete;
+    ThreadContext(ThreadContext&&) = delete;
+    ThreadContext& operator=(const ThreadContext&) = delete;
+    ThreadContext& operator=(ThreadContext&&) = delete;
+
+    /** Returns the context managed by this instance. */
+    Context* get() const { return _context.get(); }
+
+private:
+    std::unique_ptr<Context> _context;
+};
+
 /**
  * Executes a function inside the current context's fiber.
  *
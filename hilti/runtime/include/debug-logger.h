@@ -5,6 +5,7 @@
 #include <fstream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 
@@ -13,7 +14,10 @@
 
 namespace hilti::rt::detail {
 
-/** Logger for runtime debug messages. */
+/**
+ * Logger for runtime debug messages. Once streams have been enabled, the
+ * logger may be used concurrently from multiple threads.
+ */
 class DebugLogger {
 public:
     DebugLogger(hilti::rt::filesystem::path output);
@@ -24,20 +28,23 @@ public:
     bool isEnabled(const std::string& stream) { return _streams.find(stream) != _streams.end(); }
 
     void indent(const std::string& stream) {
-        if ( isEnabled(stream) )
-            _streams[stream] += 1;
+        if ( auto i = _streams.find(stream); i != _streams.end() ) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            i->second += 1;
+        }
     }
 
     void dedent(const std::string& stream) {
-        if ( isEnabled(stream) ) {
-            auto& indent = _streams[stream];
+        if ( auto i = _streams.find(stream); i != _streams.end() ) {
+            std::lock_guard<std::mutex> lock(_mutex);
 
-            if ( indent > 0 )
-                indent -= 1;
+            if ( i->second > 0 )
+                i->second -= 1;
         }
     }
 
 private:
+    std::mutex _mutex; // protects output and indentation levels
     hilti::rt::filesystem::path _path;
     std::ostream* _output = nullptr;
     std::unique_ptr<std::ofstream> _output_file;
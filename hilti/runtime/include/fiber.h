@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <csetjmp>
 #include <functional>
 #include <iostream>
@@ -62,6 +63,14 @@ struct FiberContext {
 
     /** Cache of previously used fibers available for reuse. */
     std::vector<std::unique_ptr<Fiber>> cache;
+
+    /**
+     * If true, new fibers receive individual stacks so that a suspended
+     * `Resumable` may be resumed later from another thread's context. Such
+     * contexts also exchange unused fibers through a global pool when their
+     * own cache overflows or runs dry.
+     */
+    bool migratable = false;
 };
 
 /**
@@ -271,14 +280,21 @@ private:
     } _asan;
 #endif
 
-    // TODO: Usage of these isn't thread-safe. Should become "atomic" and
-    // move into global state.
-    inline static uint64_t _total_fibers;
-    inline static uint64_t _current_fibers;
-    inline static uint64_t _cached_fibers;
-    inline static uint64_t _max_fibers;
-    inline static uint64_t _max_stack_size;
-    inline static uint64_t _initialized; // number of trampolines run
+    /** Raises an atomic high-water mark to `value` if that's larger. */
+    static void _updateMax(std::atomic<uint64_t>& max, uint64_t value) {
+        auto current = max.load(std::memory_order_relaxed);
+        while ( value > current && ! max.compare_exchange_weak(current, value, std::memory_order_relaxed) )
+            ;
+    }
+
+    // Process-wide statistics, updated concurrently by all threads running
+    // fibers. The fibers themselves, and their caches, remain per context.
+    inline static std::atomic<uint64_t> _total_fibers;
+    inline static std::atomic<uint64_t> _current_fibers;
+    inline static std::atomic<uint64_t> _cached_fibers;
+    inline static std::atomic<uint64_t> _max_fibers;
+    inline static std::atomic<uint64_t> _max_stack_size;
+    inline static std::atomic<uint64_t> _initialized; // number of trampolines run
 };
 
 std::ostream& operator<<(std::ostream& out, const Fiber& fiber);
@@ -3,7 +3,9 @@
 #pragma once
 #include <sys/resource.h>
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <unordered_map>
@@ -16,11 +18,14 @@
 
 // We collect all (or most) of the runtime's global state centrally. That's
 // 1st good to see what we have (global state should be minimal) and 2nd
-// helpful to ensure that JIT maps things correctly. Note that all code
-// accessing any of this state is in charge of ensuring thread-safety itself.
-// These globals are generally initialized through hilti::rt::init();
+// helpful to ensure that JIT maps things correctly. These globals are
+// generally initialized through hilti::rt::init();
 //
-// TODO(robin): Accesses to global state are *not* completely thread-safe yet.
+// Thread-safety: The state is set up by `init()` on the main thread before
+// any further threads may use the runtime, and torn down by `done()` after
+// they have all finished. In between, fields that may change get accessed
+// either atomically or under the corresponding mutex below; everything else
+// is read-only at that point. Per-thread state lives in `Context` instead.
 
 namespace hilti::rt {
 struct Configuration;
@@ -50,7 +55,10 @@ struct GlobalState {
     bool profiling_enabled = false;
 
     /** If not zero, `Configuration::abort_on_exception` is disabled. */
-    int disable_abort_on_exceptions = 0;
+    std::atomic<int> disable_abort_on_exceptions = 0;
+
+    /** Counter for allocating IDs of virtual threads created through `context::ThreadContext`. */
+    std::atomic<vthread::ID> next_vthread_id = 0;
 
     /** Resource usage at library initialization time. */
     ResourceUsage resource_usage_init;
@@ -58,6 +66,9 @@ struct GlobalState {
     /** Profiler's global measurements. */
     std::unordered_map<std::string, profiler::detail::MeasurementState> profilers;
 
+    /** Mutex protecting `profilers`. */
+    std::mutex profilers_mutex;
+
     /** Debug logger recording runtime diagnostics. */
     std::unique_ptr<hilti::rt::detail::DebugLogger> debug_logger;
 
@@ -75,6 +86,18 @@ struct GlobalState {
 
     /** Cache of already compiled regular expressions. */
     std::unordered_map<std::string, std::shared_ptr<regexp::detail::CompiledRegExp>> regexp_cache;
+
+    /** Mutex protecting `regexp_cache`. */
+    std::mutex regexp_cache_mutex;
+
+    /**
+     * Pool of unused fibers with individual stacks, shared between all
+     * contexts with migratable fibers.
+     */
+    std::vector<std::unique_ptr<detail::Fiber>> fiber_pool;
+
+    /** Mutex protecting `fiber_pool`. */
+    std::mutex fiber_pool_mutex;
 };
 
 /**
@@ -109,24 +132,42 @@ inline const GlobalState* unsafeGlobalState() {
 }
 
 /** Returns the current context's array of HILTI global variables. */
-inline auto hiltiGlobals() {
+inline auto& hiltiGlobals() {
     assert(context::detail::current());
     return context::detail::current()->hilti_globals;
 }
 
+/**
+ * Initializes the current context's set of a HILTI module's global variables
+ * on first access by running the module's initialization function. This is
+ * the slow path of `moduleGlobals()`.
+ *
+ * @param idx module's index inside the array of HILTI global variables;
+ * this is determined by the HILTI linker
+ */
+extern void initModuleGlobalsLazily(unsigned int idx);
+
 /**
  * Returns the current context's set of a  HILTI module's global variables.
+ * If the module's globals haven't been used in the current context yet,
+ * this initializes them first.
+ *
+ * Generated code calls this on every access to a global, so this is kept
+ * to a bounds and null check on the fast path; the returned pointer is not
+ * reference-counted and remains valid as long as the context does.
  *
  * @param idx module's index inside the array of HILTI global variables;
  * this is determined by the HILTI linker
  */
 template<typename T>
-inline auto moduleGlobals(unsigned int idx) {
-    const auto& globals = hiltiGlobals();
+inline T* moduleGlobals(unsigned int idx) {
+    auto& globals = hiltiGlobals();
 
-    assert(idx < globals.size());
+    if ( idx >= globals.size() || ! globals[idx] )
+        initModuleGlobalsLazily(idx);
 
-    return std::static_pointer_cast<T>(globals[idx]);
+    assert(idx < globals.size() && globals[idx]);
+    return static_cast<T*>(globals[idx].get());
 }
 
 /**
@@ -138,10 +179,12 @@ inline auto moduleGlobals(unsigned int idx) {
  */
 template<typename T>
 inline auto initModuleGlobals(unsigned int idx) {
-    if ( context::detail::current()->hilti_globals.size() <= idx )
-        context::detail::current()->hilti_globals.resize(idx + 1);
+    auto& globals = hiltiGlobals();
+
+    if ( globals.size() <= idx )
+        globals.resize(idx + 1);
 
-    context::detail::current()->hilti_globals[idx] = std::make_shared<T>();
+    globals[idx] = std::make_shared<T>();
 }
 
 } // namespace hilti::rt::detail
@@ -11,19 +11,32 @@
 #include <type_traits>
 
 #include <hilti/rt/configuration.h>
+#include <hilti/rt/context.h>
 #include <hilti/rt/exception.h>
 #include <hilti/rt/extension-points.h>
 #include <hilti/rt/util.h>
 
 namespace hilti::rt {
 
+namespace detail {
+
+/** Returns the stream `print()` writes to; must only be called if printing isn't silenced. */
+inline std::ostream& printStream() {
+    if ( auto* ctx = context::detail::get(true); ctx && ctx->cout )
+        return *ctx->cout;
+
+    return configuration::get().cout->get();
+}
+
+} // namespace detail
+
 /** Corresponds to `hilti::print`. */
 template<typename T>
 void print(const T& t, bool newline = true) {
     if ( ! configuration::get().cout )
         return;
 
-    auto& cout = configuration::get().cout->get();
+    auto& cout = detail::printStream();
 
     cout << hilti::rt::to_string_for_print(t);
 
@@ -39,7 +52,7 @@ void printValues(const T& t, bool newline = true) {
     if ( ! configuration::get().cout )
         return;
 
-    auto& cout = configuration::get().cout->get();
+    auto& cout = detail::printStream();
 
     cout << join_tuple_for_print(t);
 
@@ -21,6 +21,7 @@
 #include <hilti/rt/logging.h>
 #include <hilti/rt/profiler.h>
 #include <hilti/rt/result.h>
+#include <hilti/rt/ring-buffer.h>
 #include <hilti/rt/safe-int.h>
 #include <hilti/rt/type-info.h>
 #include <hilti/rt/types/all.h>
@@ -0,0 +1,141 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace hilti::rt {
+
+/**
+ * Fixed-capacity, lock-free ring buffer for passing values from exactly one
+ * producer thread to exactly one consumer thread. The producer may only call
+ * `tryPush()`, the consumer only `tryPop()` and `popMany()`; all other
+ * methods may be called from either side.
+ *
+ * @tparam T type of values to pass; must be default-constructible and
+ * move-assignable
+ */
+template<typename T>
+class SPSCRingBuffer {
+public:
+    /**
+     * Constructor.
+     *
+     * @param capacity minimum number of values the buffer can hold; will be
+     * rounded up to the next power of two
+     */
+    explicit SPSCRingBuffer(size_t capacity) : _buffer(_roundUp(capacity)), _mask(_buffer.size() - 1) {}
+
+    SPSCRingBuffer(const SPSCRingBuffer&) = delete;
+    SPSCRingBuffer(SPSCRingBuffer&&) = delete;
+    SPSCRingBuffer& operator=(const SPSCRingBuffer&) = delete;
+    SPSCRingBuffer& operator=(SPSCRingBuffer&&) = delete;
+
+    /**
+     * Appends a value to the buffer. Must be called only by the producer.
+     *
+     * @param t value to append; it will be moved from only if the operation
+     * succeeds
+     * @return true if the value was appended, false if the buffer was full
+     */
+    bool tryPush(T&& t) {
+        auto tail = _tail.load(std::memory_order_relaxed);
+
+        if ( tail - _cached_head == _buffer.size() ) {
+            _cached_head = _head.load(std::memory_order_acquire);
+            if ( tail - _cached_head == _buffer.size() )
+                return false;
+        }
+
+        _buffer[tail & _mask] = std::move(t);
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Removes the oldest value from the buffer. Must be called only by the
+     * consumer.
+     *
+     * @return the value, or unset if the buffer was empty
+     */
+    std::optional<T> tryPop() {
+        auto head = _head.load(std::memory_order_relaxed);
+
+        if ( head == _cached_tail ) {
+            _cached_tail = _tail.load(std::memory_order_acquire);
+            if ( head == _cached_tail )
+                return {};
+        }
+
+        std::optional<T> t = std::move(_buffer[head & _mask]);
+        _head.store(head + 1, std::memory_order_release);
+        return t;
+    }
+
+    /**
+     * Removes up to a given number of the oldest values from the buffer at
+     * once, appending them to a vector. Must be called only by the consumer.
+     * This is cheaper than calling `tryPop()` repeatedly as it synchronizes
+     * with the producer just once.
+     *
+     * @param out vector to append the values to
+     * @param max maximum number of values to remove
+     * @return number of values removed
+     */
+    size_t popMany(std::vector<T>* out, size_t max) {
+        auto head = _head.load(std::memory_order_relaxed);
+        _cached_tail = _tail.load(std::memory_order_acquire);
+
+        auto n = std::min(static_cast<size_t>(_cached_tail - head), max);
+        for ( size_t i = 0; i < n; i++ )
+            out->emplace_back(std::move(_buffer[(head + i) & _mask]));
+
+        _head.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    /**
+     * Returns the number of values currently in the buffer. With concurrent
+     * access, that's only a snapshot that may be outdated immediately.
+     */
+    size_t size() const {
+        auto head = _head.load(std::memory_order_acquire);
+        auto tail = _tail.load(std::memory_order_acquire);
+        return tail - head;
+    }
+
+    /** Returns true if the buffer is currently empty; see `size()` for caveats. */
+    bool empty() const { return size() == 0; }
+
+    /** Returns the maximum number of values the buffer can hold. */
+    size_t capacity() const { return _buffer.size(); }
+
+private:
+    static size_t _roundUp(size_t n) {
+        size_t x = 1;
+        while ( x < n )
+            x <<= 1;
+
+        return x;
+    }
+
+    // Align the indices to separate cache lines to avoid false sharing
+    // between producer and consumer.
+    static constexpr size_t CacheLineSize = 64;
+
+    std::vector<T> _buffer;
+    const size_t _mask;
+
+    alignas(CacheLineSize) std::atomic<size_t> _head = 0; // next slot to read; written by consumer
+    size_t _cached_tail = 0;                              // consumer's last seen value of `_tail`
+
+    alignas(CacheLineSize) std::atomic<size_t> _tail = 0; // next slot to write; written by producer
+    size_t _cached_head = 0;                              // producer's last seen value of `_head`
+};
+
+} // namespace hilti::rt
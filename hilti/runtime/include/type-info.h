@@ -859,6 +859,18 @@ struct Field {
         };
     }
 
+    /**
+     * Alternative accessor function for ``&optional`` fields stored jointly
+     * in a `hilti::rt::struct_::Packed` member.
+     *
+     * @tparam P type of the `Packed` member
+     * @tparam I index of the field inside the member
+     */
+    template<typename P, std::size_t I>
+    static Accessor accessor_packed() {
+        return [](const Value& v) -> const void* { return static_cast<const P*>(v.pointer())->template get<I>(); };
+    }
+
     bool isInternal() const { return internal; }
 
     const std::string name; /**< ID of the field */
@@ -3,9 +3,11 @@
 #pragma once
 
 #include <cinttypes>
+#include <cstring>
 #include <limits>
 #include <string>
 #include <tuple>
+#include <type_traits>
 #include <utility>
 
 #include <hilti/rt/extension-points.h>
@@ -81,15 +83,56 @@ inline void pack(D x, uint8_t* dst, std::initializer_list<int> bytes) {
     }
 }
 
-template<typename T, typename D>
-inline Result<std::tuple<integer::safe<T>, D>> unpack(D b, const uint8_t* dst, std::initializer_list<int> bytes) {
-    T x = 0;
-    for ( auto i : bytes ) {
-        x <<= 8U;
-        x |= (static_cast<T>(dst[i]));
+// Reverses the bytes of an unsigned integer.
+template<typename U>
+inline U byteswap(U x) {
+    if constexpr ( sizeof(U) == 1 )
+        return x;
+    else if constexpr ( sizeof(U) == 2 )
+        return __builtin_bswap16(x);
+    else if constexpr ( sizeof(U) == 4 )
+        return __builtin_bswap32(x);
+    else
+        return __builtin_bswap64(x);
+}
+
+// Returns true if integers stored in the given byte order need their bytes
+// reversed for use on this host. The byte order must not be `Host`.
+constexpr bool needsByteSwap(ByteOrder order) {
+    constexpr bool big_endian_host = (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__);
+    return (order != ByteOrder::Little) != big_endian_host;
+}
+
+// Unpacks an integer from the beginning of the data, reversing its bytes if
+// requested. The caller must have ensured that there's sufficient data.
+template<typename T, bool Swap, typename D>
+inline Result<std::tuple<integer::safe<T>, D>> unpack(const D& b) {
+    using U = std::make_unsigned_t<T>;
+
+    U x;
+    D rest;
+
+    if constexpr ( std::is_same_v<D, Bytes> ) {
+        memcpy(&x, b.data(), sizeof(x));
+        rest = b.sub(sizeof(T), std::string::npos);
+    }
+    else if ( auto direct = b.extractInPlace(sizeof(T)) ) {
+        // Load straight from the chunk storing the data.
+        memcpy(&x, std::get<0>(*direct), sizeof(x));
+        rest = std::move(std::get<1>(*direct));
     }
+    else {
+        // Data spans chunks, collect it first.
+        uint8_t raw[sizeof(T)];
+        rest = b.extract(raw, sizeof(raw));
+        memcpy(&x, raw, sizeof(x));
+    }
+
+    if constexpr ( Swap )
+        x = byteswap(x);
 
-    return std::make_tuple(static_cast<integer::safe<T>>(x), std::move(b));
+    auto v = static_cast<T>(x); // Forced cast to skip safe<T> range check.
+    return std::make_tuple(static_cast<integer::safe<T>>(v), std::move(rest));
 }
 
 } // namespace detail
@@ -149,6 +192,25 @@ inline Bytes pack(integer::safe<T> i, ByteOrder fmt) {
     return Bytes(reinterpret_cast<Bytes::Base::value_type*>(raw), sizeof(raw));
 }
 
+/**
+ * Unpacks an integer from binary data stored in a byte order known at
+ * compile time.
+ *
+ * @tparam T integer type to unpack
+ * @tparam Order byte order of the data; must be `Big`, `Network`, or `Little`
+ * @param b data to unpack from, either `Bytes` or a `stream::View`
+ * @return unpacked value and remaining data, or an error if there's not enough data
+ */
+template<typename T, ByteOrder::Value Order, typename D>
+inline Result<std::tuple<integer::safe<T>, D>> unpack(const D& b) {
+    static_assert(Order == ByteOrder::Big || Order == ByteOrder::Network || Order == ByteOrder::Little);
+
+    if ( b.size() < static_cast<int64_t>(sizeof(T)) )
+        return result::Error("insufficient data to unpack integer");
+
+    return detail::unpack<T, detail::needsByteSwap(Order)>(b);
+}
+
 template<typename T, typename D>
 inline Result<std::tuple<integer::safe<T>, D>> unpack(D b, ByteOrder fmt) {
     if ( fmt == ByteOrder::Host )
@@ -157,59 +219,13 @@ inline Result<std::tuple<integer::safe<T>, D>> unpack(D b, ByteOrder fmt) {
     if ( b.size() < static_cast<int64_t>(sizeof(T)) )
         return result::Error("insufficient data to unpack integer");
 
-    uint8_t raw[sizeof(T)];
-    b = b.extract(raw, sizeof(raw));
-
-    switch ( fmt.value() ) {
-        case ByteOrder::Big:
-        case ByteOrder::Network:
-            if constexpr ( std::is_same<T, uint8_t>::value )
-                return std::make_tuple(static_cast<integer::safe<uint8_t>>(raw[0]), std::move(b));
-
-            if constexpr ( std::is_same<T, int8_t>::value ) {
-                auto x = static_cast<int8_t>(raw[0]); // Forced cast to skip safe<T> range check.
-                return std::make_tuple(static_cast<integer::safe<int8_t>>(x), std::move(b));
-            }
-
-            if constexpr ( std::is_same<T, uint16_t>::value || std::is_same<T, int16_t>::value )
-                return detail::unpack<T>(std::move(b), raw, {0, 1});
-
-            if constexpr ( std::is_same<T, uint32_t>::value || std::is_same<T, int32_t>::value )
-                return detail::unpack<T>(std::move(b), raw, {0, 1, 2, 3});
-
-            if constexpr ( std::is_same<T, uint64_t>::value || std::is_same<T, int64_t>::value )
-                return detail::unpack<T>(std::move(b), raw, {0, 1, 2, 3, 4, 5, 6, 7});
-
-            abort_with_backtrace();
-
-        case ByteOrder::Little:
-            if constexpr ( std::is_same<T, uint8_t>::value )
-                return std::make_tuple(static_cast<integer::safe<uint8_t>>(raw[0]), std::move(b));
-
-            if constexpr ( std::is_same<T, int8_t>::value ) {
-                auto x = static_cast<int8_t>(raw[0]); // Forced cast to skip safe<T> range check.
-                return std::make_tuple(static_cast<integer::safe<int8_t>>(x), std::move(b));
-            }
-
-            if constexpr ( std::is_same<T, uint16_t>::value || std::is_same<T, int16_t>::value )
-                return detail::unpack<T>(std::move(b), raw, {1, 0});
-
-            if constexpr ( std::is_same<T, uint32_t>::value || std::is_same<T, int32_t>::value )
-                return detail::unpack<T>(std::move(b), raw, {3, 2, 1, 0});
-
-            if constexpr ( std::is_same<T, uint64_t>::value || std::is_same<T, int64_t>::value )
-                return detail::unpack<T>(std::move(b), raw, {7, 6, 5, 4, 3, 2, 1, 0});
-
-            abort_with_backtrace();
-
-        case ByteOrder::Host:
-            // Cannot reach, we check this above.
-            abort_with_backtrace();
-
-        case ByteOrder::Undef: return result::Error("undefined byte order");
-    }
+    if ( fmt == ByteOrder::Undef )
+        return result::Error("undefined byte order");
 
-    cannot_be_reached();
+    if ( detail::needsByteSwap(fmt) )
+        return detail::unpack<T, true>(b);
+    else
+        return detail::unpack<T, false>(b);
 }
 
 /**
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <tuple>
@@ -127,7 +128,11 @@ namespace detail {
 // Internal helper class to compile and cache regular expressions. We compile
 // each unique set of patterns once into an instance of this class, which we
 // then retain inside a global cache for later reuse when seeing the same set
-// of patterns again.
+// of patterns again. By default, JRX builds its DFA lazily while matching,
+// so that version must be used only by the main thread. For all other
+// contexts, we compile a second version fully upfront on first use. That
+// one doesn't change anymore once compiled, so all threads share it, each
+// keeping just its own matching state.
 class CompiledRegExp {
 public:
     CompiledRegExp(const std::vector<std::string>& patterns, regexp::Flags flags);
@@ -143,6 +148,12 @@ public:
         return _jrx.get();
     }
 
+    /**
+     * Returns a fully compiled version of the regexp that any number of
+     * threads can match with concurrently, compiling it on first call.
+     */
+    jrx_regex_t* sharedJrx() const;
+
 private:
     friend class rt::RegExp;
     friend class regexp::MatchState;
@@ -151,12 +162,17 @@ private:
         void operator()(jrx_regex_t* j);
     };
 
-    void _newJrx();
-    void _compileOne(std::string pattern, int idx);
+    using Jrx = std::unique_ptr<jrx_regex_t, RegFree>;
+
+    // Compiles the patterns into a new JRX instance.
+    Jrx _compile(bool lazy) const;
 
     regexp::Flags _flags{};
     std::vector<std::string> _patterns;
-    std::unique_ptr<jrx_regex_t, RegFree> _jrx;
+    Jrx _jrx;
+
+    mutable std::once_flag _shared_once;
+    mutable Jrx _shared_jrx;
 };
 
 } // namespace detail
@@ -243,8 +259,11 @@ public:
      */
     regexp::MatchState tokenMatcher() const;
 
-    /** Accessor to underlying JRX state. Intended for internal use and testing. */
-    jrx_regex_t* jrx() const { return _re->jrx(); }
+    /**
+     * Accessor to underlying JRX state to match with on the current thread.
+     * Intended for internal use and testing.
+     */
+    jrx_regex_t* jrx() const;
 
     bool operator==(const RegExp& other) const {
         // Due to caching uniqueing instances, we can just compare the pointers.
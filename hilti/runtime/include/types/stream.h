@@ -11,6 +11,7 @@
 #include <limits>
 #include <memory>
 #include <optional>
+#include <set>
 #include <string>
 #include <tuple>
 #include <utility>
@@ -34,6 +35,7 @@ class Stream;
 
 namespace stream {
 class View;
+class Pin;
 class SafeConstIterator;
 
 namespace detail {
@@ -73,6 +75,13 @@ struct Gap {
     size_t size;
 };
 
+// Represents data held by an immutable buffer that may be shared with other
+// chunks, starting at index `begin` of the buffer.
+struct SharedData {
+    std::shared_ptr<const std::vector<Byte>> buffer;
+    size_t begin;
+};
+
 /**
  * Represents one block of continuous data inside a stream instance. A
  * stream's *Chain* links multiple of these chunks to represent all of its
@@ -80,7 +89,9 @@ struct Gap {
  *
  * A chunk internally employs small-buffer optimization for very small
  * amounts of data, storing it directly inside the instance instead of using
- * heap-allocated memory.
+ * heap-allocated memory. Chunks can also refer to data in a buffer shared
+ * with other chunks, so that the same data can be added to several streams
+ * without copying it.
  *
  * All public methods of Chunk are constant. Modifications can be done only
  * be through the owning Chain (so that we can track changes there).
@@ -94,6 +105,7 @@ public:
     Chunk(const Offset& o, std::array<Byte, SmallBufferSize> d, const Size& n)
         : _offset(o), _data(std::make_pair(n, d)) {}
     Chunk(const Offset& o, Vector&& d) : _offset(o), _data(std::move(d)) {}
+    Chunk(const Offset& o, std::shared_ptr<const Vector> d) : _offset(o), _data(SharedData{std::move(d), 0}) {}
     Chunk(const Offset& o, const View& d);
     Chunk(const Offset& o, const std::string& s);
 
@@ -131,6 +143,8 @@ public:
         else if ( auto a = std::get_if<Vector>(&_data) ) {
             return a->data();
         }
+        else if ( auto a = std::get_if<SharedData>(&_data) )
+            return a->buffer->data() + a->begin;
         else if ( std::holds_alternative<Gap>(_data) )
             throw MissingData("data is missing");
 
@@ -148,6 +162,8 @@ public:
         else if ( auto a = std::get_if<Vector>(&_data) ) {
             return a->data() + a->size();
         }
+        else if ( auto a = std::get_if<SharedData>(&_data) )
+            return a->buffer->data() + a->buffer->size();
         else if ( std::holds_alternative<Gap>(_data) )
             throw MissingData("data is missing");
 
@@ -159,6 +175,8 @@ public:
             return a->first;
         else if ( auto a = std::get_if<Vector>(&_data) )
             return a->size();
+        else if ( auto a = std::get_if<SharedData>(&_data) )
+            return a->buffer->size() - a->begin;
         else if ( auto a = std::get_if<Gap>(&_data) )
             return a->size;
 
@@ -245,7 +263,7 @@ private:
     }
 
     Offset _offset = 0;                     // global offset of 1st byte
-    std::variant<Array, Vector, Gap> _data; // content of this chunk
+    std::variant<Array, Vector, SharedData, Gap> _data; // content of this chunk
     const Chain* _chain = nullptr; // chain this chunk is part of, or null if not linked to a chain yet (non-owning;
                                    // will stay valid at least as long as the current chunk does)
     std::unique_ptr<Chunk> _next = nullptr; // next chunk in chain, or null if last
@@ -312,13 +330,44 @@ public:
     void trim(const SafeConstIterator& i);
     void trim(const UnsafeConstIterator& i);
 
+    // Pins an offset so that trimming leaves data from there on in place
+    // until the offset gets unpinned again. Pins do not change the chain's
+    // content, hence these work on const chains as well.
+    void pin(const Offset& offset) const { _pins.insert(offset); }
+
+    void unpin(const Offset& offset) const {
+        if ( auto i = _pins.find(offset); i != _pins.end() )
+            _pins.erase(i);
+    }
+
+    // Discards all data appended from now on that falls below *offset*,
+    // recording it as a gap instead. Data already in the chain remains.
+    void discardUntil(const Offset& offset) { _discard_offset = std::max(_discard_offset, offset); }
+
+    // Returns true if data appended next will be discarded.
+    bool isDiscarding() const { return _discard_offset > endOffset(); }
+
+    // If data of size *n* appended next would be discarded completely,
+    // records it as a gap without further ado and returns true.
+    bool discard(const Size& n) {
+        if ( endOffset() + n > _discard_offset )
+            return false;
+
+        _ensureValid();
+        _ensureMutable();
+        _appendGap(n);
+        return true;
+    }
+
     // Turns the chain into invalidated state, whill releases all chunks and
     // will let attempts to dereference any still existing iterators fail.
     void invalidate() {
         _state = State::Invalid;
         _head.reset();
         _head_offset = 0;
+        _discard_offset = 0;
         _tail = nullptr;
+        _pins.clear();
     }
 
     // Turns the chain into a freshly initialized state.
@@ -326,7 +375,9 @@ public:
         _state = State::Mutable;
         _head.reset();
         _head_offset = 0;
+        _discard_offset = 0;
         _tail = nullptr;
+        _pins.clear();
     }
 
     void freeze() {
@@ -352,6 +403,12 @@ private:
             throw Frozen("stream object can no longer be modified");
     }
 
+    // Links in a new chunk at the end.
+    void _link(std::unique_ptr<Chunk> chunk);
+
+    // Appends a gap of size *n*, extending a trailing gap if there's one.
+    void _appendGap(const Size& n);
+
     enum class State {
         Mutable, // content can be expanded an trimmed
         Frozen,  // content cannot be changed
@@ -373,6 +430,12 @@ private:
     // Always pointing to last chunk reachable from *head*, or null if chain
     // is empty; non-owning
     Chunk* _tail = nullptr;
+
+    // Offset up to which newly appended data is being discarded.
+    Offset _discard_offset = 0;
+
+    // Offsets currently pinned; trimming does not go beyond the lowest.
+    mutable std::multiset<Offset> _pins;
 };
 
 } // namespace detail
@@ -569,6 +632,7 @@ public:
     void debugPrint(std::ostream& out) const;
 
 protected:
+    friend class hilti::rt::stream::Pin;
     friend class hilti::rt::stream::View;
     friend class hilti::rt::stream::detail::Chain;
     friend class hilti::rt::stream::detail::UnsafeConstIterator;
@@ -1353,6 +1417,27 @@ public:
         return View(SafeConstIterator(p), _end);
     }
 
+    /**
+     * Provides direct access to a fixed number of stream bytes at the
+     * beginning of the view if they are all stored inside the same chunk,
+     * avoiding the copy that `extract()` performs. The caller must have
+     * ensured that the view contains at least *n* bytes.
+     *
+     * @param n number of stream bytes to access; must be larger than zero
+     * @return pointer to the bytes along with a new view that has it's
+     * starting position advanced by N, or nothing if the bytes span chunks
+     */
+    std::optional<std::tuple<const Byte*, View>> extractInPlace(uint64_t n) const {
+        assert(n > 0);
+        _ensureValid();
+
+        if ( auto chunk = _begin.chunk(); chunk && chunk->inRange(_begin.offset() + n - 1) )
+            return std::make_tuple(chunk->data(_begin.offset()),
+                                   View(SafeConstIterator(_begin._chain, _begin.offset() + n, chunk), _end));
+
+        return {};
+    }
+
     /**
      * Copies the view into raw memory.
      *
@@ -1483,6 +1568,74 @@ inline Bytes stream::View::data() const {
 }
 
 inline std::ostream& operator<<(std::ostream& out, const View& x) { return out << hilti::rt::to_string_for_print(x); }
+
+/**
+ * Keeps a stream's data from a given position on in place when the stream
+ * gets trimmed, for as long as the pin exists. That way, views into the
+ * data remain valid while the stream's owner keeps trimming it. Copying a
+ * pin pins the same position once more.
+ */
+class Pin {
+public:
+    /** Creates a pin that doesn't pin anything. */
+    Pin() = default;
+
+    /**
+     * Pins the position of an iterator inside its stream.
+     *
+     * @param i iterator marking the first position to keep
+     */
+    explicit Pin(const SafeConstIterator& i) : _chain(i._chain), _offset(i.offset()) {
+        if ( _chain )
+            _chain->pin(_offset);
+    }
+
+    Pin(const Pin& other) : _chain(other._chain), _offset(other._offset) {
+        if ( _chain )
+            _chain->pin(_offset);
+    }
+
+    Pin(Pin&& other) noexcept : _chain(std::move(other._chain)), _offset(other._offset) { other._chain = nullptr; }
+
+    ~Pin() { _release(); }
+
+    Pin& operator=(const Pin& other) {
+        if ( &other == this )
+            return *this;
+
+        _release();
+        _chain = other._chain;
+        _offset = other._offset;
+
+        if ( _chain )
+            _chain->pin(_offset);
+
+        return *this;
+    }
+
+    Pin& operator=(Pin&& other) noexcept {
+        if ( &other == this )
+            return *this;
+
+        _release();
+        _chain = std::move(other._chain);
+        _offset = other._offset;
+        other._chain = nullptr;
+        return *this;
+    }
+
+private:
+    void _release() {
+        if ( _chain )
+            _chain->unpin(_offset);
+
+        _chain = nullptr;
+    }
+
+    detail::ConstChainPtr _chain = nullptr;
+    Offset _offset = 0;
+};
+
 } // namespace stream
 
 /**
@@ -1610,6 +1763,21 @@ public:
      */
     void append(Bytes&& data);
 
+    /**
+     * Appends the content of a byte vector, taking over its memory without
+     * copying the data. This function does not invalidate iterators.
+     * @param data vector to append; will be moved from
+     */
+    void append(std::vector<Byte>&& data);
+
+    /**
+     * Appends the content of a buffer that may be shared with other streams,
+     * without copying the data. The buffer must not be modified anymore
+     * afterwards. This function does not invalidate iterators.
+     * @param data buffer to append
+     */
+    void append(std::shared_ptr<const std::vector<Byte>> data);
+
     /**
      * Appends the content of a raw memory area, taking ownership. This function does not invalidate iterators.
      * @param data pointer to `Bytes` to append
@@ -1632,6 +1800,24 @@ public:
      */
     void trim(const SafeConstIterator& i) { _chain->trim(i); }
 
+    /**
+     * Discards data up to, but excluding, a given offset as it arrives. Any
+     * data appended from now on that falls below that offset is not stored
+     * but recorded as a gap, which keeps offsets unchanged. Data already
+     * stored remains available until trimmed. This lets a consumer skip
+     * over input it does not need without buffering it.
+     *
+     * @param offset offset one past the last data element to discard
+     */
+    void discardUntil(const Offset& offset) { _chain->discardUntil(offset); }
+
+    /**
+     * Returns true if data appended next will be discarded because of a
+     * previous `discardUntil()`. Until that changes, there's no new data to
+     * look at.
+     */
+    bool isDiscarding() const { return _chain->isDiscarding(); }
+
     /** Freezes the instance. When frozen, no further data can be appended. */
     void freeze() { _chain->freeze(); }
 
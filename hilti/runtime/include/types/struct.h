@@ -2,10 +2,20 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <optional>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 #include <hilti/rt/extension-points.h>
 #include <hilti/rt/result.h>
+#include <hilti/rt/types/optional.h>
 #include <hilti/rt/util.h>
 
 namespace hilti::rt {
@@ -24,10 +34,264 @@ inline auto& value_or_exception(const std::optional<T>& t) {
 
     throw AttributeNotSet("struct attribute not set");
 }
+
+namespace packed {
+
+/** Returns the offsets at which `Packed` stores its elements. */
+template<typename... Ts>
+constexpr auto offsets() {
+    constexpr std::size_t n = sizeof...(Ts);
+    constexpr std::array<std::size_t, n> sizes = {sizeof(Ts)...};
+    constexpr std::array<std::size_t, n> alignments = {alignof(Ts)...};
+
+    // Place elements by decreasing alignment. As each element's size is a
+    // multiple of its alignment, that leaves no padding between them.
+    std::array<std::size_t, n> offsets{};
+    std::array<bool, n> placed{};
+    std::size_t next = 0;
+
+    for ( std::size_t i = 0; i < n; i++ ) {
+        std::size_t k = n;
+        for ( std::size_t j = 0; j < n; j++ ) {
+            if ( ! placed[j] && (k == n || alignments[j] > alignments[k]) )
+                k = j;
+        }
+
+        placed[k] = true;
+        offsets[k] = next;
+        next += sizes[k];
+    }
+
+    return offsets;
+}
+
+/** Returns the number of bytes `Packed` needs to store all its elements. */
+template<typename... Ts>
+constexpr std::size_t size() {
+    return (sizeof(Ts) + ... + 0);
+}
+
+/** Returns the alignment `Packed` needs for storing all its elements. */
+template<typename... Ts>
+constexpr std::size_t alignment() {
+    std::size_t a = 1;
+    ((a = std::max(a, alignof(Ts))), ...);
+    return a;
+}
+
+/** Reference to a potentially unset element of `Packed`, for rendering. */
+template<typename T>
+struct Ref {
+    const T* value;
+};
+
+} // namespace packed
+
+/**
+ * Storage for a struct's optional fields. Each element may be set or unset,
+ * like a `std::optional`, but instead of one flag per element, presence is
+ * tracked in a joint bitmask. Elements are laid out by decreasing
+ * alignment, so that they don't need any padding between them.
+ *
+ * Generated code uses this for `&optional` fields if compiling with
+ * `--cxx-packed-structs`, accessing elements by their index through the
+ * functions below.
+ *
+ * @tparam Ts types of the elements
+ */
+template<typename... Ts>
+class Packed {
+public:
+    /** Type of the element at a given index. */
+    template<std::size_t I>
+    using Type = std::tuple_element_t<I, std::tuple<Ts...>>;
+
+    Packed() = default;
+
+    Packed(const Packed& other) { _copy(other, std::index_sequence_for<Ts...>()); }
+
+    Packed(Packed&& other) noexcept((std::is_nothrow_move_constructible_v<Ts> && ...)) {
+        _move(other, std::index_sequence_for<Ts...>());
+    }
+
+    ~Packed() { clear(); }
+
+    Packed& operator=(const Packed& other) {
+        if ( &other != this ) {
+            clear();
+            _copy(other, std::index_sequence_for<Ts...>());
+        }
+
+        return *this;
+    }
+
+    Packed& operator=(Packed&& other) noexcept((std::is_nothrow_move_constructible_v<Ts> && ...)) {
+        if ( &other != this ) {
+            clear();
+            _move(other, std::index_sequence_for<Ts...>());
+        }
+
+        return *this;
+    }
+
+    /** Returns true if the element at a given index is set. */
+    template<std::size_t I>
+    bool has() const {
+        return _present[I / 8] & (1U << (I % 8));
+    }
+
+    /** Returns a pointer to the element at a given index, or null if it's not set. */
+    template<std::size_t I>
+    const Type<I>* get() const {
+        return has<I>() ? _slot<I>() : nullptr;
+    }
+
+    /** Returns a pointer to the element at a given index, or null if it's not set. */
+    template<std::size_t I>
+    Type<I>* get() {
+        return has<I>() ? _slot<I>() : nullptr;
+    }
+
+    /**
+     * Sets the element at a given index to a new value, constructed from
+     * the given arguments.
+     *
+     * @return a reference to the new element
+     */
+    template<std::size_t I, typename... Args>
+    Type<I>& emplace(Args&&... args) {
+        reset<I>();
+        auto* x = new (_data + _offsets[I]) Type<I>(std::forward<Args>(args)...);
+        _present[I / 8] |= (1U << (I % 8));
+        return *x;
+    }
+
+    /** Unsets the element at a given index, if set. */
+    template<std::size_t I>
+    void reset() {
+        if ( ! has<I>() )
+            return;
+
+        _slot<I>()->~Type<I>();
+        _present[I / 8] &= ~(1U << (I % 8));
+    }
+
+    /** Unsets all elements. */
+    void clear() { _clear(std::index_sequence_for<Ts...>()); }
+
+private:
+    template<std::size_t I>
+    const Type<I>* _slot() const {
+        return std::launder(reinterpret_cast<const Type<I>*>(_data + _offsets[I]));
+    }
+
+    template<std::size_t I>
+    Type<I>* _slot() {
+        return std::launder(reinterpret_cast<Type<I>*>(_data + _offsets[I]));
+    }
+
+    template<std::size_t... Is>
+    void _copy(const Packed& other, std::index_sequence<Is...> /* unused */) {
+        ((other.template has<Is>() ? (void)emplace<Is>(*other.template _slot<Is>()) : (void)0), ...);
+    }
+
+    template<std::size_t... Is>
+    void _move(Packed& other, std::index_sequence<Is...> /* unused */) {
+        ((other.template has<Is>() ? (void)emplace<Is>(std::move(*other.template _slot<Is>())) : (void)0), ...);
+    }
+
+    template<std::size_t... Is>
+    void _clear(std::index_sequence<Is...> /* unused */) {
+        (reset<Is>(), ...);
+    }
+
+    static constexpr auto _offsets = packed::offsets<Ts...>();
+
+    alignas(packed::alignment<Ts...>()) std::byte _data[std::max(packed::size<Ts...>(), std::size_t(1))];
+    std::array<uint8_t, (sizeof...(Ts) + 7) / 8> _present{};
+};
+
+/** Returns a `Packed` element, throwing an `UnsetOptional` if it's not set. */
+template<std::size_t I, typename... Ts>
+inline const auto& value(const Packed<Ts...>& p) {
+    if ( auto x = p.template get<I>() )
+        return *x;
+    else
+        optional::detail::throw_unset_optional();
+}
+
+/** Returns a `Packed` element, throwing an `UnsetOptional` if it's not set. */
+template<std::size_t I, typename... Ts>
+inline auto& value(Packed<Ts...>& p) {
+    if ( auto x = p.template get<I>() )
+        return *x;
+    else
+        optional::detail::throw_unset_optional();
+}
+
+/** Returns a `Packed` element if set, or a default value otherwise. */
+template<std::size_t I, typename... Ts>
+inline auto valueOr(const Packed<Ts...>& p, const typename Packed<Ts...>::template Type<I>& default_) {
+    if ( auto x = p.template get<I>() )
+        return *x;
+    else
+        return default_;
+}
+
+/** Returns a `Packed` element, first setting it to a default value if it's not set. */
+template<std::size_t I, typename... Ts>
+inline auto& valueOrInit(Packed<Ts...>& p, const typename Packed<Ts...>::template Type<I>& default_) {
+    if ( auto x = p.template get<I>() )
+        return *x;
+    else
+        return p.template emplace<I>(default_);
+}
+
+/** Returns a `Packed` element, first default-constructing it if it's not set. */
+template<std::size_t I, typename... Ts>
+inline auto& valueOrInit(Packed<Ts...>& p) {
+    if ( auto x = p.template get<I>() )
+        return *x;
+    else
+        return p.template emplace<I>();
+}
+
+/** Returns a `Packed` element, throwing an `AttributeNotSet` if it's not set. */
+template<std::size_t I, typename... Ts>
+inline const auto& value_or_exception(const Packed<Ts...>& p) {
+    if ( auto x = p.template get<I>() )
+        return *x;
+
+    throw AttributeNotSet("struct attribute not set");
+}
+
+/** Returns true if a `Packed` element is set. */
+template<std::size_t I, typename... Ts>
+inline bool isSet(const Packed<Ts...>& p) {
+    return p.template has<I>();
+}
+
+/** Unsets a `Packed` element. */
+template<std::size_t I, typename... Ts>
+inline void reset(Packed<Ts...>& p) {
+    p.template reset<I>();
+}
+
+/** Returns a reference to a `Packed` element suitable for rendering it. */
+template<std::size_t I, typename... Ts>
+inline auto ref(const Packed<Ts...>& p) {
+    return packed::Ref<typename Packed<Ts...>::template Type<I>>{p.template get<I>()};
+}
+
 } // namespace struct_
 
 namespace detail::adl {
 
+template<typename T>
+inline std::string to_string(const struct_::packed::Ref<T>& x, adl::tag /*unused*/) {
+    return x.value ? hilti::rt::to_string(*x.value) : "(not set)";
+}
+
 template<typename>
 constexpr std::false_type has__str__helper(long);
 
@@ -0,0 +1,88 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+//
+// Compares access to HILTI globals as emitted by the code generator with
+// and without `--cxx-enable-dynamic-globals`.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <optional>
+
+#include <hilti/rt/context.h>
+#include <hilti/rt/global-state.h>
+#include <hilti/rt/init.h>
+
+// Mimics a module compiled with static globals.
+namespace static_globals {
+std::optional<uint64_t> counter;
+} // namespace static_globals
+
+// Mimics a module compiled with dynamic globals.
+namespace dynamic_globals {
+struct __globals_t {
+    uint64_t counter;
+};
+
+inline unsigned int __globals_index;
+
+static auto __globals() { return ::hilti::rt::detail::moduleGlobals<__globals_t>(__globals_index); }
+
+static void __init_globals(::hilti::rt::Context* ctx) {
+    ::hilti::rt::detail::initModuleGlobals<__globals_t>(__globals_index);
+    __globals()->counter = 0;
+}
+
+static auto registered = []() {
+    ::hilti::rt::detail::registerModule(
+        {.name = "bench", .id = "bench", .init_globals = &__init_globals, .globals_idx = &__globals_index});
+    return 0;
+}();
+} // namespace dynamic_globals
+
+static void access_static(benchmark::State& state) {
+    hilti::rt::init();
+    static_globals::counter = 0;
+
+    for ( auto _ : state ) {
+        (void)_;
+        (*static_globals::counter) += 1;
+        benchmark::DoNotOptimize(*static_globals::counter);
+    }
+
+    hilti::rt::done();
+}
+
+static void access_dynamic(benchmark::State& state) {
+    hilti::rt::init();
+
+    for ( auto _ : state ) {
+        (void)_;
+        dynamic_globals::__globals()->counter += 1;
+        benchmark::DoNotOptimize(dynamic_globals::__globals()->counter);
+    }
+
+    hilti::rt::done();
+}
+
+// Cost of setting up a new context and initializing a module's globals on
+// first use there.
+static void first_use_dynamic(benchmark::State& state) {
+    hilti::rt::init();
+    auto* master = hilti::rt::context::detail::get();
+
+    for ( auto _ : state ) {
+        (void)_;
+        hilti::rt::Context ctx(1);
+        hilti::rt::context::detail::set(&ctx);
+        benchmark::DoNotOptimize(dynamic_globals::__globals()->counter);
+        hilti::rt::context::detail::set(master);
+    }
+
+    hilti::rt::done();
+}
+
+BENCHMARK(access_static);
+BENCHMARK(access_dynamic);
+BENCHMARK(first_use_dynamic);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,98 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+//
+// Measures unpacking integers from a stream, with the byte order passed at
+// runtime versus known at compile time as emitted by the code generator for
+// constant byte orders.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include <hilti/rt/init.h>
+#include <hilti/rt/types/integer.h>
+#include <hilti/rt/types/stream.h>
+
+// Number of values to unpack per iteration.
+static const size_t Count = 1024;
+
+// Returns a stream holding `Count` values of type `T`, spread across chunks
+// of typical TCP payload size.
+template<typename T>
+static hilti::rt::Stream data() {
+    hilti::rt::Stream stream;
+
+    std::string chunk;
+    for ( size_t i = 0; i < Count * sizeof(T); i++ ) {
+        chunk += static_cast<char>(i * 7);
+
+        if ( chunk.size() == 1460 ) {
+            stream.append(hilti::rt::Bytes(std::move(chunk)));
+            chunk = {};
+        }
+    }
+
+    stream.append(hilti::rt::Bytes(std::move(chunk)));
+    return stream;
+}
+
+template<typename T, hilti::rt::ByteOrder::Value Order>
+static void unpack_runtime(benchmark::State& state) {
+    hilti::rt::init();
+    auto stream = data<T>();
+
+    // Hide the byte order from the compiler.
+    hilti::rt::ByteOrder order = Order;
+    benchmark::DoNotOptimize(order);
+
+    for ( auto _ : state ) {
+        (void)_;
+        auto cur = stream.view();
+
+        for ( size_t i = 0; i < Count; i++ ) {
+            auto x = hilti::rt::integer::unpack<T>(cur, order).value();
+            benchmark::DoNotOptimize(std::get<0>(x));
+            cur = std::get<1>(x);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * Count);
+    hilti::rt::done();
+}
+
+template<typename T, hilti::rt::ByteOrder::Value Order>
+static void unpack_constant(benchmark::State& state) {
+    hilti::rt::init();
+    auto stream = data<T>();
+
+    for ( auto _ : state ) {
+        (void)_;
+        auto cur = stream.view();
+
+        for ( size_t i = 0; i < Count; i++ ) {
+            auto x = hilti::rt::integer::unpack<T, Order>(cur).value();
+            benchmark::DoNotOptimize(std::get<0>(x));
+            cur = std::get<1>(x);
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * Count);
+    hilti::rt::done();
+}
+
+BENCHMARK_TEMPLATE(unpack_runtime, uint16_t, hilti::rt::ByteOrder::Big);
+BENCHMARK_TEMPLATE(unpack_runtime, uint16_t, hilti::rt::ByteOrder::Little);
+BENCHMARK_TEMPLATE(unpack_runtime, uint32_t, hilti::rt::ByteOrder::Big);
+BENCHMARK_TEMPLATE(unpack_runtime, uint32_t, hilti::rt::ByteOrder::Little);
+BENCHMARK_TEMPLATE(unpack_runtime, uint64_t, hilti::rt::ByteOrder::Big);
+BENCHMARK_TEMPLATE(unpack_runtime, uint64_t, hilti::rt::ByteOrder::Little);
+
+BENCHMARK_TEMPLATE(unpack_constant, uint16_t, hilti::rt::ByteOrder::Big);
+BENCHMARK_TEMPLATE(unpack_constant, uint16_t, hilti::rt::ByteOrder::Little);
+BENCHMARK_TEMPLATE(unpack_constant, uint32_t, hilti::rt::ByteOrder::Big);
+BENCHMARK_TEMPLATE(unpack_constant, uint32_t, hilti::rt::ByteOrder::Little);
+BENCHMARK_TEMPLATE(unpack_constant, uint64_t, hilti::rt::ByteOrder::Big);
+BENCHMARK_TEMPLATE(unpack_constant, uint64_t, hilti::rt::ByteOrder::Little);
+
+BENCHMARK_MAIN();
@@ -4,7 +4,9 @@
 #include <memory>
 
 #include <hilti/rt/context.h>
+#include <hilti/rt/exception.h>
 #include <hilti/rt/global-state.h>
+#include <hilti/rt/init.h>
 #include <hilti/rt/logging.h>
 #include <hilti/rt/util.h>
 
@@ -34,10 +36,9 @@ Context::Context(vthread::ID vid) : vid(vid) {
         return;
     }
 
-    for ( const auto& m : globalState()->hilti_modules ) {
-        if ( m.init_globals )
-            (*m.init_globals)(this);
-    }
+    // Globals of the individual modules get initialized lazily on first
+    // access, so that a context doesn't pay for modules it never runs.
+    hilti_globals.resize(globalState()->hilti_modules.size());
 }
 
 Context::~Context() {
@@ -50,3 +51,25 @@ Context::~Context() {
 }
 
 Context* context::detail::master() { return globalState()->master_context.get(); }
+
+context::ThreadContext::ThreadContext(bool migratable) {
+    if ( ! isInitialized() )
+        throw UsageError("runtime must be initialized before creating thread contexts");
+
+    if ( context::detail::current() )
+        throw UsageError("thread already has a context");
+
+    auto vid = globalState()->next_vthread_id++;
+    HILTI_RT_DEBUG("libhilti", fmt("creating context for vid %" PRIu64, vid));
+
+    _context = std::make_unique<Context>(vid);
+    _context->fiber.migratable = migratable;
+    context::detail::set(_context.get());
+}
+
+context::ThreadContext::~ThreadContext() {
+    // Release any cached fibers while our context is still current, as their
+    // destruction may need it.
+    _context->fiber.cache.clear();
+    context::detail::set(nullptr);
+}
@@ -28,6 +28,8 @@ void detail::DebugLogger::print(const std::string& stream, const std::string& ms
     if ( i == _streams.end() )
         return;
 
+    std::lock_guard<std::mutex> lock(_mutex);
+
     if ( ! _output ) {
         if ( _path == "/dev/stdout" )
             _output = &std::cout;
@@ -3,6 +3,7 @@
 #include <fiber/fiber.h>
 
 #include <memory>
+#include <mutex>
 
 #include <hilti/rt/autogen/config.h>
 #include <hilti/rt/configuration.h>
@@ -212,10 +213,7 @@ detail::Fiber::Fiber(Type type) : _type(type), _fiber(std::make_unique<::Fiber>(
         case Type::IndividualStack: {
             // We do bookkeeping only for the "real" fibers with payload.
             ++_total_fibers;
-            ++_current_fibers;
-
-            if ( _current_fibers > _max_fibers )
-                _max_fibers = _current_fibers;
+            _updateMax(_max_fibers, ++_current_fibers);
         }
 
         case Type::SwitchTrampoline:
@@ -520,6 +518,26 @@ std::unique_ptr<detail::Fiber> detail::Fiber::create() {
         return f;
     }
 
+    if ( context->fiber.migratable ) {
+        // Our own cache has run dry, see if other threads have left any
+        // fibers for reuse.
+        auto* gs = globalState();
+        std::unique_lock lock(gs->fiber_pool_mutex);
+
+        if ( ! gs->fiber_pool.empty() ) {
+            auto f = std::move(gs->fiber_pool.back());
+            gs->fiber_pool.pop_back();
+            lock.unlock();
+
+            --_cached_fibers;
+            HILTI_RT_FIBER_DEBUG("create", fmt("reusing fiber %s from global pool", *f.get()));
+            return f;
+        }
+
+        lock.unlock();
+        return std::make_unique<Fiber>(Type::IndividualStack);
+    }
+
     return std::make_unique<Fiber>(DefaultFiberType);
 }
 
@@ -543,6 +561,19 @@ void detail::Fiber::destroy(std::unique_ptr<detail::Fiber> f) {
         return;
     }
 
+    if ( context->fiber.migratable && f->_type == Type::IndividualStack ) {
+        // Leave the fiber to other threads that may be running dry.
+        auto* gs = globalState();
+        std::unique_lock lock(gs->fiber_pool_mutex);
+
+        if ( gs->fiber_pool.size() < configuration::detail::unsafeGet().fiber_global_cache_size ) {
+            HILTI_RT_FIBER_DEBUG("destroy", fmt("putting fiber %s into global pool", *f.get()));
+            gs->fiber_pool.push_back(std::move(f));
+            ++_cached_fibers;
+            return;
+        }
+    }
+
     HILTI_RT_FIBER_DEBUG("destroy", fmt("cache size exceeded, deleting finished fiber %s", *f.get()));
 }
 
@@ -561,6 +592,12 @@ void detail::Fiber::primeCache() {
 
 void detail::Fiber::reset() {
     context::detail::get()->fiber.cache.clear();
+
+    {
+        std::unique_lock lock(globalState()->fiber_pool_mutex);
+        globalState()->fiber_pool.clear();
+    }
+
     _total_fibers = 0;
     _current_fibers = 0;
     _cached_fibers = 0;
@@ -642,19 +679,18 @@ void detail::trackStack() {
         return;
 
     if ( fiber->type() == Fiber::Type::IndividualStack || fiber->type() == Fiber::Type::SharedStack ) {
-        if ( auto size = fiber->stackBuffer().activeSize(); size > detail::Fiber::_max_stack_size )
-            detail::Fiber::_max_stack_size = size;
+        detail::Fiber::_updateMax(detail::Fiber::_max_stack_size, fiber->stackBuffer().activeSize());
     }
 }
 
 detail::Fiber::Statistics detail::Fiber::statistics() {
     Statistics stats{
-        .total = _total_fibers,
-        .current = _current_fibers,
-        .cached = _cached_fibers,
-        .max = _max_fibers,
-        .max_stack_size = _max_stack_size,
-        .initialized = _initialized,
+        .total = _total_fibers.load(),
+        .current = _current_fibers.load(),
+        .cached = _cached_fibers.load(),
+        .max = _max_fibers.load(),
+        .max_stack_size = _max_stack_size.load(),
+        .initialized = _initialized.load(),
     };
 
     return stats;
@@ -4,6 +4,7 @@
 #include <hilti/rt/context.h>
 #include <hilti/rt/global-state.h>
 #include <hilti/rt/logging.h>
+#include <hilti/rt/util.h>
 
 using namespace hilti::rt;
 using namespace hilti::rt::detail;
@@ -18,3 +19,13 @@ GlobalState* detail::createGlobalState() {
 }
 
 GlobalState::~GlobalState() { HILTI_RT_DEBUG("libhilti", "destroying global state"); }
+
+void detail::initModuleGlobalsLazily(unsigned int idx) {
+    const auto& modules = globalState()->hilti_modules;
+
+    if ( idx >= modules.size() || ! modules[idx].init_globals )
+        internalError(fmt("access to globals of unknown module #%u", idx));
+
+    HILTI_RT_DEBUG("libhilti", fmt("initializing globals for module %s on first use", modules[idx].name));
+    (*modules[idx].init_globals)(context::detail::current());
+}
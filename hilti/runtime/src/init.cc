@@ -82,6 +82,9 @@ void hilti::rt::done() {
         }
     }
 
+    // Release any pooled fibers while we still have our context.
+    globalState()->fiber_pool.clear();
+
     delete __global_state; // NOLINT (cppcoreguidelines-owning-memory)
     __global_state = nullptr;
     context::detail::set(nullptr);
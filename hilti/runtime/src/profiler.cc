@@ -1,6 +1,7 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
 #include <cinttypes>
+#include <mutex>
 #include <unordered_map>
 
 #include <hilti/rt/configuration.h>
@@ -28,7 +29,10 @@ inline uint64_t _getClock() {
 #endif
 }
 
-void Profiler::_register() const { ++detail::globalState()->profilers[_name].instances; }
+void Profiler::_register() const {
+    std::lock_guard<std::mutex> lock(detail::globalState()->profilers_mutex);
+    ++detail::globalState()->profilers[_name].instances;
+}
 
 profiler::Measurement Profiler::snapshot() {
     if ( ! detail::globalState()->profiling_enabled )
@@ -46,6 +50,7 @@ void Profiler::record(const Measurement& end) {
     if ( ! *this )
         return; // already recorded
 
+    std::lock_guard<std::mutex> lock(detail::globalState()->profilers_mutex);
     auto& p = detail::globalState()->profilers[_name];
     assert(p.instances > 0);
 
@@ -80,6 +85,7 @@ void profiler::detail::done() {
 }
 
 std::optional<Measurement> profiler::get(const std::string& name) {
+    std::lock_guard<std::mutex> lock(rt::detail::globalState()->profilers_mutex);
     const auto& profilers = rt::detail::globalState()->profilers;
     if ( auto i = profilers.find(name); i != profilers.end() )
         return i->second.m;
@@ -91,6 +97,7 @@ void profiler::report() {
     static const auto fmt_header = "#%-49s %10s %10s %10s %10s\n";
     static const auto fmt_data = "%-50s %10" PRIu64 " %10" PRIu64 " %10.2f %10.2f \n";
 
+    std::lock_guard<std::mutex> lock(rt::detail::globalState()->profilers_mutex);
     const auto& profilers = rt::detail::globalState()->profilers;
 
     std::cerr << "#\n# Profiling results\n#\n";
@@ -1,9 +1,15 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
+#include <atomic>
 #include <cstddef>
+#include <optional>
+#include <thread>
+#include <vector>
 
 #include <hilti/rt/context.h>
 #include <hilti/rt/doctest.h>
+#include <hilti/rt/exception.h>
+#include <hilti/rt/fiber.h>
 #include <hilti/rt/init.h>
 #include <hilti/rt/test/utils.h>
 #include <hilti/rt/threading.h>
@@ -63,4 +69,127 @@ TEST_CASE("execute") {
     CHECK_EQ(count, 1U); // Function was executed exactly once.
 }
 
+TEST_CASE("ThreadContext") {
+    init(); // Noop if already initialized.
+
+    // The main thread already has its context.
+    CHECK_THROWS_WITH_AS(context::ThreadContext(), "thread already has a context", const UsageError&);
+
+    Context* ctx = nullptr;
+
+    std::thread t([&]() {
+        REQUIRE_EQ(context::detail::get(true), nullptr);
+
+        {
+            context::ThreadContext tc;
+            ctx = tc.get();
+            CHECK_EQ(context::detail::get(), ctx);
+            CHECK_NE(ctx->vid, vthread::Master);
+        }
+
+        CHECK_EQ(context::detail::get(true), nullptr);
+    });
+
+    t.join();
+
+    CHECK_NE(ctx, nullptr);
+    CHECK_NE(ctx, context::detail::master());
+    CHECK_EQ(context::detail::get(), context::detail::master());
+}
+
+TEST_CASE("ThreadContext stress") {
+    init(); // Noop if already initialized.
+
+    const int num_threads = 8;
+    const int num_resumables = 64;
+    const int num_yields = 100;
+
+    std::atomic<int> finished = 0;
+    std::vector<std::thread> threads;
+
+    for ( int i = 0; i < num_threads; ++i ) {
+        threads.emplace_back([&]() {
+            context::ThreadContext tc;
+            detail::Fiber::primeCache();
+
+            // Keep many resumables suspended concurrently on each thread,
+            // and interleave their execution.
+            std::vector<Resumable> rs;
+            rs.reserve(num_resumables);
+
+            for ( int j = 0; j < num_resumables; ++j ) {
+                rs.emplace_back([j](resumable::Handle* r) {
+                    auto x = j;
+                    for ( int k = 0; k < num_yields; ++k ) {
+                        r->yield();
+                        x += 1;
+                    }
+
+                    return x;
+                });
+
+                rs.back().run();
+            }
+
+            for ( int k = 0; k < num_yields; ++k ) {
+                for ( auto& r : rs )
+                    r.resume();
+            }
+
+            for ( int j = 0; j < num_resumables; ++j ) {
+                if ( rs[j] && rs[j].get<int>() == j + num_yields )
+                    ++finished;
+            }
+        });
+    }
+
+    for ( auto& t : threads )
+        t.join();
+
+    CHECK_EQ(finished, num_threads * num_resumables);
+}
+
+TEST_CASE("ThreadContext migratable") {
+    init(); // Noop if already initialized.
+
+    std::optional<Resumable> r;
+    std::vector<Context*> seen;
+
+    auto step = [&](bool start) {
+        context::ThreadContext tc(true);
+        CHECK(tc.get()->fiber.migratable);
+
+        if ( start ) {
+            r.emplace([&](resumable::Handle* h) {
+                for ( int i = 0; i < 3; ++i ) {
+                    seen.push_back(context::detail::get());
+                    h->yield();
+                }
+
+                return seen.size();
+            });
+
+            r->run();
+        }
+        else
+            r->resume();
+
+        if ( *r ) {
+            CHECK_EQ(r->get<size_t>(), 3U);
+            r.reset();
+        }
+        else
+            CHECK_EQ(seen.back(), tc.get());
+    };
+
+    // Resume the same resumable on a different thread each time.
+    for ( int i = 0; i < 4; ++i ) {
+        std::thread t(step, i == 0);
+        t.join();
+    }
+
+    CHECK_FALSE(r);
+    CHECK_EQ(seen.size(), 3U);
+}
+
 TEST_SUITE_END();
@@ -2,9 +2,11 @@
 
 #include <string>
 
+#include <hilti/rt/context.h>
 #include <hilti/rt/doctest.h>
 #include <hilti/rt/global-state.h>
 #include <hilti/rt/init.h>
+#include <hilti/rt/test/utils.h>
 
 using namespace hilti::rt;
 
@@ -47,7 +49,7 @@ TEST_CASE("initModuleGlobals/hiltiGlobals/moduleGlobals") {
 
     REQUIRE_EQ(detail::hiltiGlobals().size(), 1U);
     CHECK_NE(detail::hiltiGlobals().back(), nullptr);
-    CHECK_EQ(detail::hiltiGlobals().back(), detail::moduleGlobals<int>(idx));
+    CHECK_EQ(detail::hiltiGlobals().back().get(), detail::moduleGlobals<int>(idx));
     REQUIRE(detail::moduleGlobals<int>(idx));
     CHECK_EQ(*detail::moduleGlobals<int>(idx), 0U);
 
@@ -56,8 +58,37 @@ TEST_CASE("initModuleGlobals/hiltiGlobals/moduleGlobals") {
 
     REQUIRE_EQ(detail::hiltiGlobals().size(), 2U);
     REQUIRE_NE(detail::hiltiGlobals().back(), nullptr);
-    CHECK_EQ(detail::hiltiGlobals().back(), detail::moduleGlobals<int>(idx));
+    CHECK_EQ(detail::hiltiGlobals().back().get(), detail::moduleGlobals<int>(idx));
     CHECK_NE(detail::moduleGlobals<int>(idx - 1), detail::moduleGlobals<int>(idx));
 }
 
+TEST_CASE("moduleGlobals lazy initialization") {
+    init(); // Noop if already initialized.
+
+    static unsigned int idx = 0;
+    static int calls = 0;
+
+    detail::registerModule({.name = "lazy", .id = "lazy", .init_globals = [](Context*) {
+                                ++calls;
+                                detail::initModuleGlobals<int>(idx);
+                                *detail::moduleGlobals<int>(idx) = 42;
+                            },
+                            .globals_idx = &idx});
+
+    Context context(4711);
+    test::TestContext _(&context);
+
+    // Nothing gets initialized until first use.
+    REQUIRE_GT(detail::hiltiGlobals().size(), idx);
+    CHECK_EQ(detail::hiltiGlobals()[idx], nullptr);
+    CHECK_EQ(calls, 0);
+
+    CHECK_EQ(*detail::moduleGlobals<int>(idx), 42);
+    CHECK_EQ(calls, 1);
+
+    *detail::moduleGlobals<int>(idx) = 1;
+    CHECK_EQ(*detail::moduleGlobals<int>(idx), 1);
+    CHECK_EQ(calls, 1);
+}
+
 TEST_SUITE_END();
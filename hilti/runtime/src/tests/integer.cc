@@ -10,6 +10,7 @@
 #include <hilti/rt/safe-int.h>
 #include <hilti/rt/types/bytes.h>
 #include <hilti/rt/types/integer.h>
+#include <hilti/rt/types/stream.h>
 #include <hilti/rt/types/tuple.h>
 
 using namespace hilti::rt;
@@ -211,6 +212,66 @@ TEST_CASE("unpack") {
     CHECK_EQ(integer::unpack<uint64_t>("\x01\x02\x03\x04\x05\x06\x07\x08"_b, ByteOrder::Big), Result64(std::make_tuple(0x0102030405060708, ""_b)));
     CHECK_EQ(integer::unpack<uint64_t>("\x08\x07\x06\x05\x04\x03\x02\x01"_b, ByteOrder::Little), Result64(std::make_tuple(0x0102030405060708, ""_b)));
 
+    CHECK_EQ(integer::unpack<int16_t>("\xff\xfe"_b, ByteOrder::Big),
+             Result<std::tuple<integer::safe<int16_t>, Bytes>>(std::make_tuple(-2, ""_b)));
+    CHECK_EQ(integer::unpack<int32_t>("\xfe\xff\xff\xff"_b, ByteOrder::Little),
+             Result<std::tuple<integer::safe<int32_t>, Bytes>>(std::make_tuple(-2, ""_b)));
+    CHECK_EQ(integer::unpack<int8_t>("\xfe\x01"_b, ByteOrder::Network),
+             Result<std::tuple<integer::safe<int8_t>, Bytes>>(std::make_tuple(-2, "\x01"_b)));
+}
+
+TEST_CASE("unpack with constant byte order") {
+    using Result16 = Result<std::tuple<integer::safe<uint16_t>, Bytes>>;
+    using Result32 = Result<std::tuple<integer::safe<uint32_t>, Bytes>>;
+    using Result64 = Result<std::tuple<integer::safe<uint64_t>, Bytes>>;
+
+    CHECK_EQ(integer::unpack<uint16_t, ByteOrder::Little>("\x01"_b),
+             Result16(result::Error("insufficient data to unpack integer")));
+
+    CHECK_EQ(integer::unpack<uint16_t, ByteOrder::Little>("\x01\x00\x02"_b), Result16(std::make_tuple(1, "\x02"_b)));
+    CHECK_EQ(integer::unpack<uint16_t, ByteOrder::Big>("\x01\x00"_b), Result16(std::make_tuple(256, ""_b)));
+    CHECK_EQ(integer::unpack<uint32_t, ByteOrder::Network>("\x01\x02\x03\x04"_b),
+             Result32(std::make_tuple(0x01020304, ""_b)));
+    CHECK_EQ(integer::unpack<uint32_t, ByteOrder::Little>("\x04\x03\x02\x01"_b),
+             Result32(std::make_tuple(0x01020304, ""_b)));
+    CHECK_EQ(integer::unpack<uint64_t, ByteOrder::Big>("\x01\x02\x03\x04\x05\x06\x07\x08"_b),
+             Result64(std::make_tuple(0x0102030405060708, ""_b)));
+    CHECK_EQ(integer::unpack<uint64_t, ByteOrder::Little>("\x08\x07\x06\x05\x04\x03\x02\x01"_b),
+             Result64(std::make_tuple(0x0102030405060708, ""_b)));
+
+    CHECK_EQ(integer::unpack<int64_t, ByteOrder::Big>("\xff\xff\xff\xff\xff\xff\xff\xfe"_b),
+             Result<std::tuple<integer::safe<int64_t>, Bytes>>(std::make_tuple(-2, ""_b)));
+
+    SUBCASE("stream spanning chunks") {
+        Stream data;
+        data.append("\x01\x02"_b);
+        data.append("\x03\x04\x05"_b);
+
+        auto x = integer::unpack<uint32_t, ByteOrder::Big>(data.view());
+        REQUIRE(x);
+        CHECK_EQ(std::get<0>(*x), 0x01020304U);
+        CHECK_EQ(std::get<1>(*x).data(), "\x05"_b);
+
+        auto y = integer::unpack<uint32_t, ByteOrder::Little>(data.view());
+        REQUIRE(y);
+        CHECK_EQ(std::get<0>(*y), 0x04030201U);
+    }
+
+    SUBCASE("stream within single chunk") {
+        Stream data;
+        data.append("\x01\x02\x03\x04"_b);
+        data.append("\x05\x06"_b);
+
+        auto x = integer::unpack<uint32_t, ByteOrder::Big>(data.view());
+        REQUIRE(x);
+        CHECK_EQ(std::get<0>(*x), 0x01020304U);
+        CHECK_EQ(std::get<1>(*x).data(), "\x05\x06"_b);
+
+        auto y = integer::unpack<uint16_t, ByteOrder::Little>(std::get<1>(*x));
+        REQUIRE(y);
+        CHECK_EQ(std::get<0>(*y), 0x0605U);
+        CHECK(std::get<1>(*y).isEmpty());
+    }
 }
 
 TEST_SUITE_END();
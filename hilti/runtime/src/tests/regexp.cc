@@ -1,10 +1,14 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
+#include <thread>
 #include <tuple>
+#include <vector>
 
+#include <hilti/rt/context.h>
 #include <hilti/rt/doctest.h>
 #include <hilti/rt/exception.h>
 #include <hilti/rt/extension-points.h>
+#include <hilti/rt/init.h>
 #include <hilti/rt/types/bytes.h>
 #include <hilti/rt/types/integer.h>
 #include <hilti/rt/types/regexp.h>
@@ -464,3 +468,40 @@ TEST_CASE("caching") {
     CHECK_NE(re1a.jrx(), re3.jrx());
     CHECK_NE(re1a.jrx(), re4.jrx());
 }
+
+TEST_CASE("thread contexts") {
+    init(); // Noop if already initialized.
+
+    const auto re = RegExp(".*END\n", {.no_sub = true});
+    auto* main_jrx = re.jrx();
+
+    const int num_threads = 8;
+    std::vector<std::thread> threads;
+    std::vector<jrx_regex_t*> thread_jrxs(num_threads);
+    std::vector<int> matches(num_threads);
+
+    for ( int i = 0; i < num_threads; ++i ) {
+        threads.emplace_back([&, i]() {
+            context::ThreadContext tc;
+
+            // Other contexts share a fully compiled version of the regexp.
+            thread_jrxs[i] = re.jrx();
+
+            for ( int j = 0; j < 1000; ++j ) {
+                if ( re.match("abc END\n"_b) > 0 && re.jrx() == thread_jrxs[i] )
+                    ++matches[i];
+            }
+        });
+    }
+
+    for ( auto& t : threads )
+        t.join();
+
+    for ( int i = 0; i < num_threads; ++i ) {
+        CHECK_NE(thread_jrxs[i], main_jrx);
+        CHECK_EQ(thread_jrxs[i], thread_jrxs[0]);
+        CHECK_EQ(matches[i], 1000);
+    }
+
+    CHECK_EQ(re.jrx(), main_jrx);
+}
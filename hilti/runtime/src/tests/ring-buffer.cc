@@ -0,0 +1,92 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <hilti/rt/doctest.h>
+#include <hilti/rt/ring-buffer.h>
+
+using namespace hilti::rt;
+
+TEST_SUITE_BEGIN("SPSCRingBuffer");
+
+TEST_CASE("capacity") {
+    CHECK_EQ(SPSCRingBuffer<int>(1).capacity(), 1U);
+    CHECK_EQ(SPSCRingBuffer<int>(3).capacity(), 4U);
+    CHECK_EQ(SPSCRingBuffer<int>(4).capacity(), 4U);
+    CHECK_EQ(SPSCRingBuffer<int>(1000).capacity(), 1024U);
+}
+
+TEST_CASE("push-pop") {
+    SPSCRingBuffer<std::string> rb(2);
+    CHECK(rb.empty());
+    CHECK_FALSE(rb.tryPop());
+
+    CHECK(rb.tryPush("a"));
+    CHECK(rb.tryPush("b"));
+    CHECK_EQ(rb.size(), 2U);
+
+    SUBCASE("full") {
+        std::string c = "c";
+        CHECK_FALSE(rb.tryPush(std::move(c)));
+        CHECK_EQ(c, "c"); // not moved from
+    }
+
+    CHECK_EQ(rb.tryPop().value_or(""), "a");
+    CHECK(rb.tryPush("c"));
+    CHECK_EQ(rb.tryPop().value_or(""), "b");
+    CHECK_EQ(rb.tryPop().value_or(""), "c");
+    CHECK_FALSE(rb.tryPop());
+    CHECK(rb.empty());
+}
+
+TEST_CASE("popMany") {
+    SPSCRingBuffer<int> rb(8);
+
+    for ( int i = 0; i < 5; i++ )
+        REQUIRE(rb.tryPush(std::move(i)));
+
+    std::vector<int> out;
+    CHECK_EQ(rb.popMany(&out, 3), 3U);
+    CHECK_EQ(out, std::vector<int>{0, 1, 2});
+
+    CHECK_EQ(rb.popMany(&out, 10), 2U);
+    CHECK_EQ(out, std::vector<int>{0, 1, 2, 3, 4});
+
+    CHECK_EQ(rb.popMany(&out, 10), 0U);
+    CHECK(rb.empty());
+}
+
+TEST_CASE("concurrent") {
+    const int n = 100000;
+    SPSCRingBuffer<int> rb(64);
+
+    std::thread producer([&]() {
+        for ( int i = 0; i < n; ) {
+            if ( int x = i; rb.tryPush(std::move(x)) )
+                ++i;
+            else
+                std::this_thread::yield();
+        }
+    });
+
+    std::vector<int> received;
+    received.reserve(n);
+
+    while ( received.size() < static_cast<size_t>(n) ) {
+        if ( rb.popMany(&received, 16) == 0 )
+            std::this_thread::yield();
+    }
+
+    producer.join();
+
+    bool in_order = true;
+    for ( int i = 0; i < n; i++ )
+        in_order = in_order && (received[i] == i);
+
+    CHECK(in_order);
+    CHECK(rb.empty());
+}
+
+TEST_SUITE_END();
@@ -1,7 +1,9 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
 #include <exception>
+#include <memory>
 #include <sstream>
+#include <vector>
 
 #include <hilti/rt/doctest.h>
 #include <hilti/rt/exception.h>
@@ -271,6 +273,50 @@ TEST_CASE("append") {
         CHECK_NOTHROW(s.append(data, 0));
         CHECK_THROWS_WITH_AS(s.append(data, strlen(data)), "stream object can no longer be modified", const Frozen&);
     }
+
+    SUBCASE("byte vector") {
+        s.append(std::vector<Byte>());
+        CHECK_EQ(s, "123"_b);
+        CHECK_EQ(s.size(), 3);
+        CHECK_EQ(s.numberOfChunks(), 1);
+
+        s.append(std::vector<Byte>({'4', '5', '6'}));
+        CHECK_EQ(s, "123456"_b);
+        CHECK_EQ(s.size(), 6);
+        CHECK_EQ(s.numberOfChunks(), 2);
+
+        s.freeze();
+        CHECK_NOTHROW(s.append(std::vector<Byte>()));
+        CHECK_THROWS_WITH_AS(s.append(std::vector<Byte>{'4'}), "stream object can no longer be modified",
+                             const Frozen&);
+    }
+
+    SUBCASE("shared buffer") {
+        auto buffer = std::make_shared<const std::vector<Byte>>(std::vector<Byte>({'4', '5', '6', '7'}));
+        auto t = Stream("abc"_b);
+
+        s.append(std::make_shared<const std::vector<Byte>>());
+        CHECK_EQ(s.numberOfChunks(), 1);
+
+        s.append(buffer);
+        t.append(buffer);
+        CHECK_EQ(s, "1234567"_b);
+        CHECK_EQ(t, "abc4567"_b);
+        CHECK_EQ(s.numberOfChunks(), 2);
+        CHECK_EQ(buffer.use_count(), 3);
+
+        // Trimming one stream leaves the other one's data in place.
+        s.trim(s.at(5));
+        CHECK_EQ(s, "67"_b);
+        CHECK_EQ(t, "abc4567"_b);
+
+        t.trim(t.at(7));
+        CHECK_EQ(t, ""_b);
+        CHECK_EQ(buffer.use_count(), 2);
+
+        s.freeze();
+        CHECK_THROWS_WITH_AS(s.append(buffer), "stream object can no longer be modified", const Frozen&);
+    }
 }
 
 TEST_CASE("iteration") {
@@ -738,6 +784,70 @@ TEST_CASE("Trim to beyond end") {
     CHECK_EQ(x.view().end().offset(), 10);
 }
 
+TEST_CASE("Trim with pins") {
+    auto x = Stream("0123456789"_b);
+
+    std::optional<stream::Pin> p1 = stream::Pin(x.at(3));
+    auto p2 = stream::Pin(x.at(6));
+    auto v = x.view().sub(x.at(6), x.at(8));
+
+    // Trimming stops at the lowest pin.
+    x.trim(x.at(5));
+    CHECK_EQ(x.begin().offset(), 3);
+    CHECK_EQ(x, "3456789"_b);
+
+    // Copies pin again, so releasing the original keeps the position pinned.
+    std::optional<stream::Pin> p3 = *p1;
+    p1.reset();
+    x.trim(x.at(5));
+    CHECK_EQ(x.begin().offset(), 3);
+
+    p3.reset();
+    x.trim(x.at(9));
+    CHECK_EQ(x.begin().offset(), 6);
+    CHECK_EQ(v, "67"_b);
+
+    // A moved pin stays in effect.
+    auto p4 = std::move(p2);
+    x.trim(x.at(9));
+    CHECK_EQ(x.begin().offset(), 6);
+
+    p4 = stream::Pin();
+    x.trim(x.at(9));
+    CHECK_EQ(x, "9"_b);
+}
+
+TEST_CASE("Discard") {
+    auto x = Stream("01"_b);
+    auto v = x.view();
+
+    x.discardUntil(10);
+    CHECK(x.isDiscarding());
+
+    x.append("234"_b);
+    x.append("5678"_b);
+    CHECK_EQ(x.size(), 9);
+    CHECK_EQ(x.numberOfChunks(), 2);
+    CHECK(x.isDiscarding());
+
+    x.append("9abc"_b);
+    CHECK_EQ(x.size(), 13);
+    CHECK_EQ(x.numberOfChunks(), 3);
+    CHECK_FALSE(x.isDiscarding());
+    CHECK_EQ(v.dataForPrint(), "01<gap>abc");
+    CHECK_EQ(v.sub(v.begin() + 10, v.end()), "abc"_b);
+
+    x.trim(x.at(4));
+    CHECK_EQ(x.size(), 9);
+    CHECK_EQ(x.numberOfChunks(), 2);
+
+    x.trim(x.at(10));
+    CHECK_EQ(x, "abc"_b);
+
+    x.append("def", 3);
+    CHECK_EQ(x, "abcdef"_b);
+}
+
 TEST_CASE("Block iteration") {
     auto content = [](auto b, auto s) -> bool { return memcmp(b->start, s, strlen(s)) == 0; };
 
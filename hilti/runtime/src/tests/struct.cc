@@ -1,6 +1,8 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
+#include <cstdint>
 #include <optional>
+#include <string>
 
 #include <hilti/rt/doctest.h>
 #include <hilti/rt/extension-points.h>
@@ -39,6 +41,76 @@ struct TestWithCustomStr : public Test {
     std::optional<std::string> __str__() { return "__str__"; }
 };
 
+TEST_CASE("Packed") {
+    using P = struct_::Packed<uint8_t, std::string, uint64_t, uint16_t>;
+
+    // Elements are laid out without padding, with presence in a single byte.
+    CHECK_EQ(sizeof(P), sizeof(std::string) + 8 + 8);
+
+    P p;
+    CHECK_FALSE(struct_::isSet<0>(p));
+    CHECK_FALSE(struct_::isSet<1>(p));
+    CHECK_EQ(p.get<2>(), nullptr);
+
+    SUBCASE("set and reset") {
+        struct_::valueOrInit<0>(p) = 1;
+        struct_::valueOrInit<1>(p, "abc") += "def";
+        CHECK(struct_::isSet<0>(p));
+        CHECK(struct_::isSet<1>(p));
+        CHECK_FALSE(struct_::isSet<3>(p));
+        CHECK_EQ(struct_::value<0>(p), 1);
+        CHECK_EQ(struct_::value<1>(p), "abcdef");
+
+        struct_::reset<1>(p);
+        CHECK_FALSE(struct_::isSet<1>(p));
+        CHECK(struct_::isSet<0>(p));
+
+        p.emplace<1>(10, 'x');
+        CHECK_EQ(struct_::value<1>(p), "xxxxxxxxxx");
+    }
+
+    SUBCASE("unset access") {
+        CHECK_THROWS_AS(struct_::value<2>(p), const UnsetOptional&);
+        CHECK_THROWS_AS(struct_::value_or_exception<2>(p), const AttributeNotSet&);
+        CHECK_EQ(struct_::valueOr<2>(p, 42U), 42U);
+        CHECK_FALSE(struct_::isSet<2>(p));
+
+        p.emplace<2>(7U);
+        CHECK_EQ(struct_::valueOr<2>(p, 42U), 7U);
+        CHECK_EQ(struct_::value_or_exception<2>(p), 7U);
+    }
+
+    SUBCASE("copy and move") {
+        p.emplace<1>("foo");
+        p.emplace<3>(3);
+
+        P q = p;
+        CHECK_EQ(struct_::value<1>(q), "foo");
+        CHECK_EQ(struct_::value<3>(q), 3);
+        CHECK_FALSE(struct_::isSet<0>(q));
+
+        struct_::value<1>(q) = "bar";
+        CHECK_EQ(struct_::value<1>(p), "foo");
+
+        P r = std::move(q);
+        CHECK_EQ(struct_::value<1>(r), "bar");
+
+        r = p;
+        CHECK_EQ(struct_::value<1>(r), "foo");
+
+        p.clear();
+        CHECK_FALSE(struct_::isSet<1>(p));
+        CHECK_FALSE(struct_::isSet<3>(p));
+        CHECK(struct_::isSet<1>(r));
+    }
+
+    SUBCASE("to_string") {
+        p.emplace<2>(42U);
+        CHECK_EQ(to_string(struct_::ref<1>(p)), "(not set)");
+        CHECK_EQ(to_string(struct_::ref<2>(p)), "42");
+    }
+}
+
 TEST_CASE("to_string") { CHECK_EQ(to_string(Test(42)), "[$_x=42, $_y=43]"); }
 TEST_CASE("to_string_custom") { CHECK_EQ(to_string(TestWithCustomStr(42)), "__str__"); }
 
@@ -5,6 +5,7 @@
 
 #include <utility>
 
+#include <hilti/rt/context.h>
 #include <hilti/rt/global-state.h>
 #include <hilti/rt/types/regexp.h>
 #include <hilti/rt/util.h>
@@ -46,14 +47,13 @@ public:
 
     jrx_match_state _ms{};
     std::shared_ptr<regexp::detail::CompiledRegExp> _re;
+    jrx_regex_t* _jrx = nullptr; // version of `_re` that the match state belongs to
 
     ~Pimpl() { jrx_match_state_done(&_ms); }
 
-    Pimpl(std::shared_ptr<regexp::detail::CompiledRegExp> re) : _re(std::move(re)) {
-        jrx_match_state_init(_re->jrx(), 0, &_ms);
-    }
+    Pimpl(const RegExp& re) : _re(re._re), _jrx(re.jrx()) { jrx_match_state_init(_jrx, 0, &_ms); }
 
-    Pimpl(const Pimpl& other) : _acc(other._acc), _first(other._first), _re(other._re) {
+    Pimpl(const Pimpl& other) : _acc(other._acc), _first(other._first), _re(other._re), _jrx(other._jrx) {
         jrx_match_state_copy(&other._ms, &_ms);
     }
 };
@@ -62,14 +62,14 @@ regexp::MatchState::MatchState(const RegExp& re) {
     if ( re.patterns().empty() )
         throw PatternError("trying to match empty pattern set");
 
-    _pimpl = std::make_unique<Pimpl>(re._re);
+    _pimpl = std::make_unique<Pimpl>(re);
 }
 
 regexp::MatchState::MatchState(const MatchState& other) {
     if ( this == &other )
         return;
 
-    if ( other._pimpl->_re->jrx()->cflags & REG_STD_MATCHER )
+    if ( other._pimpl->_jrx->cflags & REG_STD_MATCHER )
         throw InvalidArgument("cannot copy match state of regexp with sub-expressions support");
 
     _pimpl = std::make_unique<Pimpl>(*other._pimpl);
@@ -79,7 +79,7 @@ regexp::MatchState& regexp::MatchState::operator=(const MatchState& other) {
     if ( this == &other )
         return *this;
 
-    if ( other._pimpl->_re->jrx()->cflags & REG_STD_MATCHER )
+    if ( other._pimpl->_jrx->cflags & REG_STD_MATCHER )
         throw InvalidArgument("cannot copy match state of regexp with sub-expressions support");
 
     _pimpl = std::make_unique<Pimpl>(*other._pimpl);
@@ -150,7 +150,7 @@ std::pair<int32_t, int64_t> regexp::MatchState::_advance(const stream::View& dat
     }
 
     jrx_accept_id rc = 0;
-    auto use_std_matcher = _use_std_matcher(_pimpl->_re->jrx(), &_pimpl->_ms);
+    auto use_std_matcher = _use_std_matcher(_pimpl->_jrx, &_pimpl->_ms);
     auto start_ms_offset = _pimpl->_ms.offset;
 
     for ( auto block = data.firstBlock(); block; block = data.nextBlock(block) ) {
@@ -166,11 +166,11 @@ std::pair<int32_t, int64_t> regexp::MatchState::_advance(const stream::View& dat
 
         if ( use_std_matcher )
             rc = static_cast<jrx_accept_id>(
-                jrx_regexec_partial_std(_pimpl->_re->jrx(), reinterpret_cast<const char*>(block->start), block->size,
+                jrx_regexec_partial_std(_pimpl->_jrx, reinterpret_cast<const char*>(block->start), block->size,
                                         first, last, &_pimpl->_ms, final_block));
         else
             rc = static_cast<jrx_accept_id>(
-                jrx_regexec_partial_min(_pimpl->_re->jrx(), reinterpret_cast<const char*>(block->start), block->size,
+                jrx_regexec_partial_min(_pimpl->_jrx, reinterpret_cast<const char*>(block->start), block->size,
                                         first, last, &_pimpl->_ms, final_block));
 
             // Note: The JRX match_state initializes offsets with 1.
@@ -205,9 +205,9 @@ regexp::Captures regexp::MatchState::captures(const Stream& data) const {
 
     Captures captures = {};
 
-    auto num_groups = jrx_num_groups(_pimpl->_re->jrx());
+    auto num_groups = jrx_num_groups(_pimpl->_jrx);
     jrx_regmatch_t groups[num_groups];
-    if ( jrx_reggroups(_pimpl->_re->jrx(), &_pimpl->_ms, num_groups, groups) == REG_OK ) {
+    if ( jrx_reggroups(_pimpl->_jrx, &_pimpl->_ms, num_groups, groups) == REG_OK ) {
         for ( auto i = 0; i < num_groups; i++ ) {
             // The following condition follows what JRX does
             // internally as well: if not both are set, just skip (and
@@ -226,46 +226,48 @@ void regexp::detail::CompiledRegExp::RegFree::operator()(jrx_regex_t* j) {
 }
 
 regexp::detail::CompiledRegExp::CompiledRegExp(const std::vector<std::string>& patterns, regexp::Flags flags)
-    : _flags(flags), _patterns(patterns) {
-    _newJrx();
-
-    if ( patterns.empty() )
-        return;
-
-    int idx = 0;
-    for ( const auto& p : patterns )
-        _compileOne(p, idx++);
+    : _flags(flags), _patterns(patterns), _jrx(_compile(true)) {}
 
-    jrx_regset_finalize(jrx());
-}
-
-void regexp::detail::CompiledRegExp::_newJrx() {
-    assert(! _jrx && "regexp already compiled");
+regexp::detail::CompiledRegExp::Jrx regexp::detail::CompiledRegExp::_compile(bool lazy) const {
+    int cflags = (REG_EXTENDED | REG_ANCHOR); // | REG_DEBUG;
 
-    int cflags = (REG_EXTENDED | REG_ANCHOR | REG_LAZY); // | REG_DEBUG;
+    if ( lazy )
+        cflags |= REG_LAZY;
 
     if ( _flags.no_sub )
         cflags |= REG_NOSUB;
     else if ( _flags.use_std )
         cflags |= REG_STD_MATCHER;
 
-    _patterns.clear();
-    _jrx = std::unique_ptr<jrx_regex_t, RegFree>(new jrx_regex_t);
-    jrx_regset_init(_jrx.get(), -1, cflags);
-}
+    auto jrx = Jrx(new jrx_regex_t);
+    jrx_regset_init(jrx.get(), -1, cflags);
+
+    if ( _patterns.empty() )
+        return jrx;
 
-void regexp::detail::CompiledRegExp::_compileOne(std::string pattern, int idx) {
-    if ( auto rc = jrx_regset_add(_jrx.get(), pattern.c_str(), pattern.size()); rc != REG_OK ) {
-        static char err[256];
-        jrx_regerror(rc, _jrx.get(), err, sizeof(err));
-        throw PatternError(fmt("error compiling pattern '%s': %s", pattern, err));
+    for ( const auto& p : _patterns ) {
+        if ( auto rc = jrx_regset_add(jrx.get(), p.c_str(), p.size()); rc != REG_OK ) {
+            char err[256];
+            jrx_regerror(rc, jrx.get(), err, sizeof(err));
+            throw PatternError(fmt("error compiling pattern '%s': %s", p, err));
+        }
     }
 
-    _patterns.push_back(std::move(pattern));
+    jrx_regset_finalize(jrx.get());
+    return jrx;
+}
+
+jrx_regex_t* regexp::detail::CompiledRegExp::sharedJrx() const {
+    // Without REG_LAZY, JRX builds the complete DFA during finalization, so
+    // matching won't modify it anymore.
+    std::call_once(_shared_once, [this]() { _shared_jrx = _compile(false); });
+    return _shared_jrx.get();
 }
 
 RegExp::RegExp(const std::vector<std::string>& patterns, regexp::Flags flags) {
     auto key = (patterns.empty() ? std::string() : join(patterns, "|") + "|" + flags.cacheKey());
+
+    std::lock_guard<std::mutex> lock(detail::globalState()->regexp_cache_mutex);
     auto& ptr = detail::globalState()->regexp_cache[key];
 
     if ( ! ptr )
@@ -274,6 +276,13 @@ RegExp::RegExp(const std::vector<std::string>& patterns, regexp::Flags flags) {
     _re = ptr;
 }
 
+jrx_regex_t* RegExp::jrx() const {
+    if ( auto* ctx = context::detail::get(true); ! ctx || ctx->vid == vthread::Master )
+        return _re->jrx();
+
+    return _re->sharedJrx();
+}
+
 RegExp::RegExp(std::string pattern, regexp::Flags flags)
     : RegExp(std::vector<std::string>{std::move(pattern)}, flags) {}
 
@@ -294,7 +303,8 @@ static Bytes _subslice(const Bytes& data, jrx_offset so, jrx_offset eo) {
 }
 
 Vector<Bytes> RegExp::matchGroups(const Bytes& data) const {
-    assert(jrx() && "regexp not compiled");
+    auto* jrx = this->jrx();
+    assert(jrx && "regexp not compiled");
 
     if ( _re->_patterns.size() > 1 )
         throw NotSupported("cannot capture groups during set matching");
@@ -312,9 +322,9 @@ Vector<Bytes> RegExp::matchGroups(const Bytes& data) const {
     if ( rc > 0 ) {
         groups.emplace_back(_subslice(data, so, eo));
 
-        if ( auto num_groups = jrx_num_groups(jrx()); num_groups > 1 ) {
+        if ( auto num_groups = jrx_num_groups(jrx); num_groups > 1 ) {
             jrx_regmatch_t pmatch[num_groups];
-            jrx_reggroups(jrx(), &ms, num_groups, pmatch);
+            jrx_reggroups(jrx, &ms, num_groups, pmatch);
 
             for ( int i = 1; i < num_groups; i++ ) {
                 if ( pmatch[i].rm_so >= 0 )
@@ -376,19 +386,21 @@ regexp::MatchState RegExp::tokenMatcher() const { return regexp::MatchState(*thi
 
 jrx_accept_id RegExp::_search_pattern(jrx_match_state* ms, const char* data, size_t len, jrx_offset* so,
                                       jrx_offset* eo) const {
+    auto* jrx = this->jrx();
+
     if ( len == 0 ) {
         // Nothing to do, but still need to init the match state.
-        jrx_match_state_init(jrx(), 0, ms);
+        jrx_match_state_init(jrx, 0, ms);
         return -1;
     }
 
     const jrx_assertion last = JRX_ASSERTION_EOL | JRX_ASSERTION_EOD;
     jrx_assertion first = JRX_ASSERTION_BOL | JRX_ASSERTION_BOD;
 
-    jrx_match_state_init(jrx(), 0, ms);
+    jrx_match_state_init(jrx, 0, ms);
     jrx_accept_id rc = 0;
 
-    auto use_std_matcher = _use_std_matcher(jrx(), ms);
+    auto use_std_matcher = _use_std_matcher(jrx, ms);
 
 #ifdef _DEBUG_MATCHING
     std::cerr << fmt("feeding |%s| use_std_matcher=%u first=%u last=%u\n", escapeBytes(std::string_view(data, len)),
@@ -396,9 +408,9 @@ jrx_accept_id RegExp::_search_pattern(jrx_match_state* ms, const char* data, siz
 #endif
 
     if ( use_std_matcher )
-        rc = static_cast<jrx_accept_id>(jrx_regexec_partial_std(jrx(), data, len, first, last, ms, true));
+        rc = static_cast<jrx_accept_id>(jrx_regexec_partial_std(jrx, data, len, first, last, ms, true));
     else
-        rc = static_cast<jrx_accept_id>(jrx_regexec_partial_min(jrx(), data, len, first, last, ms, true));
+        rc = static_cast<jrx_accept_id>(jrx_regexec_partial_min(jrx, data, len, first, last, ms, true));
 
 #ifdef _DEBUG_MATCHING
     std::cerr << fmt("-> rc=%d ms->offset=%d\n", rc, ms->offset);
@@ -407,7 +419,7 @@ jrx_accept_id RegExp::_search_pattern(jrx_match_state* ms, const char* data, siz
     if ( rc > 0 ) {
         if ( use_std_matcher ) {
             jrx_regmatch_t pmatch;
-            jrx_reggroups(jrx(), ms, 1, &pmatch);
+            jrx_reggroups(jrx, ms, 1, &pmatch);
 
             if ( so )
                 *so = pmatch.rm_so; // 0-based
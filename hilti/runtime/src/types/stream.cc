@@ -49,7 +49,11 @@ void Chunk::trim(const Offset& o) {
         auto& v = std::get<Vector>(_data);
         v.erase(v.begin(), v.begin() + static_cast<Vector::difference_type>((o - _offset).Ref()));
     }
-    // Nothing to do for gap chunks.
+    else if ( auto a = std::get_if<SharedData>(&_data) )
+        // Other chunks may be using the buffer, just skip the trimmed data.
+        a->begin += (o - _offset).Ref();
+    else if ( auto a = std::get_if<Gap>(&_data) )
+        a->size -= (o - _offset).Ref();
 
     _offset = o;
 }
@@ -58,6 +62,32 @@ void Chain::append(std::unique_ptr<Chunk> chunk) {
     _ensureValid();
     _ensureMutable();
 
+    if ( isDiscarding() ) {
+        // Replace any data falling below the discard offset with a gap.
+        auto offset = endOffset();
+        auto discarded = offset;
+        chunk->setOffset(offset);
+
+        while ( chunk && chunk->endOffset() <= _discard_offset ) {
+            discarded = chunk->endOffset();
+            chunk = std::move(chunk->_next);
+        }
+
+        if ( chunk && chunk->offset() < _discard_offset ) {
+            chunk->trim(_discard_offset);
+            discarded = _discard_offset;
+        }
+
+        _appendGap(discarded - offset);
+
+        if ( ! chunk )
+            return;
+    }
+
+    _link(std::move(chunk));
+}
+
+void Chain::_link(std::unique_ptr<Chunk> chunk) {
     if ( _tail ) {
         _tail->setNext(std::move(chunk));
         _tail = _tail->last();
@@ -71,6 +101,16 @@ void Chain::append(std::unique_ptr<Chunk> chunk) {
     }
 }
 
+void Chain::_appendGap(const Size& n) {
+    if ( n == 0 )
+        return;
+
+    if ( _tail && _tail->isGap() )
+        std::get<Gap>(_tail->_data).size += n.Ref();
+    else
+        _link(std::make_unique<Chunk>(0, n.Ref()));
+}
+
 void Chain::append(Chain&& other) {
     _ensureValid();
     _ensureMutable();
@@ -84,9 +124,14 @@ void Chain::append(Chain&& other) {
     other.reset();
 }
 
-void Chain::trim(const Offset& offset) {
+void Chain::trim(const Offset& requested) {
     _ensureValid();
 
+    // Leave pinned data in place.
+    auto offset = requested;
+    if ( ! _pins.empty() )
+        offset = std::max(std::min(offset, *_pins.begin()), _head_offset);
+
     // We search the first chunk that's containing the desired position,
     // deleting all the ones we pass on the way. We trim the one that
     // contains the position.
@@ -388,21 +433,35 @@ Stream::Stream(const Bytes& d) : Stream(Chunk(0, d.str())) {}
 Stream::Stream(const char* d, const Size& n) : Stream() { append(d, n); }
 
 void Stream::append(Bytes&& data) {
-    if ( data.isEmpty() )
+    if ( data.isEmpty() || _chain->discard(data.size()) )
         return;
 
     _chain->append(std::make_unique<Chunk>(0, data.str()));
 }
 
+void Stream::append(std::vector<Byte>&& data) {
+    if ( data.empty() || _chain->discard(data.size()) )
+        return;
+
+    _chain->append(std::make_unique<Chunk>(0, std::move(data)));
+}
+
+void Stream::append(std::shared_ptr<const std::vector<Byte>> data) {
+    if ( data->empty() || _chain->discard(data->size()) )
+        return;
+
+    _chain->append(std::make_unique<Chunk>(0, std::move(data)));
+}
+
 void Stream::append(const Bytes& data) {
-    if ( data.isEmpty() )
+    if ( data.isEmpty() || _chain->discard(data.size()) )
         return;
 
     _chain->append(std::make_unique<Chunk>(0, data.str()));
 }
 
 void Stream::append(const char* data, size_t len) {
-    if ( len == 0 )
+    if ( len == 0 || _chain->discard(len) )
         return;
 
     if ( data )
@@ -50,6 +50,8 @@ struct Options {
     std::vector<std::string> cxx_link; /**< additional static archives or shared libraries to link during JIT */
     bool cxx_enable_dynamic_globals =
         false; /**< if true, allocate globals dynamically at runtime for (future) thread safety */
+    bool cxx_packed_structs =
+        false; /**< if true, store optional struct fields jointly with a presence bitmask instead of as `std::optional` */
 
     /**
      * Retrieves the value for an auxiliary option.
@@ -93,6 +93,11 @@ public:
     cxx::Expression typeInfo(const hilti::Type& t);
     void addTypeInfoDefinition(const hilti::Type& t);
 
+    // Returns the index of a struct field inside the struct's joint storage
+    // for optional fields, or nothing if the field is stored by itself. See
+    // `Options::cxx_packed_structs`.
+    std::optional<unsigned int> packedFieldIndex(const hilti::Type& t, const ID& id);
+
     cxx::Expression coerce(const cxx::Expression& e, const Type& src, const Type& dst); // only for supported coercions
     cxx::Expression pack(const Expression& data, const std::vector<Expression>& args);
     cxx::Expression pack(const hilti::Type& t, const cxx::Expression& data, const std::vector<cxx::Expression>& args);
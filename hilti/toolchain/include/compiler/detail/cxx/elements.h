@@ -332,6 +332,7 @@ struct Struct {
     std::optional<cxx::Type> self;
     cxx::Block ctor;
     bool add_ctors = false;
+    std::vector<cxx::ID> packed; /**< members stored jointly in a `__packed` member, in the order of their indices */
     std::string str() const;
     std::string inlineCode() const;
 
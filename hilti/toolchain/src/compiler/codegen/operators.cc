@@ -455,7 +455,14 @@ struct Visitor : hilti::visitor::PreOrder<cxx::Expression, Visitor> {
     }
 
     result_t operator()(const operator_::generic::Unpack& n) {
-        auto args = tupleArguments(n, n.op1());
+        auto ctor = n.op1().as<expression::Ctor>().ctor();
+
+        if ( auto x = ctor.tryAs<ctor::Coerced>() )
+            ctor = x->coercedCtor();
+
+        // Pass on the original expressions so that the unpacking can take
+        // advantage of constant arguments.
+        auto args = ctor.as<ctor::Tuple>().value().copy();
         auto throw_on_error = n.op2().as<expression::Ctor>().ctor().as<ctor::Bool>().value();
         return cg->unpack(n.op0().type().as<type::Type_>().typeValue(), args[0], util::slice(args, 1, -1),
                           throw_on_error);
@@ -737,9 +744,33 @@ struct Visitor : hilti::visitor::PreOrder<cxx::Expression, Visitor> {
         return memberAccess(o, cg->compile(o.op0(), lhs), member);
     }
 
+    // Returns the index of a field stored inside the struct's `__packed` member, if it's stored there.
+    auto packedIndex(const expression::ResolvedOperatorBase& o, const ID& id) {
+        return cg->packedFieldIndex(o.op0().type(), id);
+    }
+
     result_t structMember(const expression::ResolvedOperatorBase& o, const Expression& op1) {
         const auto& op0 = o.op0();
         auto id = op1.as<expression::Member>().id();
+
+        if ( auto idx = packedIndex(o, id) ) {
+            auto packed = memberAccess(o, "__packed");
+            auto d = op0.type().as<type::Struct>().field(id)->default_();
+
+            if ( lhs ) {
+                if ( d )
+                    return {fmt("::hilti::rt::struct_::valueOrInit<%u>(%s, %s)", *idx, packed, cg->compile(*d)),
+                            cxx::Side::LHS};
+
+                return {fmt("::hilti::rt::struct_::valueOrInit<%u>(%s)", *idx, packed), cxx::Side::LHS};
+            }
+
+            if ( d )
+                return fmt("::hilti::rt::struct_::valueOr<%u>(%s, %s)", *idx, packed, cg->compile(*d));
+
+            return fmt("::hilti::rt::struct_::value<%u>(%s)", *idx, packed);
+        }
+
         auto attr = memberAccess(o, id);
 
         if ( auto f = op0.type().as<type::Struct>().field(id); f->isOptional() ) {
@@ -786,6 +817,9 @@ struct Visitor : hilti::visitor::PreOrder<cxx::Expression, Visitor> {
     result_t operator()(const operator_::struct_::HasMember& n) {
         auto id = n.op1().as<expression::Member>().id();
 
+        if ( auto idx = packedIndex(n, id) )
+            return fmt("::hilti::rt::struct_::isSet<%u>(%s)", *idx, memberAccess(n, "__packed"));
+
         if ( auto f = n.op0().type().as<type::Struct>().field(id); f->isOptional() )
             return fmt("%s.has_value()", memberAccess(n, id));
 
@@ -796,6 +830,15 @@ struct Visitor : hilti::visitor::PreOrder<cxx::Expression, Visitor> {
         auto id = n.op1().as<expression::Member>().id();
         assert(! lhs);
 
+        if ( auto idx = packedIndex(n, id) ) {
+            auto packed = memberAccess(n, "__packed");
+
+            if ( auto d = n.op0().type().as<type::Struct>().field(id)->default_() )
+                return fmt("::hilti::rt::struct_::valueOr<%u>(%s, %s)", *idx, packed, cg->compile(*d));
+
+            return fmt("::hilti::rt::struct_::value_or_exception<%u>(%s)", *idx, packed);
+        }
+
         if ( auto f = n.op0().type().as<type::Struct>().field(id); f->isOptional() ) {
             auto attr = memberAccess(n, id);
 
@@ -810,6 +853,10 @@ struct Visitor : hilti::visitor::PreOrder<cxx::Expression, Visitor> {
 
     result_t operator()(const operator_::struct_::Unset& n) {
         auto id = n.op1().as<expression::Member>().id();
+
+        if ( auto idx = packedIndex(n, id) )
+            return fmt("::hilti::rt::struct_::reset<%u>(%s)", *idx, memberAccess(n, "__packed"));
+
         return fmt("%s.reset()", memberAccess(n, std::move(id)));
     }
 
@@ -52,6 +52,7 @@ struct VisitorDeclaration : hilti::visitor::PreOrder<cxx::declaration::Type, Vis
             [&](auto& dummy) {
                 std::vector<cxx::declaration::Argument> args;
                 std::vector<cxx::type::struct_::Member> fields;
+                std::vector<cxx::ID> packed;
 
                 cxx::Block ctor;
 
@@ -197,7 +198,10 @@ struct VisitorDeclaration : hilti::visitor::PreOrder<cxx::declaration::Type, Vis
 
                     auto t = cg->compile(f.type(), codegen::TypeUsage::Storage);
 
-                    if ( f.isOptional() )
+                    if ( cg->packedFieldIndex(p.node.as<Type>(), f.id()) )
+                        packed.emplace_back(f.id());
+
+                    else if ( f.isOptional() )
                         t = fmt("std::optional<%s>", t);
 
                     std::optional<cxx::Expression> default_;
@@ -259,7 +263,8 @@ struct VisitorDeclaration : hilti::visitor::PreOrder<cxx::declaration::Type, Vis
                                            .members = std::move(fields),
                                            .type_name = cxx::ID(id.local()),
                                            .ctor = std::move(ctor),
-                                           .add_ctors = true};
+                                           .add_ctors = true,
+                                           .packed = std::move(packed)};
                 return cxx::declaration::Type{id, t, t.inlineCode()};
             });
 
@@ -871,18 +876,26 @@ struct VisitorTypeInfoDynamic : hilti::visitor::PreOrder<cxx::Expression, Visito
             if ( f.isStatic() || f.isNoEmit() )
                 continue;
 
+            cxx::ID cxx_type_id{*typeID(p.node)};
+            if ( auto x = cxxID(p.node) )
+                cxx_type_id = *x;
+
+            auto member = cxx::ID(f.id());
             std::string accessor;
 
-            if ( f.isOptional() )
+            if ( auto idx = cg->packedFieldIndex(p.node.as<Type>(), f.id()) ) {
+                member = cxx::ID("__packed");
+                accessor =
+                    fmt(", ::hilti::rt::type_info::struct_::Field::accessor_packed<decltype(%s::__packed), %u>()",
+                        cxx_type_id, *idx);
+            }
+
+            else if ( f.isOptional() )
                 accessor = fmt(", ::hilti::rt::type_info::struct_::Field::accessor_optional<%s>()",
                                cg->compile(f.type(), codegen::TypeUsage::Storage));
 
-            cxx::ID cxx_type_id{*typeID(p.node)};
-            if ( auto x = cxxID(p.node) )
-                cxx_type_id = *x;
-
             fields.push_back(fmt("::hilti::rt::type_info::struct_::Field{ \"%s\", %s, offsetof(%s, %s), %s%s }",
-                                 cxx::ID(f.id()), cg->typeInfo(f.type()), cxx_type_id, cxx::ID(f.id()), f.isInternal(),
+                                 cxx::ID(f.id()), cg->typeInfo(f.type()), cxx_type_id, member, f.isInternal(),
                                  accessor));
         }
 
@@ -1062,6 +1075,33 @@ std::optional<cxx::Expression> CodeGen::typeDefaultValue(const hilti::Type& t) {
     return std::move(x->default_);
 };
 
+std::optional<unsigned int> CodeGen::packedFieldIndex(const hilti::Type& t, const ID& id) {
+    // Types defined in C++ keep their own layout.
+    if ( ! options().cxx_packed_structs || t.cxxID() )
+        return {};
+
+    // Internal fields may get removed by the optimizer, so we leave them out
+    // to keep the indices of all other fields stable.
+    auto is_packed = [](const auto& f) {
+        return f.isOptional() && ! f.isStatic() && ! f.isNoEmit() && ! f.isInternal() &&
+               ! util::startsWith(f.id(), "__") && ! f.type().template isA<type::Function>();
+    };
+
+    unsigned int idx = 0;
+
+    for ( const auto& f : t.as<type::Struct>().fields() ) {
+        if ( ! is_packed(f) )
+            continue;
+
+        if ( f.id() == id )
+            return idx;
+
+        ++idx;
+    }
+
+    return {};
+}
+
 std::list<cxx::declaration::Type> CodeGen::typeDependencies(const hilti::Type& t) {
     VisitorDeclaration v(this, &_cache_types_declarations);
     v.dispatch(t);
@@ -1,9 +1,15 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
+#include <optional>
+#include <string>
 #include <utility>
 
+#include <hilti/ast/ctors/enum.h>
+#include <hilti/ast/declarations/constant.h>
 #include <hilti/ast/detail/visitor.h>
 #include <hilti/ast/expression.h>
+#include <hilti/ast/expressions/ctor.h>
+#include <hilti/ast/expressions/id.h>
 #include <hilti/ast/type.h>
 #include <hilti/base/logger.h>
 #include <hilti/compiler/detail/codegen/codegen.h>
@@ -16,15 +22,36 @@ using namespace hilti::detail;
 
 namespace {
 
+// Returns the label of a byte order if it's a constant that the runtime can
+// specialize unpacking for at compile time.
+std::optional<std::string> constantByteOrder(const Expression& e) {
+    if ( auto id = e.tryAs<expression::ResolvedID>() ) {
+        if ( auto c = id->declaration().tryAs<declaration::Constant>() )
+            return constantByteOrder(c->value());
+    }
+
+    if ( auto c = e.tryAs<expression::Ctor>() ) {
+        if ( auto x = c->ctor().tryAs<ctor::Enum>() ) {
+            const auto& label = x->value().id().str();
+            if ( label == "Big" || label == "Network" || label == "Little" )
+                return label;
+        }
+    }
+
+    return {};
+}
+
 struct Visitor : hilti::visitor::PreOrder<std::string, Visitor> {
     enum class Kind { Pack, Unpack };
 
-    Visitor(CodeGen* cg, Kind kind, cxx::Expression data, const std::vector<cxx::Expression>& args)
-        : cg(cg), kind(kind), data(std::move(data)), args(args) {}
+    Visitor(CodeGen* cg, Kind kind, cxx::Expression data, const std::vector<cxx::Expression>& args,
+            std::optional<std::string> byte_order = {})
+        : cg(cg), kind(kind), data(std::move(data)), args(args), byte_order(std::move(byte_order)) {}
     CodeGen* cg;
     Kind kind;
     cxx::Expression data;
     const std::vector<cxx::Expression>& args;
+    std::optional<std::string> byte_order; // set if constant for integer unpacking
 
     auto kindToString() const {
         switch ( kind ) {
@@ -45,10 +72,18 @@ struct Visitor : hilti::visitor::PreOrder<std::string, Visitor> {
     }
 
     result_t operator()(const type::UnsignedInteger& n) {
+        if ( kind == Kind::Unpack && byte_order )
+            return fmt("::hilti::rt::integer::unpack<uint%d_t, ::hilti::rt::ByteOrder::%s>(%s)", n.width(),
+                       *byte_order, data);
+
         return fmt("::hilti::rt::integer::%s<uint%d_t>(%s, %s)", kindToString(), n.width(), data, args[0]);
     }
 
     result_t operator()(const type::SignedInteger& n) {
+        if ( kind == Kind::Unpack && byte_order )
+            return fmt("::hilti::rt::integer::unpack<int%d_t, ::hilti::rt::ByteOrder::%s>(%s)", n.width(),
+                       *byte_order, data);
+
         return fmt("::hilti::rt::integer::%s<int%d_t>(%s, %s)", kindToString(), n.width(), data, args[0]);
     }
 
@@ -77,7 +112,12 @@ cxx::Expression CodeGen::pack(const hilti::Type& t, const cxx::Expression& data,
 
 cxx::Expression CodeGen::unpack(const hilti::Type& t, const Expression& data, const std::vector<Expression>& args, bool throw_on_error) {
     auto cxx_args = util::transform(args, [&](const auto& e) { return compile(e, false); });
-    if ( auto x = Visitor(this, Visitor::Kind::Unpack, compile(data), cxx_args).dispatch(t) ) {
+
+    std::optional<std::string> byte_order;
+    if ( ! args.empty() )
+        byte_order = constantByteOrder(args.back());
+
+    if ( auto x = Visitor(this, Visitor::Kind::Unpack, compile(data), cxx_args, byte_order).dispatch(t) ) {
         if ( throw_on_error )
             return cxx::Expression(util::fmt("%s.valueOrThrow()", *x));
         else
@@ -1,5 +1,8 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
+#include <algorithm>
+#include <optional>
+
 #include <hilti/rt/json.h>
 
 #include <hilti/base/logger.h>
@@ -336,11 +339,28 @@ std::string cxx::declaration::Local::str() const { return fmtDeclaration(id, typ
 
 std::string cxx::declaration::Global::str() const { return fmtDeclaration(id, type, args, linkage, init); }
 
+// Returns the index of a struct member inside the struct's `__packed`
+// member, if it's stored there.
+inline std::optional<size_t> packedIndex(const cxx::type::Struct& s, const cxx::ID& id) {
+    if ( auto i = std::find(s.packed.begin(), s.packed.end(), id); i != s.packed.end() )
+        return static_cast<size_t>(i - s.packed.begin());
+
+    return {};
+}
+
 std::string cxx::type::Struct::str() const {
     std::vector<std::string> visitor_calls;
+    std::vector<std::string> packed_types(packed.size());
 
     auto fmt_member = [&](const auto& f) {
         if ( auto x = std::get_if<declaration::Local>(&f) ) {
+            if ( auto idx = packedIndex(*this, x->id) ) {
+                // Stored inside `__packed`, which we declare below.
+                visitor_calls.emplace_back(fmt("_(\"%s\", ::hilti::rt::struct_::ref<%u>(__packed)); ", x->id, *idx));
+                packed_types[*idx] = x->type;
+                return std::string();
+            }
+
             if ( ! (x->isInternal() || x->linkage == "inline static") ) // Don't visit internal or static fields.
                 visitor_calls.emplace_back(fmt("_(\"%s\", %s); ", x->id, x->id));
 
@@ -388,7 +408,16 @@ std::string cxx::type::Struct::str() const {
     };
 
     std::vector<std::string> struct_fields;
-    util::append(struct_fields, util::transform(members, fmt_member));
+
+    for ( const auto& m : members ) {
+        if ( auto x = fmt_member(m); ! x.empty() )
+            struct_fields.emplace_back(std::move(x));
+    }
+
+    if ( ! packed.empty() )
+        struct_fields.emplace_back(
+            fmt("::hilti::rt::struct_::Packed<%s> __packed;", util::join(packed_types, ", ")));
+
     util::append(struct_fields, util::transform(args, fmt_argument));
 
     if ( add_ctors ) {
@@ -527,6 +556,11 @@ std::string cxx::type::Struct::inlineCode() const {
             util::join(util::transform(locals_user,
                                        [&](const auto& x) {
                                            auto& l = std::get<declaration::Local>(x);
+
+                                           if ( auto idx = packedIndex(*this, l.id) )
+                                               return fmt("    if ( %s ) this->__packed.emplace<%u>(std::move(*%s));\n",
+                                                          l.id, *idx, l.id);
+
                                            return fmt("    if ( %s ) this->%s = std::move(*%s);\n", l.id, l.id, l.id);
                                        }),
                        "");
@@ -37,6 +37,7 @@ inline const DebugStream Driver("driver");
 
 constexpr int OPT_CXX_LINK = 1000;
 constexpr int OPT_CXX_ENABLE_DYNAMIC_GLOBALS = 1001;
+constexpr int OPT_CXX_PACKED_STRUCTS = 1002;
 
 static struct option long_driver_options[] = {{"abort-on-exceptions", required_argument, nullptr, 'A'},
                                               {"show-backtraces", required_argument, nullptr, 'B'},
@@ -44,6 +45,7 @@ static struct option long_driver_options[] = {{"abort-on-exceptions", required_a
                                               {"cxx-enable-dynamic-globals", no_argument, nullptr,
                                                OPT_CXX_ENABLE_DYNAMIC_GLOBALS},
                                               {"cxx-link", required_argument, nullptr, OPT_CXX_LINK},
+                                              {"cxx-packed-structs", no_argument, nullptr, OPT_CXX_PACKED_STRUCTS},
                                               {"debug", no_argument, nullptr, 'd'},
                                               {"debug-addl", required_argument, nullptr, 'X'},
                                               {"disable-optimizations", no_argument, nullptr, 'g'},
@@ -136,6 +138,8 @@ void Driver::usage() {
            "  -Z | --enable-profiling          Report profiling statistics after execution.\n"
            "       --cxx-link <lib>            Link specified static archive or shared library during JIT or to "
            "produced HLTO file. Can be given multiple times.\n"
+           "       --cxx-packed-structs        Track presence of optional struct fields in a bitmask, reducing memory "
+           "usage. All code linked together must use the same setting.\n"
         << addl_usage
         << "\n"
            "Inputs can be "
@@ -411,6 +415,8 @@ Result<Nothing> Driver::parseOptions(int argc, char** argv) {
 
             case OPT_CXX_ENABLE_DYNAMIC_GLOBALS: _compiler_options.cxx_enable_dynamic_globals = true; break;
 
+            case OPT_CXX_PACKED_STRUCTS: _compiler_options.cxx_packed_structs = true; break;
+
             case 'h': usage(); return Nothing();
 
             case '?': usage(); return error("unknown option");
@@ -9,6 +9,8 @@
 #include <hilti/rt/types/bytes.h>
 #include <hilti/rt/types/stream.h>
 
+#include <spicy/rt/filter.h>
+
 namespace spicy::rt::base64 {
 
 namespace detail {
@@ -81,6 +83,27 @@ private:
     std::shared_ptr<detail::State> _state;
 };
 
+/**
+ * Native filter performing base64 decoding, corresponding to the Spicy
+ * filter unit `filter::Base64Decode`.
+ */
+class DecodeFilter : public filter::Native {
+public:
+    std::string name() const override { return "base64-decode"; }
+
+    void process(const hilti::rt::stream::View& input,
+                 hilti::rt::Stream& output) override { // NOLINT(google-runtime-references)
+        output.append(_stream.decode(input));
+    }
+
+    void finish(hilti::rt::Stream& output) override { // NOLINT(google-runtime-references)
+        output.append(_stream.finish());
+    }
+
+private:
+    Stream _stream;
+};
+
 /** Forwards to the corresponding `Stream` method. */
 inline hilti::rt::Bytes encode(Stream& stream, // NOLINT(google-runtime-references)
                                const hilti::rt::Bytes& data) {
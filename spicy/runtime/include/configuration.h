@@ -3,6 +3,7 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <optional>
@@ -12,6 +13,17 @@
 
 namespace spicy::rt {
 
+namespace sink {
+/** What a sink does when the data it buffers for reassembly exceeds a limit. */
+enum class LimitPolicy {
+    /** Skips ahead to the next buffered data, reporting undelivered and skipped data as usual. */
+    Skip,
+
+    /** Drops new data unless it can be delivered right away. */
+    Drop,
+};
+} // namespace sink
+
 /** Configuration parameters for the Spicy runtime system. */
 struct Configuration {
     Configuration() {}
@@ -28,6 +40,37 @@ struct Configuration {
      * the caller.
      */
     std::optional<std::function<void(const std::string&)>> hook_decline_input;
+
+    /**
+     * Maximum number of bytes any single sink buffers for reassembly,
+     * including data delivered already but not yet trimmed. If exceeded,
+     * the sink applies `sink_limit_policy`. Zero means no limit.
+     */
+    uint64_t sink_max_buffered = 0;
+
+    /**
+     * Maximum number of bytes all sinks combined buffer for reassembly. If
+     * exceeded, a sink receiving new data applies `sink_limit_policy` to
+     * its own buffer. Zero means no limit.
+     */
+    uint64_t sink_max_total_buffered = 0;
+
+    /** What a sink does when exceeding one of the limits on buffered data. */
+    sink::LimitPolicy sink_limit_policy = sink::LimitPolicy::Skip;
+
+    /**
+     * Default for the maximum number of bytes a decompression stream (zlib,
+     * zstd, lz4) decompresses in total before aborting with an error. Zero
+     * means no limit.
+     */
+    uint64_t decompress_max_output = 0;
+
+    /**
+     * Default for the maximum ratio of decompressed to compressed bytes
+     * that a decompression stream accepts before aborting with an error.
+     * Zero means no limit.
+     */
+    uint64_t decompress_max_ratio = 0;
 };
 
 namespace configuration {
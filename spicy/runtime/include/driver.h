@@ -2,10 +2,16 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 #include <hilti/rt/result.h>
 
@@ -19,6 +25,151 @@ namespace driver {
 
 enum class ParsingType { Stream, Block };
 
+/**
+ * Histogram of latencies in nanoseconds. Buckets grow logarithmically, with
+ * `SubBuckets` of them per power of two, so that recording a value remains
+ * cheap while percentiles derived from the histogram are accurate to within
+ * about 6%. Recording is thread-safe.
+ */
+class LatencyHistogram {
+public:
+    /** Number of buckets per power of two, as a power of two itself. */
+    static constexpr unsigned int SubBucketBits = 4;
+
+    /** Number of buckets per power of two. */
+    static constexpr unsigned int SubBuckets = 1U << SubBucketBits;
+
+    /** Total number of buckets needed to cover all 64-bit values. */
+    static constexpr size_t NumBuckets = (64 - SubBucketBits + 1) * SubBuckets;
+
+    /** Records a latency. */
+    void record(uint64_t ns) { _buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed); }
+
+    /** Returns the current count of each bucket. */
+    std::vector<uint64_t> counts() const;
+
+    /** Returns the index of the bucket that a latency falls into. */
+    static size_t bucket(uint64_t ns) {
+        if ( ns < SubBuckets )
+            return ns;
+
+        auto exp = 63U - static_cast<unsigned int>(__builtin_clzll(ns));
+        auto sub = (ns >> (exp - SubBucketBits)) & (SubBuckets - 1);
+        return ((exp - SubBucketBits + 1) << SubBucketBits) + sub;
+    }
+
+    /** Returns the smallest latency falling into a bucket. */
+    static uint64_t lowerBound(size_t bucket);
+
+    /**
+     * Computes a percentile from bucket counts as returned by `counts()`.
+     *
+     * @param counts counts per bucket
+     * @param p percentile to compute, between 0 and 100
+     * @return the latency at the percentile, or zero if there are no counts
+     */
+    static uint64_t percentile(const std::vector<uint64_t>& counts, double p);
+
+private:
+    std::array<std::atomic<uint64_t>, NumBuckets> _buckets{};
+};
+
+/** Values of a `ThroughputStats`' counters at one point in time. */
+struct ThroughputSnapshot {
+    uint64_t bytes = 0;              /**< number of input bytes fed into parsing, excluding gaps */
+    uint64_t units = 0;              /**< number of units parsed completely */
+    uint64_t errors = 0;             /**< number of parse errors */
+    uint64_t resumes = 0;            /**< number of times the parser was started or resumed */
+    std::vector<uint64_t> latencies; /**< counts per `LatencyHistogram` bucket of the time each resume took */
+
+    /** Adds the counters of another snapshot to this one. */
+    ThroughputSnapshot& operator+=(const ThroughputSnapshot& other);
+
+    /** Returns the difference to an earlier snapshot of the same counters. */
+    ThroughputSnapshot operator-(const ThroughputSnapshot& other) const;
+
+    /** Returns a percentile of the resume latencies, in nanoseconds. */
+    uint64_t latency(double p) const { return LatencyHistogram::percentile(latencies, p); }
+};
+
+/**
+ * Counters tracking the throughput of a parser, updated by `ParsingState`
+ * when set through `ParsingState::setThroughputStats()`. Updates use
+ * relaxed atomic operations, so that states running on different threads
+ * can share the same counters.
+ */
+class ThroughputStats {
+public:
+    /** Records input fed into parsing. */
+    void recordInput(uint64_t bytes) { _bytes.fetch_add(bytes, std::memory_order_relaxed); }
+
+    /** Records one start or resume of a parser, along with the time it took. */
+    void recordResume(uint64_t ns) {
+        _resumes.fetch_add(1, std::memory_order_relaxed);
+        _latencies.record(ns);
+    }
+
+    /** Records a unit parsed completely. */
+    void recordUnit() { _units.fetch_add(1, std::memory_order_relaxed); }
+
+    /** Records a parse error. */
+    void recordError() { _errors.fetch_add(1, std::memory_order_relaxed); }
+
+    /** Returns the current values of all counters. */
+    ThroughputSnapshot snapshot() const;
+
+private:
+    std::atomic<uint64_t> _bytes = 0;
+    std::atomic<uint64_t> _units = 0;
+    std::atomic<uint64_t> _errors = 0;
+    std::atomic<uint64_t> _resumes = 0;
+    LatencyHistogram _latencies;
+};
+
+/**
+ * Limits on the state a `Driver` keeps for the flows of batch or pcap
+ * input, so that processing input with flows that never end stays within
+ * a fixed memory budget. If a limit is exceeded, the driver evicts flows:
+ * it either finishes their parsing as if their input had ended, or skips
+ * their remaining input, and then releases their state. A value of zero
+ * means no limit. With worker threads, the limits on the number of flows
+ * and on the total bytes get divided evenly across the threads.
+ */
+struct FlowLimits {
+    /** Max. number of concurrent flows; if exceeded, the least recently active flow gets evicted. */
+    uint64_t max_flows = 0;
+
+    /** Max. number of input bytes buffered by any single flow; if exceeded, that flow gets evicted. */
+    uint64_t max_flow_bytes = 0;
+
+    /** Max. number of input bytes buffered by all flows; if exceeded, the least recently active flows get evicted. */
+    uint64_t max_total_bytes = 0;
+
+    /**
+     * Seconds of capture time after which the connection of a flow
+     * without further input ends, evicting its flows. Supported only for
+     * pcap input.
+     */
+    double idle_timeout = 0;
+
+    /** If true, evicted flows skip their remaining input instead of finishing their parsing. */
+    bool skip_evicted = false;
+
+    /** Returns true if any limit is set. */
+    bool any() const { return max_flows || max_flow_bytes || max_total_bytes || idle_timeout > 0; }
+};
+
+/** Numbers of flows evicted because of the individual `FlowLimits`. */
+struct FlowEvictions {
+    uint64_t max_flows = 0;       /**< flows evicted because of `FlowLimits::max_flows` */
+    uint64_t max_flow_bytes = 0;  /**< flows evicted because of `FlowLimits::max_flow_bytes` */
+    uint64_t max_total_bytes = 0; /**< flows evicted because of `FlowLimits::max_total_bytes` */
+    uint64_t idle = 0;            /**< flows evicted because of `FlowLimits::idle_timeout` */
+
+    /** Returns the total number of flows evicted. */
+    uint64_t total() const { return max_flows + max_flow_bytes + max_total_bytes + idle; }
+};
+
 /**
  * Abstract base class maintaining the parsing state during incremental input
  * processing.
@@ -79,6 +230,21 @@ public:
     /** Returns true if `skipRemaining()` has been called previously. */
     bool isSkipping() const { return _skip; }
 
+    /**
+     * Sets counters to record throughput statistics into while parsing.
+     * Without counters set, no statistics are collected.
+     *
+     * @param stats counters to update, or null to stop collecting; must
+     * remain valid as long as the state is being used
+     */
+    void setThroughputStats(ThroughputStats* stats) { _stats = stats; }
+
+    /**
+     * Returns the number of input bytes that stream-based parsing currently
+     * holds on to, which includes data not yet consumed by the parser.
+     */
+    uint64_t bufferedBytes() const { return _input ? (*_input)->size().Ref() : 0; }
+
     /** Helper type for capturing return value of `process()`. */
     enum State {
         Done,    /**< parsing has fully finished */
@@ -101,6 +267,20 @@ public:
      */
     State process(size_t size, const char* data) { return _process(size, data, false); }
 
+    /**
+     * Feeds one chunk of data into parsing like `process(size, data)`, but
+     * takes over the memory of the data instead of copying it into the
+     * parser's input.
+     *
+     * @param data data to feed into parsing; will be moved from
+     * @returns Returns `State` indicating if parsing remains ongoing or has finished.
+     * @throws any exceptions (including in particular parse errors) are
+     * passed through to caller
+     */
+    State process(std::vector<hilti::rt::stream::Byte>&& data) {
+        return _process(data.size(), reinterpret_cast<const char*>(data.data()), false, &data);
+    }
+
     /**
      * Finalizes parsing, signaling end-of-data to the parser. After calling
      * this, `process()` can no longer be called.
@@ -136,12 +316,14 @@ protected:
     void debug(const std::string& msg, size_t size, const char* data);
 
 private:
-    State _process(size_t size, const char* data, bool eod = true);
+    // If `owned` is given, it holds `data` and may be moved into the input stream.
+    State _process(size_t size, const char* data, bool eod = true, std::vector<hilti::rt::stream::Byte>* owned = nullptr);
 
     ParsingType _type;                   /**< type of parsing */
     const Parser* _parser;               /**< parser to use, or null if not specified */
     bool _skip = false;                  /**< true if all further input is to be skipped */
     std::optional<UnitContext> _context; /** context to make available to parsing unit */
+    ThroughputStats* _stats = nullptr;   /**< counters to record statistics into, if any */
 
     // State for stream matching only
     bool _done = false; /**< flag to indicate that stream matching has completed (either regularly or irregularly) */
@@ -187,6 +369,10 @@ private:
     Driver* _driver;
 };
 
+namespace detail {
+class BatchState;
+} // namespace detail
+
 /** Connection state collecting parsing state for the two side. */
 struct ConnectionState {
     std::string orig_id;
@@ -195,6 +381,127 @@ struct ConnectionState {
     ParsingStateForDriver* resp_state = nullptr;
 };
 
+/**
+ * Definitions for the binary v3 batch format. See the documentation of
+ * `spicy-driver` for a description of the format.
+ */
+namespace batch {
+
+/** Magic line starting a batch in the line-based v2 format. */
+inline constexpr std::string_view MagicV2 = "!spicy-batch v2";
+
+/** Magic line starting a batch in the binary v3 format. */
+inline constexpr std::string_view MagicV3 = "!spicy-batch v3";
+
+/** Magic value terminating a v3 batch that comes with an index. */
+inline constexpr std::string_view IndexMagic = "spcyidx3";
+
+/** Types of records in a v3 batch. */
+enum class RecordType : uint8_t {
+    BeginFlow = 1,
+    BeginConnection = 2,
+    Data = 3,
+    Gap = 4,
+    EndFlow = 5,
+    EndConnection = 6,
+    Index = 7,
+};
+
+/** Size of a v3 record header: type (1 byte), ID (4 bytes), length of the body (4 bytes). */
+inline constexpr size_t RecordHeaderSize = 9;
+
+/** Size of a v3 index entry: record type (1 byte), ID (4 bytes), offset of the record (8 bytes). */
+inline constexpr size_t IndexEntrySize = 13;
+
+/** Size of the trailer following a v3 index: offset of the index record (8 bytes), `IndexMagic`. */
+inline constexpr size_t TrailerSize = 16;
+
+/** Entry of a v3 batch's index, locating a record that begins a flow or connection. */
+struct IndexEntry {
+    RecordType type; /**< type of the record, either `BeginFlow` or `BeginConnection` */
+    uint32_t id;     /**< ID of the flow or connection */
+    uint64_t offset; /**< offset of the record from the start of the batch */
+};
+
+/**
+ * Reads the next record from a batch in the binary v3 format.
+ *
+ * @param in stream positioned at the start of a record
+ * @param type receives the record's type
+ * @param id receives the record's ID
+ * @param body receives the record's body; passing the same string
+ * repeatedly reuses its memory
+ * @return true if a record was read, false at the end of the batch's
+ * records, which is either the end of input or the start of its index
+ */
+hilti::rt::Result<bool> readRecord(std::istream& in, RecordType* type, uint32_t* id, std::string* body);
+
+/**
+ * Reads the index of a batch in the binary v3 format, locating it through
+ * the batch's trailer. This requires a seekable stream, and leaves the
+ * stream's position undefined.
+ *
+ * @param in stream to read the batch from
+ * @return the index's entries, or an error if the batch doesn't come with an index
+ */
+hilti::rt::Result<std::vector<IndexEntry>> readIndex(std::istream& in);
+
+/**
+ * Writes a batch in the binary v3 format. All integers are written in
+ * little-endian byte order.
+ */
+class WriterV3 {
+public:
+    /**
+     * Constructor. Writes the batch's magic line.
+     *
+     * @param out stream to write the batch to
+     */
+    WriterV3(std::ostream& out);
+
+    /** Writes a record beginning a new flow. */
+    void beginFlow(uint32_t id, ParsingType type, std::string_view parser);
+
+    /** Writes a record beginning a new connection along with its two flows. */
+    void beginConnection(uint32_t cid, ParsingType type, uint32_t orig_id, std::string_view orig_parser,
+                         uint32_t resp_id, std::string_view resp_parser);
+
+    /** Writes a record with the next chunk of data for a flow. */
+    void data(uint32_t id, const char* data, size_t size);
+
+    /** Writes a record signaling a gap in the data of a flow. */
+    void gap(uint32_t id, uint64_t size);
+
+    /** Writes a record ending a flow. */
+    void endFlow(uint32_t id);
+
+    /** Writes a record ending a connection. */
+    void endConnection(uint32_t cid);
+
+    /**
+     * Writes a record with an already encoded body, such as one returned
+     * by `readRecord()`. The record must not be an index.
+     */
+    void record(RecordType type, uint32_t id, std::string_view body);
+
+    /**
+     * Terminates the batch by writing an index of all the begin records
+     * written, followed by the trailer pointing to the index. No further
+     * records may be written after this.
+     */
+    void finish();
+
+private:
+    void _record(RecordType type, uint32_t id, std::string_view body);
+
+    std::ostream& _out;
+    uint64_t _offset = 0;
+    std::string _index; // encoded index entries collected so far
+    std::string _body;  // buffer for assembling record bodies
+};
+
+} // namespace batch
+
 } // namespace driver
 
 /** Exception thrown when a unit type is requested for parsing that isn't useable. */
@@ -209,7 +516,14 @@ HILTI_EXCEPTION(InvalidUnitType, UsageError);
  */
 class Driver {
 public:
-    Driver() {}
+    Driver();
+    ~Driver();
+
+    Driver(const Driver&) = delete;
+    Driver(Driver&&) = delete;
+    Driver& operator=(const Driver&) = delete;
+    Driver& operator=(Driver&&) = delete;
+
     /**
      * Prints a human-readable list of all available parsers, retrieved from
      * the Spicy runtime system.
@@ -247,23 +561,112 @@ public:
 
     /**
      * Processes a batch of input data given in Spicy's custom batch
-     * format. See the documentation of `spicy-driver` for a reference of the
-     * batch format.
+     * format, either in the line-based v2 or the binary v3 version. See the
+     * documentation of `spicy-driver` for a reference of the batch format.
+     *
+     * With worker threads, flows are distributed across the threads by
+     * their IDs, with both flows of a connection going to the same thread.
+     * The output of each flow and connection is then recorded separately
+     * and emitted in the order the flows and connections were created,
+     * making it independent of the number of threads. Parsers using globals
+     * must have been compiled with dynamic globals enabled to be processed
+     * by worker threads; otherwise, this returns an error before processing
+     * any input.
      *
      * @param in an open stream to read the batch from
+     * @param threads number of worker threads to process flows in parallel;
+     * if zero or one, everything is processed on the calling thread, with
+     * output emitted as it is produced
      * @returns appropriate error if there was a problem processing the batch
      */
-    hilti::rt::Result<hilti::rt::Nothing> processPreBatchedInput(std::istream& in);
+    hilti::rt::Result<hilti::rt::Nothing> processPreBatchedInput(std::istream& in, unsigned int threads = 0);
+
+    /**
+     * Processes a packet trace in pcap or pcapng format, parsing the
+     * payload of its TCP and UDP connections. A connection's originator
+     * side gets parsed by the parser registered for the responder's port
+     * as `<port>%orig` (see `lookupParser()`), and its responder side by
+     * the one registered as `<port>%resp`. If there are parsers for both
+     * sides, they share a unit context; connections without any parser
+     * are ignored. TCP payload gets reassembled and parsed as a stream,
+     * UDP datagrams get parsed individually as blocks.
+     *
+     * @param in an open stream to read the trace from
+     * @returns appropriate error if there was a problem reading the trace
+     */
+    hilti::rt::Result<hilti::rt::Nothing> processPcapInput(std::istream& in);
+
+    /**
+     * Enables collecting statistics about parsing throughput for all input
+     * processed subsequently through the driver: input bytes, units parsed,
+     * parse errors, and latencies of starting or resuming parsers, per
+     * parser and overall. While processing input, the driver then reports
+     * the statistics for the most recent interval periodically; at the end,
+     * `reportThroughput()` reports the totals.
+     *
+     * @param out stream to write reports to; must remain valid as long as the driver is being used
+     * @param interval seconds between periodic reports; zero disables them
+     * @param json if true, write each report as a single line of JSON; otherwise in human-readable form
+     */
+    void enableThroughputReporting(std::ostream& out, double interval = 0, bool json = false);
+
+    /**
+     * Returns the throughput counters for a parser, creating them on first
+     * use. Hosts driving their own `ParsingState` instances can pass them to
+     * `ParsingState::setThroughputStats()` to have them included into the
+     * driver's reports. Thread-safe.
+     *
+     * @return the counters, or null if throughput reporting hasn't been enabled
+     */
+    driver::ThroughputStats* throughputStats(const Parser& parser);
+
+    /**
+     * Reports the throughput statistics collected since reporting was
+     * enabled. Does nothing if it hasn't been enabled.
+     */
+    void reportThroughput();
+
+    /**
+     * Sets limits on the state kept for flows by subsequent calls to
+     * `processPreBatchedInput()` and `processPcapInput()`.
+     */
+    void setFlowLimits(const driver::FlowLimits& limits) { _flow_limits = limits; }
+
+    /** Returns the limits set through `setFlowLimits()`. */
+    const auto& flowLimits() const { return _flow_limits; }
+
+    /** Returns the numbers of flows evicted so far because of the limits set through `setFlowLimits()`. */
+    driver::FlowEvictions flowEvictions() const;
 
     /** Records a debug message to the `spicy-driver` runtime debug stream. */
     void debug(const std::string& msg);
 
 private:
+    friend class driver::detail::BatchState;
+
+    struct Throughput;
+
+    // Reports interval statistics if due; to be called regularly while processing input.
+    void _tickThroughput() {
+        if ( _throughput )
+            _tickThroughputSlow();
+    }
+
+    void _tickThroughputSlow();
+    void _reportThroughput(bool final);
+
     void _debugStats(const hilti::rt::ValueReference<hilti::rt::Stream>& data);
     void _debugStats(size_t current_flows, size_t current_connections);
 
-    uint64_t _total_flows = 0;
-    uint64_t _total_connections = 0;
+    std::atomic<uint64_t> _total_flows = 0;
+    std::atomic<uint64_t> _total_connections = 0;
+    std::unique_ptr<Throughput> _throughput; // set if throughput reporting is enabled
+
+    driver::FlowLimits _flow_limits;
+    std::atomic<uint64_t> _evicted_max_flows = 0;
+    std::atomic<uint64_t> _evicted_max_flow_bytes = 0;
+    std::atomic<uint64_t> _evicted_max_total_bytes = 0;
+    std::atomic<uint64_t> _evicted_idle = 0;
 };
 
 } // namespace spicy::rt
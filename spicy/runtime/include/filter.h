@@ -2,6 +2,9 @@
 
 #pragma once
 
+#include <memory>
+#include <optional>
+#include <string>
 #include <utility>
 
 #include <hilti/rt/extension-points.h>
@@ -12,6 +15,41 @@
 #include <spicy/rt/typedefs.h>
 
 namespace spicy::rt::filter {
+
+/**
+ * Base class for filters implemented natively in C++. Native filters can be
+ * connected to units and sinks just like filter units, with the same
+ * semantics. However, they transform their input directly when new data
+ * arrives, without running a parser inside a fiber of their own.
+ */
+class Native {
+public:
+    virtual ~Native() = default;
+
+    /** Returns a name for the filter, used in debug output. */
+    virtual std::string name() const = 0;
+
+    /**
+     * Transforms a chunk of input. Each chunk will continue where the
+     * previous one left off. The filter must have consumed the input
+     * completely when returning, buffering internally anything it cannot
+     * transform yet.
+     *
+     * @param input next chunk of input; may span multiple blocks of data
+     * @param output stream to append transformed data to
+     */
+    virtual void process(const hilti::rt::stream::View& input,
+                         hilti::rt::Stream& output) = 0; // NOLINT(google-runtime-references)
+
+    /**
+     * Signals the end of input. The output stream will be frozen afterwards.
+     * The default implementation does nothing.
+     *
+     * @param output stream to append any final transformed data to
+     */
+    virtual void finish(hilti::rt::Stream& output) {} // NOLINT(google-runtime-references)
+};
+
 namespace detail {
 
 /** Checks whether a given struct type corresponds to a Spicy filter unit. */
@@ -31,10 +69,18 @@ struct OneFilter {
     OneFilter(Parse1Function _parse, hilti::rt::ValueReference<hilti::rt::Stream> _input,
               hilti::rt::Resumable _resumable)
         : parse(std::move(_parse)), input(std::move(_input)), resumable(std::move(_resumable)) {}
+    OneFilter(std::shared_ptr<Native> _native, hilti::rt::ValueReference<hilti::rt::Stream> _input)
+        : input(std::move(_input)), native(std::move(_native)) {}
 
     Parse1Function parse;
     hilti::rt::ValueReference<hilti::rt::Stream> input;
     hilti::rt::Resumable resumable;
+
+    // State for native filters, which leave `parse` and `resumable` unset.
+    std::shared_ptr<Native> native;
+    hilti::rt::StrongReference<hilti::rt::Stream> source; // stream the filter is reading from
+    std::optional<hilti::rt::stream::View> source_cur;   // input not processed yet
+    bool finished = false;                                // true once input has reached its end
 };
 
 /**
@@ -49,6 +95,33 @@ using Filters = hilti::rt::Vector<OneFilter>;
  */
 using Forward = hilti::rt::Stream;
 
+/**
+ * Lets a native filter transform any input that has become available
+ * since it last ran, and finishes it once its input has been frozen.
+ */
+inline void run(OneFilter* f) {
+    if ( f->finished )
+        return;
+
+    auto& cur = *f->source_cur;
+
+    if ( auto n = cur.size() ) {
+        f->native->process(cur, *f->input);
+        cur = cur.advance(n);
+
+        // Like filter units, we don't need to keep input that we've processed.
+        f->source->trim(cur.begin());
+    }
+
+    if ( cur.isFrozen() ) {
+        SPICY_RT_DEBUG_VERBOSE(
+            hilti::rt::fmt("- native filter %s is sending EOD to stream %p", f->native->name(), f->input.get()));
+        f->native->finish(*f->input);
+        f->input->freeze();
+        f->finished = true;
+    }
+}
+
 } // namespace detail
 
 /**
@@ -167,6 +240,32 @@ void connect(UnitType<U>& unit, UnitRef<F> filter_unit) {
     return connect(*unit, filter_unit);
 }
 
+/**
+ * Connects a native filter to a unit for transforming parsing. Like with
+ * filter units, this won't have an observable effect until `filter::init()`
+ * is executed (and must be called before that).
+ *
+ * @tparam S type compatible with the attribute's defined by the `State`
+ * type; this is target unit being connected to
+ *
+ * @param filter native filter doing the transformation
+ */
+template<typename S>
+void connect(S& state, std::shared_ptr<Native> filter) {
+    SPICY_RT_DEBUG_VERBOSE(hilti::rt::fmt("- connecting native filter %s [%p] to unit %s [%p]", filter->name(),
+                                          filter.get(), S::__parser.name, &state));
+
+    if ( ! state.__filters )
+        state.__filters = hilti::rt::reference::make_strong<::spicy::rt::filter::detail::Filters>();
+
+    (*state.__filters).push_back(detail::OneFilter(std::move(filter), hilti::rt::Stream()));
+}
+
+template<typename U>
+void connect(UnitType<U>& unit, std::shared_ptr<Native> filter) {
+    return connect(*unit, std::move(filter));
+}
+
 /**
  * Set up filtering for a unit if any filters have been connected. Must be
  * called before parsing starts.
@@ -187,7 +286,19 @@ hilti::rt::StrongReference<hilti::rt::Stream> init(
         SPICY_RT_DEBUG_VERBOSE(
             hilti::rt::fmt("- beginning to filter input for unit %s [%p]", S::__parser.name, &state));
 
-        if ( ! previous )
+        if ( f.native ) {
+            if ( ! previous ) {
+                f.source = hilti::rt::StrongReference<hilti::rt::Stream>(data);
+                f.source_cur = cur;
+            }
+            else {
+                f.source = hilti::rt::StrongReference<hilti::rt::Stream>(previous->input);
+                f.source_cur = previous->input->view();
+            }
+
+            detail::run(&f);
+        }
+        else if ( ! previous )
             f.resumable = f.parse(data, cur);
         else
             f.resumable = f.parse(previous->input, previous->input->view());
@@ -261,8 +372,12 @@ inline void forward_eod(UnitType<U>& unit) {
  * input stream.
  */
 inline void flush(hilti::rt::StrongReference<spicy::rt::filter::detail::Filters> filters) {
-    for ( auto& f : (*filters) )
-        f.resumable.resume();
+    for ( auto& f : (*filters) ) {
+        if ( f.native )
+            detail::run(&f);
+        else
+            f.resumable.resume();
+    }
 }
 
 /**
@@ -2,11 +2,14 @@
 
 #pragma once
 
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace spicy::rt {
@@ -22,6 +25,18 @@ struct Configuration;
 
 namespace spicy::rt::detail {
 
+/**
+ * Parsers that `Sink::connect_mime_type()` connects for one MIME type,
+ * including those registered for matching wildcards.
+ */
+struct MIMEDispatch {
+    /** Parsers to connect from a linker scope that has no parsers of its own. */
+    std::vector<const Parser*> public_parsers;
+
+    /** Parsers to connect, indexed by the linker scope asking for them. */
+    std::unordered_map<std::string, std::vector<const Parser*>> scoped_parsers;
+};
+
 /** Struct capturing all truly global runtime state. */
 struct GlobalState {
     GlobalState() = default;
@@ -55,6 +70,24 @@ struct GlobalState {
 
     /** Map of parsers by the MIME types they handle. */
     std::map<std::string, std::vector<const Parser*>> parsers_by_mime_type;
+
+    /**
+     * Parsers to connect to sinks for MIME types, indexed like
+     * `parsers_by_mime_type`. Computed once by `init()`.
+     */
+    std::unordered_map<std::string, MIMEDispatch> mime_dispatch;
+
+    /** Number of bytes currently buffered for reassembly by all sinks. */
+    std::atomic<uint64_t> sink_buffered = 0;
+
+    /** Number of times sinks skipped ahead because of their limits on buffered data. */
+    std::atomic<uint64_t> sink_limit_skips = 0;
+
+    /** Number of chunks of new data that sinks dropped because of their limits on buffered data. */
+    std::atomic<uint64_t> sink_limit_drops = 0;
+
+    /** Number of bytes that sinks dropped because of their limits on buffered data. */
+    std::atomic<uint64_t> sink_limit_dropped_bytes = 0;
 };
 
 /**
@@ -0,0 +1,317 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <hilti/rt/exception.h>
+#include <hilti/rt/ring-buffer.h>
+
+#include <spicy/rt/driver.h>
+#include <spicy/rt/parser.h>
+
+/**
+ * API for feeding parsers running on a dedicated thread from other threads,
+ * such as those capturing the input. Producers queue input for their flows
+ * into a `Worker` through lock-free queues; the worker owns the parsing
+ * state for all of its flows and processes the queued input in batches.
+ */
+namespace spicy::rt::ingestion {
+
+/** Host-chosen ID identifying a flow fed into a `Worker`. */
+using FlowHandle = uint64_t;
+
+/** One piece of input queued for a flow. */
+struct Input {
+    /** Type of input. */
+    enum class Type {
+        Begin, /**< starts a new flow, to be parsed with `parser` */
+        Data,  /**< next chunk of data for the flow */
+        Gap,   /**< gap in the flow's data of length `size` */
+        End    /**< end of data for the flow; finishes parsing and releases its state */
+    };
+
+    Type type = Type::Data;                                         /**< type of input */
+    FlowHandle flow = 0;                                            /**< flow that the input belongs to */
+    const Parser* parser = nullptr;                                 /**< for `Begin` */
+    driver::ParsingType parsing_type = driver::ParsingType::Stream; /**< for `Begin` */
+    std::string data;                                               /**< for `Data` */
+    size_t size = 0;                                                /**< for `Gap` */
+};
+
+/** Result of queuing input, signaling back-pressure to the producer. */
+enum class Status {
+    Ok,        /**< input has been queued */
+    Congested, /**< input has been queued, but the worker is falling behind and the producer should slow down */
+    Full,      /**< input has not been queued because the queue is full; producer must retry later or drop it */
+};
+
+/** Options controlling a `Worker`. */
+struct Options {
+    /** Number of producer threads, each receiving a separate queue. */
+    size_t num_producers = 1;
+
+    /** Minimum number of inputs each producer's queue can hold. */
+    size_t queue_size = 4096;
+
+    /** Fill level of a queue, relative to its size, at which `Status::Congested` gets reported. */
+    double congestion_threshold = 0.75;
+
+    /** Maximum number of inputs the worker takes from each queue at a time. */
+    size_t max_batch_size = 256;
+
+    /**
+     * Maximum number of flows a `Pool` keeps active at a time, with
+     * `congestion_threshold` applying accordingly; zero for no limit. Does
+     * not apply to a `Worker`, where beginning a flow queues input like
+     * anything else.
+     */
+    size_t max_flows = 0;
+
+    /**
+     * Callback executed on the worker's thread when parsing a flow fails
+     * with an exception. No further input will be parsed for that flow.
+     */
+    std::function<void(FlowHandle, const hilti::rt::Exception&)> on_error;
+};
+
+/** Statistics about a `Worker`'s operation. */
+struct Statistics {
+    uint64_t queued;    /**< number of inputs queued successfully */
+    uint64_t congested; /**< number of inputs queued while congested */
+    uint64_t rejected;  /**< number of inputs rejected because a queue was full */
+    uint64_t processed; /**< number of inputs processed by the worker */
+    uint64_t resumes;   /**< number of times parsers were fed data, after coalescing inputs */
+    uint64_t flows;     /**< number of flows currently active */
+    uint64_t steals;    /**< number of times a `Pool` thread took over a flow from another thread */
+};
+
+namespace detail {
+class FlowState;
+struct PoolFlow;
+struct PoolThread;
+} // namespace detail
+
+/**
+ * Parser worker processing input queued by one or more producer threads.
+ *
+ * Each producer must use a separate producer index, and input for any given
+ * flow must always come from the same producer. The worker processes all
+ * input of a flow in order. When it finds several chunks of data queued for
+ * the same stream-based flow, it passes them to the parser at once, so that
+ * the parser needs to resume only once for all of them.
+ *
+ * The worker processes its input either on a dedicated thread created
+ * through `start()`, or on a host-managed thread through calls to `poll()`.
+ * In the latter case, that thread must have a HILTI runtime context set up
+ * (see `hilti::rt::context::ThreadContext`), and the worker must be
+ * destroyed on that thread as well.
+ */
+class Worker {
+public:
+    /**
+     * Constructor.
+     *
+     * @param options options controlling the worker's operation
+     */
+    Worker(Options options = {});
+    ~Worker();
+
+    Worker(const Worker&) = delete;
+    Worker(Worker&&) = delete;
+    Worker& operator=(const Worker&) = delete;
+    Worker& operator=(Worker&&) = delete;
+
+    /**
+     * Queues input for processing. To be called by producers.
+     *
+     * @param input input to queue
+     * @param producer index of the calling producer, less than `Options::num_producers`
+     * @return status of the operation, signaling back-pressure
+     */
+    Status enqueue(Input input, size_t producer = 0);
+
+    /** Queues the beginning of a new flow. See `enqueue()`. */
+    Status begin(FlowHandle flow, const Parser* parser, driver::ParsingType type = driver::ParsingType::Stream,
+                 size_t producer = 0);
+
+    /** Queues a chunk of data for a flow, copying it. See `enqueue()`. */
+    Status data(FlowHandle flow, const char* data, size_t len, size_t producer = 0);
+
+    /** Queues a gap for a flow. See `enqueue()`. */
+    Status gap(FlowHandle flow, size_t size, size_t producer = 0);
+
+    /** Queues the end of a flow. See `enqueue()`. */
+    Status end(FlowHandle flow, size_t producer = 0);
+
+    /**
+     * Processes all input currently queued, up to `Options::max_batch_size`
+     * per queue. To be called by the consumer if it doesn't use `start()`.
+     *
+     * @return number of inputs processed
+     */
+    size_t poll();
+
+    /**
+     * Starts a dedicated thread that processes queued input continuously
+     * until `stop()` gets called.
+     *
+     * @throws UsageError if the worker has already been started
+     */
+    void start();
+
+    /**
+     * Stops the thread started through `start()` after it has processed all
+     * input queued so far. Flows remaining active are then released without
+     * finishing their parsing. Does nothing if the worker hasn't been
+     * started.
+     *
+     * @throws any exception that terminated the worker thread prematurely
+     */
+    void stop();
+
+    /** Returns statistics about the worker's operation so far. */
+    Statistics statistics() const;
+
+private:
+    void _processBatch();
+    void _feed(detail::FlowState* flow, size_t size, const char* data);
+    void _apply(Input& input);
+
+    Options _options;
+    size_t _congestion_level;
+    std::vector<std::unique_ptr<hilti::rt::SPSCRingBuffer<Input>>> _queues;
+
+    // State owned by the consumer.
+    std::unordered_map<FlowHandle, std::unique_ptr<detail::FlowState>> _flows;
+    std::vector<Input> _batch;
+    std::unordered_map<FlowHandle, std::string> _pending;
+    std::vector<FlowHandle> _pending_order;
+
+    std::thread _thread;
+    std::atomic<bool> _stopping = false;
+    std::exception_ptr _exception;
+
+    std::atomic<uint64_t> _queued = 0;
+    std::atomic<uint64_t> _congested = 0;
+    std::atomic<uint64_t> _rejected = 0;
+    std::atomic<uint64_t> _processed = 0;
+    std::atomic<uint64_t> _resumes = 0;
+    std::atomic<uint64_t> _num_flows = 0;
+};
+
+/**
+ * Pool of parser threads that balances flows between them. In contrast to
+ * a set of `Worker` instances, flows are not tied to a specific thread:
+ * once a flow has input queued, it becomes ready for processing by its
+ * current thread, and a thread running out of ready flows of its own steals
+ * ready flows from other threads, continuing their parsing where it left
+ * off. To make that possible, all threads use migratable fibers (see
+ * `hilti::rt::context::ThreadContext`). As a consequence, parsers should
+ * not rely on HILTI globals retaining state across chunks of input, as
+ * each thread has its own set.
+ *
+ * Any thread may queue input, but input for any given flow must come from
+ * only one thread at a time. Beginning a flow with the handle of a flow
+ * still active ends that previous flow. Of the `Options`, `queue_size` limits the
+ * number of inputs pending per flow, `max_batch_size` the number of
+ * inputs processed for a flow before a thread moves on to the next one, and
+ * `max_flows` the number of flows active at a time; `num_producers` does
+ * not apply. The `on_error` callback may be executed
+ * concurrently by different threads.
+ */
+class Pool {
+public:
+    /**
+     * Constructor.
+     *
+     * @param threads number of parser threads to run
+     * @param options options controlling the pool's operation
+     */
+    Pool(unsigned int threads, Options options = {});
+    ~Pool();
+
+    Pool(const Pool&) = delete;
+    Pool(Pool&&) = delete;
+    Pool& operator=(const Pool&) = delete;
+    Pool& operator=(Pool&&) = delete;
+
+    /**
+     * Queues the beginning of a new flow. With `Options::max_flows` set,
+     * new flows beyond that limit get rejected; beginning a flow with the
+     * handle of a flow still active always succeeds.
+     *
+     * @return status of the operation, signaling back-pressure
+     */
+    Status begin(FlowHandle flow, const Parser* parser, driver::ParsingType type = driver::ParsingType::Stream);
+
+    /** Queues a chunk of data for a flow, copying it. See `begin()`. */
+    Status data(FlowHandle flow, const char* data, size_t len);
+
+    /** Queues a gap for a flow. See `begin()`. */
+    Status gap(FlowHandle flow, size_t size);
+
+    /** Queues the end of a flow. See `begin()`. */
+    Status end(FlowHandle flow);
+
+    /**
+     * Starts the parser threads.
+     *
+     * @throws UsageError if the pool has already been started
+     */
+    void start();
+
+    /**
+     * Stops the parser threads after they have processed all input queued
+     * so far. Flows remaining active are then released without finishing
+     * their parsing, each by the thread that processed it last, before
+     * that thread exits. Only if a thread terminated prematurely, its
+     * flows get released on the calling thread, which then needs a HILTI
+     * runtime context. Does nothing if the pool hasn't been started.
+     *
+     * @throws any exception that terminated a parser thread prematurely
+     */
+    void stop();
+
+    /** Returns statistics about the pool's operation so far. */
+    Statistics statistics() const;
+
+private:
+    Status _enqueue(const std::shared_ptr<detail::PoolFlow>& flow, Input input, bool force = false);
+    void _schedule(const std::shared_ptr<detail::PoolFlow>& flow, size_t thread);
+    std::shared_ptr<detail::PoolFlow> _next(size_t thread);
+    void _run(size_t thread);
+    void _release(size_t thread);
+    void _process(const std::shared_ptr<detail::PoolFlow>& flow, size_t thread);
+    void _feed(detail::PoolFlow* flow, size_t size, const char* data);
+
+    Options _options;
+    size_t _congestion_level;
+    size_t _flows_congestion_level;
+    std::vector<std::unique_ptr<detail::PoolThread>> _threads;
+
+    std::mutex _flows_mutex; // protects `_flows`
+    std::unordered_map<FlowHandle, std::shared_ptr<detail::PoolFlow>> _flows;
+
+    std::atomic<bool> _stopping = false;
+    std::atomic<size_t> _drained = 0; // number of threads done processing input after `stop()`
+
+    std::atomic<uint64_t> _queued = 0;
+    std::atomic<uint64_t> _congested = 0;
+    std::atomic<uint64_t> _rejected = 0;
+    std::atomic<uint64_t> _processed = 0;
+    std::atomic<uint64_t> _resumes = 0;
+    std::atomic<uint64_t> _num_flows = 0;
+    std::atomic<uint64_t> _steals = 0;
+};
+
+} // namespace spicy::rt::ingestion
@@ -12,11 +12,15 @@
 #include <spicy/rt/filter.h>
 #include <spicy/rt/global-state.h>
 #include <spicy/rt/hilti-fwd.h>
+#include <spicy/rt/ingestion.h>
 #include <spicy/rt/init.h>
+#include <spicy/rt/lz4_.h>
 #include <spicy/rt/mime.h>
 #include <spicy/rt/parsed-unit.h>
 #include <spicy/rt/parser.h>
+#include <spicy/rt/pcap.h>
 #include <spicy/rt/sink.h>
 #include <spicy/rt/typedefs.h>
 #include <spicy/rt/util.h>
 #include <spicy/rt/zlib_.h>
+#include <spicy/rt/zstd_.h>
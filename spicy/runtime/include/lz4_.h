@@ -0,0 +1,163 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <hilti/rt/types/bytes.h>
+#include <hilti/rt/types/stream.h>
+
+#include <spicy/rt/filter.h>
+
+namespace spicy::rt::lz4 {
+
+namespace detail {
+struct State;
+} // namespace detail
+
+/** Thrown when something goes wrong with uncompressing. */
+class LZ4Error : public hilti::rt::RuntimeError {
+    using hilti::rt::RuntimeError::RuntimeError;
+};
+
+/**
+ * State for streaming decompression of the LZ4 frame format. The stream
+ * accepts any number of consecutive frames, including skippable frames.
+ *
+ * LZ4 support is optional at build time; if it is missing, creating a
+ * stream throws an `LZ4Error`.
+ */
+class Stream {
+public:
+    /** Constructor initializing a new stream for decompression. */
+    Stream();
+    ~Stream();
+
+    Stream(const Stream&) = default;
+    Stream(Stream&&) noexcept = default;
+    Stream& operator=(const Stream&) = default;
+    Stream& operator=(Stream&&) noexcept = default;
+
+    /**
+     * Sets limits on the amount of data the stream decompresses, replacing
+     * the defaults from the runtime configuration. Once a limit is
+     * exceeded, decompression aborts with an `LZ4Error`.
+     *
+     * @param max_output maximum number of bytes to decompress in total; zero means no limit
+     * @param max_ratio maximum ratio of decompressed to compressed bytes; zero means no limit
+     */
+    void setLimits(uint64_t max_output, uint64_t max_ratio);
+
+    /**
+     * Decompresses a chunk of data. Each chunk will continue where the
+     * previous one left off.
+     *
+     * @param data next chunk of data to decompress
+     * @return newly decompressed data
+     */
+    hilti::rt::Bytes decompress(const hilti::rt::Bytes& data);
+
+    /**
+     * Decompresses a chunk of data. Each chunk will continue where the
+     * previous one left off.
+     *
+     * @param data next chunk of data to decompress
+     * @return newly decompressed data
+     */
+    hilti::rt::Bytes decompress(const hilti::rt::stream::View& data);
+
+    /**
+     * Decompresses a chunk of data, appending the result directly to a
+     * stream. Each chunk will continue where the previous one left off.
+     *
+     * @param output stream to append newly decompressed data to
+     * @param data next chunk of data to decompress
+     */
+    void decompress(hilti::rt::Stream& output, const hilti::rt::Bytes& data);
+
+    /**
+     * Decompresses a chunk of data, appending the result directly to a
+     * stream. Each chunk will continue where the previous one left off.
+     *
+     * @param output stream to append newly decompressed data to
+     * @param data next chunk of data to decompress
+     */
+    void decompress(hilti::rt::Stream& output, const hilti::rt::stream::View& data);
+
+    /**
+     * Signals the end of decompression. Throws an `LZ4Error` if the stream
+     * has received input that did not end with a complete frame.
+     *
+     * @return any additional data becoming available at the end of the process
+     */
+    hilti::rt::Bytes finish();
+
+private:
+    template<typename Buffer>
+    void _decompress(Buffer* out, const hilti::rt::stream::View& data);
+
+    template<typename Buffer>
+    void _decompress(Buffer* out, const hilti::rt::Bytes& data);
+
+    std::shared_ptr<detail::State> _state;
+};
+
+/**
+ * Native filter performing LZ4 decompression, corresponding to the Spicy
+ * filter unit `filter::LZ4`.
+ */
+class Filter : public filter::Native {
+public:
+    /** Returns the underlying decompression stream, e.g., for setting limits. */
+    Stream& stream() { return _stream; }
+
+    std::string name() const override { return "lz4"; }
+
+    void process(const hilti::rt::stream::View& input,
+                 hilti::rt::Stream& output) override { // NOLINT(google-runtime-references)
+        _stream.decompress(output, input);
+    }
+
+    void finish(hilti::rt::Stream& output) override { // NOLINT(google-runtime-references)
+        _stream.finish();
+    }
+
+private:
+    Stream _stream;
+};
+
+/** Returns true if the runtime library has been built with LZ4 support. */
+extern bool available();
+
+/** Forwards to the corresponding `Stream` method. */
+inline void set_limits(Stream& stream, // NOLINT(google-runtime-references)
+                       uint64_t max_output, uint64_t max_ratio) {
+    stream.setLimits(max_output, max_ratio);
+}
+
+/** Forwards to the corresponding `Stream` method. */
+inline hilti::rt::Bytes decompress(Stream& stream, // NOLINT(google-runtime-references)
+                                   const hilti::rt::Bytes& data) {
+    return stream.decompress(data);
+}
+
+/** Forwards to the corresponding `Stream` method. */
+inline hilti::rt::Bytes decompress(Stream& stream, // NOLINT(google-runtime-references)
+                                   const hilti::rt::stream::View& data) {
+    return stream.decompress(data);
+}
+
+/** Forwards to the corresponding `Stream` method. */
+inline hilti::rt::Bytes finish(Stream& stream) // NOLINT(google-runtime-references)
+{
+    return stream.finish();
+}
+
+} // namespace spicy::rt::lz4
+
+namespace hilti::rt::detail::adl {
+extern inline std::string to_string(const spicy::rt::lz4::Stream& /* x */, adl::tag /*unused*/) {
+    return "<lz4 stream>";
+}
+} // namespace hilti::rt::detail::adl
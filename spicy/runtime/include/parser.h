@@ -472,6 +472,32 @@ extern void waitForInput(hilti::rt::ValueReference<hilti::rt::Stream>& data, //
 extern bool atEod(hilti::rt::ValueReference<hilti::rt::Stream>& data, const hilti::rt::stream::View& cur,
                   const hilti::rt::StrongReference<spicy::rt::filter::detail::Filters>& filters);
 
+/**
+ * Used by generated parsers to skip input without buffering it. Lets the
+ * input stream discard any data arriving for the given number of bytes
+ * following the beginning of the current view. Hosts won't need to resume
+ * parsing until the stream has caught up with the end of that range.
+ *
+ * @param data current input data
+ * @param cur view of *data* that's being parsed
+ * @param n number of bytes to discard, counting from the beginning of *cur*
+ */
+extern void discardInput(hilti::rt::ValueReference<hilti::rt::Stream>& data, // NOLINT(google-runtime-references)
+                         const hilti::rt::stream::View& cur, uint64_t n);
+
+/**
+ * Used by generated parsers of units storing views into their input to keep
+ * that input from being trimmed. The returned pin keeps all data from the
+ * beginning of *cur* on in place for as long as it exists, so that the views
+ * remain valid while the unit instance holding the pin is alive.
+ *
+ * @param cur view of the input starting at the unit's first byte
+ * @return pin to store with the unit instance
+ */
+inline hilti::rt::stream::Pin pinInput(const hilti::rt::stream::View& cur) {
+    return hilti::rt::stream::Pin(cur.begin());
+}
+
 /**
  * Manually trigger a backtrack operation, reverting back to the most revent &try.
  */
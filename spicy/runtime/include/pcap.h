@@ -0,0 +1,292 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <hilti/rt/result.h>
+#include <hilti/rt/types/address.h>
+#include <hilti/rt/types/port.h>
+#include <hilti/rt/types/stream.h>
+
+/**
+ * Built-in support for processing packet traces in pcap and pcapng format:
+ * reading packets, decoding their IPv4/IPv6 and TCP/UDP headers, and
+ * tracking connections with TCP stream reassembly. This is what
+ * `spicy-driver` uses to feed parsers directly from traces; it does not
+ * depend on libpcap.
+ */
+namespace spicy::rt::pcap {
+
+using Byte = hilti::rt::stream::Byte;
+
+/** Link-layer types supported for decoding, with their values from the pcap specification. */
+namespace link_type {
+constexpr uint32_t Null = 0;        /**< BSD loopback encapsulation */
+constexpr uint32_t Ethernet = 1;    /**< Ethernet, optionally with VLAN tags */
+constexpr uint32_t Raw = 101;       /**< raw IPv4 or IPv6 */
+constexpr uint32_t LinuxSLL = 113;  /**< Linux cooked capture */
+constexpr uint32_t IPv4 = 228;      /**< raw IPv4 */
+constexpr uint32_t IPv6 = 229;      /**< raw IPv6 */
+constexpr uint32_t LinuxSLL2 = 276; /**< Linux cooked capture v2 */
+} // namespace link_type
+
+/** A packet read from a trace. */
+struct Packet {
+    double time = 0;            /**< capture time in seconds since the epoch */
+    uint32_t link_type = 0;     /**< link-layer type of the packet's data */
+    const Byte* data = nullptr; /**< captured data; remains valid only until the next packet is read */
+    size_t size = 0;            /**< length of captured data */
+};
+
+/**
+ * Reads packets from a trace in either pcap or pcapng format, detecting
+ * the format and byte order automatically.
+ */
+class Reader {
+public:
+    /**
+     * Constructor.
+     *
+     * @param in stream to read the trace from; must remain valid while the reader is used
+     */
+    explicit Reader(std::istream& in) : _in(in) {}
+
+    /** Reads the trace's file header. Must be called before reading any packets. */
+    hilti::rt::Result<hilti::rt::Nothing> open();
+
+    /**
+     * Reads the next packet from the trace, skipping any pcapng blocks that
+     * don't carry packets.
+     *
+     * @param packet packet to fill in
+     * @return true if a packet was read, false at the end of the trace
+     */
+    hilti::rt::Result<bool> next(Packet* packet);
+
+private:
+    struct Interface {
+        uint32_t link_type;
+        double time_unit; // seconds per timestamp unit
+    };
+
+    hilti::rt::Result<bool> _nextPcap(Packet* packet);
+    hilti::rt::Result<bool> _nextPcapNG(Packet* packet);
+    hilti::rt::Result<hilti::rt::Nothing> _readSectionHeader(std::array<Byte, 4> length);
+    hilti::rt::Result<hilti::rt::Nothing> _parseInterface();
+    bool _read(size_t size);
+    uint16_t _u16(size_t offset) const;
+    uint32_t _u32(size_t offset) const;
+
+    std::istream& _in;
+    enum class Format { Unknown, Pcap, PcapNG } _format = Format::Unknown;
+    bool _big_endian = false;
+    double _time_unit = 1e-6;           // for pcap
+    uint32_t _link_type = 0;            // for pcap
+    std::vector<Interface> _interfaces; // for pcapng, of the current section
+    std::vector<Byte> _buffer;          // current record or block
+};
+
+/** Flags of a TCP segment. */
+namespace tcp {
+constexpr uint8_t FIN = 0x01;
+constexpr uint8_t SYN = 0x02;
+constexpr uint8_t RST = 0x04;
+constexpr uint8_t ACK = 0x10;
+} // namespace tcp
+
+/** A TCP segment or UDP datagram decoded from a packet. */
+struct Segment {
+    hilti::rt::Address src;        /**< source address */
+    hilti::rt::Address dst;        /**< destination address */
+    hilti::rt::Port src_port;      /**< source port, including the transport protocol */
+    hilti::rt::Port dst_port;      /**< destination port, including the transport protocol */
+    double time = 0;               /**< capture time of the packet carrying the segment */
+    uint32_t seq = 0;              /**< TCP sequence number */
+    uint8_t flags = 0;             /**< TCP flags */
+    const Byte* payload = nullptr; /**< payload, pointing into the packet's data */
+    size_t size = 0;               /**< length of payload */
+};
+
+/**
+ * Decodes a packet's link-layer, network-layer, and transport-layer
+ * headers. IP fragments are not reassembled, but skipped.
+ *
+ * @param packet packet to decode
+ * @param segment segment to fill in; its payload will point into the packet's data
+ * @return true if the packet carries a TCP segment or UDP datagram that
+ * could be decoded, false if it's anything else or truncated
+ */
+bool decode(const Packet& packet, Segment* segment);
+
+/**
+ * Reassembles one direction of a TCP connection into the in-order byte
+ * stream, following the approach of `spicy::rt::Sink`: data arriving in
+ * order gets delivered right away, data arriving ahead of a hole is
+ * buffered until the hole is filled, and overlaps with data seen already
+ * are trimmed. If the data buffered exceeds a limit, or at the end of the
+ * connection, remaining holes are reported as gaps so that the data after
+ * them can be delivered.
+ */
+class Reassembler {
+public:
+    /** Callback receiving the next chunk of in-order data; may move from it. */
+    using DataCallback = std::function<void(std::vector<Byte>&& data)>;
+
+    /** Callback receiving the length of a hole skipped in the stream. */
+    using GapCallback = std::function<void(uint64_t size)>;
+
+    /**
+     * Constructor.
+     *
+     * @param on_data callback receiving in-order data
+     * @param on_gap callback receiving gaps
+     * @param max_buffered maximum number of bytes to buffer ahead of a hole
+     */
+    Reassembler(DataCallback on_data, GapCallback on_gap, size_t max_buffered = 1024 * 1024)
+        : _on_data(std::move(on_data)), _on_gap(std::move(on_gap)), _max_buffered(max_buffered) {}
+
+    /**
+     * Adds a segment's payload to the stream.
+     *
+     * @param seq sequence number of the first byte of the payload; the
+     * first call determines the stream's initial sequence number
+     * @param data payload
+     * @param size length of payload
+     */
+    void add(uint32_t seq, const Byte* data, size_t size);
+
+    /** Reports any remaining holes as gaps and delivers all data buffered. */
+    void flush();
+
+    /** Returns the number of bytes delivered or skipped as gaps so far. */
+    uint64_t offset() const { return _offset; }
+
+    /** Returns the number of bytes currently buffered ahead of a hole. */
+    size_t buffered() const { return _buffered; }
+
+private:
+    void _deliver();
+    void _skipHole();
+
+    DataCallback _on_data;
+    GapCallback _on_gap;
+    size_t _max_buffered;
+
+    bool _initialized = false;
+    uint32_t _initial_seq = 0;
+    uint64_t _offset = 0;                                // next stream offset to deliver
+    std::map<uint64_t, std::vector<Byte>> _out_of_order; // buffered segments, by stream offset
+    size_t _buffered = 0;                                // total size of `_out_of_order`
+};
+
+/** A TCP or UDP connection tracked by a `ConnectionTable`. */
+struct Connection {
+    uint64_t id = 0;           /**< sequential ID, unique within the table */
+    hilti::rt::Address orig;   /**< originator's address */
+    hilti::rt::Port orig_port; /**< originator's port */
+    hilti::rt::Address resp;   /**< responder's address */
+    hilti::rt::Port resp_port; /**< responder's port, which also determines the connection's protocol */
+    bool active = true;        /**< if false, the connection's payload is not of interest */
+    double last_seen = 0;      /**< capture time of the connection's most recent segment */
+    bool expired = false;      /**< true if the connection ends because it has been idle for too long */
+
+    /** Returns a textual ID for the connection, such as `10.0.0.1:1234-10.0.0.2:80/tcp`. */
+    std::string str() const;
+
+    // State for TCP.
+    std::unique_ptr<Reassembler> orig_stream;
+    std::unique_ptr<Reassembler> resp_stream;
+    bool orig_fin = false;
+    bool resp_fin = false;
+};
+
+/**
+ * Tracks the TCP and UDP connections that segments belong to, passing
+ * their payload on through callbacks. The originator of a connection is
+ * the side sending its first segment, unless that segment acknowledges a
+ * SYN. TCP payload gets reassembled; UDP datagrams are passed on
+ * individually. TCP connections end once both sides have closed them or
+ * either side has reset them, or once they have been idle for longer than
+ * an optional timeout; all others end with `finish()`.
+ */
+class ConnectionTable {
+public:
+    /** Callbacks receiving a connection's events. */
+    struct Callbacks {
+        /**
+         * Called when a new connection begins, before any of its data. If
+         * the callback sets the connection's `active` field to false,
+         * there will be no further callbacks for it.
+         */
+        std::function<void(Connection& conn)> begin;
+
+        /** Called with the next chunk of a side's payload; the callback may move from it. */
+        std::function<void(Connection& conn, bool is_orig, std::vector<Byte>&& data)> data;
+
+        /** Called for a hole in a side's TCP payload that will not be filled. */
+        std::function<void(Connection& conn, bool is_orig, uint64_t size)> gap;
+
+        /** Called when a connection ends. */
+        std::function<void(Connection& conn)> end;
+    };
+
+    /**
+     * Constructor.
+     *
+     * @param callbacks callbacks receiving the connections' events
+     * @param idle_timeout if non-zero, seconds of capture time after which
+     * connections without further segments end
+     */
+    explicit ConnectionTable(Callbacks callbacks, double idle_timeout = 0)
+        : _callbacks(std::move(callbacks)), _idle_timeout(idle_timeout) {}
+
+    ConnectionTable(const ConnectionTable&) = delete;
+    ConnectionTable(ConnectionTable&&) = delete;
+    ConnectionTable& operator=(const ConnectionTable&) = delete;
+    ConnectionTable& operator=(ConnectionTable&&) = delete;
+
+    /**
+     * Processes a segment, creating its connection if necessary. Before
+     * that, ends any connections that have become idle as of the segment's
+     * time.
+     */
+    void process(const Segment& segment);
+
+    /** Ends all remaining connections, in the order they began. */
+    void finish();
+
+    /** Returns the number of connections currently tracked. */
+    size_t size() const { return _connections.size(); }
+
+private:
+    using Endpoint = std::pair<hilti::rt::Address, hilti::rt::Port>;
+    using Key = std::pair<Endpoint, Endpoint>; // ordered so that the smaller endpoint comes first
+
+    // Pending check whether a connection has become idle.
+    struct IdleCheck {
+        double last_seen; // connection's last time seen when queued
+        Key key;
+        uint64_t id; // to recognize if the connection has been replaced in the meantime
+    };
+
+    void _end(std::map<Key, std::unique_ptr<Connection>>::iterator i);
+    void _expire(double now);
+
+    Callbacks _callbacks;
+    double _idle_timeout;
+    std::map<Key, std::unique_ptr<Connection>> _connections;
+    std::deque<IdleCheck> _idle_checks; // in order of time, as long as packet times are
+    uint64_t _next_id = 0;
+};
+
+} // namespace spicy::rt::pcap
@@ -2,7 +2,9 @@
 
 #pragma once
 
-#include <list>
+#include <map>
+#include <memory>
+#include <optional>
 #include <string>
 #include <type_traits>
 #include <utility>
@@ -15,6 +17,7 @@
 #include <hilti/rt/types/reference.h>
 #include <hilti/rt/types/stream.h>
 
+#include <spicy/rt/configuration.h>
 #include <spicy/rt/debug.h>
 #include <spicy/rt/filter.h>
 #include <spicy/rt/mime.h>
@@ -30,6 +33,20 @@ HILTI_EXCEPTION(SinkError, UsageError)
 
 namespace sink {
 enum class ReassemblerPolicy { First };
+
+/**
+ * Statistics about data buffered by sinks for reassembly, and about the
+ * limits set for it through the runtime configuration.
+ */
+struct Statistics {
+    uint64_t buffered;      /**< number of bytes currently buffered by all sinks */
+    uint64_t skips;         /**< number of times sinks skipped ahead because of a limit */
+    uint64_t drops;         /**< number of chunks of new data sinks dropped because of a limit */
+    uint64_t dropped_bytes; /**< number of bytes sinks dropped because of a limit */
+};
+
+/** Returns statistics about all sinks' buffered data. */
+Statistics statistics();
 } // namespace sink
 
 namespace sink::detail {
@@ -116,7 +133,7 @@ inline const char sink_name[] = "__sink__";
 
 class Sink {
 public:
-    Sink() { _init(); } // NOLINT(hicpp-member-init)
+    Sink(); // NOLINT(hicpp-member-init)
     ~Sink() {
         try {
             _close(true);
@@ -155,7 +172,7 @@ public:
      */
     template<typename T>
     void connect_filter(spicy::rt::UnitRef<T> unit) {
-        if ( _size )
+        if ( _size || _filter_data )
             throw SinkError("cannot connect filter after data has been forwarded already");
 
         SPICY_RT_DEBUG_VERBOSE(
@@ -163,6 +180,16 @@ public:
         spicy::rt::filter::connect(_filter, unit);
     }
 
+    /**
+     * Connects a native filter to the sink. Any input will then pass through
+     * the filter before being forwarded to parsing. The same rules apply as
+     * for filter units, and native filters and filter units can be chained.
+     *
+     * @param filter native filter to connect to the sink.
+     * @throws ``SinkError`` if data has been processed already
+     */
+    void connect_filter(std::shared_ptr<filter::Native> filter);
+
     /**
      * Disconnects all units connected to the sink. They will then no longer
      * receive any data written into the sink.
@@ -190,7 +217,7 @@ public:
      * @param scope identifier for the desired scope
      * @throws ``mime::InvalidType`` if the type cannot be parsed
      */
-    void connect_mime_type(const std::string& mt, const std::string& scope) { connect_mime_type(MIMEType(mt), scope); }
+    void connect_mime_type(const std::string& mt, const std::string& scope);
 
     /**
      * Connects new instances of all units to the sink that support a given
@@ -202,9 +229,7 @@ public:
      * @param scope identifier for the desired scope
      * @throws ``mime::InvalidType`` if the type cannot be parsed
      */
-    void connect_mime_type(const hilti::rt::Bytes& mt, const std::string& scope) {
-        connect_mime_type(MIMEType(mt.str()), scope);
-    }
+    void connect_mime_type(const hilti::rt::Bytes& mt, const std::string& scope) { connect_mime_type(mt.str(), scope); }
 
     /**
      * Reports a gap in the input stream.
@@ -243,6 +268,35 @@ public:
     /** Sets the sink's reassembler policy. */
     void set_policy(sink::ReassemblerPolicy policy) { _policy = policy; }
 
+    /**
+     * Sets how many chunks of in-order data the sink passes on to connected
+     * units before resuming their parsing. Units always get resumed before
+     * gaps and skips are reported, and when the sink closes.
+     *
+     * @param n number of chunks; zero is treated like the default of one
+     */
+    void set_resume_batch(uint64_t n) {
+        _resume_batch = (n ? n : 1);
+
+        if ( _pending_resumes >= _resume_batch )
+            _resume();
+    }
+
+    /**
+     * Sets how many bytes of in-order data the sink collects for a connected
+     * filter before letting the filter process them. Pending data always
+     * gets passed through the filter before gaps and skips are reported,
+     * and when the sink closes.
+     *
+     * @param n number of bytes; the default of zero runs the filter on each chunk
+     */
+    void set_filter_batch(uint64_t n) {
+        _filter_batch = n;
+
+        if ( _filter_data && _filter_data->pending && _filter_data->pending >= _filter_batch )
+            _flushFilter();
+    }
+
     /**
      * Returns the number of bytes written into the sink so far.
      */
@@ -290,7 +344,22 @@ private:
             : data(std::move(data)), rseq(rseq), rupper(rupper) {}
     };
 
-    using ChunkList = std::list<Chunk>;
+    // Buffered chunks indexed by their `rseq`. Chunks never overlap, so
+    // they are ordered by their `rupper` as well.
+    using ChunkMap = std::map<uint64_t, Chunk>;
+
+    // Adds a chunk to the buffer, accounting for its data.
+    ChunkMap::iterator _insertChunk(ChunkMap::const_iterator hint, std::optional<hilti::rt::Bytes> data, uint64_t rseq,
+                                    uint64_t rupper);
+
+    // Removes a chunk from the buffer, accounting for its data. Returns the chunk following it.
+    ChunkMap::iterator _eraseChunk(ChunkMap::iterator c);
+
+    // Returns true if buffering another *n* bytes would exceed a limit on buffered data.
+    bool _exceedsLimit(uint64_t n = 0) const;
+
+    // Applies the limit policy if the data buffered exceeds a limit.
+    void _enforceLimits();
 
     // Returns true if any input has been passed in already (including gaps).
     bool _haveInput() { return _cur_rseq || _chunks.size(); }
@@ -314,13 +383,22 @@ private:
     // (Re-)initialize instance.
     void _init();
 
-    // Add new data to buffer, beginning search for insert position at given start *c*.
-    ChunkList::iterator _addAndCheck(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_t rupper,
-                                     ChunkList::iterator c);
+    // Add new data to buffer, splitting it up where it overlaps with data buffered already. Returns the chunk
+    // holding the first part of the new data that was not buffered already.
+    ChunkMap::iterator _addAndCheck(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_t rupper);
+
+    // Connects new instances of the given parsers, which were selected for a MIME type.
+    void _connectParsers(const std::vector<const Parser*>& parsers, const std::string& mt);
 
     // Deliver data to connected parsers. Returns false if the data is empty (i.e., a gap).
     bool _deliver(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_t rupper);
 
+    // Pass data on to connected parsers, after any filtering.
+    void _deliverToUnits(const hilti::rt::Bytes& data);
+
+    // Lets the filter process any pending input, passing its output on to connected parsers.
+    void _flushFilter();
+
     // Entry point for all new data. If not bytes instance is given, that signals a gap.
     void _newData(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_t len);
 
@@ -330,8 +408,11 @@ private:
     // Trim up to sequence number.
     void _trim(uint64_t rseq);
 
+    // Resumes all connected units that have data pending.
+    void _resume();
+
     // Deliver as much as possible starting at given buffer position.
-    void _tryDeliver(ChunkList::iterator c);
+    void _tryDeliver(ChunkMap::iterator c);
 
     // Trigger various hooks.
     void _reportGap(uint64_t rseq, uint64_t len) const;
@@ -357,19 +438,38 @@ private:
         hilti::rt::ValueReference<hilti::rt::Stream> input;
         hilti::rt::StrongReference<hilti::rt::Stream> output;
         hilti::rt::stream::View output_cur;
+        uint64_t pending = 0; // Number of bytes of input the filter has not processed yet.
     };
 
     std::optional<FilterData> _filter_data;
 
+    // Parsers selected by the most recent MIME type lookup.
+    struct MIMECache {
+        std::string mime_type;
+        std::string scope;
+        const std::vector<const Parser*>* parsers;
+    };
+
+    std::optional<MIMECache> _mime_cache;
+
     // Reassembly state.
     sink::ReassemblerPolicy _policy; // Current policy
     bool _auto_trim{};               // True if automatic trimming is enabled.
+    uint64_t _resume_batch{};        // Number of chunks to pass on before resuming units.
+    uint64_t _pending_resumes{};     // Number of chunks passed on since units were last resumed.
+    uint64_t _filter_batch{};        // Number of bytes to collect before running the filter.
     uint64_t _size{};
     uint64_t _initial_seq{};       // Initial sequence number.
     uint64_t _cur_rseq{};          // Sequence of last delivered byte + 1 (i.e., seq of next)
     uint64_t _last_reassem_rseq{}; // Sequence of last byte reassembled and delivered + 1.
     uint64_t _trim_rseq{};         // Sequence of last byte trimmed so far + 1.
-    ChunkList _chunks;             // Buffered data not yet delivered or trimmed
+    ChunkMap _chunks;              // Buffered data not yet delivered or trimmed
+    uint64_t _buffered{};          // Number of bytes of data in `_chunks`.
+
+    // Limits on buffered data, from the runtime configuration.
+    uint64_t _max_buffered{};
+    uint64_t _max_total_buffered{};
+    sink::LimitPolicy _limit_policy{};
 };
 
 } // namespace spicy::rt
@@ -377,4 +477,5 @@ private:
 namespace hilti::rt::detail::adl {
 std::string to_string(const spicy::rt::Sink& /* x */, adl::tag /*unused*/);
 std::string to_string(const spicy::rt::sink::ReassemblerPolicy& x, adl::tag /*unused*/);
+std::string to_string(const spicy::rt::sink::LimitPolicy& x, adl::tag /*unused*/);
 } // namespace hilti::rt::detail::adl
@@ -8,6 +8,8 @@
 #include <hilti/rt/types/bytes.h>
 #include <hilti/rt/types/stream.h>
 
+#include <spicy/rt/filter.h>
+
 namespace spicy::rt::zlib {
 
 namespace detail {
@@ -21,6 +23,11 @@ class ZlibError : public hilti::rt::RuntimeError {
 
 /**
  * State for streaming gzip decompression.
+ *
+ * If the stream accepts gzip data, decompression continues with the next
+ * member when one gzip member is followed by another, as in concatenated
+ * gzip files. Any other data following the end of the compressed data is
+ * ignored.
  */
 class Stream {
 public:
@@ -39,6 +46,16 @@ public:
     Stream& operator=(const Stream&) = default;
     Stream& operator=(Stream&&) noexcept = default;
 
+    /**
+     * Sets limits on the amount of data the stream decompresses, replacing
+     * the defaults from the runtime configuration. Once a limit is
+     * exceeded, decompression aborts with a `ZlibError`.
+     *
+     * @param max_output maximum number of bytes to decompress in total; zero means no limit
+     * @param max_ratio maximum ratio of decompressed to compressed bytes; zero means no limit
+     */
+    void setLimits(uint64_t max_output, uint64_t max_ratio);
+
     /**
      * Decompresses a chunk of data. Each chunk will continue where the
      * previous one left off.
@@ -58,22 +75,85 @@ public:
     hilti::rt::Bytes decompress(const hilti::rt::stream::View& data);
 
     /**
-     * Signals the end of decompression.
+     * Decompresses a chunk of data, appending the result directly to a
+     * stream. Each chunk will continue where the previous one left off.
+     *
+     * @param output stream to append newly decompressed data to
+     * @param data next chunk of data to decompress
+     */
+    void decompress(hilti::rt::Stream& output, const hilti::rt::Bytes& data);
+
+    /**
+     * Decompresses a chunk of data, appending the result directly to a
+     * stream. Each chunk will continue where the previous one left off.
+     *
+     * @param output stream to append newly decompressed data to
+     * @param data next chunk of data to decompress
+     */
+    void decompress(hilti::rt::Stream& output, const hilti::rt::stream::View& data);
+
+    /**
+     * Signals the end of decompression. Throws a `ZlibError` if the
+     * stream has received input that did not end with complete compressed
+     * data.
      *
      * @return any additional data becoming available at the end of the process
      */
     hilti::rt::Bytes finish();
 
 private:
+    template<typename Buffer>
+    void _decompress(Buffer* out, const hilti::rt::stream::View& data);
+
+    template<typename Buffer>
+    void _decompress(Buffer* out, const hilti::rt::Bytes& data);
+
     std::shared_ptr<detail::State> _state;
 };
 
+/**
+ * Native filter performing zlib decompression, corresponding to the Spicy
+ * filter unit `filter::Zlib`.
+ */
+class Filter : public filter::Native {
+public:
+    /**
+     * Constructor.
+     *
+     * @param window_bits passed on to the decompression `Stream`
+     */
+    Filter(int64_t window_bits = 15 + 32) : _stream(window_bits) {}
+
+    /** Returns the underlying decompression stream, e.g., for setting limits. */
+    Stream& stream() { return _stream; }
+
+    std::string name() const override { return "zlib"; }
+
+    void process(const hilti::rt::stream::View& input,
+                 hilti::rt::Stream& output) override { // NOLINT(google-runtime-references)
+        _stream.decompress(output, input);
+    }
+
+    void finish(hilti::rt::Stream& output) override { // NOLINT(google-runtime-references)
+        _stream.finish();
+    }
+
+private:
+    Stream _stream;
+};
+
 /** Instantiates a new `Stream` object, forwarding arguments to its constructor. */
 inline Stream init(int64_t window_bits) // NOLINT(google-runtime-references)
 {
     return Stream(window_bits);
 }
 
+/** Forwards to the corresponding `Stream` method. */
+inline void set_limits(Stream& stream, // NOLINT(google-runtime-references)
+                       uint64_t max_output, uint64_t max_ratio) {
+    stream.setLimits(max_output, max_ratio);
+}
+
 /** Forwards to the corresponding `Stream` method. */
 inline hilti::rt::Bytes decompress(Stream& stream, // NOLINT(google-runtime-references)
                                    const hilti::rt::Bytes& data) {
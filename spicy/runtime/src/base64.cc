@@ -1,30 +1,417 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define SPICY_BASE64_X86
+#endif
+
 #include <hilti/rt/types/bytes.h>
 
 #include <spicy/rt/base64.h>
 
-extern "C" {
-#include <b64/cdecode.h>
-#include <b64/cencode.h>
-}
-
 using namespace spicy::rt;
 using namespace spicy::rt::base64;
 
-struct detail::State {
-    base64_encodestate estate;
-    base64_decodestate dstate;
+struct base64::detail::State {
+    // Encoding: input bytes left over from a previous chunk that did not
+    // fill a complete 3-byte group yet.
+    uint8_t pending[2] = {0, 0};
+    unsigned int num_pending = 0;
+
+    // Decoding: bits of characters decoded so far that did not fill a
+    // complete output byte yet.
+    uint32_t bits = 0;
+    unsigned int num_bits = 0;
+};
+
+namespace {
+
+// The vectorized decoders may store up to this many bytes beyond the data
+// they actually produce.
+constexpr size_t OutputSlack = 16;
+
+const char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Maps characters to their 6-bit values, or -1 if they are not part of the
+// alphabet. Such characters (including padding and line breaks) are skipped
+// when decoding.
+struct DecodeTable {
+    int8_t values[256];
+
+    constexpr DecodeTable() : values() {
+        for ( auto& v : values )
+            v = -1;
+
+        for ( auto i = 0; i < 64; i++ )
+            values[static_cast<uint8_t>(Alphabet[i])] = static_cast<int8_t>(i);
+    }
 };
 
+constexpr DecodeTable Decode;
+
+// Signature of functions encoding or decoding a prefix of their input in
+// bulk. They return the number of input bytes they have consumed, which is
+// always a multiple of 3 (encoding) or 4 (decoding), and leave the rest to
+// the scalar code. Decoders stop at the first block containing a character
+// outside of the alphabet.
+using BulkFunction = size_t (*)(const uint8_t* in, size_t len, uint8_t* out);
+
+size_t encodeScalar(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t i = 0;
+
+    for ( ; i + 3 <= len; i += 3 ) {
+        uint32_t x = (static_cast<uint32_t>(in[i]) << 16) | (static_cast<uint32_t>(in[i + 1]) << 8) | in[i + 2];
+        *out++ = Alphabet[(x >> 18) & 0x3f];
+        *out++ = Alphabet[(x >> 12) & 0x3f];
+        *out++ = Alphabet[(x >> 6) & 0x3f];
+        *out++ = Alphabet[x & 0x3f];
+    }
+
+    return i;
+}
+
+size_t decodeScalar(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t i = 0;
+
+    for ( ; i + 4 <= len; i += 4 ) {
+        int32_t a = Decode.values[in[i]];
+        int32_t b = Decode.values[in[i + 1]];
+        int32_t c = Decode.values[in[i + 2]];
+        int32_t d = Decode.values[in[i + 3]];
+
+        if ( (a | b | c | d) < 0 )
+            break;
+
+        uint32_t x = (static_cast<uint32_t>(a) << 18) | (static_cast<uint32_t>(b) << 12) |
+                     (static_cast<uint32_t>(c) << 6) | static_cast<uint32_t>(d);
+        *out++ = static_cast<uint8_t>(x >> 16);
+        *out++ = static_cast<uint8_t>(x >> 8);
+        *out++ = static_cast<uint8_t>(x);
+    }
+
+    return i;
+}
+
+#ifdef SPICY_BASE64_X86
+
+// The vectorized code follows the approach described by Wojciech Muła and
+// Daniel Lemire in "Faster Base64 Encoding and Decoding Using AVX2
+// Instructions" (ACM Transactions on the Web, 2018).
+
+// Splits each 3-byte group into four 6-bit indices, one per output byte,
+// and maps them to their characters.
+__attribute__((target("ssse3"))) inline __m128i encodeBlock(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+    const auto t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const auto t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const auto t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const auto t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const auto indices = _mm_or_si128(t1, t3);
+
+    // Determine each index' range inside the alphabet, then add the offset
+    // mapping that range to its characters.
+    auto range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const auto less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+
+    const auto offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                       '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+}
+
+__attribute__((target("avx2"))) inline __m256i encodeBlock(__m256i in) {
+    const auto shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    in = _mm256_shuffle_epi8(in, _mm256_broadcastsi128_si256(shuffle));
+
+    const auto t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    const auto t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    const auto t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    const auto t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    const auto indices = _mm256_or_si256(t1, t3);
+
+    auto range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    const auto less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    range = _mm256_or_si256(range, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+
+    const auto offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                       '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    return _mm256_add_epi8(_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(offsets), range), indices);
+}
+
+// Lookup tables for validating characters and translating them into their
+// 6-bit values, indexed by the characters' low and high nibbles.
+#define DECODE_TABLES                                                                                                  \
+    _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a),    \
+        _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10), \
+        _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0)
+
+// Translates a block of characters into their 6-bit values, packing each
+// group of four into three bytes at the start of each 128-bit lane. Returns
+// false if the block contains any character outside of the alphabet.
+__attribute__((target("ssse3"))) inline bool decodeBlock(__m128i* block) {
+    const __m128i tables[] = {DECODE_TABLES};
+    const auto mask_2f = _mm_set1_epi8(0x2f);
+
+    const auto hi_nibbles = _mm_and_si128(_mm_srli_epi32(*block, 4), mask_2f);
+    const auto lo_nibbles = _mm_and_si128(*block, mask_2f);
+    const auto lo = _mm_shuffle_epi8(tables[0], lo_nibbles);
+    const auto hi = _mm_shuffle_epi8(tables[1], hi_nibbles);
+
+    if ( _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0 )
+        return false;
+
+    const auto eq_2f = _mm_cmpeq_epi8(*block, mask_2f);
+    const auto values = _mm_add_epi8(*block, _mm_shuffle_epi8(tables[2], _mm_add_epi8(eq_2f, hi_nibbles)));
+
+    const auto pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+    const auto words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    *block = _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    return true;
+}
+
+__attribute__((target("avx2"))) inline bool decodeBlock(__m256i* block) {
+    const __m128i tables[] = {DECODE_TABLES};
+    const auto mask_2f = _mm256_set1_epi8(0x2f);
+
+    const auto hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(*block, 4), mask_2f);
+    const auto lo_nibbles = _mm256_and_si256(*block, mask_2f);
+    const auto lo = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(tables[0]), lo_nibbles);
+    const auto hi = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(tables[1]), hi_nibbles);
+
+    if ( _mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_and_si256(lo, hi), _mm256_setzero_si256())) != 0 )
+        return false;
+
+    const auto eq_2f = _mm256_cmpeq_epi8(*block, mask_2f);
+    const auto roll = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(tables[2]), _mm256_add_epi8(eq_2f, hi_nibbles));
+    const auto values = _mm256_add_epi8(*block, roll);
+
+    const auto pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    const auto words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    const auto shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const auto packed = _mm256_shuffle_epi8(words, _mm256_broadcastsi128_si256(shuffle));
+
+    // Move the two lanes' 12 bytes next to each other.
+    *block = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    return true;
+}
+
+#undef DECODE_TABLES
+
+__attribute__((target("ssse3"))) size_t encodeSSSE3(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t i = 0;
+
+    // Each block reads 16 bytes, of which it encodes the first 12.
+    for ( ; i + 16 <= len; i += 12, out += 16 ) {
+        auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), encodeBlock(block));
+    }
+
+    return i;
+}
+
+__attribute__((target("ssse3"))) size_t decodeSSSE3(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t i = 0;
+
+    for ( ; i + 16 <= len; i += 16, out += 12 ) {
+        auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+
+        if ( ! decodeBlock(&block) )
+            break;
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), block);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2"))) size_t encodeAVX2(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t i = 0;
+
+    // Each block reads 28 bytes, of which it encodes the first 24, 12 per
+    // lane.
+    for ( ; i + 28 <= len; i += 24, out += 32 ) {
+        auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12));
+        auto block = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), encodeBlock(block));
+    }
+
+    return i + encodeSSSE3(in + i, len - i, out);
+}
+
+__attribute__((target("avx2"))) size_t decodeAVX2(const uint8_t* in, size_t len, uint8_t* out) {
+    size_t i = 0;
+
+    for ( ; i + 32 <= len; i += 32, out += 24 ) {
+        auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+
+        if ( ! decodeBlock(&block) )
+            return i;
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), block);
+    }
+
+    return i + decodeSSSE3(in + i, len - i, out);
+}
+
+#endif
+
+struct Codec {
+    BulkFunction encode = encodeScalar;
+    BulkFunction decode = decodeScalar;
+};
+
+// Selects the fastest implementation the CPU supports.
+const Codec& codec() {
+    static const Codec codec = []() {
+        Codec c;
+#ifdef SPICY_BASE64_X86
+        if ( __builtin_cpu_supports("avx2") ) {
+            c.encode = encodeAVX2;
+            c.decode = decodeAVX2;
+        }
+        else if ( __builtin_cpu_supports("ssse3") ) {
+            c.encode = encodeSSSE3;
+            c.decode = decodeSSSE3;
+        }
+#endif
+        return c;
+    }();
+
+    return codec;
+}
+
+// Returns the maximum number of bytes that encoding a chunk of data can produce.
+size_t encodeBound(const base64::detail::State& state, size_t len) { return (state.num_pending + len) / 3 * 4 + 2; }
+
+// Returns the maximum number of bytes that decoding a chunk of data can
+// produce, plus room for the vectorized code to store beyond that.
+size_t decodeBound(const base64::detail::State& state, size_t len) {
+    return (state.num_bits + len * 6) / 8 + OutputSlack;
+}
+
+// Encodes a chunk of data, appending the result to a buffer. Like libb64,
+// which we used previously, this emits all characters that the input
+// determines already, including those of a trailing incomplete group.
+void encode(base64::detail::State* state, const uint8_t* in, size_t len, std::string* out) {
+    auto used = out->size();
+    out->resize(used + encodeBound(*state, len));
+
+    auto* start = reinterpret_cast<uint8_t*>(out->data() + used);
+    auto* dst = start;
+
+    // Continue any group left over from the previous chunk, skipping the
+    // characters we have emitted for it already.
+    if ( state->num_pending ) {
+        uint8_t group[3] = {0, 0, 0};
+        memcpy(group, state->pending, state->num_pending);
+
+        auto emitted = state->num_pending;
+        auto n = std::min(static_cast<size_t>(3 - state->num_pending), len);
+        memcpy(group + state->num_pending, in, n);
+        in += n;
+        len -= n;
+
+        uint8_t chars[4];
+        encodeScalar(group, 3, chars);
+
+        auto filled = state->num_pending + n;
+        auto available = (filled == 3 ? 4 : filled);
+        memcpy(dst, chars + emitted, available - emitted);
+        dst += available - emitted;
+
+        state->num_pending = (filled == 3 ? 0 : filled);
+        memcpy(state->pending, group, state->num_pending);
+
+        if ( state->num_pending ) {
+            out->resize(used + (dst - start));
+            return;
+        }
+    }
+
+    auto consumed = codec().encode(in, len, dst);
+    dst += 4 * (consumed / 3);
+
+    auto rest = encodeScalar(in + consumed, len - consumed, dst);
+    dst += 4 * (rest / 3);
+    consumed += rest;
+
+    state->num_pending = len - consumed;
+
+    if ( state->num_pending ) {
+        uint8_t group[3] = {0, 0, 0};
+        memcpy(group, in + consumed, state->num_pending);
+        memcpy(state->pending, group, state->num_pending);
+
+        uint8_t chars[4];
+        encodeScalar(group, 3, chars);
+        memcpy(dst, chars, state->num_pending);
+        dst += state->num_pending;
+    }
+
+    out->resize(used + (dst - start));
+}
+
+// Decodes a chunk of data, appending the result to a buffer.
+void decode(base64::detail::State* state, const uint8_t* in, size_t len, std::string* out) {
+    auto used = out->size();
+    out->resize(used + decodeBound(*state, len));
+
+    auto* start = reinterpret_cast<uint8_t*>(out->data() + used);
+    auto* dst = start;
+    const auto& bulk = codec().decode;
+
+    size_t i = 0;
+
+    while ( i < len ) {
+        // As long as we are at a group boundary, decode groups of four
+        // characters in bulk.
+        if ( state->num_bits == 0 ) {
+            auto consumed = bulk(in + i, len - i, dst);
+            consumed += decodeScalar(in + i + consumed, len - i - consumed, dst + 3 * (consumed / 4));
+            dst += 3 * (consumed / 4);
+            i += consumed;
+
+            if ( i == len )
+                break;
+        }
+
+        // Go character by character until we are back at a group boundary,
+        // skipping anything outside of the alphabet.
+        auto value = Decode.values[in[i++]];
+        if ( value < 0 )
+            continue;
+
+        state->bits = (state->bits << 6) | static_cast<uint32_t>(value);
+        state->num_bits += 6;
+
+        if ( state->num_bits >= 8 ) {
+            state->num_bits -= 8;
+            *dst++ = static_cast<uint8_t>(state->bits >> state->num_bits);
+        }
+
+        state->bits &= (1U << state->num_bits) - 1;
+    }
+
+    out->resize(used + (dst - start));
+}
+
+} // namespace
+
 Stream::Stream() {
-    _state = std::shared_ptr<detail::State>(new detail::State(), [](auto p) {
+    _state = std::shared_ptr<base64::detail::State>(new base64::detail::State(), [](auto p) {
         // Nothing else to clean up.
         delete p; // NOLINT(cppcoreguidelines-owning-memory)
     });
-
-    base64_init_encodestate(&_state->estate);
-    base64_init_decodestate(&_state->dstate);
 }
 
 // Don't finish the stream here, it might be shared with other instances.
@@ -35,52 +422,46 @@ hilti::rt::Bytes Stream::encode(const hilti::rt::Bytes& data) {
     if ( ! _state )
         throw Base64Error("encoding already finished");
 
-    char buf[static_cast<uint64_t>(data.size() * 2)];
-    auto len = base64_encode_block(data.data(), static_cast<int>(data.size()), buf, &_state->estate);
-    return hilti::rt::Bytes(buf, len);
+    std::string encoded;
+    ::encode(_state.get(), reinterpret_cast<const uint8_t*>(data.data()), data.size(), &encoded);
+    return hilti::rt::Bytes(std::move(encoded));
 }
 
 hilti::rt::Bytes Stream::encode(const hilti::rt::stream::View& data) {
     if ( ! _state )
         throw Base64Error("encoding already finished");
 
-    hilti::rt::Bytes encoded;
+    // Reserve space for all blocks at once so that the output never needs to
+    // be moved.
+    std::string encoded;
+    encoded.reserve(encodeBound(*_state, data.size()));
 
-    for ( auto block = data.firstBlock(); block; block = data.nextBlock(block) ) {
-        char buf[static_cast<uint64_t>(block->size * 2)];
-        auto len = base64_encode_block(reinterpret_cast<const char*>(block->start), static_cast<int>(block->size), buf,
-                                       &_state->estate);
-        encoded.append(hilti::rt::Bytes(buf, len));
-    }
+    for ( auto block = data.firstBlock(); block; block = data.nextBlock(block) )
+        ::encode(_state.get(), block->start, block->size, &encoded);
 
-    return encoded;
+    return hilti::rt::Bytes(std::move(encoded));
 }
 
 hilti::rt::Bytes Stream::decode(const hilti::rt::Bytes& data) {
     if ( ! _state )
         throw Base64Error("decoding already finished");
 
-    char buf[static_cast<uint64_t>(data.size() * 2)];
-    auto len = base64_decode_block(reinterpret_cast<const char*>(data.data()), static_cast<int>(data.size()), buf,
-                                   &_state->dstate);
-
-    return hilti::rt::Bytes(buf, len);
+    std::string decoded;
+    ::decode(_state.get(), reinterpret_cast<const uint8_t*>(data.data()), data.size(), &decoded);
+    return hilti::rt::Bytes(std::move(decoded));
 }
 
 hilti::rt::Bytes Stream::decode(const hilti::rt::stream::View& data) {
     if ( ! _state )
         throw Base64Error("decoding already finished");
 
-    hilti::rt::Bytes decoded;
+    std::string decoded;
+    decoded.reserve(decodeBound(*_state, data.size()));
 
-    for ( auto block = data.firstBlock(); block; block = data.nextBlock(block) ) {
-        char buf[static_cast<uint64_t>(block->size * 2)];
-        auto len = base64_decode_block(reinterpret_cast<const char*>(block->start), static_cast<int>(block->size), buf,
-                                       &_state->dstate);
-        decoded.append(hilti::rt::Bytes(buf, len));
-    }
+    for ( auto block = data.firstBlock(); block; block = data.nextBlock(block) )
+        ::decode(_state.get(), block->start, block->size, &decoded);
 
-    return decoded;
+    return hilti::rt::Bytes(std::move(decoded));
 }
 
 hilti::rt::Bytes Stream::finish() {
@@ -89,12 +470,20 @@ hilti::rt::Bytes Stream::finish() {
 
     // This can be safely called for both encoding and decoding, but won't do
     // anything for the latter.
-    hilti::rt::Bytes b;
-    char buf[4];
+    std::string b;
+
+    if ( _state->num_pending ) {
+        // Emit the one character of the final group not yet determined
+        // before, followed by padding.
+        uint8_t group[3] = {0, 0, 0};
+        memcpy(group, _state->pending, _state->num_pending);
 
-    auto len = base64_encode_blockend(buf, &_state->estate);
-    b.append(hilti::rt::Bytes(buf, len));
+        uint8_t chars[4];
+        encodeScalar(group, 3, chars);
+        b += static_cast<char>(chars[_state->num_pending]);
+        b.append(3 - _state->num_pending, '=');
+    }
 
     _state = nullptr;
-    return b;
+    return hilti::rt::Bytes(std::move(b));
 }
@@ -0,0 +1,110 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+//
+// Measures the optional zstd and LZ4 decompressors on the same kind of input
+// as the zlib benchmarks: compressed bodies arriving in segments of typical
+// TCP payload size, decompressed directly into a stream.
+
+#include <benchmark/benchmark.h>
+
+#include <spicy/rt/autogen/config.h>
+
+#ifdef SPICY_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef SPICY_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <hilti/rt/init.h>
+#include <hilti/rt/types/stream.h>
+
+#include <spicy/rt/init.h>
+#include <spicy/rt/lz4_.h>
+#include <spicy/rt/zstd_.h>
+
+static const size_t SegmentSize = 1460;
+
+// Returns an HTML-like body of the given size.
+static std::string body(size_t size) {
+    std::string body;
+    for ( uint64_t i = 0; body.size() < size; i++ )
+        body += "<tr><td class=\"item\">" + std::to_string(i * 7919 % 10007) + "</td><td>entry " + std::to_string(i) +
+                "</td></tr>\n";
+
+    body.resize(size);
+    return body;
+}
+
+// Splits compressed data into segments.
+static std::vector<hilti::rt::Bytes> segment(const std::string& compressed) {
+    std::vector<hilti::rt::Bytes> segments;
+    for ( size_t i = 0; i < compressed.size(); i += SegmentSize )
+        segments.emplace_back(compressed.substr(i, SegmentSize));
+
+    return segments;
+}
+
+// Decompresses all segments with a fresh stream of the given type in each iteration.
+template<typename Stream>
+static void decompress(benchmark::State& state, const std::vector<hilti::rt::Bytes>& segments, size_t size) {
+    for ( auto _ : state ) {
+        (void)_;
+        Stream z;
+        hilti::rt::Stream output;
+
+        for ( const auto& s : segments )
+            z.decompress(output, s);
+
+        z.finish();
+        benchmark::DoNotOptimize(output.size());
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size));
+}
+
+#ifdef SPICY_HAVE_ZSTD
+static void decompress_zstd(benchmark::State& state) {
+    hilti::rt::init();
+    spicy::rt::init();
+
+    auto size = static_cast<size_t>(state.range(0));
+    auto data = body(size);
+
+    std::string compressed(ZSTD_compressBound(size), '\0');
+    compressed.resize(ZSTD_compress(compressed.data(), compressed.size(), data.data(), data.size(), 3));
+
+    decompress<spicy::rt::zstd::Stream>(state, segment(compressed), size);
+
+    spicy::rt::done();
+    hilti::rt::done();
+}
+
+BENCHMARK(decompress_zstd)->RangeMultiplier(16)->Range(4096, 1024 * 1024);
+#endif
+
+#ifdef SPICY_HAVE_LZ4
+static void decompress_lz4(benchmark::State& state) {
+    hilti::rt::init();
+    spicy::rt::init();
+
+    auto size = static_cast<size_t>(state.range(0));
+    auto data = body(size);
+
+    std::string compressed(LZ4F_compressFrameBound(size, nullptr), '\0');
+    compressed.resize(LZ4F_compressFrame(compressed.data(), compressed.size(), data.data(), data.size(), nullptr));
+
+    decompress<spicy::rt::lz4::Stream>(state, segment(compressed), size);
+
+    spicy::rt::done();
+    hilti::rt::done();
+}
+
+BENCHMARK(decompress_lz4)->RangeMultiplier(16)->Range(4096, 1024 * 1024);
+#endif
+
+BENCHMARK_MAIN();
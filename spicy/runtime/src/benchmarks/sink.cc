@@ -0,0 +1,244 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+//
+// Measures the cost of reassembling out-of-order input in a sink, with
+// segments arriving in patterns typical for lossy TCP captures, and of
+// passing input through a filter connected to a sink, implemented either as
+// a filter unit or natively.
+
+#include <zlib.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <hilti/rt/fiber.h>
+#include <hilti/rt/init.h>
+
+#include <spicy/rt/filter.h>
+#include <spicy/rt/init.h>
+#include <spicy/rt/parser.h>
+#include <spicy/rt/sink.h>
+#include <spicy/rt/zlib_.h>
+
+static const auto Segment = hilti::rt::Bytes(std::string(100, 'x'));
+
+static void reassemble(benchmark::State& state, const std::vector<uint64_t>& order) {
+    hilti::rt::init();
+    spicy::rt::init();
+
+    for ( auto _ : state ) {
+        (void)_;
+        spicy::rt::Sink sink;
+
+        for ( auto i : order )
+            sink.write(Segment, i * Segment.size());
+
+        benchmark::DoNotOptimize(sink.size());
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(order.size()));
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(order.size() * Segment.size()));
+
+    spicy::rt::done();
+    hilti::rt::done();
+}
+
+// Every other segment gets lost and retransmitted after all others, with
+// the first one missing until the very end.
+static void odd_then_even(benchmark::State& state) {
+    auto n = static_cast<uint64_t>(state.range(0));
+    std::vector<uint64_t> order;
+
+    for ( uint64_t i = 1; i < n; i += 2 )
+        order.push_back(i);
+
+    for ( uint64_t i = 2; i < n; i += 2 )
+        order.push_back(i);
+
+    order.push_back(0);
+    reassemble(state, order);
+}
+
+// Segments in random order, a quarter of them retransmitted.
+static void shuffled_with_retransmissions(benchmark::State& state) {
+    auto n = static_cast<uint64_t>(state.range(0));
+    std::vector<uint64_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    order.insert(order.end(), order.begin(), order.begin() + static_cast<std::ptrdiff_t>(n / 4));
+    std::shuffle(order.begin(), order.end(), std::mt19937(42)); // NOLINT
+    reassemble(state, order);
+}
+
+// A filter forwarding its input unchanged, standing in for a decompressor
+// to measure the overhead of switching into filters.
+struct Passthrough {
+    hilti::rt::WeakReference<spicy::rt::filter::detail::Forward> __forward;
+    static inline spicy::rt::Parser __parser;
+};
+
+static hilti::rt::Resumable parsePassthrough(spicy::rt::UnitType<Passthrough>& unit,
+                                             hilti::rt::ValueReference<hilti::rt::Stream>& data,
+                                             const std::optional<hilti::rt::stream::View>& cur,
+                                             const std::optional<spicy::rt::UnitContext>& /* context */) {
+    auto* filter = &*unit;
+    auto* input = data.get();
+    auto view = (cur ? *cur : data->view());
+
+    return hilti::rt::fiber::execute([filter, input, view](hilti::rt::resumable::Handle* /* r */) mutable {
+        while ( true ) {
+            if ( auto n = view.size() ) {
+                spicy::rt::filter::forward(*filter, view.data());
+                view = view.advance(n);
+            }
+
+            if ( input->isFrozen() )
+                break;
+
+            hilti::rt::detail::yield();
+        }
+
+        spicy::rt::filter::forward_eod(*filter);
+        return hilti::rt::Nothing();
+    });
+}
+
+// Writes in-order segments into a sink with a filter, letting the filter
+// process batches of the given number of bytes.
+static void filter_batch(benchmark::State& state) {
+    hilti::rt::init();
+    spicy::rt::init();
+
+    Passthrough::__parser.name = "Passthrough";
+    Passthrough::__parser.parse2 = spicy::rt::Parse2Function<Passthrough>(parsePassthrough);
+
+    const auto segments = 1024;
+    const auto batch = static_cast<uint64_t>(state.range(0));
+
+    for ( auto _ : state ) {
+        (void)_;
+        spicy::rt::Sink sink;
+        sink.connect_filter(hilti::rt::reference::make_strong<Passthrough>());
+        sink.set_filter_batch(batch);
+
+        for ( auto i = 0; i < segments; i++ )
+            sink.write(Segment);
+
+        sink.close();
+    }
+
+    state.SetItemsProcessed(state.iterations() * segments);
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(segments * Segment.size()));
+
+    spicy::rt::done();
+    hilti::rt::done();
+}
+
+// Native version of `Passthrough`.
+class NativePassthrough : public spicy::rt::filter::Native {
+public:
+    std::string name() const override { return "passthrough"; }
+
+    void process(const hilti::rt::stream::View& input, hilti::rt::Stream& output) override {
+        output.append(input.data());
+    }
+};
+
+// Writes in-order segments into a sink with a native filter.
+static void filter_native(benchmark::State& state) {
+    hilti::rt::init();
+    spicy::rt::init();
+
+    const auto segments = 1024;
+
+    for ( auto _ : state ) {
+        (void)_;
+        spicy::rt::Sink sink;
+        sink.connect_filter(std::make_shared<NativePassthrough>());
+
+        for ( auto i = 0; i < segments; i++ )
+            sink.write(Segment);
+
+        sink.close();
+    }
+
+    state.SetItemsProcessed(state.iterations() * segments);
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(segments * Segment.size()));
+
+    spicy::rt::done();
+    hilti::rt::done();
+}
+
+// Returns a gzip'ed HTML-like body of the given size, split into segments
+// of `Segment`'s size.
+static std::vector<hilti::rt::Bytes> gzippedSegments(size_t size) {
+    std::string body;
+    for ( uint64_t i = 0; body.size() < size; i++ )
+        body += "<tr><td class=\"item\">" + std::to_string(i * 7919 % 10007) + "</td><td>entry " + std::to_string(i) +
+                "</td></tr>\n";
+
+    body.resize(size);
+
+    z_stream zs{};
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+
+    std::string compressed(deflateBound(&zs, size), '\0');
+    zs.next_in = reinterpret_cast<Bytef*>(body.data());
+    zs.avail_in = size;
+    zs.next_out = reinterpret_cast<Bytef*>(compressed.data());
+    zs.avail_out = compressed.size();
+    deflate(&zs, Z_FINISH);
+    compressed.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    std::vector<hilti::rt::Bytes> segments;
+    for ( size_t i = 0; i < compressed.size(); i += Segment.size() )
+        segments.emplace_back(compressed.substr(i, Segment.size()));
+
+    return segments;
+}
+
+// Writes segments of a gzip'ed body into a sink with the native zlib filter,
+// letting the filter process batches of the given number of bytes. Unlike
+// the pass-through filters, this includes the decompressor's per-call
+// overhead.
+static void filter_zlib(benchmark::State& state) {
+    hilti::rt::init();
+    spicy::rt::init();
+
+    const auto size = 1024 * 1024;
+    const auto segments = gzippedSegments(size);
+    const auto batch = static_cast<uint64_t>(state.range(0));
+
+    for ( auto _ : state ) {
+        (void)_;
+        spicy::rt::Sink sink;
+        sink.connect_filter(std::make_shared<spicy::rt::zlib::Filter>());
+        sink.set_filter_batch(batch);
+
+        for ( const auto& s : segments )
+            sink.write(s);
+
+        sink.close();
+        benchmark::DoNotOptimize(sink.size());
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(segments.size()));
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size));
+
+    spicy::rt::done();
+    hilti::rt::done();
+}
+
+BENCHMARK(odd_then_even)->RangeMultiplier(4)->Range(64, 16384);
+BENCHMARK(shuffled_with_retransmissions)->RangeMultiplier(4)->Range(64, 16384);
+BENCHMARK(filter_batch)->Arg(0)->Arg(1024)->Arg(16384);
+BENCHMARK(filter_native);
+BENCHMARK(filter_zlib)->Arg(0)->Arg(1024)->Arg(4096)->Arg(16384);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,166 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+//
+// Measures decompressing gzip'ed bodies the way HTTP transfers them, arriving
+// in segments of typical TCP payload size.
+
+#include <zlib.h>
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <hilti/rt/init.h>
+#include <hilti/rt/types/stream.h>
+
+#include <spicy/rt/init.h>
+#include <spicy/rt/zlib_.h>
+
+static const size_t SegmentSize = 1460;
+
+// Returns a compressed HTML-like body of the given size, split into segments.
+// With more than one member, compresses that many parts of the body
+// separately and concatenates the results, like multi-member gzip files.
+static std::vector<hilti::rt::Bytes> compressedBody(size_t size, int window_bits = 15 + 16, size_t members = 1) {
+    std::string body;
+    for ( uint64_t i = 0; body.size() < size; i++ )
+        body += "<tr><td class=\"item\">" + std::to_string(i * 7919 % 10007) + "</td><td>entry " + std::to_string(i) +
+                "</td></tr>\n";
+
+    body.resize(size);
+
+    std::string compressed;
+    auto member_size = (size + members - 1) / members;
+
+    for ( size_t offset = 0; offset < size; offset += member_size ) {
+        auto n = std::min(member_size, size - offset);
+
+        z_stream zs{};
+        deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+
+        std::string member(deflateBound(&zs, n), '\0');
+        zs.next_in = reinterpret_cast<Bytef*>(body.data() + offset);
+        zs.avail_in = n;
+        zs.next_out = reinterpret_cast<Bytef*>(member.data());
+        zs.avail_out = member.size();
+        deflate(&zs, Z_FINISH);
+        member.resize(zs.total_out);
+        deflateEnd(&zs);
+
+        compressed += member;
+    }
+
+    std::vector<hilti::rt::Bytes> segments;
+    for ( size_t i = 0; i < compressed.size(); i += SegmentSize )
+        segments.emplace_back(compressed.substr(i, SegmentSize));
+
+    return segments;
+}
+
+// Decompresses into a separate `Bytes` instance for each segment.
+static void decompress_to_bytes(benchmark::State& state) {
+    hilti::rt::init();
+    spicy::rt::init();
+
+    auto size = static_cast<size_t>(state.range(0));
+    auto segments = compressedBody(size);
+
+    for ( auto _ : state ) {
+        (void)_;
+        spicy::rt::zlib::Stream z;
+
+        for ( const auto& s : segments )
+            benchmark::DoNotOptimize(z.decompress(s));
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size));
+
+    spicy::rt::done();
+    hilti::rt::done();
+}
+
+// Decompresses directly into a stream.
+static void decompress_to_stream(benchmark::State& state) {
+    hilti::rt::init();
+    spicy::rt::init();
+
+    auto size = static_cast<size_t>(state.range(0));
+    auto segments = compressedBody(size);
+
+    for ( auto _ : state ) {
+        (void)_;
+        spicy::rt::zlib::Stream z;
+        hilti::rt::Stream output;
+
+        for ( const auto& s : segments )
+            z.decompress(output, s);
+
+        benchmark::DoNotOptimize(output.size());
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size));
+
+    spicy::rt::done();
+    hilti::rt::done();
+}
+
+// Decompresses raw deflate data directly into a stream.
+static void decompress_raw_deflate(benchmark::State& state) {
+    hilti::rt::init();
+    spicy::rt::init();
+
+    auto size = static_cast<size_t>(state.range(0));
+    auto segments = compressedBody(size, -15);
+
+    for ( auto _ : state ) {
+        (void)_;
+        spicy::rt::zlib::Stream z(-15);
+        hilti::rt::Stream output;
+
+        for ( const auto& s : segments )
+            z.decompress(output, s);
+
+        benchmark::DoNotOptimize(output.size());
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size));
+
+    spicy::rt::done();
+    hilti::rt::done();
+}
+
+// Decompresses gzip data consisting of 16 concatenated members directly
+// into a stream.
+static void decompress_gzip_members(benchmark::State& state) {
+    hilti::rt::init();
+    spicy::rt::init();
+
+    auto size = static_cast<size_t>(state.range(0));
+    auto segments = compressedBody(size, 15 + 16, 16);
+
+    for ( auto _ : state ) {
+        (void)_;
+        spicy::rt::zlib::Stream z;
+        hilti::rt::Stream output;
+
+        for ( const auto& s : segments )
+            z.decompress(output, s);
+
+        z.finish();
+        benchmark::DoNotOptimize(output.size());
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size));
+
+    spicy::rt::done();
+    hilti::rt::done();
+}
+
+BENCHMARK(decompress_to_bytes)->RangeMultiplier(16)->Range(4096, 1024 * 1024);
+BENCHMARK(decompress_to_stream)->RangeMultiplier(16)->Range(4096, 1024 * 1024);
+BENCHMARK(decompress_raw_deflate)->RangeMultiplier(16)->Range(4096, 1024 * 1024);
+BENCHMARK(decompress_gzip_members)->RangeMultiplier(16)->Range(4096, 1024 * 1024);
+
+BENCHMARK_MAIN();
@@ -3,20 +3,41 @@
 #include <getopt.h>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <ios>
 #include <iostream>
+#include <limits>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include <hilti/rt/context.h>
 #include <hilti/rt/exception.h>
 #include <hilti/rt/fmt.h>
+#include <hilti/rt/global-state.h>
 #include <hilti/rt/init.h>
+#include <hilti/rt/json.h>
 #include <hilti/rt/profiler.h>
 
 #include <spicy/rt/driver.h>
+#include <spicy/rt/pcap.h>
 
 using hilti::rt::Nothing;
 using hilti::rt::Result;
@@ -81,6 +102,13 @@ void Driver::_debugStats(size_t current_flows, size_t current_connections) {
     DRIVER_DEBUG(fmt("state: current_flows=%s total_flows=%s current_connections=%s total_connections=%s", num_flows,
                      total_flows, num_connections, total_connections));
 
+    if ( _flow_limits.any() ) {
+        auto evicted = flowEvictions();
+        DRIVER_DEBUG(fmt("evicted: max-flows=%" PRIu64 " max-flow-bytes=%" PRIu64 " max-total-bytes=%" PRIu64
+                         " idle=%" PRIu64,
+                         evicted.max_flows, evicted.max_flow_bytes, evicted.max_total_bytes, evicted.idle));
+    }
+
     auto stats = hilti::rt::resource_usage();
     auto memory_heap = pretty_print_number(stats.memory_heap);
     auto num_stacks = pretty_print_number(stats.num_fibers);
@@ -92,6 +120,220 @@ void Driver::_debugStats(size_t current_flows, size_t current_connections) {
                      cached_stacks, max_stacks, max_stack_size));
 }
 
+std::vector<uint64_t> driver::LatencyHistogram::counts() const {
+    std::vector<uint64_t> counts(NumBuckets);
+
+    for ( size_t i = 0; i < NumBuckets; i++ )
+        counts[i] = _buckets[i].load(std::memory_order_relaxed);
+
+    return counts;
+}
+
+uint64_t driver::LatencyHistogram::lowerBound(size_t bucket) {
+    if ( bucket < SubBuckets )
+        return bucket;
+
+    auto exp = (bucket >> SubBucketBits) + SubBucketBits - 1;
+    auto sub = bucket & (SubBuckets - 1);
+    return static_cast<uint64_t>(SubBuckets + sub) << (exp - SubBucketBits);
+}
+
+uint64_t driver::LatencyHistogram::percentile(const std::vector<uint64_t>& counts, double p) {
+    uint64_t total = 0;
+    for ( auto c : counts )
+        total += c;
+
+    if ( ! total )
+        return 0;
+
+    // Rank of the value we're looking for, starting at 1.
+    auto rank = std::max(uint64_t(1), static_cast<uint64_t>(std::ceil(p / 100.0 * static_cast<double>(total))));
+
+    uint64_t seen = 0;
+    for ( size_t i = 0; i < counts.size(); i++ ) {
+        seen += counts[i];
+        if ( seen < rank )
+            continue;
+
+        // Report the middle of the bucket.
+        auto lower = lowerBound(i);
+        auto upper = (i + 1 < NumBuckets ? lowerBound(i + 1) - 1 : std::numeric_limits<uint64_t>::max());
+        return lower + (upper - lower) / 2;
+    }
+
+    hilti::rt::cannot_be_reached();
+}
+
+driver::ThroughputSnapshot& driver::ThroughputSnapshot::operator+=(const ThroughputSnapshot& other) {
+    bytes += other.bytes;
+    units += other.units;
+    errors += other.errors;
+    resumes += other.resumes;
+
+    latencies.resize(std::max(latencies.size(), other.latencies.size()));
+    for ( size_t i = 0; i < other.latencies.size(); i++ )
+        latencies[i] += other.latencies[i];
+
+    return *this;
+}
+
+driver::ThroughputSnapshot driver::ThroughputSnapshot::operator-(const ThroughputSnapshot& other) const {
+    ThroughputSnapshot x = *this;
+    x.bytes -= other.bytes;
+    x.units -= other.units;
+    x.errors -= other.errors;
+    x.resumes -= other.resumes;
+
+    for ( size_t i = 0; i < std::min(x.latencies.size(), other.latencies.size()); i++ )
+        x.latencies[i] -= other.latencies[i];
+
+    return x;
+}
+
+driver::ThroughputSnapshot driver::ThroughputStats::snapshot() const {
+    return ThroughputSnapshot{.bytes = _bytes.load(std::memory_order_relaxed),
+                              .units = _units.load(std::memory_order_relaxed),
+                              .errors = _errors.load(std::memory_order_relaxed),
+                              .resumes = _resumes.load(std::memory_order_relaxed),
+                              .latencies = _latencies.counts()};
+}
+
+/** State for reporting throughput, created once enabled. */
+struct Driver::Throughput {
+    using Clock = std::chrono::steady_clock;
+
+    /** Max. number of ticks between checks of the clock. */
+    static constexpr uint64_t TicksPerCheck = 256;
+
+    std::ostream* out = nullptr;
+    std::chrono::duration<double> interval{0};
+    bool json = false;
+
+    Clock::time_point start = Clock::now();
+    Clock::time_point last_report = start;
+    uint64_t ticks = 0;
+
+    std::mutex mutex; // protects `parsers`
+    std::map<std::string, std::unique_ptr<driver::ThroughputStats>> parsers;
+    std::map<std::string, driver::ThroughputSnapshot> last; // snapshots at the time of the last report
+};
+
+Driver::Driver() = default;
+Driver::~Driver() = default;
+
+driver::FlowEvictions Driver::flowEvictions() const {
+    return driver::FlowEvictions{.max_flows = _evicted_max_flows.load(),
+                                 .max_flow_bytes = _evicted_max_flow_bytes.load(),
+                                 .max_total_bytes = _evicted_max_total_bytes.load(),
+                                 .idle = _evicted_idle.load()};
+}
+
+void Driver::enableThroughputReporting(std::ostream& out, double interval, bool json) {
+    _throughput = std::make_unique<Throughput>();
+    _throughput->out = &out;
+    _throughput->interval = std::chrono::duration<double>(interval);
+    _throughput->json = json;
+}
+
+driver::ThroughputStats* Driver::throughputStats(const Parser& parser) {
+    if ( ! _throughput )
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(_throughput->mutex);
+
+    auto& stats = _throughput->parsers[parser.name];
+    if ( ! stats )
+        stats = std::make_unique<driver::ThroughputStats>();
+
+    return stats.get();
+}
+
+void Driver::reportThroughput() {
+    if ( _throughput )
+        _reportThroughput(true);
+}
+
+void Driver::_tickThroughputSlow() {
+    if ( _throughput->interval.count() <= 0 || ++_throughput->ticks < Throughput::TicksPerCheck )
+        return;
+
+    _throughput->ticks = 0;
+
+    if ( Throughput::Clock::now() - _throughput->last_report >= _throughput->interval )
+        _reportThroughput(false);
+}
+
+void Driver::_reportThroughput(bool final) {
+    auto now = Throughput::Clock::now();
+    auto since = (final ? _throughput->start : _throughput->last_report);
+    auto elapsed = std::chrono::duration<double>(now - since).count();
+
+    std::vector<std::pair<std::string, driver::ThroughputSnapshot>> parsers;
+
+    {
+        std::lock_guard<std::mutex> lock(_throughput->mutex);
+
+        for ( const auto& [name, stats] : _throughput->parsers ) {
+            auto current = stats->snapshot();
+            auto& last = _throughput->last[name];
+
+            parsers.emplace_back(name, final ? current : current - last);
+            last = std::move(current);
+        }
+    }
+
+    _throughput->last_report = now;
+
+    driver::ThroughputSnapshot total;
+    for ( const auto& [name, snapshot] : parsers )
+        total += snapshot;
+
+    auto rate = [&](uint64_t n) { return elapsed > 0 ? static_cast<double>(n) / elapsed : 0.0; };
+    auto& out = *_throughput->out;
+
+    if ( _throughput->json ) {
+        auto to_json = [&](const driver::ThroughputSnapshot& x) {
+            return nlohmann::json{{"bytes", x.bytes},
+                                  {"bytes_per_second", rate(x.bytes)},
+                                  {"units", x.units},
+                                  {"units_per_second", rate(x.units)},
+                                  {"errors", x.errors},
+                                  {"resumes", x.resumes},
+                                  {"latency_ns", {{"p50", x.latency(50)}, {"p90", x.latency(90)}, {"p99", x.latency(99)}}}};
+        };
+
+        auto j = nlohmann::json{{"report", final ? "total" : "interval"}, {"elapsed", elapsed}};
+        j["parsers"] = nlohmann::json::object();
+
+        for ( const auto& [name, snapshot] : parsers )
+            j["parsers"][name] = to_json(snapshot);
+
+        j["total"] = to_json(total);
+        out << j.dump() << '\n';
+    }
+
+    else {
+        auto latency = [](uint64_t ns) { return fmt("%.2fus", static_cast<double>(ns) / 1000.0); };
+
+        auto print = [&](const std::string& name, const driver::ThroughputSnapshot& x) {
+            out << fmt("  %s: bytes=%" PRIu64 " bytes/s=%s units=%" PRIu64 " units/s=%.1f errors=%" PRIu64
+                       " resumes=%" PRIu64 " latency-p50=%s latency-p90=%s latency-p99=%s\n",
+                       name, x.bytes, pretty_print_number(static_cast<uint64_t>(rate(x.bytes))), x.units,
+                       rate(x.units), x.errors, x.resumes, latency(x.latency(50)), latency(x.latency(90)),
+                       latency(x.latency(99)));
+        };
+
+        out << fmt("throughput (%s, %.2fs):\n", final ? "total" : "interval", elapsed);
+
+        for ( const auto& [name, snapshot] : parsers )
+            print(name, snapshot);
+
+        print("all parsers", total);
+    }
+
+    out.flush();
+}
+
 Result<Nothing> Driver::listParsers(std::ostream& out) {
     if ( ! hilti::rt::isInitialized() )
         return Error("runtime not initialized");
@@ -153,6 +395,33 @@ Result<const spicy::rt::Parser*> Driver::lookupParser(const std::string& name) {
         return hilti::rt::result::Error("no matching parser available");
 }
 
+namespace {
+// Records the time a parser spends running into throughput statistics, if collected.
+class ResumeTimer {
+public:
+    ResumeTimer(driver::ThroughputStats* stats) : _stats(stats) {
+        if ( _stats )
+            _start = std::chrono::steady_clock::now();
+    }
+
+    ~ResumeTimer() {
+        if ( _stats )
+            _stats->recordResume(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::steady_clock::now() - _start)
+                                     .count());
+    }
+
+    ResumeTimer(const ResumeTimer&) = delete;
+    ResumeTimer(ResumeTimer&&) = delete;
+    ResumeTimer& operator=(const ResumeTimer&) = delete;
+    ResumeTimer& operator=(ResumeTimer&&) = delete;
+
+private:
+    driver::ThroughputStats* _stats;
+    std::chrono::steady_clock::time_point _start;
+};
+} // namespace
+
 Result<spicy::rt::ParsedUnit> Driver::processInput(const spicy::rt::Parser& parser, std::istream& in, int increment) {
     if ( ! hilti::rt::isInitialized() )
         return Error("runtime not initialized");
@@ -168,6 +437,7 @@ Result<spicy::rt::ParsedUnit> Driver::processInput(const spicy::rt::Parser& pars
     DRIVER_DEBUG_STATS(data);
 
     hilti::rt::ValueReference<spicy::rt::ParsedUnit> unit;
+    auto* stats = throughputStats(parser);
 
     while ( in.good() && ! in.eof() ) {
         auto len = (increment > 0 ? increment : sizeof(buffer));
@@ -177,24 +447,43 @@ Result<spicy::rt::ParsedUnit> Driver::processInput(const spicy::rt::Parser& pars
                 {
             auto profiler = hilti::rt::profiler::start(fmt("spicy/prepare/input/%s", parser.name));
 
-            if ( auto n = in.gcount() )
+            if ( auto n = in.gcount() ) {
                 data->append(hilti::rt::Bytes(buffer, n));
 
+                if ( stats )
+                    stats->recordInput(n);
+            }
+
             if ( in.peek() == EOF )
                 data->freeze();
         }
-        if ( ! r ) {
-            DRIVER_DEBUG(fmt("beginning parsing input (eod=%s)", data->isFrozen()));
-            r = parser.parse3(unit, data, {}, {});
-        }
-        else {
-            DRIVER_DEBUG(fmt("resuming parsing input (eod=%s)", data->isFrozen()));
-            r->resume();
+        try {
+            ResumeTimer timer(stats);
+
+            if ( ! r ) {
+                DRIVER_DEBUG(fmt("beginning parsing input (eod=%s)", data->isFrozen()));
+                r = parser.parse3(unit, data, {}, {});
+            }
+            else {
+                DRIVER_DEBUG(fmt("resuming parsing input (eod=%s)", data->isFrozen()));
+                r->resume();
+            }
+        } catch ( const hilti::rt::Exception& ) {
+            if ( stats )
+                stats->recordError();
+
+            throw;
         }
 
+        _tickThroughput();
+
         if ( *r ) {
             DRIVER_DEBUG(fmt("finished parsing input (eod=%s)", data->isFrozen()));
             DRIVER_DEBUG_STATS(data);
+
+            if ( stats )
+                stats->recordUnit();
+
             break;
         }
         else {
@@ -230,7 +519,8 @@ std::optional<hilti::rt::stream::Offset> driver::ParsingState::finish() {
         return {};
 }
 
-driver::ParsingState::State driver::ParsingState::_process(size_t size, const char* data, bool eod) {
+driver::ParsingState::State driver::ParsingState::_process(size_t size, const char* data, bool eod,
+                                                           std::vector<hilti::rt::stream::Byte>* owned) {
     assert(size == 0 || ! eod);
 
     if ( ! _parser ) {
@@ -253,9 +543,17 @@ driver::ParsingState::State driver::ParsingState::_process(size_t size, const ch
                 DRIVER_DEBUG("block", size, data);
                 auto profiler = hilti::rt::profiler::start(fmt("spicy/prepare/block/%s", _parser->name));
 
-                auto input = hilti::rt::reference::make_value<hilti::rt::Stream>(data, size);
+                auto input = hilti::rt::reference::make_value<hilti::rt::Stream>();
+                if ( owned )
+                    input->append(std::move(*owned));
+                else
+                    input->append(data, size);
+
                 input->freeze();
 
+                if ( _stats && data )
+                    _stats->recordInput(size);
+
                 if ( ! _parser->parse1 )
                     throw InvalidUnitType(
                         fmt("unit type '%s' cannot be used as external entry point because it requires arguments",
@@ -270,11 +568,17 @@ driver::ParsingState::State driver::ParsingState::_process(size_t size, const ch
 
                 hilti::rt::profiler::stop(profiler);
 
-                _resumable = _parser->parse1(input, {}, _context);
+                {
+                    ResumeTimer timer(_stats);
+                    _resumable = _parser->parse1(input, {}, _context);
+                }
 
                 if ( ! *_resumable )
                     hilti::rt::internalError("block-based parsing yielded");
 
+                if ( _stats )
+                    _stats->recordUnit();
+
                 return Done;
             }
 
@@ -301,16 +605,26 @@ driver::ParsingState::State driver::ParsingState::_process(size_t size, const ch
                             DRIVER_DEBUG("no context provided");
                     }
 
-                    _input = hilti::rt::reference::make_value<hilti::rt::Stream>(data, size);
+                    _input = hilti::rt::reference::make_value<hilti::rt::Stream>();
+                    if ( owned )
+                        (*_input)->append(std::move(*owned));
+                    else
+                        (*_input)->append(data, size);
+
                     if ( eod )
                         (*_input)->freeze();
 
+                    if ( _stats && data )
+                        _stats->recordInput(size);
+
                     if ( ! _parser->parse1 )
                         throw InvalidUnitType(
                             fmt("unit type '%s' cannot be used as external entry point because it requires arguments",
                                 _parser->name));
 
                     hilti::rt::profiler::stop(profiler);
+
+                    ResumeTimer timer(_stats);
                     _resumable = _parser->parse1(*_input, {}, _context);
                 }
 
@@ -318,7 +632,9 @@ driver::ParsingState::State driver::ParsingState::_process(size_t size, const ch
                     // Resume parsing.
                     assert(_input && _resumable);
 
-                    if ( size )
+                    if ( owned )
+                        (*_input)->append(std::move(*owned));
+                    else if ( size )
                         (*_input)->append(data, size);
 
                     if ( eod ) {
@@ -328,7 +644,19 @@ driver::ParsingState::State driver::ParsingState::_process(size_t size, const ch
                     else
                         DRIVER_DEBUG("next data chunk", size, data);
 
+                    if ( _stats && data )
+                        _stats->recordInput(size);
+
                     hilti::rt::profiler::stop(profiler);
+
+                    if ( ! eod && (*_input)->isDiscarding() ) {
+                        // The parser is skipping over data that's being
+                        // discarded, no need to resume it yet.
+                        DRIVER_DEBUG("data chunk discarded");
+                        return Continue;
+                    }
+
+                    ResumeTimer timer(_stats);
                     _resumable->resume();
                 }
 
@@ -336,6 +664,10 @@ driver::ParsingState::State driver::ParsingState::_process(size_t size, const ch
                     // Done parsing.
                     _done = true;
                     DRIVER_DEBUG("parsing finished");
+
+                    if ( _stats )
+                        _stats->recordUnit();
+
                     return Done;
                 }
                 else {
@@ -349,122 +681,791 @@ driver::ParsingState::State driver::ParsingState::_process(size_t size, const ch
     } catch ( const hilti::rt::Exception& e ) {
         DRIVER_DEBUG(e.what());
         _done = true;
+
+        if ( _stats )
+            _stats->recordError();
+
         throw;
     }
 
     hilti::rt::cannot_be_reached();
 }
 
-Result<hilti::rt::Nothing> Driver::processPreBatchedInput(std::istream& in) {
-    std::string magic;
-    std::getline(in, magic);
-
-    if ( magic != std::string("!spicy-batch v2") )
-        return hilti::rt::result::Error("input is not a v2 Spicy batch file");
+namespace spicy::rt::driver::detail {
+
+/**
+ * Output recorded for one flow or connection while processing a batch with
+ * worker threads, so that it can be emitted in a deterministic order.
+ */
+struct BatchOutput {
+    std::stringstream out;          /**< output recorded so far */
+    std::atomic<bool> done = false; /**< set once the flow or connection is gone and no further output will follow */
+};
+
+/** A single command read from a batch file. */
+struct BatchCommand {
+    enum class Type { BeginFlow, BeginConnection, Data, Gap, EndFlow, EndConnection };
+
+    Type type;
+    ParsingType parsing_type = ParsingType::Stream; /**< for `BeginFlow`/`BeginConnection` */
+    uint64_t handle = 0;      /**< interned flow ID, or connection ID for connection commands */
+    std::string id;           /**< textual flow or connection ID, for `BeginFlow`/`BeginConnection` */
+    std::string parser;       /**< for `BeginFlow` */
+    uint64_t orig_handle = 0; /**< for `BeginConnection` */
+    std::string orig_id;      /**< for `BeginConnection` */
+    std::string orig_parser;  /**< for `BeginConnection` */
+    uint64_t resp_handle = 0; /**< for `BeginConnection` */
+    std::string resp_id;      /**< for `BeginConnection` */
+    std::string resp_parser;  /**< for `BeginConnection` */
+    size_t size = 0;          /**< for `Data`/`Gap` */
+    std::vector<hilti::rt::stream::Byte> data; /**< for `Data`; moved into the flow's input when parsed */
+    BatchOutput* output = nullptr; /**< for `BeginFlow`/`BeginConnection` if output is to be recorded */
+};
+
+/**
+ * Parsing state for a set of flows and connections from a batch, all
+ * processed by the same thread. The state enforces the driver's flow
+ * limits.
+ */
+class BatchState {
+public:
+    /**
+     * Constructor.
+     *
+     * @param driver driver owning the state
+     * @param shares number of states splitting the driver's flow limits between them
+     */
+    BatchState(Driver* driver, unsigned int shares = 1);
+
+    /**
+     * Executes a single command on the state, moving the command's data
+     * into the corresponding flow's input.
+     */
+    void execute(BatchCommand&& cmd) { _execute(cmd, true); }
+
+    /**
+     * Executes a single command on the state, copying the command's data
+     * into the corresponding flow's input. That leaves the command's
+     * buffer to the caller for reuse.
+     */
+    void execute(BatchCommand& cmd) { _execute(cmd, false); }
+
+    /**
+     * Evicts a flow that has become idle, as determined by the caller. Does
+     * nothing if the flow does not exist.
+     */
+    void expire(uint64_t handle) { _evict(handle, Eviction::Idle); }
+
+    /**
+     * Sets a callback to execute for every flow that the state evicts. The
+     * callback receives the flow's handle, plus the handle of its
+     * connection if that's gone now as well.
+     */
+    void onEviction(std::function<void(uint64_t, std::optional<uint64_t>)> callback) {
+        _on_eviction = std::move(callback);
+    }
 
-    std::unordered_map<std::string, driver::ParsingStateForDriver> flows;
-    std::unordered_map<std::string, driver::ConnectionState> connections;
+    /** Records the current state to the driver's debug stream. */
+    void debugStats() { DRIVER_DEBUG_STATS(_flows.size(), _connections.size()); }
 
-    // Helper to add flows to the map.
-    auto create_state = [&](driver::ParsingType type, const std::string& parser_name, const std::string& id,
-                            std::optional<std::string> cid, std::optional<UnitContext> context) {
-        if ( auto parser = lookupParser(parser_name) ) {
-            if ( ! context )
-                context = (*parser)->createContext();
+private:
+    enum class Eviction { MaxFlows, MaxFlowBytes, MaxTotalBytes, Idle };
 
-            auto x = flows.insert_or_assign(id, driver::ParsingStateForDriver(type, *parser, id, std::move(cid),
-                                                                              context, this));
-            if ( x.second )
-                _total_flows++;
+    struct Flow {
+        ParsingStateForDriver state;
+        BatchOutput* output = nullptr;      // output to record to, if any
+        bool owns_output = false;           // if true, output is done once the flow goes away
+        std::optional<uint64_t> connection; // handle of the connection the flow belongs to, if any
+        uint64_t buffered = 0;              // input bytes buffered as of the flow's most recent input
+        std::list<uint64_t>::iterator lru;  // position in `_lru`
+    };
 
-            return std::make_pair(x.first, std::move(context));
-        }
-        else {
-            DRIVER_DEBUG(hilti::rt::fmt("no parser for ID %s, skipping", id));
-            return std::make_pair(flows.end(), std::optional<UnitContext>{});
-        }
+    struct Connection {
+        ConnectionState state;
+        uint64_t orig_handle = 0;
+        uint64_t resp_handle = 0;
+        BatchOutput* output = nullptr; // output to record to, if any
     };
 
-    while ( in.good() && ! in.eof() ) {
-        std::string cmd;
-        std::getline(in, cmd);
-        cmd = hilti::rt::trim(cmd);
+    using FlowMap = std::unordered_map<uint64_t, Flow>;
 
-        if ( cmd.empty() )
-            continue;
+    std::pair<FlowMap::iterator, std::optional<UnitContext>> _createFlow(ParsingType type,
+                                                                         const std::string& parser_name,
+                                                                         uint64_t handle, const std::string& id,
+                                                                         std::optional<std::string> cid,
+                                                                         std::optional<UnitContext> context,
+                                                                         BatchOutput* output, bool owns_output);
+    void _eraseFlow(uint64_t handle);
 
-        auto m = hilti::rt::split(cmd);
-        if ( m[0] == "@begin-flow" ) {
-            // @begin-flow <id> <parser> <type>
-            if ( m.size() != 4 )
-                return hilti::rt::result::Error("unexpected number of argument for @begin-flow");
+    void _execute(BatchCommand& cmd, bool move_data);
+
+    template<typename Function>
+    void _run(Flow& flow, Function f);
+
+    // Marks a flow as having received input.
+    void _touch(Flow& flow) { _lru.splice(_lru.end(), _lru, flow.lru); }
+
+    // Updates a flow's buffered bytes after input, evicting flows if that exceeds a limit.
+    void _account(FlowMap::iterator f);
+
+    // Evicts least recently active flows until `n` more flows fit into the limit.
+    void _makeRoom(size_t n);
+
+    void _evict(uint64_t handle, Eviction reason);
+
+    static void _release(BatchOutput* output) {
+        if ( output )
+            output->done.store(true, std::memory_order_release);
+    }
+
+    void debug(const std::string& msg) { _driver->debug(msg); }
+    void _debugStats(size_t current_flows, size_t current_connections) {
+        _driver->_debugStats(current_flows, current_connections);
+    }
+
+    Driver* _driver;
+    FlowMap _flows;
+    std::unordered_map<uint64_t, Connection> _connections;
+
+    driver::FlowLimits _limits;
+    bool _track_bytes = false;    // true if a limit requires tracking buffered bytes
+    uint64_t _total_buffered = 0; // sum of all flows' buffered bytes
+    std::list<uint64_t> _lru;     // flow handles, least recently active first
 
-            auto id = std::string(m[1]);
-            auto parser_name = std::string(m[3]);
+    std::function<void(uint64_t, std::optional<uint64_t>)> _on_eviction;
+};
 
-            driver::ParsingType type;
+/** Worker thread processing the commands for a share of a batch's flows. */
+class BatchWorker {
+public:
+    /** Max. number of command vectors queued before `push()` blocks. */
+    static constexpr size_t MaxQueueSize = 64;
+
+    BatchWorker(Driver* driver, unsigned int shares) {
+        _thread = std::thread([this, driver, shares]() { _run(driver, shares); });
+    }
+
+    ~BatchWorker() {
+        if ( _thread.joinable() )
+            finish();
+    }
+
+    BatchWorker(const BatchWorker&) = delete;
+    BatchWorker(BatchWorker&&) = delete;
+    BatchWorker& operator=(const BatchWorker&) = delete;
+    BatchWorker& operator=(BatchWorker&&) = delete;
+
+    /**
+     * Queues commands for execution, blocking while the queue is full.
+     * Returns false if the worker has terminated with an exception.
+     */
+    bool push(std::vector<BatchCommand> commands);
+
+    /**
+     * Waits for all queued commands to be executed and terminates the
+     * thread. Returns any exception the worker terminated with.
+     */
+    std::exception_ptr finish();
+
+    /**
+     * Returns the flows that the worker has evicted since the last call,
+     * each with its connection if that's gone now as well.
+     */
+    std::vector<std::pair<uint64_t, std::optional<uint64_t>>> takeEvicted() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return std::exchange(_evicted, {});
+    }
+
+private:
+    void _run(Driver* driver, unsigned int shares);
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::vector<BatchCommand>> _queue;
+    std::vector<std::pair<uint64_t, std::optional<uint64_t>>> _evicted;
+    bool _done = false;
+    std::exception_ptr _exception;
+    std::thread _thread;
+};
+
+} // namespace spicy::rt::driver::detail
+
+using driver::detail::BatchCommand;
+using driver::detail::BatchOutput;
+using driver::detail::BatchState;
+using driver::detail::BatchWorker;
+
+BatchState::BatchState(Driver* driver, unsigned int shares) : _driver(driver), _limits(driver->flowLimits()) {
+    if ( shares > 1 ) {
+        if ( _limits.max_flows )
+            _limits.max_flows = std::max(_limits.max_flows / shares, static_cast<uint64_t>(1));
+
+        if ( _limits.max_total_bytes )
+            _limits.max_total_bytes = std::max(_limits.max_total_bytes / shares, static_cast<uint64_t>(1));
+    }
+
+    _track_bytes = (_limits.max_flow_bytes || _limits.max_total_bytes);
+}
 
-            if ( m[2] == "stream" )
-                type = driver::ParsingType::Stream;
-            else if ( m[2] == "block" )
-                type = driver::ParsingType::Block;
-            else
-                return hilti::rt::result::Error(hilti::rt::fmt("unknown session type '%s'", m[2]));
+std::pair<BatchState::FlowMap::iterator, std::optional<UnitContext>> BatchState::_createFlow(
+    driver::ParsingType type, const std::string& parser_name, uint64_t handle, const std::string& id,
+    std::optional<std::string> cid, std::optional<UnitContext> context, BatchOutput* output, bool owns_output) {
+    if ( auto parser = _driver->lookupParser(parser_name) ) {
+        if ( ! context )
+            context = (*parser)->createContext();
 
+        // A flow reusing an existing handle replaces the old one.
+        _eraseFlow(handle);
 
-            create_state(type, parser_name, id, {}, {});
+        auto x = _flows.emplace(handle, Flow{.state = driver::ParsingStateForDriver(type, *parser, id, std::move(cid),
+                                                                                 context, _driver),
+                                         .output = output,
+                                         .owns_output = owns_output});
+        _driver->_total_flows++;
+
+        auto& flow = x.first->second;
+        flow.state.setThroughputStats(_driver->throughputStats(**parser));
+        flow.lru = _lru.insert(_lru.end(), handle);
+
+        return std::make_pair(x.first, std::move(context));
+    }
+    else {
+        DRIVER_DEBUG(hilti::rt::fmt("no parser for ID %s, skipping", id));
+        return std::make_pair(_flows.end(), std::optional<UnitContext>{});
+    }
+}
+
+void BatchState::_eraseFlow(uint64_t handle) {
+    if ( auto f = _flows.find(handle); f != _flows.end() ) {
+        if ( f->second.owns_output )
+            _release(f->second.output);
+
+        _total_buffered -= f->second.buffered;
+        _lru.erase(f->second.lru);
+        _flows.erase(f);
+    }
+}
+
+void BatchState::_account(FlowMap::iterator f) {
+    auto handle = f->first;
+    auto buffered = f->second.state.bufferedBytes();
+    _total_buffered = _total_buffered - f->second.buffered + buffered;
+    f->second.buffered = buffered;
+
+    if ( _limits.max_flow_bytes && buffered > _limits.max_flow_bytes )
+        _evict(handle, Eviction::MaxFlowBytes);
+
+    while ( _limits.max_total_bytes && _total_buffered > _limits.max_total_bytes && ! _lru.empty() )
+        _evict(_lru.front(), Eviction::MaxTotalBytes);
+}
+
+void BatchState::_makeRoom(size_t n) {
+    if ( ! _limits.max_flows )
+        return;
+
+    while ( _flows.size() + n > _limits.max_flows && ! _lru.empty() )
+        _evict(_lru.front(), Eviction::MaxFlows);
+}
+
+void BatchState::_evict(uint64_t handle, Eviction reason) {
+    auto f = _flows.find(handle);
+    if ( f == _flows.end() )
+        return;
+
+    switch ( reason ) {
+        case Eviction::MaxFlows: _driver->_evicted_max_flows++; break;
+        case Eviction::MaxFlowBytes: _driver->_evicted_max_flow_bytes++; break;
+        case Eviction::MaxTotalBytes: _driver->_evicted_max_total_bytes++; break;
+        case Eviction::Idle: _driver->_evicted_idle++; break;
+    }
+
+    DRIVER_DEBUG(hilti::rt::fmt("evicting flow %s", f->second.state.id()));
+
+    // With `skip_evicted`, the flow just goes away without finishing.
+    if ( ! _limits.skip_evicted )
+        _run(f->second, [](auto& state) { state.finish(); });
+
+    auto connection = f->second.connection;
+    _eraseFlow(handle);
+
+    std::optional<uint64_t> connection_done;
+
+    // Once both of its flows are gone, the connection is done as well.
+    if ( auto c = (connection ? _connections.find(*connection) : _connections.end()); c != _connections.end() ) {
+        if ( c->second.orig_handle == handle )
+            c->second.state.orig_state = nullptr;
+
+        if ( c->second.resp_handle == handle )
+            c->second.state.resp_state = nullptr;
+
+        if ( _flows.find(c->second.orig_handle) == _flows.end() &&
+             _flows.find(c->second.resp_handle) == _flows.end() ) {
+            _release(c->second.output);
+            _connections.erase(c);
+            connection_done = connection;
         }
-        else if ( m[0] == "@begin-conn" ) {
-            // @begin-conn <conn-id> <type> <orig-id> <orig-parser> <resp-id> <resp-parser>
-            if ( m.size() != 7 )
-                return hilti::rt::result::Error("unexpected number of argument for @begin-conn");
+    }
+
+    if ( _on_eviction )
+        _on_eviction(handle, connection_done);
+}
+
+template<typename Function>
+void BatchState::_run(Flow& flow, Function f) {
+    // Route any output of the parser into the flow's output, if we're
+    // recording it.
+    struct OutputSetter {
+        OutputSetter(std::ostream* out) : ctx(hilti::rt::context::detail::get()), old(ctx->cout) {
+            if ( out )
+                ctx->cout = out;
+        }
+
+        ~OutputSetter() { ctx->cout = old; }
+
+        hilti::rt::Context* ctx;
+        std::ostream* old;
+    };
+
+    auto* out = (flow.output ? &flow.output->out : nullptr);
+    OutputSetter _(out);
+
+    try {
+        f(flow.state);
+    } catch ( const hilti::rt::Exception& e ) {
+        (out ? *out : std::cout) << hilti::rt::fmt("error for ID %s: %s\n", flow.state.id(), e.what());
+    }
+}
 
-            auto cid = std::string(m[1]);
-            auto orig_id = std::string(m[3]);
-            auto orig_parser_name = std::string(m[4]);
-            auto resp_id = std::string(m[5]);
-            auto resp_parser_name = std::string(m[6]);
+void BatchState::_execute(BatchCommand& cmd, bool move_data) {
+    switch ( cmd.type ) {
+        case BatchCommand::Type::BeginFlow: {
+            _makeRoom(1);
 
-            driver::ParsingType type;
+            if ( auto [x, ctx] =
+                     _createFlow(cmd.parsing_type, cmd.parser, cmd.handle, cmd.id, {}, {}, cmd.output, true);
+                 x == _flows.end() )
+                _release(cmd.output);
 
-            if ( m[2] == "stream" )
-                type = driver::ParsingType::Stream;
-            else if ( m[2] == "block" )
-                type = driver::ParsingType::Block;
-            else
-                return hilti::rt::result::Error(hilti::rt::fmt("unknown session type '%s'", m[2]));
+            break;
+        }
 
-            if ( connections.find(cid) != connections.end() ) {
+        case BatchCommand::Type::BeginConnection: {
+            if ( _connections.find(cmd.handle) != _connections.end() ) {
                 // already exists, ignore
-                DRIVER_DEBUG(hilti::rt::fmt("connection %s exists, skipping", cid));
-                continue;
+                DRIVER_DEBUG(hilti::rt::fmt("connection %s exists, skipping", cmd.id));
+                _release(cmd.output);
+                break;
             }
 
+            _makeRoom(2);
+
             driver::ParsingStateForDriver* orig_state = nullptr;
             driver::ParsingStateForDriver* resp_state = nullptr;
 
             std::optional<UnitContext> context;
 
-            if ( auto [x, ctx] = create_state(type, orig_parser_name, orig_id, cid, context); x != flows.end() ) {
-                orig_state = &x->second;
+            if ( auto [x, ctx] = _createFlow(cmd.parsing_type, cmd.orig_parser, cmd.orig_handle, cmd.orig_id, cmd.id,
+                                             context, cmd.output, false);
+                 x != _flows.end() ) {
+                orig_state = &x->second.state;
                 context = std::move(ctx);
             }
 
-            if ( auto [x, ctx] = create_state(type, resp_parser_name, resp_id, cid, context); x != flows.end() )
-                resp_state = &x->second;
+            if ( auto [x, ctx] = _createFlow(cmd.parsing_type, cmd.resp_parser, cmd.resp_handle, cmd.resp_id, cmd.id,
+                                             context, cmd.output, false);
+                 x != _flows.end() )
+                resp_state = &x->second.state;
 
             if ( ! (orig_state && resp_state) ) {
                 // cannot get parsers, ignore
-                flows.erase(orig_id);
-                flows.erase(resp_id);
-                continue;
+                _eraseFlow(cmd.orig_handle);
+                _eraseFlow(cmd.resp_handle);
+                _release(cmd.output);
+                break;
+            }
+
+            _connections[cmd.handle] = Connection{.state = driver::ConnectionState{.orig_id = cmd.orig_id,
+                                                                                   .resp_id = cmd.resp_id,
+                                                                                   .orig_state = orig_state,
+                                                                                   .resp_state = resp_state},
+                                                  .orig_handle = cmd.orig_handle,
+                                                  .resp_handle = cmd.resp_handle,
+                                                  .output = cmd.output};
+            _flows.at(cmd.orig_handle).connection = cmd.handle;
+            _flows.at(cmd.resp_handle).connection = cmd.handle;
+            _driver->_total_connections++;
+            break;
+        }
+
+        case BatchCommand::Type::Data: {
+            if ( auto s = _flows.find(cmd.handle); s != _flows.end() ) {
+                _touch(s->second);
+                _run(s->second, [&](auto& state) {
+                    if ( move_data )
+                        state.process(std::move(cmd.data));
+                    else
+                        state.process(cmd.data.size(), reinterpret_cast<const char*>(cmd.data.data()));
+                });
+
+                if ( _track_bytes )
+                    _account(s);
+            }
+
+            break;
+        }
+
+        case BatchCommand::Type::Gap: {
+            if ( auto s = _flows.find(cmd.handle); s != _flows.end() ) {
+                _touch(s->second);
+                _run(s->second, [&](auto& state) { state.process(cmd.size, nullptr); });
+            }
+
+            break;
+        }
+
+        case BatchCommand::Type::EndFlow: {
+            if ( auto s = _flows.find(cmd.handle); s != _flows.end() ) {
+                _run(s->second, [](auto& state) { state.finish(); });
+                _eraseFlow(cmd.handle);
+                DRIVER_DEBUG_STATS(_flows.size(), _connections.size());
+            }
+
+            break;
+        }
+
+        case BatchCommand::Type::EndConnection: {
+            if ( auto c = _connections.find(cmd.handle); c != _connections.end() ) {
+                // Look the flows up by handle, they may have been ended individually already.
+                for ( auto handle : {c->second.orig_handle, c->second.resp_handle} ) {
+                    if ( auto s = _flows.find(handle); s != _flows.end() )
+                        _run(s->second, [](auto& state) { state.finish(); });
+                }
+
+                _eraseFlow(c->second.orig_handle);
+                _eraseFlow(c->second.resp_handle);
+                _release(c->second.output);
+                _connections.erase(c);
+                DRIVER_DEBUG_STATS(_flows.size(), _connections.size());
+            }
+
+            break;
+        }
+    }
+}
+
+bool BatchWorker::push(std::vector<BatchCommand> commands) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [this]() { return _queue.size() < MaxQueueSize || _exception; });
+
+    if ( _exception )
+        return false;
+
+    _queue.emplace_back(std::move(commands));
+    _cv.notify_all();
+    return true;
+}
+
+std::exception_ptr BatchWorker::finish() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _done = true;
+    }
+
+    _cv.notify_all();
+    _thread.join();
+    return _exception;
+}
+
+void BatchWorker::_run(Driver* driver, unsigned int shares) {
+    try {
+        hilti::rt::context::ThreadContext context;
+        BatchState state(driver, shares);
+
+        state.onEviction([this](uint64_t flow, std::optional<uint64_t> connection) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _evicted.emplace_back(flow, connection);
+        });
+
+        while ( true ) {
+            std::vector<BatchCommand> commands;
+
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [this]() { return ! _queue.empty() || _done; });
+
+                if ( _queue.empty() )
+                    break; // done
+
+                commands = std::move(_queue.front());
+                _queue.pop_front();
             }
 
-            connections[cid] = driver::ConnectionState{.orig_id = orig_id,
-                                                       .resp_id = resp_id,
-                                                       .orig_state = orig_state,
-                                                       .resp_state = resp_state};
-            _total_connections++;
+            _cv.notify_all();
+
+            for ( auto& cmd : commands )
+                state.execute(std::move(cmd));
+        }
+
+        state.debugStats();
+    } catch ( ... ) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _exception = std::current_exception();
+        _queue.clear();
+        _cv.notify_all();
+    }
+}
+
+// Little-endian encoding of integers in v3 batches.
+template<typename T>
+static void appendUInt(std::string* out, T x) {
+    for ( size_t i = 0; i < sizeof(T); i++ )
+        out->push_back(static_cast<char>((x >> (8 * i)) & 0xff));
+}
+
+template<typename T>
+static T decodeUInt(const char* p) {
+    T x = 0;
+    for ( size_t i = 0; i < sizeof(T); i++ )
+        x |= static_cast<T>(static_cast<uint8_t>(p[i])) << (8 * i);
+
+    return x;
+}
+
+// Reads the header of the next v3 record. Returns false at the end of input.
+static Result<bool> readRecordHeader(std::istream& in, driver::batch::RecordType* type, uint32_t* id, uint32_t* len) {
+    char header[driver::batch::RecordHeaderSize];
+    in.read(header, sizeof(header));
+
+    if ( in.gcount() == 0 )
+        return false;
+
+    if ( in.gcount() != sizeof(header) )
+        return hilti::rt::result::Error("premature end of batch record");
+
+    *type = static_cast<driver::batch::RecordType>(header[0]);
+    *id = decodeUInt<uint32_t>(header + 1);
+    *len = decodeUInt<uint32_t>(header + 5);
+    return true;
+}
+
+Result<bool> driver::batch::readRecord(std::istream& in, RecordType* type, uint32_t* id, std::string* body) {
+    uint32_t len = 0;
+    auto x = readRecordHeader(in, type, id, &len);
+    if ( ! x || ! *x || *type == RecordType::Index )
+        return x ? Result<bool>(false) : x;
+
+    body->resize(len);
+    if ( len && ! in.read(body->data(), static_cast<std::streamsize>(len)) )
+        return hilti::rt::result::Error("premature end of batch record");
+
+    return true;
+}
+
+Result<std::vector<driver::batch::IndexEntry>> driver::batch::readIndex(std::istream& in) {
+    char trailer[TrailerSize];
+
+    if ( ! in.seekg(-static_cast<std::streamoff>(sizeof(trailer)), std::ios::end) ||
+         ! in.read(trailer, sizeof(trailer)) || std::string_view(trailer + 8, IndexMagic.size()) != IndexMagic )
+        return hilti::rt::result::Error("batch does not have an index");
+
+    RecordType type;
+    uint32_t id = 0;
+    uint32_t len = 0;
+
+    if ( ! in.seekg(static_cast<std::streamoff>(decodeUInt<uint64_t>(trailer))) )
+        return hilti::rt::result::Error("invalid batch index");
+
+    if ( auto x = readRecordHeader(in, &type, &id, &len); ! (x && *x) || type != RecordType::Index ||
+                                                           len % IndexEntrySize != 0 )
+        return hilti::rt::result::Error("invalid batch index");
+
+    std::string data(len, '\0');
+    if ( len && ! in.read(data.data(), static_cast<std::streamsize>(len)) )
+        return hilti::rt::result::Error("premature end of batch index");
+
+    std::vector<IndexEntry> entries;
+    entries.reserve(len / IndexEntrySize);
+
+    for ( size_t i = 0; i < len; i += IndexEntrySize )
+        entries.push_back(IndexEntry{.type = static_cast<RecordType>(data[i]),
+                                     .id = decodeUInt<uint32_t>(data.data() + i + 1),
+                                     .offset = decodeUInt<uint64_t>(data.data() + i + 5)});
+
+    return entries;
+}
+
+/** Reads the commands of a batch in either v2 or v3 format. */
+class BatchReader {
+public:
+    BatchReader(std::istream& in) : _in(in) {}
+
+    /** Reads the batch's magic line to determine the format. */
+    Result<hilti::rt::Nothing> readMagic();
+
+    /**
+     * Reads the next command from the batch. The command object may be
+     * reused across calls, which avoids reallocating its buffers. Flow and
+     * connection IDs are interned into handles; in v3 these are the IDs
+     * themselves, and textual IDs are filled in only for commands beginning
+     * a flow or connection.
+     *
+     * @return true if a command was read, false at the end of input
+     */
+    Result<bool> next(BatchCommand* cmd) { return _version == 3 ? _nextV3(cmd) : _nextV2(cmd); }
+
+    /**
+     * Forgets about an evicted flow, and its connection if given, so that
+     * later commands using their IDs no longer refer to them.
+     */
+    void release(uint64_t flow, std::optional<uint64_t> connection);
+
+private:
+    Result<bool> _nextV2(BatchCommand* cmd);
+    Result<bool> _nextV3(BatchCommand* cmd);
+
+    static Result<driver::ParsingType> _parseType(std::string_view t) {
+        if ( t == "stream" )
+            return driver::ParsingType::Stream;
+        else if ( t == "block" )
+            return driver::ParsingType::Block;
+        else
+            return hilti::rt::result::Error(hilti::rt::fmt("unknown session type '%s'", t));
+    }
+
+    // Handle for v2 IDs that haven't been begun; it never matches any flow or connection.
+    static constexpr uint64_t UnknownHandle = std::numeric_limits<uint64_t>::max();
+
+    using Handles = std::unordered_map<std::string, uint64_t>;
+    using IDs = std::unordered_map<uint64_t, std::string>;
+
+    // Assigns a new handle to a v2 ID. Like with v3 input, a flow begun
+    // again under an ID that's still in use becomes a separate flow, so that
+    // a handle never gets reused. Leaves the ID in `_key`.
+    uint64_t _begin(Handles* handles, IDs* ids, std::string_view id) {
+        _key.assign(id);
+        auto handle = _next_handle++;
+        (*handles)[_key] = handle;
+        ids->emplace(handle, _key);
+        return handle;
+    }
+
+    // Removes a handle's ID mapping, unless the ID has been reused already.
+    static void _forget(Handles* handles, IDs* ids, uint64_t handle) {
+        if ( auto i = ids->find(handle); i != ids->end() ) {
+            if ( auto h = handles->find(i->second); h != handles->end() && h->second == handle )
+                handles->erase(h);
+
+            ids->erase(i);
+        }
+    }
+
+    // Removes the ID mappings of a connection and its flows.
+    void _forgetConnection(uint64_t handle);
+
+    // Returns the handle for a v2 ID, or `UnknownHandle` if it's not known.
+    // Leaves the ID in `_key`.
+    uint64_t _lookup(const Handles& handles, std::string_view id) {
+        _key.assign(id);
+        auto i = handles.find(_key);
+        return i != handles.end() ? i->second : UnknownHandle;
+    }
+
+    std::istream& _in;
+    int _version = 0;
+    std::string _buffer; // scratch space for v3 record bodies, and v2 lines
+    std::string _key;    // scratch space for looking up v2 IDs
+
+    Handles _flow_handles;       // v2 IDs of active flows to their handles
+    IDs _flow_ids;               // reverse of `_flow_handles`, including flows whose ID has been reused
+    Handles _connection_handles; // v2 IDs of active connections to their handles
+    IDs _connection_ids;         // reverse of `_connection_handles`, including connections whose ID has been reused
+    std::unordered_map<uint64_t, std::array<uint64_t, 2>> _connection_flows; // flow handles of each connection
+    uint64_t _next_handle = 0;
+};
+
+Result<hilti::rt::Nothing> BatchReader::readMagic() {
+    std::string magic;
+    std::getline(_in, magic);
+
+    if ( magic == driver::batch::MagicV2 )
+        _version = 2;
+    else if ( magic == driver::batch::MagicV3 )
+        _version = 3;
+    else
+        return hilti::rt::result::Error("input is not a v2 or v3 Spicy batch file");
+
+    return hilti::rt::Nothing();
+}
+
+void BatchReader::release(uint64_t flow, std::optional<uint64_t> connection) {
+    // For v3 input, handles are the IDs themselves.
+    if ( _version != 2 )
+        return;
+
+    _forget(&_flow_handles, &_flow_ids, flow);
+
+    if ( connection )
+        _forgetConnection(*connection);
+}
+
+void BatchReader::_forgetConnection(uint64_t handle) {
+    _forget(&_connection_handles, &_connection_ids, handle);
+
+    if ( auto c = _connection_flows.find(handle); c != _connection_flows.end() ) {
+        for ( auto flow : c->second )
+            _forget(&_flow_handles, &_flow_ids, flow);
+
+        _connection_flows.erase(c);
+    }
+}
+
+Result<bool> BatchReader::_nextV2(BatchCommand* cmd) {
+    while ( _in.good() && ! _in.eof() ) {
+        std::getline(_in, _buffer);
+        auto line = hilti::rt::trim(_buffer);
+
+        if ( line.empty() )
+            continue;
+
+        cmd->output = nullptr;
+
+        auto m = hilti::rt::split(line);
+        if ( m[0] == "@begin-flow" ) {
+            // @begin-flow <id> <parser> <type>
+            if ( m.size() != 4 )
+                return hilti::rt::result::Error("unexpected number of argument for @begin-flow");
+
+            auto type = _parseType(m[2]);
+            if ( ! type )
+                return type.error();
+
+            cmd->type = BatchCommand::Type::BeginFlow;
+            cmd->parsing_type = *type;
+            cmd->handle = _begin(&_flow_handles, &_flow_ids, m[1]);
+            cmd->id = _key;
+            cmd->parser = m[3];
+        }
+        else if ( m[0] == "@begin-conn" ) {
+            // @begin-conn <conn-id> <type> <orig-id> <orig-parser> <resp-id> <resp-parser>
+            if ( m.size() != 7 )
+                return hilti::rt::result::Error("unexpected number of argument for @begin-conn");
+
+            auto type = _parseType(m[2]);
+            if ( ! type )
+                return type.error();
+
+            cmd->type = BatchCommand::Type::BeginConnection;
+            cmd->parsing_type = *type;
+            cmd->handle = _begin(&_connection_handles, &_connection_ids, m[1]);
+            cmd->id = _key;
+            cmd->orig_handle = _begin(&_flow_handles, &_flow_ids, m[3]);
+            cmd->orig_id = _key;
+            cmd->orig_parser = m[4];
+            cmd->resp_handle = _begin(&_flow_handles, &_flow_ids, m[5]);
+            cmd->resp_id = _key;
+            cmd->resp_parser = m[6];
+
+            _connection_flows[cmd->handle] = {cmd->orig_handle, cmd->resp_handle};
         }
         else if ( m[0] == "@data" ) {
             // @data <id> <size>
@@ -472,93 +1473,527 @@ Result<hilti::rt::Nothing> Driver::processPreBatchedInput(std::istream& in) {
             if ( m.size() != 3 )
                 return hilti::rt::result::Error("unexpected number of argument for @data");
 
-            auto id = std::string(m[1]);
-            auto size = std::stoul(std::string(m[2]));
+            cmd->type = BatchCommand::Type::Data;
+            cmd->handle = _lookup(_flow_handles, m[1]);
+            cmd->size = std::stoul(std::string(m[2]));
 
-            char data[size];
-            in.read(data, static_cast<std::streamsize>(size));
-            in.get(); // Eat newline.
+            cmd->data.resize(cmd->size);
+            _in.read(reinterpret_cast<char*>(cmd->data.data()), static_cast<std::streamsize>(cmd->size));
+            _in.get(); // Eat newline.
 
-            if ( in.eof() || in.fail() )
+            if ( _in.eof() || _in.fail() )
                 return hilti::rt::result::Error("premature end of @data");
-
-            auto s = flows.find(id);
-            if ( s != flows.end() ) {
-                try {
-                    s->second.process(size, data);
-                } catch ( const hilti::rt::Exception& e ) {
-                    std::cout << hilti::rt::fmt("error for ID %s: %s\n", id, e.what());
-                }
-            }
         }
         else if ( m[0] == "@gap" ) {
             // @gap <id> <size>
             if ( m.size() != 3 )
                 return hilti::rt::result::Error("unexpected number of argument for @gap");
 
-            auto id = std::string(m[1]);
-            auto size = std::stoul(std::string(m[2]));
-
-            auto s = flows.find(id);
-            if ( s != flows.end() ) {
-                try {
-                    s->second.process(size, nullptr);
-                } catch ( const hilti::rt::Exception& e ) {
-                    std::cout << hilti::rt::fmt("error for ID %s: %s\n", id, e.what());
-                }
-            }
+            cmd->type = BatchCommand::Type::Gap;
+            cmd->handle = _lookup(_flow_handles, m[1]);
+            cmd->size = std::stoul(std::string(m[2]));
         }
         else if ( m[0] == "@end-flow" ) {
             // @end-flow <id>
             if ( m.size() != 2 )
                 return hilti::rt::result::Error("unexpected number of argument for @end-flow");
 
-            auto id = std::string(m[1]);
-
-            auto s = flows.find(id);
-            if ( s != flows.end() ) {
-                try {
-                    s->second.finish();
-                } catch ( const hilti::rt::Exception& e ) {
-                    std::cout << hilti::rt::fmt("error for ID %s: %s\n", id, e.what());
-                }
-
-                flows.erase(s);
-                DRIVER_DEBUG_STATS(flows.size(), connections.size());
-            }
+            cmd->type = BatchCommand::Type::EndFlow;
+            cmd->handle = _lookup(_flow_handles, m[1]);
+            _forget(&_flow_handles, &_flow_ids, cmd->handle);
         }
         else if ( m[0] == "@end-conn" ) {
             // @end-conn <cid>
             if ( m.size() != 2 )
                 return hilti::rt::result::Error("unexpected number of argument for @end-conn");
 
-            auto cid = std::string(m[1]);
+            cmd->type = BatchCommand::Type::EndConnection;
+            cmd->handle = _lookup(_connection_handles, m[1]);
+            _forgetConnection(cmd->handle);
+        }
+        else
+            return hilti::rt::result::Error(hilti::rt::fmt("unknown command '%s'", m[0]));
+
+        return true;
+    }
+
+    return false;
+}
+
+Result<bool> BatchReader::_nextV3(BatchCommand* cmd) {
+    using driver::batch::RecordType;
+
+    RecordType type;
+    uint32_t id = 0;
+    uint32_t len = 0;
+
+    if ( auto x = readRecordHeader(_in, &type, &id, &len); ! x || ! *x )
+        return x;
+
+    if ( type == RecordType::Index )
+        // The index always comes last, and we don't need it for sequential processing.
+        return false;
+
+    // Read data straight into the command, anything else into our scratch
+    // buffer. If the caller reuses the command, the data's buffer is reused
+    // as well.
+    char* body = nullptr;
+
+    if ( type == RecordType::Data ) {
+        cmd->data.resize(len);
+        body = reinterpret_cast<char*>(cmd->data.data());
+    }
+    else {
+        _buffer.resize(len);
+        body = _buffer.data();
+    }
+
+    if ( len && ! _in.read(body, static_cast<std::streamsize>(len)) )
+        return hilti::rt::result::Error("premature end of batch record");
+
+    auto parse_type = [](char t) -> Result<driver::ParsingType> {
+        switch ( t ) {
+            case 0: return driver::ParsingType::Stream;
+            case 1: return driver::ParsingType::Block;
+            default: return hilti::rt::result::Error(hilti::rt::fmt("unknown session type %d", static_cast<int>(t)));
+        }
+    };
+
+    cmd->output = nullptr;
+    cmd->handle = id;
+
+    switch ( type ) {
+        case RecordType::BeginFlow: {
+            // <type:1> <parser>
+            if ( len < 1 )
+                return hilti::rt::result::Error("invalid begin-flow record");
+
+            auto t = parse_type(_buffer[0]);
+            if ( ! t )
+                return t.error();
+
+            cmd->type = BatchCommand::Type::BeginFlow;
+            cmd->parsing_type = *t;
+            cmd->id = std::to_string(id);
+            cmd->parser.assign(_buffer, 1);
+            break;
+        }
+
+        case RecordType::BeginConnection: {
+            // <type:1> <orig-id:4> <resp-id:4> <orig-parser-length:2> <orig-parser> <resp-parser>
+            if ( len < 11 )
+                return hilti::rt::result::Error("invalid begin-conn record");
+
+            auto t = parse_type(_buffer[0]);
+            if ( ! t )
+                return t.error();
+
+            auto orig_len = decodeUInt<uint16_t>(_buffer.data() + 9);
+            if ( len < 11U + orig_len )
+                return hilti::rt::result::Error("invalid begin-conn record");
+
+            cmd->type = BatchCommand::Type::BeginConnection;
+            cmd->parsing_type = *t;
+            cmd->id = std::to_string(id);
+            cmd->orig_handle = decodeUInt<uint32_t>(_buffer.data() + 1);
+            cmd->orig_id = std::to_string(cmd->orig_handle);
+            cmd->resp_handle = decodeUInt<uint32_t>(_buffer.data() + 5);
+            cmd->resp_id = std::to_string(cmd->resp_handle);
+            cmd->orig_parser.assign(_buffer, 11, orig_len);
+            cmd->resp_parser.assign(_buffer, 11 + orig_len);
+            break;
+        }
+
+        case RecordType::Data: {
+            cmd->type = BatchCommand::Type::Data;
+            cmd->size = len;
+            break;
+        }
+
+        case RecordType::Gap: {
+            // <size:8>
+            if ( len != 8 )
+                return hilti::rt::result::Error("invalid gap record");
+
+            cmd->type = BatchCommand::Type::Gap;
+            cmd->size = decodeUInt<uint64_t>(_buffer.data());
+            break;
+        }
+
+        case RecordType::EndFlow: cmd->type = BatchCommand::Type::EndFlow; break;
+        case RecordType::EndConnection: cmd->type = BatchCommand::Type::EndConnection; break;
+
+        default:
+            return hilti::rt::result::Error(
+                hilti::rt::fmt("unknown batch record type %d", static_cast<int>(static_cast<uint8_t>(type))));
+    }
+
+    return true;
+}
+
+Result<hilti::rt::Nothing> Driver::processPreBatchedInput(std::istream& in, unsigned int threads) {
+    // Batch input has no notion of time that idleness could be measured in.
+    if ( _flow_limits.idle_timeout > 0 )
+        return hilti::rt::result::Error("flow idle timeout is supported only for pcap input");
+
+    BatchReader reader(in);
+
+    if ( auto x = reader.readMagic(); ! x )
+        return x.error();
+
+    if ( threads <= 1 ) {
+        // Process everything right here. A single worker thread would not
+        // gain anything, but would reorder the output by flow, so we treat
+        // it like no threads to keep the output the same.
+        BatchState state(this);
+        BatchCommand cmd; // reused for all commands, including its data buffer
+
+        state.onEviction([&](uint64_t flow, std::optional<uint64_t> connection) { reader.release(flow, connection); });
+
+        while ( true ) {
+            auto x = reader.next(&cmd);
+            if ( ! x )
+                return x.error();
+
+            if ( ! *x )
+                break;
+
+            state.execute(cmd);
+            _tickThroughput();
+        }
+
+        state.debugStats();
+        return hilti::rt::Nothing();
+    }
+
+    // Each worker needs its own instance of all globals, which requires
+    // generated code to have been compiled with dynamic globals.
+    for ( const auto& m : hilti::rt::detail::globalState()->hilti_modules ) {
+        if ( m.init_globals && ! m.globals_idx )
+            return hilti::rt::result::Error(
+                hilti::rt::fmt("cannot process batch with worker threads, module %s has not been compiled with "
+                               "dynamic globals",
+                               m.name));
+    }
+
+    // Shard flows across worker threads. A connection's flows go to the
+    // same worker as the connection itself. Each worker records the output
+    // of its flows separately, which we then emit in the order the flows
+    // and connections were created.
+    static constexpr size_t BatchSize = 64; // number of commands to pass to a worker at once
+
+    std::vector<std::unique_ptr<BatchWorker>> workers;
+    std::vector<std::vector<BatchCommand>> pending(threads);
+    std::deque<std::unique_ptr<BatchOutput>> outputs;
+    std::unordered_map<uint64_t, size_t> flow_workers;
+    std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t>> connection_flows;
+
+    for ( unsigned int i = 0; i < threads; i++ )
+        workers.emplace_back(std::make_unique<BatchWorker>(this, threads));
+
+    auto select_worker = [&](uint64_t handle) { return std::hash<uint64_t>{}(handle) % threads; };
 
-            if ( auto s = connections.find(cid); s != connections.end() ) {
-                try {
-                    s->second.orig_state->finish();
-                } catch ( const hilti::rt::Exception& e ) {
-                    std::cout << hilti::rt::fmt("error for ID %s: %s\n", s->second.orig_id, e.what());
+    auto new_output = [&]() {
+        outputs.emplace_back(std::make_unique<BatchOutput>());
+        return outputs.back().get();
+    };
+
+    auto flush_outputs = [&](bool all) {
+        while ( ! outputs.empty() && (all || outputs.front()->done.load(std::memory_order_acquire)) ) {
+            std::cout << outputs.front()->out.str();
+            outputs.pop_front();
+        }
+    };
+
+    // Drops our state for flows that workers have evicted. As handles
+    // aren't reused, we can't hit a later flow here.
+    auto release_evicted = [&]() {
+        for ( auto& w : workers ) {
+            for ( const auto& [flow, connection] : w->takeEvicted() ) {
+                flow_workers.erase(flow);
+
+                if ( connection )
+                    connection_flows.erase(*connection);
+
+                reader.release(flow, connection);
+            }
+        }
+    };
+
+    auto dispatch = [&](size_t worker, std::optional<BatchCommand> cmd) {
+        if ( cmd )
+            pending[worker].emplace_back(std::move(*cmd));
+
+        if ( pending[worker].empty() || (cmd && pending[worker].size() < BatchSize) )
+            return true;
+
+        auto success = workers[worker]->push(std::move(pending[worker]));
+        pending[worker].clear();
+        release_evicted();
+        return success;
+    };
+
+    Result<hilti::rt::Nothing> result = hilti::rt::Nothing();
+
+    while ( true ) {
+        BatchCommand c;
+        auto x = reader.next(&c);
+        if ( ! x ) {
+            result = x.error();
+            break;
+        }
+
+        if ( ! *x )
+            break;
+
+        std::optional<size_t> worker;
+
+        switch ( c.type ) {
+            case BatchCommand::Type::BeginFlow:
+                worker = select_worker(c.handle);
+                flow_workers[c.handle] = *worker;
+                c.output = new_output();
+                break;
+
+            case BatchCommand::Type::BeginConnection:
+                worker = select_worker(c.handle);
+                flow_workers[c.orig_handle] = *worker;
+                flow_workers[c.resp_handle] = *worker;
+                connection_flows[c.handle] = std::make_pair(c.orig_handle, c.resp_handle);
+                c.output = new_output();
+                break;
+
+            case BatchCommand::Type::Data:
+            case BatchCommand::Type::Gap:
+            case BatchCommand::Type::EndFlow:
+                if ( auto w = flow_workers.find(c.handle); w != flow_workers.end() ) {
+                    worker = w->second;
+
+                    if ( c.type == BatchCommand::Type::EndFlow )
+                        flow_workers.erase(w);
                 }
 
-                try {
-                    s->second.resp_state->finish();
-                } catch ( const hilti::rt::Exception& e ) {
-                    std::cout << hilti::rt::fmt("error for ID %s: %s\n", s->second.resp_id, e.what());
+                break;
+
+            case BatchCommand::Type::EndConnection:
+                worker = select_worker(c.handle);
+
+                if ( auto f = connection_flows.find(c.handle); f != connection_flows.end() ) {
+                    flow_workers.erase(f->second.first);
+                    flow_workers.erase(f->second.second);
+                    connection_flows.erase(f);
                 }
 
-                flows.erase(s->second.orig_id);
-                flows.erase(s->second.resp_id);
-                connections.erase(s);
-                DRIVER_DEBUG_STATS(flows.size(), connections.size());
-            }
+                break;
         }
-        else
-            return hilti::rt::result::Error(hilti::rt::fmt("unknown command '%s'", m[0]));
+
+        if ( worker && ! dispatch(*worker, std::move(c)) )
+            break; // worker terminated with exception, will be reported below
+
+        flush_outputs(false);
+        _tickThroughput();
+    }
+
+    for ( size_t i = 0; i < workers.size(); i++ )
+        dispatch(i, {});
+
+    std::exception_ptr exception;
+    for ( auto& w : workers ) {
+        if ( auto e = w->finish(); e && ! exception )
+            exception = e;
     }
 
+    flush_outputs(true);
+
+    if ( exception )
+        std::rethrow_exception(exception);
+
+    return result;
+}
+
+Result<hilti::rt::Nothing> Driver::processPcapInput(std::istream& in) {
+    pcap::Reader reader(in);
+
+    if ( auto x = reader.open(); ! x )
+        return x.error();
+
+    // We turn the connections' events into batch commands. Each connection
+    // gets three consecutive handles: one for itself and one per side.
+    BatchState state(this);
+    BatchCommand cmd; // reused for all commands
+
+    auto handle = [](const pcap::Connection& c, int side) { return c.id * 3 + side; };
+
+    auto execute = [&](BatchCommand::Type type, uint64_t handle) {
+        cmd.type = type;
+        cmd.handle = handle;
+        cmd.output = nullptr;
+        state.execute(std::move(cmd));
+    };
+
+    pcap::ConnectionTable::Callbacks callbacks;
+
+    callbacks.begin = [&](pcap::Connection& c) {
+        auto id = c.str();
+        auto port = std::string(c.resp_port);
+        auto orig_parser = port + "%orig";
+        auto resp_parser = port + "%resp";
+        auto have_orig = static_cast<bool>(lookupParser(orig_parser));
+        auto have_resp = static_cast<bool>(lookupParser(resp_parser));
+
+        if ( ! (have_orig || have_resp) ) {
+            DRIVER_DEBUG(hilti::rt::fmt("no parser for connection %s, skipping", id));
+            c.active = false;
+            return;
+        }
+
+        if ( c.resp_port.protocol() == hilti::rt::Protocol::TCP )
+            cmd.parsing_type = driver::ParsingType::Stream;
+        else
+            cmd.parsing_type = driver::ParsingType::Block;
+
+        if ( have_orig && have_resp ) {
+            cmd.id = id;
+            cmd.orig_handle = handle(c, 1);
+            cmd.orig_id = id + "%orig";
+            cmd.orig_parser = std::move(orig_parser);
+            cmd.resp_handle = handle(c, 2);
+            cmd.resp_id = id + "%resp";
+            cmd.resp_parser = std::move(resp_parser);
+            execute(BatchCommand::Type::BeginConnection, handle(c, 0));
+        }
+        else {
+            cmd.id = id + (have_orig ? "%orig" : "%resp");
+            cmd.parser = (have_orig ? std::move(orig_parser) : std::move(resp_parser));
+            execute(BatchCommand::Type::BeginFlow, handle(c, have_orig ? 1 : 2));
+        }
+    };
+
+    callbacks.data = [&](pcap::Connection& c, bool is_orig, std::vector<pcap::Byte>&& data) {
+        cmd.size = data.size();
+        cmd.data = std::move(data);
+        execute(BatchCommand::Type::Data, handle(c, is_orig ? 1 : 2));
+    };
+
+    callbacks.gap = [&](pcap::Connection& c, bool is_orig, uint64_t size) {
+        cmd.size = size;
+        execute(BatchCommand::Type::Gap, handle(c, is_orig ? 1 : 2));
+    };
+
+    callbacks.end = [&](pcap::Connection& c) {
+        // Idle connections get their flows evicted; these are counted, and
+        // depending on the limits, discarded instead of finished.
+        if ( c.expired ) {
+            state.expire(handle(c, 1));
+            state.expire(handle(c, 2));
+        }
+
+        // Whichever of these has state gets it finished.
+        execute(BatchCommand::Type::EndConnection, handle(c, 0));
+        execute(BatchCommand::Type::EndFlow, handle(c, 1));
+        execute(BatchCommand::Type::EndFlow, handle(c, 2));
+    };
+
+    pcap::ConnectionTable connections(std::move(callbacks), _flow_limits.idle_timeout);
+    pcap::Packet packet;
+    pcap::Segment segment;
 
-    DRIVER_DEBUG_STATS(flows.size(), connections.size());
+    while ( true ) {
+        auto x = reader.next(&packet);
+        if ( ! x )
+            return x.error();
 
+        if ( ! *x )
+            break;
+
+        if ( pcap::decode(packet, &segment) )
+            connections.process(segment);
+
+        _tickThroughput();
+    }
+
+    connections.finish();
+    state.debugStats();
     return hilti::rt::Nothing();
 }
+
+driver::batch::WriterV3::WriterV3(std::ostream& out) : _out(out) {
+    _out << MagicV3 << '\n';
+    _offset = MagicV3.size() + 1;
+}
+
+void driver::batch::WriterV3::_record(RecordType type, uint32_t id, std::string_view body) {
+    if ( body.size() > std::numeric_limits<uint32_t>::max() )
+        throw hilti::rt::InvalidArgument("batch record too large");
+
+    if ( type == RecordType::BeginFlow || type == RecordType::BeginConnection ) {
+        appendUInt(&_index, static_cast<uint8_t>(type));
+        appendUInt(&_index, id);
+        appendUInt(&_index, _offset);
+    }
+
+    std::string header;
+    header.reserve(RecordHeaderSize);
+    appendUInt(&header, static_cast<uint8_t>(type));
+    appendUInt(&header, id);
+    appendUInt(&header, static_cast<uint32_t>(body.size()));
+
+    _out.write(header.data(), static_cast<std::streamsize>(header.size()));
+    _out.write(body.data(), static_cast<std::streamsize>(body.size()));
+    _offset += header.size() + body.size();
+}
+
+void driver::batch::WriterV3::beginFlow(uint32_t id, ParsingType type, std::string_view parser) {
+    _body.clear();
+    appendUInt(&_body, static_cast<uint8_t>(type == ParsingType::Stream ? 0 : 1));
+    _body.append(parser);
+    _record(RecordType::BeginFlow, id, _body);
+}
+
+void driver::batch::WriterV3::beginConnection(uint32_t cid, ParsingType type, uint32_t orig_id,
+                                              std::string_view orig_parser, uint32_t resp_id,
+                                              std::string_view resp_parser) {
+    if ( orig_parser.size() > std::numeric_limits<uint16_t>::max() )
+        throw hilti::rt::InvalidArgument("parser name too long");
+
+    _body.clear();
+    appendUInt(&_body, static_cast<uint8_t>(type == ParsingType::Stream ? 0 : 1));
+    appendUInt(&_body, orig_id);
+    appendUInt(&_body, resp_id);
+    appendUInt(&_body, static_cast<uint16_t>(orig_parser.size()));
+    _body.append(orig_parser);
+    _body.append(resp_parser);
+    _record(RecordType::BeginConnection, cid, _body);
+}
+
+void driver::batch::WriterV3::data(uint32_t id, const char* data, size_t size) {
+    _record(RecordType::Data, id, std::string_view(data, size));
+}
+
+void driver::batch::WriterV3::gap(uint32_t id, uint64_t size) {
+    _body.clear();
+    appendUInt(&_body, size);
+    _record(RecordType::Gap, id, _body);
+}
+
+void driver::batch::WriterV3::endFlow(uint32_t id) { _record(RecordType::EndFlow, id, {}); }
+
+void driver::batch::WriterV3::endConnection(uint32_t cid) { _record(RecordType::EndConnection, cid, {}); }
+
+void driver::batch::WriterV3::record(RecordType type, uint32_t id, std::string_view body) {
+    if ( type == RecordType::Index )
+        throw hilti::rt::InvalidArgument("cannot write index record explicitly");
+
+    _record(type, id, body);
+}
+
+void driver::batch::WriterV3::finish() {
+    auto index_offset = _offset;
+    _record(RecordType::Index, 0, _index);
+
+    std::string trailer;
+    appendUInt(&trailer, index_offset);
+    trailer.append(IndexMagic);
+    _out.write(trailer.data(), static_cast<std::streamsize>(trailer.size()));
+    _out.flush();
+}
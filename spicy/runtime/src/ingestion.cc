@@ -0,0 +1,752 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <utility>
+
+#include <hilti/rt/context.h>
+#include <hilti/rt/logging.h>
+
+#include <spicy/rt/ingestion.h>
+
+using namespace spicy::rt;
+using namespace spicy::rt::ingestion;
+
+namespace spicy::rt::ingestion::detail {
+
+/** Parsing state for a single flow managed by a `Worker`. */
+class FlowState : public driver::ParsingState {
+public:
+    FlowState(FlowHandle handle, driver::ParsingType type, const Parser* parser)
+        : driver::ParsingState(type, parser), handle(handle), type(type) {}
+
+    const FlowHandle handle;
+    const driver::ParsingType type;
+
+protected:
+    void debug(const std::string& msg) override {
+        HILTI_RT_DEBUG("spicy-driver", hilti::rt::fmt("[flow %" PRIu64 "] %s", handle, msg));
+    }
+};
+
+/** State of a flow processed by a `Pool`. */
+struct PoolFlow {
+    PoolFlow(FlowHandle handle, driver::ParsingType type, const Parser* parser, size_t home)
+        : state(std::make_unique<FlowState>(handle, type, parser)), home(home) {}
+
+    std::mutex mutex;          // protects `inputs` and `scheduled`
+    std::vector<Input> inputs; // input queued but not processed yet
+    bool scheduled = false;    // true while the flow is ready for processing or being processed
+
+    // Accessed only by the thread currently processing the flow.
+    std::unique_ptr<FlowState> state; // reset once the flow has ended
+    size_t home;                      // thread the flow gets scheduled on when it becomes ready
+};
+
+/** A parser thread of a `Pool`. */
+struct PoolThread {
+    std::mutex mutex;                            // protects `ready`
+    std::deque<std::shared_ptr<PoolFlow>> ready; // flows ready for processing
+    std::thread thread;
+    std::exception_ptr exception;
+    bool drained = false; // true once the thread has counted itself into `Pool::_drained`
+};
+
+} // namespace spicy::rt::ingestion::detail
+
+Worker::Worker(Options options) : _options(std::move(options)) {
+    if ( _options.num_producers == 0 )
+        throw hilti::rt::UsageError("ingestion worker requires at least one producer");
+
+    if ( _options.max_batch_size == 0 )
+        throw hilti::rt::UsageError("ingestion worker requires a positive batch size");
+
+    _queues.reserve(_options.num_producers);
+    for ( size_t i = 0; i < _options.num_producers; i++ )
+        _queues.emplace_back(std::make_unique<hilti::rt::SPSCRingBuffer<Input>>(_options.queue_size));
+
+    auto capacity = _queues.front()->capacity();
+    _congestion_level = static_cast<size_t>(std::ceil(static_cast<double>(capacity) * _options.congestion_threshold));
+    _congestion_level = std::min(std::max(_congestion_level, size_t(1)), capacity);
+
+    _batch.reserve(_options.max_batch_size);
+}
+
+Worker::~Worker() {
+    try {
+        stop();
+    } catch ( ... ) {
+        // Nothing left to report the error to.
+    }
+}
+
+Status Worker::enqueue(Input input, size_t producer) {
+    if ( producer >= _queues.size() )
+        throw hilti::rt::UsageError(hilti::rt::fmt("invalid ingestion producer index %zu", producer));
+
+    auto& queue = *_queues[producer];
+
+    if ( ! queue.tryPush(std::move(input)) ) {
+        _rejected.fetch_add(1, std::memory_order_relaxed);
+        return Status::Full;
+    }
+
+    _queued.fetch_add(1, std::memory_order_relaxed);
+
+    if ( queue.size() >= _congestion_level ) {
+        _congested.fetch_add(1, std::memory_order_relaxed);
+        return Status::Congested;
+    }
+
+    return Status::Ok;
+}
+
+Status Worker::begin(FlowHandle flow, const Parser* parser, driver::ParsingType type, size_t producer) {
+    Input input;
+    input.type = Input::Type::Begin;
+    input.flow = flow;
+    input.parser = parser;
+    input.parsing_type = type;
+    return enqueue(std::move(input), producer);
+}
+
+Status Worker::data(FlowHandle flow, const char* data, size_t len, size_t producer) {
+    // Avoid copying the data if we know already that it won't fit.
+    if ( producer < _queues.size() && _queues[producer]->size() >= _queues[producer]->capacity() ) {
+        _rejected.fetch_add(1, std::memory_order_relaxed);
+        return Status::Full;
+    }
+
+    Input input;
+    input.type = Input::Type::Data;
+    input.flow = flow;
+    input.data.assign(data, len);
+    return enqueue(std::move(input), producer);
+}
+
+Status Worker::gap(FlowHandle flow, size_t size, size_t producer) {
+    Input input;
+    input.type = Input::Type::Gap;
+    input.flow = flow;
+    input.size = size;
+    return enqueue(std::move(input), producer);
+}
+
+Status Worker::end(FlowHandle flow, size_t producer) {
+    Input input;
+    input.type = Input::Type::End;
+    input.flow = flow;
+    return enqueue(std::move(input), producer);
+}
+
+size_t Worker::poll() {
+    size_t total = 0;
+
+    for ( auto& queue : _queues ) {
+        _batch.clear();
+
+        if ( queue->popMany(&_batch, _options.max_batch_size) == 0 )
+            continue;
+
+        total += _batch.size();
+        _processBatch();
+    }
+
+    _processed.fetch_add(total, std::memory_order_relaxed);
+    return total;
+}
+
+void Worker::_processBatch() {
+    // Consecutive chunks of data for a stream-based flow are coalesced so
+    // that its parser needs to resume only once for all of them. Any other
+    // input for a flow first flushes the data pending for it, so that the
+    // order of input remains intact within each flow.
+    auto flush = [this](FlowHandle handle) {
+        auto p = _pending.find(handle);
+        if ( p == _pending.end() )
+            return;
+
+        if ( auto f = _flows.find(handle); f != _flows.end() )
+            _feed(f->second.get(), p->second.size(), p->second.data());
+
+        _pending.erase(p);
+    };
+
+    for ( auto& input : _batch ) {
+        if ( input.type == Input::Type::Data ) {
+            auto f = _flows.find(input.flow);
+            if ( f == _flows.end() || f->second->isFinished() )
+                continue;
+
+            if ( f->second->type == driver::ParsingType::Block ) {
+                // Each chunk is a separate block, can't coalesce.
+                _feed(f->second.get(), input.data.size(), input.data.data());
+                continue;
+            }
+
+            if ( auto [p, inserted] = _pending.try_emplace(input.flow); inserted ) {
+                p->second = std::move(input.data);
+                _pending_order.push_back(input.flow);
+            }
+            else
+                p->second.append(input.data);
+        }
+        else {
+            flush(input.flow);
+            _apply(input);
+        }
+    }
+
+    for ( auto handle : _pending_order )
+        flush(handle);
+
+    _pending_order.clear();
+}
+
+void Worker::_feed(detail::FlowState* flow, size_t size, const char* data) {
+    if ( flow->isFinished() )
+        return;
+
+    _resumes.fetch_add(1, std::memory_order_relaxed);
+
+    try {
+        flow->process(size, data);
+    } catch ( const hilti::rt::Exception& e ) {
+        flow->skipRemaining();
+
+        if ( _options.on_error )
+            _options.on_error(flow->handle, e);
+    }
+}
+
+void Worker::_apply(Input& input) {
+    switch ( input.type ) {
+        case Input::Type::Begin: {
+            auto state = std::make_unique<detail::FlowState>(input.flow, input.parsing_type, input.parser);
+
+            if ( auto [f, inserted] = _flows.insert_or_assign(input.flow, std::move(state)); inserted )
+                _num_flows.fetch_add(1, std::memory_order_relaxed);
+
+            break;
+        }
+
+        case Input::Type::Gap: {
+            if ( auto f = _flows.find(input.flow); f != _flows.end() )
+                _feed(f->second.get(), input.size, nullptr);
+
+            break;
+        }
+
+        case Input::Type::End: {
+            auto f = _flows.find(input.flow);
+            if ( f == _flows.end() )
+                break;
+
+            try {
+                f->second->finish();
+            } catch ( const hilti::rt::Exception& e ) {
+                if ( _options.on_error )
+                    _options.on_error(input.flow, e);
+            }
+
+            _flows.erase(f);
+            _num_flows.fetch_sub(1, std::memory_order_relaxed);
+            break;
+        }
+
+        case Input::Type::Data: hilti::rt::cannot_be_reached();
+    }
+}
+
+void Worker::start() {
+    if ( _thread.joinable() )
+        throw hilti::rt::UsageError("ingestion worker has already been started");
+
+    _stopping = false;
+    _exception = nullptr;
+
+    _thread = std::thread([this]() {
+        try {
+            hilti::rt::context::ThreadContext context;
+
+            // When idle, spin briefly before backing off to sleeping, so that
+            // we react quickly to new input without burning a core while
+            // there's none.
+            unsigned int idle = 0;
+
+            while ( true ) {
+                // Check the flag before polling so that we always drain input
+                // queued before `stop()` was called.
+                auto stopping = _stopping.load();
+
+                if ( poll() > 0 ) {
+                    idle = 0;
+                    continue;
+                }
+
+                if ( stopping )
+                    break;
+
+                if ( ++idle < 64 )
+                    std::this_thread::yield();
+                else
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+
+            // Release any remaining parsing state while we still have our context.
+            _flows.clear();
+            _pending.clear();
+            _num_flows = 0;
+        } catch ( ... ) {
+            _exception = std::current_exception();
+        }
+    });
+}
+
+void Worker::stop() {
+    if ( ! _thread.joinable() )
+        return;
+
+    _stopping = true;
+    _thread.join();
+
+    if ( auto e = std::exchange(_exception, nullptr) )
+        std::rethrow_exception(e);
+}
+
+Statistics Worker::statistics() const {
+    Statistics s{};
+    s.queued = _queued.load();
+    s.congested = _congested.load();
+    s.rejected = _rejected.load();
+    s.processed = _processed.load();
+    s.resumes = _resumes.load();
+    s.flows = _num_flows.load();
+    return s;
+}
+
+Pool::Pool(unsigned int threads, Options options) : _options(std::move(options)) {
+    if ( threads == 0 )
+        throw hilti::rt::UsageError("ingestion pool requires at least one thread");
+
+    if ( _options.queue_size == 0 || _options.max_batch_size == 0 )
+        throw hilti::rt::UsageError("ingestion pool requires positive queue and batch sizes");
+
+    _congestion_level =
+        static_cast<size_t>(std::ceil(static_cast<double>(_options.queue_size) * _options.congestion_threshold));
+    _congestion_level = std::min(std::max(_congestion_level, size_t(1)), _options.queue_size);
+
+    _flows_congestion_level =
+        static_cast<size_t>(std::ceil(static_cast<double>(_options.max_flows) * _options.congestion_threshold));
+    _flows_congestion_level = std::min(std::max(_flows_congestion_level, size_t(1)), _options.max_flows);
+
+    _threads.reserve(threads);
+    for ( unsigned int i = 0; i < threads; i++ )
+        _threads.emplace_back(std::make_unique<detail::PoolThread>());
+}
+
+Pool::~Pool() {
+    try {
+        stop();
+    } catch ( ... ) {
+        // Nothing left to report the error to.
+    }
+}
+
+Status Pool::begin(FlowHandle handle, const Parser* parser, driver::ParsingType type) {
+    std::shared_ptr<detail::PoolFlow> previous;
+    auto status = Status::Ok;
+
+    {
+        std::unique_lock lock(_flows_mutex);
+
+        auto f = _flows.find(handle);
+
+        if ( f == _flows.end() && _options.max_flows && _flows.size() >= _options.max_flows ) {
+            ++_rejected;
+            return Status::Full;
+        }
+
+        auto flow = std::make_shared<detail::PoolFlow>(handle, type, parser, handle % _threads.size());
+
+        if ( f != _flows.end() )
+            previous = std::exchange(f->second, std::move(flow));
+        else {
+            _flows.emplace(handle, std::move(flow));
+            ++_num_flows;
+        }
+
+        if ( _options.max_flows && _flows.size() >= _flows_congestion_level ) {
+            ++_congested;
+            status = Status::Congested;
+        }
+    }
+
+    if ( previous ) {
+        // The previous flow's state must be released by a parser thread, so
+        // end it regularly even if its queue is full.
+        Input input;
+        input.type = Input::Type::End;
+        input.flow = handle;
+        _enqueue(previous, std::move(input), true);
+    }
+
+    return status;
+}
+
+Status Pool::data(FlowHandle handle, const char* data, size_t len) {
+    std::shared_ptr<detail::PoolFlow> flow;
+
+    {
+        std::unique_lock lock(_flows_mutex);
+        if ( auto f = _flows.find(handle); f != _flows.end() )
+            flow = f->second;
+        else
+            return Status::Ok; // ignore unknown flow
+    }
+
+    Input input;
+    input.type = Input::Type::Data;
+    input.flow = handle;
+    input.data.assign(data, len);
+    return _enqueue(flow, std::move(input));
+}
+
+Status Pool::gap(FlowHandle handle, size_t size) {
+    std::shared_ptr<detail::PoolFlow> flow;
+
+    {
+        std::unique_lock lock(_flows_mutex);
+        if ( auto f = _flows.find(handle); f != _flows.end() )
+            flow = f->second;
+        else
+            return Status::Ok; // ignore unknown flow
+    }
+
+    Input input;
+    input.type = Input::Type::Gap;
+    input.flow = handle;
+    input.size = size;
+    return _enqueue(flow, std::move(input));
+}
+
+Status Pool::end(FlowHandle handle) {
+    std::shared_ptr<detail::PoolFlow> flow;
+
+    {
+        std::unique_lock lock(_flows_mutex);
+        if ( auto f = _flows.find(handle); f != _flows.end() )
+            flow = f->second;
+        else
+            return Status::Ok; // ignore unknown flow
+    }
+
+    Input input;
+    input.type = Input::Type::End;
+    input.flow = handle;
+
+    auto status = _enqueue(flow, std::move(input));
+    if ( status == Status::Full )
+        return status;
+
+    std::unique_lock lock(_flows_mutex);
+    if ( auto f = _flows.find(handle); f != _flows.end() && f->second == flow ) {
+        _flows.erase(f);
+        --_num_flows;
+    }
+
+    return status;
+}
+
+Status Pool::_enqueue(const std::shared_ptr<detail::PoolFlow>& flow, Input input, bool force) {
+    std::unique_lock lock(flow->mutex);
+
+    if ( flow->inputs.size() >= _options.queue_size && ! force ) {
+        ++_rejected;
+        return Status::Full;
+    }
+
+    flow->inputs.push_back(std::move(input));
+    ++_queued;
+
+    auto congested = (flow->inputs.size() >= _congestion_level);
+
+    if ( ! flow->scheduled ) {
+        flow->scheduled = true;
+        auto home = flow->home;
+        lock.unlock();
+        _schedule(flow, home);
+    }
+
+    if ( congested ) {
+        ++_congested;
+        return Status::Congested;
+    }
+
+    return Status::Ok;
+}
+
+void Pool::_schedule(const std::shared_ptr<detail::PoolFlow>& flow, size_t thread) {
+    auto& t = *_threads[thread];
+    std::unique_lock lock(t.mutex);
+    t.ready.push_back(flow);
+}
+
+std::shared_ptr<ingestion::detail::PoolFlow> Pool::_next(size_t thread) {
+    {
+        auto& t = *_threads[thread];
+        std::unique_lock lock(t.mutex);
+
+        if ( ! t.ready.empty() ) {
+            auto flow = std::move(t.ready.front());
+            t.ready.pop_front();
+            return flow;
+        }
+    }
+
+    // Nothing left to do for us, see if we can help out another thread. We
+    // take from the opposite end of its queue to stay out of its way.
+    for ( size_t i = 1; i < _threads.size(); i++ ) {
+        auto& t = *_threads[(thread + i) % _threads.size()];
+        std::unique_lock lock(t.mutex);
+
+        if ( ! t.ready.empty() ) {
+            auto flow = std::move(t.ready.back());
+            t.ready.pop_back();
+            ++_steals;
+            return flow;
+        }
+    }
+
+    return nullptr;
+}
+
+void Pool::_process(const std::shared_ptr<detail::PoolFlow>& flow, size_t thread) {
+    // If we stole the flow, it stays with us from now on.
+    flow->home = thread;
+
+    std::vector<Input> inputs;
+
+    {
+        std::unique_lock lock(flow->mutex);
+
+        if ( flow->inputs.size() <= _options.max_batch_size )
+            inputs.swap(flow->inputs);
+        else {
+            auto n = static_cast<std::ptrdiff_t>(_options.max_batch_size);
+            inputs.assign(std::make_move_iterator(flow->inputs.begin()),
+                          std::make_move_iterator(flow->inputs.begin() + n));
+            flow->inputs.erase(flow->inputs.begin(), flow->inputs.begin() + n);
+        }
+    }
+
+    // Coalesce consecutive chunks of data for stream-based flows so that
+    // the parser needs to resume only once for all of them.
+    std::string pending;
+    bool have_pending = false;
+
+    auto flush = [&]() {
+        if ( ! have_pending )
+            return;
+
+        _feed(flow.get(), pending.size(), pending.data());
+        pending.clear();
+        have_pending = false;
+    };
+
+    for ( auto& input : inputs ) {
+        if ( ! flow->state )
+            break;
+
+        switch ( input.type ) {
+            case Input::Type::Data: {
+                if ( flow->state->type == driver::ParsingType::Block )
+                    _feed(flow.get(), input.data.size(), input.data.data());
+                else if ( ! have_pending ) {
+                    pending = std::move(input.data);
+                    have_pending = true;
+                }
+                else
+                    pending.append(input.data);
+
+                break;
+            }
+
+            case Input::Type::Gap: {
+                flush();
+                _feed(flow.get(), input.size, nullptr);
+                break;
+            }
+
+            case Input::Type::End: {
+                flush();
+
+                try {
+                    flow->state->finish();
+                } catch ( const hilti::rt::Exception& e ) {
+                    if ( _options.on_error )
+                        _options.on_error(input.flow, e);
+                }
+
+                flow->state.reset();
+                break;
+            }
+
+            case Input::Type::Begin: hilti::rt::cannot_be_reached();
+        }
+    }
+
+    flush();
+    _processed += inputs.size();
+
+    {
+        std::unique_lock lock(flow->mutex);
+
+        if ( ! flow->state ) {
+            // Flow has ended, discard anything left and never schedule it again.
+            flow->inputs.clear();
+            return;
+        }
+
+        if ( flow->inputs.empty() ) {
+            flow->scheduled = false;
+            return;
+        }
+    }
+
+    _schedule(flow, thread);
+}
+
+void Pool::_feed(detail::PoolFlow* flow, size_t size, const char* data) {
+    auto* state = flow->state.get();
+    if ( state->isFinished() )
+        return;
+
+    ++_resumes;
+
+    try {
+        state->process(size, data);
+    } catch ( const hilti::rt::Exception& e ) {
+        state->skipRemaining();
+
+        if ( _options.on_error )
+            _options.on_error(state->handle, e);
+    }
+}
+
+void Pool::_run(size_t thread) {
+    hilti::rt::context::ThreadContext context(true);
+    unsigned int idle = 0;
+
+    while ( true ) {
+        // Check the flag before looking for work so that we always drain
+        // input queued before `stop()` was called.
+        auto stopping = _stopping.load();
+
+        if ( auto flow = _next(thread) ) {
+            _process(flow, thread);
+            idle = 0;
+            continue;
+        }
+
+        if ( stopping )
+            break;
+
+        if ( ++idle < 64 )
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    _release(thread);
+}
+
+void Pool::_release(size_t thread) {
+    // All input has been processed once every thread gets here. Other
+    // threads may still be working on flows we processed earlier, so wait
+    // for them before releasing any state.
+    _threads[thread]->drained = true;
+    ++_drained;
+
+    while ( _drained.load() < _threads.size() )
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+
+    // Now release the flows remaining active that we processed last, while
+    // we still have our context. No other thread touches them anymore.
+    std::unique_lock lock(_flows_mutex);
+
+    for ( auto& [handle, flow] : _flows ) {
+        if ( flow->home == thread )
+            flow->state.reset();
+    }
+}
+
+void Pool::start() {
+    if ( _threads.front()->thread.joinable() )
+        throw hilti::rt::UsageError("ingestion pool has already been started");
+
+    _stopping = false;
+    _drained = 0;
+
+    for ( size_t i = 0; i < _threads.size(); i++ ) {
+        auto& t = *_threads[i];
+        t.exception = nullptr;
+        t.drained = false;
+        t.thread = std::thread([this, i, &t]() {
+            try {
+                _run(i);
+            } catch ( ... ) {
+                t.exception = std::current_exception();
+
+                // Don't hold up the other threads. Our flows get released
+                // by `stop()`.
+                if ( ! t.drained )
+                    ++_drained;
+            }
+        });
+    }
+}
+
+void Pool::stop() {
+    if ( ! _threads.front()->thread.joinable() )
+        return;
+
+    _stopping = true;
+
+    std::exception_ptr exception;
+
+    for ( auto& t : _threads ) {
+        t->thread.join();
+
+        if ( t->exception && ! exception )
+            exception = std::exchange(t->exception, nullptr);
+    }
+
+    {
+        // Flows that the threads have released come without state now, only
+        // those of a thread that terminated prematurely still have theirs.
+        std::unique_lock lock(_flows_mutex);
+        _flows.clear();
+        _num_flows = 0;
+    }
+
+    if ( exception )
+        std::rethrow_exception(exception);
+}
+
+Statistics Pool::statistics() const {
+    Statistics s{};
+    s.queued = _queued.load();
+    s.congested = _congested.load();
+    s.rejected = _rejected.load();
+    s.processed = _processed.load();
+    s.resumes = _resumes.load();
+    s.flows = _num_flows.load();
+    s.steals = _steals.load();
+    return s;
+}
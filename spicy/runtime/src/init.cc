@@ -2,6 +2,9 @@
 
 #include <clocale>
 #include <optional>
+#include <set>
+#include <string>
+#include <vector>
 
 #include <hilti/rt/init.h>
 
@@ -68,6 +71,50 @@ void spicy::rt::init() {
 
     globalState()->default_parser = default_parser;
 
+    // Precompute which parsers sinks connect for a MIME type: those
+    // registered for the type itself, then those for its main type, then
+    // those for all types. The empty key always exists so that lookups can
+    // fall back to it.
+    std::set<std::string> scopes;
+    for ( const auto& p : parsers )
+        scopes.insert(p->linker_scope);
+
+    const auto& by_mime_type = globalState()->parsers_by_mime_type;
+    auto& dispatch = globalState()->mime_dispatch;
+    dispatch[""];
+
+    for ( const auto& i : by_mime_type )
+        dispatch[i.first];
+
+    for ( auto& [key, d] : dispatch ) {
+        std::vector<std::string> keys = {key};
+
+        if ( auto i = key.find('/'); i != std::string::npos )
+            keys.push_back(key.substr(0, i));
+
+        if ( ! key.empty() )
+            keys.emplace_back("");
+
+        std::vector<const Parser*> candidates;
+        for ( const auto& k : keys ) {
+            if ( auto x = by_mime_type.find(k); x != by_mime_type.end() )
+                candidates.insert(candidates.end(), x->second.begin(), x->second.end());
+        }
+
+        for ( const auto& p : candidates ) {
+            if ( p->is_public )
+                d.public_parsers.push_back(p);
+        }
+
+        for ( const auto& scope : scopes ) {
+            auto& scoped = d.scoped_parsers[scope];
+            for ( const auto& p : candidates ) {
+                if ( p->is_public || p->linker_scope == scope )
+                    scoped.push_back(p);
+            }
+        }
+    }
+
     HILTI_RT_DEBUG("libspicy", "registered parsers (w/ aliases):");
     for ( const auto& i : globalState()->parsers_by_name ) {
         auto names = hilti::rt::transform(i.second, [](const auto& p) { return p->name; });
@@ -0,0 +1,202 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#include <spicy/rt/autogen/config.h>
+
+#ifdef SPICY_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include <algorithm>
+#include <cinttypes>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <hilti/rt/fmt.h>
+#include <hilti/rt/types/bytes.h>
+
+#include <spicy/rt/configuration.h>
+#include <spicy/rt/lz4_.h>
+
+using namespace spicy::rt;
+using namespace spicy::rt::lz4;
+
+struct lz4::detail::State {
+#ifdef SPICY_HAVE_LZ4
+    LZ4F_dctx* ctx = nullptr;
+#endif
+    bool ended = true; // false while inside a frame
+    uint64_t total_in = 0;
+    uint64_t total_out = 0;
+    uint64_t max_output = 0;
+    uint64_t max_ratio = 0;
+};
+
+#ifdef SPICY_HAVE_LZ4
+
+// Bounds for how much output space we provide to each call of
+// `LZ4F_decompress()`.
+static const size_t MinOutputStep = 4096;
+static const size_t MaxOutputStep = 256 * 1024;
+
+// Decompresses a chunk of input, appending output to a buffer. The buffer
+// grows the same way as for zlib, see `inflateInto()` there.
+template<typename Buffer>
+static void decompressInto(lz4::detail::State* state, Buffer* out, const void* data, size_t size) {
+    if ( ! size )
+        return;
+
+    const auto* in = reinterpret_cast<const char*>(data);
+
+    while ( true ) {
+        auto used = out->size();
+        auto ratio = (state->total_in ? state->total_out / state->total_in + 1 : 4);
+        auto step = std::clamp(std::max(static_cast<size_t>(size * ratio), used), MinOutputStep, MaxOutputStep);
+
+        // Don't provide room for more output than the limits allow, plus
+        // one byte to detect going beyond them.
+        if ( state->max_output ) {
+            auto remaining = (state->max_output > state->total_out ? state->max_output - state->total_out : 0);
+            step = std::min<uint64_t>(step, remaining + 1);
+        }
+
+        if ( state->max_ratio ) {
+            auto allowed = state->max_ratio * (state->total_in + size);
+            auto remaining = (allowed > state->total_out ? allowed - state->total_out : 0);
+            step = std::min<uint64_t>(step, remaining + 1);
+        }
+
+        out->resize(used + step);
+
+        size_t consumed = size;
+        size_t produced = step;
+        auto rc = LZ4F_decompress(state->ctx, out->data() + used, &produced, in, &consumed, nullptr);
+        out->resize(used + produced);
+
+        if ( LZ4F_isError(rc) )
+            throw LZ4Error(hilti::rt::fmt("decompression failed: %s", LZ4F_getErrorName(rc)));
+
+        in += consumed;
+        size -= consumed;
+        state->total_in += consumed;
+        state->total_out += produced;
+
+        // Without any progress, the return value refers to the next frame.
+        if ( consumed || produced )
+            state->ended = (rc == 0);
+
+        if ( state->max_output && state->total_out > state->max_output )
+            throw LZ4Error(hilti::rt::fmt("decompressed data exceeds limit of %" PRIu64 " bytes", state->max_output));
+
+        if ( state->max_ratio && state->total_out > state->max_ratio * state->total_in )
+            throw LZ4Error(hilti::rt::fmt("decompression ratio exceeds limit of %" PRIu64, state->max_ratio));
+
+        if ( ! size && (produced < step || rc == 0) )
+            break;
+    }
+}
+
+bool lz4::available() { return true; }
+
+Stream::Stream() {
+    _state = std::shared_ptr<lz4::detail::State>(new lz4::detail::State(), [](auto p) {
+        LZ4F_freeDecompressionContext(p->ctx);
+        delete p; // NOLINT(cppcoreguidelines-owning-memory)
+    });
+
+    if ( LZ4F_isError(LZ4F_createDecompressionContext(&_state->ctx, LZ4F_VERSION)) ) {
+        _state = nullptr;
+        throw LZ4Error("cannot create LZ4 decompression context");
+    }
+
+    const auto& cfg = configuration::get();
+    _state->max_output = cfg.decompress_max_output;
+    _state->max_ratio = cfg.decompress_max_ratio;
+}
+
+#else
+
+template<typename Buffer>
+static void decompressInto(lz4::detail::State* /* state */, Buffer* /* out */, const void* /* data */,
+                           size_t /* size */) {}
+
+bool lz4::available() { return false; }
+
+Stream::Stream() { throw LZ4Error("Spicy runtime has been built without LZ4 support"); }
+
+#endif
+
+// Don't finish the stream here, it might be shared with other instances.
+Stream::~Stream() = default;
+
+void Stream::setLimits(uint64_t max_output, uint64_t max_ratio) {
+    if ( ! _state )
+        throw LZ4Error("error'ed lz4 stream cannot be reused");
+
+    _state->max_output = max_output;
+    _state->max_ratio = max_ratio;
+}
+
+hilti::rt::Bytes Stream::finish() {
+    // A stream that has failed already has reported its error.
+    if ( ! _state )
+        return hilti::rt::Bytes();
+
+    if ( ! _state->ended ) {
+        _state = nullptr;
+        throw LZ4Error("incomplete compressed data");
+    }
+
+    return hilti::rt::Bytes();
+}
+
+template<typename Buffer>
+void Stream::_decompress(Buffer* out, const hilti::rt::stream::View& data) {
+    if ( ! _state )
+        throw LZ4Error("error'ed lz4 stream cannot be reused");
+
+    try {
+        for ( auto block = data.firstBlock(); block; block = data.nextBlock(block) )
+            decompressInto(_state.get(), out, block->start, block->size);
+    } catch ( const LZ4Error& ) {
+        _state = nullptr;
+        throw;
+    }
+}
+
+template<typename Buffer>
+void Stream::_decompress(Buffer* out, const hilti::rt::Bytes& data) {
+    if ( ! _state )
+        throw LZ4Error("error'ed lz4 stream cannot be reused");
+
+    try {
+        decompressInto(_state.get(), out, data.data(), data.size());
+    } catch ( const LZ4Error& ) {
+        _state = nullptr;
+        throw;
+    }
+}
+
+hilti::rt::Bytes Stream::decompress(const hilti::rt::stream::View& data) {
+    std::string decoded;
+    _decompress(&decoded, data);
+    return hilti::rt::Bytes(std::move(decoded));
+}
+
+hilti::rt::Bytes Stream::decompress(const hilti::rt::Bytes& data) {
+    std::string decoded;
+    _decompress(&decoded, data);
+    return hilti::rt::Bytes(std::move(decoded));
+}
+
+void Stream::decompress(hilti::rt::Stream& output, const hilti::rt::stream::View& data) {
+    std::vector<hilti::rt::stream::Byte> decoded;
+    _decompress(&decoded, data);
+    output.append(std::move(decoded));
+}
+
+void Stream::decompress(hilti::rt::Stream& output, const hilti::rt::Bytes& data) {
+    std::vector<hilti::rt::stream::Byte> decoded;
+    _decompress(&decoded, data);
+    output.append(std::move(decoded));
+}
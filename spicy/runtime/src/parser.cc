@@ -1,5 +1,7 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
+#include <algorithm>
+#include <cinttypes>
 #include <limits>
 #include <utility>
 
@@ -166,6 +168,19 @@ bool detail::atEod(hilti::rt::ValueReference<hilti::rt::Stream>& data, const hil
     return ! waitForInputOrEod(data, cur, filters);
 }
 
+void detail::discardInput(hilti::rt::ValueReference<hilti::rt::Stream>& data, const hilti::rt::stream::View& cur,
+                          uint64_t n) {
+    auto end = cur.offset() + n;
+
+    // Never discard beyond what the view covers, that's for somebody else to parse.
+    if ( auto end_offset = cur.endOffset() )
+        end = std::min(end, *end_offset);
+
+    SPICY_RT_DEBUG_VERBOSE(
+        hilti::rt::fmt("discarding input for stream %p up to offset %" PRIu64, data.get(), end.Ref()));
+    data->discardUntil(end);
+}
+
 std::optional<hilti::rt::stream::SafeConstIterator> detail::unitFind(
     const hilti::rt::stream::SafeConstIterator& begin, const hilti::rt::stream::SafeConstIterator& end,
     const std::optional<hilti::rt::stream::SafeConstIterator>& i, const hilti::rt::Bytes& needle,
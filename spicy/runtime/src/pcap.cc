@@ -0,0 +1,718 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#include <netinet/in.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#include <hilti/rt/fmt.h>
+#include <hilti/rt/util.h>
+
+#include <spicy/rt/pcap.h>
+
+using namespace spicy::rt;
+using namespace spicy::rt::pcap;
+
+using hilti::rt::Nothing;
+using hilti::rt::Result;
+using hilti::rt::result::Error;
+
+namespace {
+
+// Block types of pcapng.
+constexpr uint32_t SectionHeaderBlock = 0x0A0D0D0A;
+constexpr uint32_t InterfaceDescriptionBlock = 1;
+constexpr uint32_t SimplePacketBlock = 3;
+constexpr uint32_t EnhancedPacketBlock = 6;
+
+// Upper limit for the size of records and blocks, to guard against corrupt input.
+constexpr uint32_t MaxRecordSize = 256 * 1024 * 1024;
+
+// Network-order accessors for decoding headers.
+uint16_t ntoh16(const Byte* p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+
+uint32_t ntoh32(const Byte* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+constexpr uint16_t EtherTypeIPv4 = 0x0800;
+constexpr uint16_t EtherTypeIPv6 = 0x86DD;
+constexpr uint16_t EtherTypeVLAN = 0x8100;
+constexpr uint16_t EtherTypeQinQ = 0x88A8;
+
+constexpr uint8_t ProtoTCP = 6;
+constexpr uint8_t ProtoUDP = 17;
+constexpr uint8_t ProtoAH = 51;
+
+bool decodeTransport(uint8_t proto, const Byte* data, size_t size, Segment* segment) {
+    switch ( proto ) {
+        case ProtoTCP: {
+            if ( size < 20 )
+                return false;
+
+            auto header_size = static_cast<size_t>(data[12] >> 4) * 4;
+            if ( header_size < 20 || header_size > size )
+                return false;
+
+            segment->src_port = hilti::rt::Port(ntoh16(data), hilti::rt::Protocol::TCP);
+            segment->dst_port = hilti::rt::Port(ntoh16(data + 2), hilti::rt::Protocol::TCP);
+            segment->seq = ntoh32(data + 4);
+            segment->flags = data[13];
+            segment->payload = data + header_size;
+            segment->size = size - header_size;
+            return true;
+        }
+
+        case ProtoUDP: {
+            if ( size < 8 )
+                return false;
+
+            auto length = std::min(static_cast<size_t>(ntoh16(data + 4)), size);
+            if ( length < 8 )
+                return false;
+
+            segment->src_port = hilti::rt::Port(ntoh16(data), hilti::rt::Protocol::UDP);
+            segment->dst_port = hilti::rt::Port(ntoh16(data + 2), hilti::rt::Protocol::UDP);
+            segment->seq = 0;
+            segment->flags = 0;
+            segment->payload = data + 8;
+            segment->size = length - 8;
+            return true;
+        }
+
+        default: return false;
+    }
+}
+
+bool decodeIPv4(const Byte* data, size_t size, Segment* segment) {
+    if ( size < 20 || (data[0] >> 4) != 4 )
+        return false;
+
+    // With TCP segmentation offload, the total length may not have been
+    // filled in yet; we then go with what has been captured.
+    auto header_size = static_cast<size_t>(data[0] & 0x0f) * 4;
+    auto total_size = static_cast<size_t>(ntoh16(data + 2));
+    total_size = (total_size ? std::min(total_size, size) : size);
+    if ( header_size < 20 || header_size > total_size )
+        return false;
+
+    if ( ntoh16(data + 6) & 0x3fff )
+        return false; // fragment
+
+    auto next = data[9];
+    auto offset = header_size;
+
+    // Skip an authentication header, which leaves the payload in the clear.
+    // Its length counts 4-byte units, minus 2.
+    if ( next == ProtoAH ) {
+        if ( offset + 8 > total_size )
+            return false;
+
+        next = data[offset];
+        offset += (static_cast<size_t>(data[offset + 1]) + 2) * 4;
+
+        if ( offset > total_size )
+            return false;
+    }
+
+    struct in_addr src;
+    struct in_addr dst;
+    memcpy(&src, data + 12, sizeof(src));
+    memcpy(&dst, data + 16, sizeof(dst));
+    segment->src = hilti::rt::Address(src);
+    segment->dst = hilti::rt::Address(dst);
+
+    return decodeTransport(next, data + offset, total_size - offset, segment);
+}
+
+bool decodeIPv6(const Byte* data, size_t size, Segment* segment) {
+    if ( size < 40 || (data[0] >> 4) != 6 )
+        return false;
+
+    auto total_size = std::min(40 + static_cast<size_t>(ntoh16(data + 4)), size);
+    auto next = data[6];
+    size_t offset = 40;
+
+    // Skip extension headers, including authentication headers, which leave
+    // the payload in the clear. An authentication header's length counts
+    // 4-byte units minus 2, the others' 8-byte units minus 1.
+    while ( next == 0 || next == 43 || next == 60 || next == ProtoAH ) {
+        if ( offset + 8 > total_size )
+            return false;
+
+        auto header_size = (next == ProtoAH ? (static_cast<size_t>(data[offset + 1]) + 2) * 4 :
+                                              (static_cast<size_t>(data[offset + 1]) + 1) * 8);
+        next = data[offset];
+        offset += header_size;
+    }
+
+    if ( next == 44 || offset > total_size )
+        return false; // fragment, or truncated
+
+    struct in6_addr src;
+    struct in6_addr dst;
+    memcpy(&src, data + 8, sizeof(src));
+    memcpy(&dst, data + 24, sizeof(dst));
+    segment->src = hilti::rt::Address(src);
+    segment->dst = hilti::rt::Address(dst);
+
+    return decodeTransport(next, data + offset, total_size - offset, segment);
+}
+
+bool decodeIP(const Byte* data, size_t size, Segment* segment) {
+    if ( size < 1 )
+        return false;
+
+    switch ( data[0] >> 4 ) {
+        case 4: return decodeIPv4(data, size, segment);
+        case 6: return decodeIPv6(data, size, segment);
+        default: return false;
+    }
+}
+
+bool decodeEtherType(uint16_t type, const Byte* data, size_t size, Segment* segment) {
+    switch ( type ) {
+        case EtherTypeIPv4: return decodeIPv4(data, size, segment);
+        case EtherTypeIPv6: return decodeIPv6(data, size, segment);
+        default: return false;
+    }
+}
+
+} // namespace
+
+Result<Nothing> Reader::open() {
+    if ( ! _read(4) )
+        return Error("cannot read trace header");
+
+    static const Byte pcapng_magic[] = {0x0a, 0x0d, 0x0d, 0x0a};
+
+    if ( memcmp(_buffer.data(), pcapng_magic, sizeof(pcapng_magic)) == 0 ) {
+        _format = Format::PcapNG;
+
+        if ( ! _read(4) )
+            return Error("premature end of pcapng section header");
+
+        return _readSectionHeader({_buffer[0], _buffer[1], _buffer[2], _buffer[3]});
+    }
+
+    _format = Format::Pcap;
+
+    if ( _buffer[0] == 0xd4 && _buffer[1] == 0xc3 && _buffer[2] == 0xb2 && _buffer[3] == 0xa1 )
+        _big_endian = false;
+    else if ( _buffer[0] == 0xa1 && _buffer[1] == 0xb2 && _buffer[2] == 0xc3 && _buffer[3] == 0xd4 )
+        _big_endian = true;
+    else if ( _buffer[0] == 0x4d && _buffer[1] == 0x3c && _buffer[2] == 0xb2 && _buffer[3] == 0xa1 ) {
+        _big_endian = false;
+        _time_unit = 1e-9;
+    }
+    else if ( _buffer[0] == 0xa1 && _buffer[1] == 0xb2 && _buffer[2] == 0x3c && _buffer[3] == 0x4d ) {
+        _big_endian = true;
+        _time_unit = 1e-9;
+    }
+    else
+        return Error("input is not a pcap or pcapng trace");
+
+    // <version-major:2> <version-minor:2> <thiszone:4> <sigfigs:4> <snaplen:4> <network:4>
+    if ( ! _read(20) )
+        return Error("premature end of pcap header");
+
+    _link_type = _u32(16) & 0x0fffffff; // upper bits may carry FCS information
+    return Nothing();
+}
+
+Result<bool> Reader::next(Packet* packet) {
+    switch ( _format ) {
+        case Format::Pcap: return _nextPcap(packet);
+        case Format::PcapNG: return _nextPcapNG(packet);
+        case Format::Unknown: return Error("trace has not been opened");
+    }
+
+    hilti::rt::cannot_be_reached();
+}
+
+Result<bool> Reader::_nextPcap(Packet* packet) {
+    // <ts-sec:4> <ts-fraction:4> <captured-length:4> <original-length:4> <data>
+    if ( ! _read(16) ) {
+        if ( _in.gcount() == 0 )
+            return false;
+
+        return Error("premature end of pcap record");
+    }
+
+    auto time = static_cast<double>(_u32(0)) + static_cast<double>(_u32(4)) * _time_unit;
+    auto size = _u32(8);
+
+    if ( size > MaxRecordSize )
+        return Error("invalid pcap record");
+
+    if ( ! _read(size) )
+        return Error("premature end of pcap record");
+
+    packet->time = time;
+    packet->link_type = _link_type;
+    packet->data = _buffer.data();
+    packet->size = size;
+    return true;
+}
+
+Result<bool> Reader::_nextPcapNG(Packet* packet) {
+    while ( true ) {
+        // <type:4> <length:4> <body> <length:4>
+        if ( ! _read(8) ) {
+            if ( _in.gcount() == 0 )
+                return false;
+
+            return Error("premature end of pcapng block");
+        }
+
+        // The type of a section header reads the same in either byte order.
+        if ( _u32(0) == SectionHeaderBlock ) {
+            if ( auto x = _readSectionHeader({_buffer[4], _buffer[5], _buffer[6], _buffer[7]}); ! x )
+                return x.error();
+
+            continue;
+        }
+
+        auto type = _u32(0);
+        auto length = _u32(4);
+
+        if ( length < 12 || length % 4 != 0 || length > MaxRecordSize || ! _read(length - 8) )
+            return Error("invalid pcapng block");
+
+        switch ( type ) {
+            case InterfaceDescriptionBlock: {
+                if ( auto x = _parseInterface(); ! x )
+                    return x.error();
+
+                break;
+            }
+
+            case EnhancedPacketBlock: {
+                // <interface:4> <ts-high:4> <ts-low:4> <captured-length:4> <original-length:4> <data> <options>
+                if ( _buffer.size() < 24 )
+                    return Error("invalid pcapng enhanced packet block");
+
+                auto interface = _u32(0);
+                if ( interface >= _interfaces.size() )
+                    return Error("pcapng packet refers to unknown interface");
+
+                auto ts = (static_cast<uint64_t>(_u32(4)) << 32) | _u32(8);
+                auto size = _u32(12);
+
+                if ( size > _buffer.size() - 24 )
+                    return Error("invalid pcapng enhanced packet block");
+
+                packet->time = static_cast<double>(ts) * _interfaces[interface].time_unit;
+                packet->link_type = _interfaces[interface].link_type;
+                packet->data = _buffer.data() + 20;
+                packet->size = size;
+                return true;
+            }
+
+            case SimplePacketBlock: {
+                // <original-length:4> <data>
+                if ( _buffer.size() < 8 || _interfaces.empty() )
+                    return Error("invalid pcapng simple packet block");
+
+                packet->time = 0;
+                packet->link_type = _interfaces[0].link_type;
+                packet->data = _buffer.data() + 4;
+                packet->size = std::min(static_cast<size_t>(_u32(0)), _buffer.size() - 8);
+                return true;
+            }
+
+            default:
+                // Not carrying packets, skip.
+                break;
+        }
+    }
+}
+
+Result<Nothing> Reader::_readSectionHeader(std::array<Byte, 4> length) {
+    // <byte-order-magic:4> <version-major:2> <version-minor:2> <section-length:8> <options> <length:4>
+    //
+    // The byte-order magic determines how to decode the block's length, which we have read already.
+    if ( ! _read(4) )
+        return Error("premature end of pcapng section header");
+
+    if ( _buffer[0] == 0x1a && _buffer[1] == 0x2b && _buffer[2] == 0x3c && _buffer[3] == 0x4d )
+        _big_endian = true;
+    else if ( _buffer[0] == 0x4d && _buffer[1] == 0x3c && _buffer[2] == 0x2b && _buffer[3] == 0x1a )
+        _big_endian = false;
+    else
+        return Error("invalid byte-order magic in pcapng section header");
+
+    _buffer.assign(length.begin(), length.end());
+    auto size = _u32(0);
+
+    if ( size < 28 || size % 4 != 0 || size > MaxRecordSize || ! _read(size - 12) )
+        return Error("invalid pcapng section header");
+
+    if ( _u16(0) != 1 )
+        return Error(hilti::rt::fmt("unsupported pcapng version %u", _u16(0)));
+
+    _interfaces.clear();
+    return Nothing();
+}
+
+Result<Nothing> Reader::_parseInterface() {
+    // <link-type:2> <reserved:2> <snaplen:4> <options> <length:4>
+    if ( _buffer.size() < 12 )
+        return Error("invalid pcapng interface description block");
+
+    Interface interface{.link_type = _u16(0), .time_unit = 1e-6};
+
+    // Look for the timestamp resolution option.
+    size_t offset = 8;
+    while ( offset + 4 <= _buffer.size() - 4 ) {
+        auto code = _u16(offset);
+        auto length = _u16(offset + 2);
+
+        if ( code == 0 ) // end of options
+            break;
+
+        if ( code == 9 && length == 1 && offset + 5 <= _buffer.size() ) { // if_tsresol
+            auto resolution = _buffer[offset + 4];
+            if ( resolution & 0x80 )
+                interface.time_unit = std::pow(2.0, -static_cast<double>(resolution & 0x7f));
+            else
+                interface.time_unit = std::pow(10.0, -static_cast<double>(resolution));
+        }
+
+        offset += 4 + ((length + 3U) & ~3U);
+    }
+
+    _interfaces.push_back(interface);
+    return Nothing();
+}
+
+bool Reader::_read(size_t size) {
+    _buffer.resize(size);
+    _in.read(reinterpret_cast<char*>(_buffer.data()), static_cast<std::streamsize>(size));
+    return static_cast<size_t>(_in.gcount()) == size;
+}
+
+uint16_t Reader::_u16(size_t offset) const {
+    const auto* p = _buffer.data() + offset;
+    return _big_endian ? static_cast<uint16_t>((p[0] << 8) | p[1]) : static_cast<uint16_t>((p[1] << 8) | p[0]);
+}
+
+uint32_t Reader::_u32(size_t offset) const {
+    const auto* p = _buffer.data() + offset;
+
+    if ( _big_endian )
+        return ntoh32(p);
+    else
+        return (static_cast<uint32_t>(p[3]) << 24) | (static_cast<uint32_t>(p[2]) << 16) |
+               (static_cast<uint32_t>(p[1]) << 8) | static_cast<uint32_t>(p[0]);
+}
+
+bool pcap::decode(const Packet& packet, Segment* segment) {
+    const auto* data = packet.data;
+    auto size = packet.size;
+    segment->time = packet.time;
+
+    switch ( packet.link_type ) {
+        case link_type::Null: {
+            // The address family is in the capturing host's byte order.
+            if ( size < 4 )
+                return false;
+
+            auto family = (data[0] ? data[0] : data[3]);
+            if ( family == 2 )
+                return decodeIPv4(data + 4, size - 4, segment);
+            else if ( family == 24 || family == 28 || family == 30 )
+                return decodeIPv6(data + 4, size - 4, segment);
+            else
+                return false;
+        }
+
+        case link_type::Ethernet: {
+            if ( size < 14 )
+                return false;
+
+            size_t offset = 12;
+            auto type = ntoh16(data + offset);
+
+            while ( type == EtherTypeVLAN || type == EtherTypeQinQ ) {
+                offset += 4;
+                if ( offset + 2 > size )
+                    return false;
+
+                type = ntoh16(data + offset);
+            }
+
+            offset += 2;
+            return decodeEtherType(type, data + offset, size - offset, segment);
+        }
+
+        case link_type::Raw: return decodeIP(data, size, segment);
+        case link_type::IPv4: return decodeIPv4(data, size, segment);
+        case link_type::IPv6: return decodeIPv6(data, size, segment);
+
+        case link_type::LinuxSLL: {
+            if ( size < 16 )
+                return false;
+
+            return decodeEtherType(ntoh16(data + 14), data + 16, size - 16, segment);
+        }
+
+        case link_type::LinuxSLL2: {
+            if ( size < 20 )
+                return false;
+
+            return decodeEtherType(ntoh16(data), data + 20, size - 20, segment);
+        }
+
+        default: return false;
+    }
+}
+
+void Reassembler::add(uint32_t seq, const Byte* data, size_t size) {
+    if ( ! _initialized ) {
+        _initial_seq = seq - static_cast<uint32_t>(_offset);
+        _initialized = true;
+    }
+
+    if ( size == 0 )
+        return;
+
+    // Map the sequence number to a stream offset, taking wrap-around into
+    // account by assuming it's within 2GB of the current offset.
+    auto expected = static_cast<uint32_t>(_initial_seq + static_cast<uint32_t>(_offset));
+    auto delta = static_cast<int32_t>(seq - expected);
+
+    if ( delta < 0 ) {
+        // Starts before what we have delivered already, trim the overlap.
+        auto overlap = static_cast<size_t>(-static_cast<int64_t>(delta));
+        if ( overlap >= size )
+            return; // retransmission of data delivered already
+
+        data += overlap;
+        size -= overlap;
+        delta = 0;
+    }
+
+    if ( delta == 0 ) {
+        _offset += size;
+        _on_data(std::vector<Byte>(data, data + size));
+        _deliver();
+        return;
+    }
+
+    // Ahead of a hole, buffer unless we have that already.
+    auto offset = _offset + static_cast<uint64_t>(delta);
+    if ( auto i = _out_of_order.find(offset); i != _out_of_order.end() ) {
+        if ( i->second.size() >= size )
+            return;
+
+        _buffered -= i->second.size();
+    }
+
+    _out_of_order[offset] = std::vector<Byte>(data, data + size);
+    _buffered += size;
+
+    while ( _buffered > _max_buffered )
+        _skipHole();
+}
+
+void Reassembler::flush() {
+    while ( ! _out_of_order.empty() )
+        _skipHole();
+}
+
+void Reassembler::_deliver() {
+    while ( ! _out_of_order.empty() ) {
+        auto i = _out_of_order.begin();
+        auto start = i->first;
+        if ( start > _offset )
+            break; // still a hole
+
+        auto data = std::move(i->second);
+        auto end = start + data.size();
+        _buffered -= data.size();
+        _out_of_order.erase(i);
+
+        if ( end <= _offset )
+            continue; // covered already
+
+        if ( start < _offset )
+            // Trim the overlap with data delivered already.
+            data.erase(data.begin(), data.begin() + static_cast<std::ptrdiff_t>(_offset - start));
+
+        _offset = end;
+        _on_data(std::move(data));
+    }
+}
+
+void Reassembler::_skipHole() {
+    if ( _out_of_order.empty() )
+        return;
+
+    auto next = _out_of_order.begin()->first;
+    if ( next > _offset ) {
+        _on_gap(next - _offset);
+        _offset = next;
+    }
+
+    _deliver();
+}
+
+std::string Connection::str() const {
+    return hilti::rt::fmt("%s:%u-%s:%s", orig, orig_port.port(), resp, resp_port);
+}
+
+void ConnectionTable::process(const Segment& segment) {
+    auto src = std::make_pair(segment.src, segment.src_port);
+    auto dst = std::make_pair(segment.dst, segment.dst_port);
+    auto key = (src < dst ? std::make_pair(src, dst) : std::make_pair(dst, src));
+    auto is_tcp = (segment.src_port.protocol() == hilti::rt::Protocol::TCP);
+
+    if ( _idle_timeout > 0 )
+        _expire(segment.time);
+
+    auto i = _connections.find(key);
+    if ( i == _connections.end() ) {
+        // For TCP, only start tracking with a SYN or payload.
+        if ( is_tcp && ! (segment.flags & tcp::SYN) && segment.size == 0 )
+            return;
+
+        if ( is_tcp && (segment.flags & tcp::RST) )
+            return;
+
+        auto conn = std::make_unique<Connection>();
+        conn->id = _next_id++;
+
+        // If the first segment acknowledges a SYN, it's coming from the responder.
+        if ( is_tcp && (segment.flags & tcp::SYN) && (segment.flags & tcp::ACK) ) {
+            conn->orig = segment.dst;
+            conn->orig_port = segment.dst_port;
+            conn->resp = segment.src;
+            conn->resp_port = segment.src_port;
+        }
+        else {
+            conn->orig = segment.src;
+            conn->orig_port = segment.src_port;
+            conn->resp = segment.dst;
+            conn->resp_port = segment.dst_port;
+        }
+
+        if ( _callbacks.begin )
+            _callbacks.begin(*conn);
+
+        if ( conn->active && is_tcp ) {
+            auto* c = conn.get();
+
+            for ( auto is_orig : {true, false} ) {
+                auto r = std::make_unique<Reassembler>(
+                    [this, c, is_orig](std::vector<Byte>&& data) {
+                        if ( _callbacks.data )
+                            _callbacks.data(*c, is_orig, std::move(data));
+                    },
+                    [this, c, is_orig](uint64_t size) {
+                        if ( _callbacks.gap )
+                            _callbacks.gap(*c, is_orig, size);
+                    });
+
+                (is_orig ? c->orig_stream : c->resp_stream) = std::move(r);
+            }
+        }
+
+        if ( _idle_timeout > 0 )
+            _idle_checks.push_back(IdleCheck{.last_seen = segment.time, .key = key, .id = conn->id});
+
+        i = _connections.emplace(key, std::move(conn)).first;
+    }
+
+    auto& conn = *i->second;
+    conn.last_seen = segment.time;
+    if ( ! conn.active ) {
+        if ( is_tcp && (segment.flags & (tcp::FIN | tcp::RST)) )
+            _end(i); // stop tracking
+
+        return;
+    }
+
+    auto is_orig = (segment.src == conn.orig && segment.src_port == conn.orig_port);
+
+    if ( ! is_tcp ) {
+        // This copy is the only one the payload sees: the callback may move
+        // the vector into the parser's input, which then takes it over.
+        if ( segment.size && _callbacks.data )
+            _callbacks.data(conn, is_orig, std::vector<Byte>(segment.payload, segment.payload + segment.size));
+
+        return;
+    }
+
+    auto& stream = (is_orig ? conn.orig_stream : conn.resp_stream);
+
+    // A SYN occupies one sequence number ahead of the payload.
+    auto seq = segment.seq + ((segment.flags & tcp::SYN) ? 1U : 0U);
+    stream->add(seq, segment.payload, segment.size);
+
+    if ( segment.flags & tcp::RST ) {
+        _end(i);
+        return;
+    }
+
+    if ( segment.flags & tcp::FIN )
+        (is_orig ? conn.orig_fin : conn.resp_fin) = true;
+
+    if ( conn.orig_fin && conn.resp_fin )
+        _end(i);
+}
+
+void ConnectionTable::finish() {
+    // Collect connections in order of their IDs, which is the order they began.
+    std::vector<std::map<Key, std::unique_ptr<Connection>>::iterator> remaining;
+    remaining.reserve(_connections.size());
+
+    for ( auto i = _connections.begin(); i != _connections.end(); ++i )
+        remaining.push_back(i);
+
+    std::sort(remaining.begin(), remaining.end(),
+              [](const auto& a, const auto& b) { return a->second->id < b->second->id; });
+
+    for ( auto& i : remaining )
+        _end(i);
+}
+
+void ConnectionTable::_expire(double now) {
+    while ( ! _idle_checks.empty() && _idle_checks.front().last_seen + _idle_timeout < now ) {
+        auto check = std::move(_idle_checks.front());
+        _idle_checks.pop_front();
+
+        auto i = _connections.find(check.key);
+        if ( i == _connections.end() || i->second->id != check.id )
+            continue; // gone already
+
+        if ( i->second->last_seen + _idle_timeout < now ) {
+            i->second->expired = true;
+            _end(i);
+        }
+        else
+            // Seen since, check again later.
+            _idle_checks.push_back(IdleCheck{.last_seen = i->second->last_seen, .key = check.key, .id = check.id});
+    }
+}
+
+void ConnectionTable::_end(std::map<Key, std::unique_ptr<Connection>>::iterator i) {
+    auto conn = std::move(i->second);
+    _connections.erase(i);
+
+    if ( ! conn->active )
+        return;
+
+    if ( conn->orig_stream )
+        conn->orig_stream->flush();
+
+    if ( conn->resp_stream )
+        conn->resp_stream->flush();
+
+    if ( _callbacks.end )
+        _callbacks.end(*conn);
+}
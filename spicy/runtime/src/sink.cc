@@ -9,57 +9,155 @@ using hilti::rt::fmt;
 
 HILTI_EXCEPTION_IMPL(SinkError)
 
+sink::Statistics sink::statistics() {
+    const auto* state = spicy::rt::detail::globalState();
+    return Statistics{
+        .buffered = state->sink_buffered.load(),
+        .skips = state->sink_limit_skips.load(),
+        .drops = state->sink_limit_drops.load(),
+        .dropped_bytes = state->sink_limit_dropped_bytes.load(),
+    };
+}
+
+Sink::Sink() {
+    _init();
+
+    const auto& cfg = configuration::get();
+    _max_buffered = cfg.sink_max_buffered;
+    _max_total_buffered = cfg.sink_max_total_buffered;
+    _limit_policy = cfg.sink_limit_policy;
+}
+
 void Sink::_init() {
     assert(_states.empty() && _units.empty()); // must have been release already
 
     _policy = sink::ReassemblerPolicy::First;
     _auto_trim = true;
+    _resume_batch = 1;
+    _pending_resumes = 0;
+    _filter_batch = 0;
     _size = 0;
     _initial_seq = 0;
     _cur_rseq = 0;
     _last_reassem_rseq = 0;
     _trim_rseq = 0;
+
+    // Release whatever is still buffered from the global accounting. We
+    // recount here as a moved-from sink may still carry a stale `_buffered`.
+    uint64_t buffered = 0;
+    for ( const auto& [rseq, c] : _chunks ) {
+        if ( c.data )
+            buffered += c.data->size();
+    }
+
+    if ( buffered && spicy::rt::detail::__global_state )
+        spicy::rt::detail::__global_state->sink_buffered -= buffered;
+
+    _buffered = 0;
     _chunks.clear();
 }
 
-Sink::ChunkList::iterator Sink::_addAndCheck(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_t rupper,
-                                             ChunkList::iterator c) {
-    assert(! _chunks.empty());
+Sink::ChunkMap::iterator Sink::_insertChunk(ChunkMap::const_iterator hint, std::optional<hilti::rt::Bytes> data,
+                                            uint64_t rseq, uint64_t rupper) {
+    if ( data ) {
+        uint64_t n = data->size();
+        _buffered += n;
+        detail::globalState()->sink_buffered += n;
+    }
 
-    // Special check for the common case of appending to the end.
-    if ( rseq == _chunks.back().rupper ) {
-        _chunks.emplace_back(std::move(data), rseq, rupper);
-        return std::next(_chunks.end(), -1);
+    return _chunks.emplace_hint(hint, rseq, Chunk(std::move(data), rseq, rupper));
+}
+
+Sink::ChunkMap::iterator Sink::_eraseChunk(ChunkMap::iterator c) {
+    if ( const auto& data = c->second.data ) {
+        uint64_t n = data->size();
+        _buffered -= n;
+        detail::globalState()->sink_buffered -= n;
     }
 
-    // Find the first block that doesn't come completely before the new data.
-    for ( ; c != _chunks.end() && c->rupper <= rseq; c++ )
-        ;
+    return _chunks.erase(c);
+}
+
+bool Sink::_exceedsLimit(uint64_t n) const {
+    if ( _max_buffered && _buffered + n > _max_buffered )
+        return true;
+
+    if ( _max_total_buffered && detail::globalState()->sink_buffered + n > _max_total_buffered )
+        return true;
+
+    return false;
+}
+
+void Sink::_enforceLimits() {
+    if ( ! _exceedsLimit() )
+        return;
+
+    // Release anything delivered already first, that's always safe to do.
+    if ( ! _chunks.empty() && _chunks.begin()->second.rupper <= _cur_rseq )
+        _trim(_cur_rseq);
+
+    if ( _limit_policy != sink::LimitPolicy::Skip )
+        return;
+
+    // Skip ahead to the next data we have buffered until we are within our
+    // limits again. As skipping trims everything before the target, each
+    // round releases at least the first chunk still buffered.
+    while ( _exceedsLimit() ) {
+        auto c = _chunks.begin();
+        while ( c != _chunks.end() && (! c->second.data || c->second.rseq < _cur_rseq) )
+            ++c;
+
+        if ( c == _chunks.end() )
+            break;
 
-    if ( c == _chunks.end() ) {
-        // c is the last block, and it comes completely before the new block.
-        _chunks.emplace_back(std::move(data), rseq, rupper);
-        return std::next(_chunks.end(), -1);
+        SPICY_RT_DEBUG_VERBOSE(fmt("sink %p exceeds limit on buffered data (%" PRIu64 " bytes), skipping to rseq %" PRIu64,
+                                   this, _buffered, c->second.rseq));
+
+        ++detail::globalState()->sink_limit_skips;
+
+        auto trim_rseq = _trim_rseq;
+        _skip(c->second.rseq);
+
+        if ( _trim_rseq == trim_rseq )
+            // Not trimming, so nothing was released.
+            break;
     }
+}
 
-    if ( rupper <= c->rseq )
-        // The new block comes completely before c.
-        return _chunks.insert(c, Chunk(std::move(data), rseq, rupper));
+Sink::ChunkMap::iterator Sink::_addAndCheck(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_t rupper) {
+    assert(! _chunks.empty());
+
+    // Special check for the common case of appending to the end.
+    if ( rseq == _chunks.rbegin()->second.rupper )
+        return _insertChunk(_chunks.end(), std::move(data), rseq, rupper);
 
-    ChunkList::iterator new_c;
+    // Find the first block that doesn't come completely before the new data.
+    // As blocks don't overlap, that's either the last one starting at or
+    // before the new data, or the one after it.
+    auto c = _chunks.upper_bound(rseq);
+    if ( c != _chunks.begin() && std::prev(c)->second.rupper > rseq )
+        --c;
+
+    if ( c == _chunks.end() || rupper <= c->second.rseq )
+        // The new block comes completely before c, or after all others.
+        return _insertChunk(c, std::move(data), rseq, rupper);
+
+    ChunkMap::iterator new_c;
+    const auto& chunk = c->second;
 
     // The blocks overlap, complain & break up.
 
-    if ( rseq < c->rseq ) {
+    if ( rseq < chunk.rseq ) {
         // The new block has a prefix that comes before c.
-        uint64_t prefix_len = c->rseq - rseq;
+        uint64_t prefix_len = chunk.rseq - rseq;
+        std::optional<hilti::rt::Bytes> prefix;
 
         if ( data ) {
-            auto prefix = data->sub(data->begin() + prefix_len);
-            new_c = _chunks.insert(c, Chunk(std::move(prefix), rseq, rseq + prefix_len));
+            prefix = data->sub(data->begin() + prefix_len);
             data = data->sub(data->begin() + prefix_len, data->end());
         }
 
+        new_c = _insertChunk(c, std::move(prefix), rseq, rseq + prefix_len);
         rseq += prefix_len;
     }
 
@@ -68,14 +166,14 @@ Sink::ChunkList::iterator Sink::_addAndCheck(std::optional<hilti::rt::Bytes> dat
 
     auto overlap_start = rseq;
     auto new_c_len = rupper - rseq;
-    auto c_len = (c->rupper - overlap_start);
+    auto c_len = (chunk.rupper - overlap_start);
     auto overlap_len = (new_c_len < c_len ? new_c_len : c_len);
 
     hilti::rt::Bytes old_data;
     hilti::rt::Bytes new_data;
 
-    if ( c->data )
-        old_data = c->data->sub(overlap_start - c->rseq, overlap_start - c->rseq + overlap_len);
+    if ( chunk.data )
+        old_data = chunk.data->sub(overlap_start - chunk.rseq, overlap_start - chunk.rseq + overlap_len);
 
     if ( data )
         new_data = data->sub(overlap_len);
@@ -88,9 +186,9 @@ Sink::ChunkList::iterator Sink::_addAndCheck(std::optional<hilti::rt::Bytes> dat
         rseq += overlap_len;
 
         if ( new_c == c )
-            new_c = _addAndCheck(std::move(*data), rseq, rupper, c);
+            new_c = _addAndCheck(std::move(*data), rseq, rupper);
         else
-            _addAndCheck(std::move(*data), rseq, rupper, c);
+            _addAndCheck(std::move(*data), rseq, rupper);
     }
 
     return new_c;
@@ -101,6 +199,11 @@ bool Sink::_deliver(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_
         // A gap.
         SPICY_RT_DEBUG_VERBOSE(fmt("hit gap with sink %p at rseq %" PRIu64, this, rseq));
 
+        _flushFilter();
+
+        if ( _pending_resumes )
+            _resume();
+
         if ( _cur_rseq != rupper ) {
             _reportGap(rseq, (rupper - rseq));
             _cur_rseq = rupper;
@@ -125,17 +228,57 @@ bool Sink::_deliver(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_
         }
 
         _filter_data->input->append(*data);
-        spicy::rt::filter::flush(_filter);
+        _filter_data->pending += static_cast<uint64_t>(data->size());
 
-        data = _filter_data->output_cur.data();
-        _filter_data->output_cur = _filter_data->output_cur.advance(data->size());
+        _cur_rseq = rupper;
+        _last_reassem_rseq = rupper;
 
-        if ( data->size() == 0 )
-            // Empty chunk coming out of filter, nothing to do.
-            return true;
+        // Each run of the filter means switching into its parser, so we
+        // let it process larger batches of input if requested.
+        if ( _filter_data->pending >= _filter_batch )
+            _flushFilter();
+
+        SPICY_RT_DEBUG_VERBOSE(fmt("done delivering to sink %p", this));
+        return true;
     }
 
-    _size += data->size();
+    _cur_rseq = rupper;
+    _last_reassem_rseq = rupper;
+
+    _deliverToUnits(*data);
+
+    SPICY_RT_DEBUG_VERBOSE(fmt("done delivering to sink %p", this));
+    return true;
+}
+
+void Sink::_flushFilter() {
+    if ( ! (_filter_data && _filter_data->pending) )
+        return;
+
+    SPICY_RT_DEBUG_VERBOSE(fmt("running filter of sink %p on %" PRIu64 " bytes", this, _filter_data->pending));
+
+    _filter_data->pending = 0;
+    spicy::rt::filter::flush(_filter);
+
+    auto data = _filter_data->output_cur.data();
+    _filter_data->output_cur = _filter_data->output_cur.advance(data.size());
+
+    if ( data.size() == 0 )
+        // Empty chunk coming out of filter, nothing to do.
+        return;
+
+    _deliverToUnits(data);
+}
+
+void Sink::_deliverToUnits(const hilti::rt::Bytes& data) {
+    _size += data.size();
+
+    // If several units receive the data, they all share a single copy of it.
+    // Small chunks are stored inline by streams, no need to share those.
+    std::shared_ptr<const std::vector<hilti::rt::stream::Byte>> shared;
+
+    if ( _states.size() > 1 && data.size() > hilti::rt::stream::detail::Chunk::SmallBufferSize )
+        shared = std::make_shared<const std::vector<hilti::rt::stream::Byte>>(data.str().begin(), data.str().end());
 
     for ( auto s : _states ) {
         if ( s->skip_delivery )
@@ -144,7 +287,24 @@ bool Sink::_deliver(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_
         if ( s->resumable )
             throw ParseError("more data after sink's unit has already completed parsing");
 
-        s->data->append(*data);
+        if ( shared )
+            s->data->append(shared);
+        else
+            s->data->append(data);
+    }
+
+    if ( ++_pending_resumes >= _resume_batch )
+        _resume();
+}
+
+void Sink::_resume() {
+    _pending_resumes = 0;
+
+    for ( auto s : _states ) {
+        // Units skipping over data that's being discarded don't need to see it.
+        if ( s->skip_delivery || s->resumable || s->data->isDiscarding() )
+            continue;
+
         try {
             // Sinks are operating independently from the writer, so we
             // don't forward errors on.
@@ -155,12 +315,6 @@ bool Sink::_deliver(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_
             s->skip_delivery = true;
         }
     }
-
-    _cur_rseq = rupper;
-    _last_reassem_rseq = rupper;
-
-    SPICY_RT_DEBUG_VERBOSE(fmt("done delivering to sink %p", this));
-    return true;
 }
 
 void Sink::_newData(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_t len) {
@@ -178,7 +332,7 @@ void Sink::_newData(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_
 
     _debugReassembler("buffering data", data, rseq, len);
 
-    ChunkList::iterator c;
+    ChunkMap::iterator c;
     auto rupper_rseq = rseq + len;
 
     if ( rupper_rseq <= _trim_rseq )
@@ -194,31 +348,55 @@ void Sink::_newData(std::optional<hilti::rt::Bytes> data, uint64_t rseq, uint64_
             data = data->sub(data->begin() + amount_old, data->end());
     }
 
-    if ( _chunks.empty() ) {
-        _chunks.emplace_back(std::move(data), rseq, rseq + len);
-        c = std::next(_chunks.end(), -1);
+    if ( data && _limit_policy == sink::LimitPolicy::Drop && _exceedsLimit(data->size()) &&
+         (rseq > _last_reassem_rseq || rupper_rseq <= _last_reassem_rseq) ) {
+        // Buffering the data would exceed a limit, and it's not filling the
+        // leading hole either, so drop it.
+        SPICY_RT_DEBUG_VERBOSE(fmt("sink %p exceeds limit on buffered data (%" PRIu64 " bytes), dropping %" PRIu64
+                                   " bytes at rseq %" PRIu64,
+                                   this, _buffered, data->size(), rseq));
+
+        auto* state = detail::globalState();
+        ++state->sink_limit_drops;
+        state->sink_limit_dropped_bytes += static_cast<uint64_t>(data->size());
+        goto exit;
     }
+
+    if ( _chunks.empty() )
+        c = _insertChunk(_chunks.end(), std::move(data), rseq, rupper_rseq);
     else
-        c = _addAndCheck(std::move(data), rseq, rupper_rseq, _chunks.begin());
+        c = _addAndCheck(std::move(data), rseq, rupper_rseq);
 
     // See if we have data in order now to deliver.
 
-    if ( c->rseq > _last_reassem_rseq || c->rupper <= _last_reassem_rseq )
+    if ( c->second.rseq > _last_reassem_rseq || c->second.rupper <= _last_reassem_rseq )
         goto exit;
 
     // We've filled a leading hole. Deliver as much as possible.
     _debugReassemblerBuffer("buffer content");
 
     _tryDeliver(c);
+
+    if ( _max_buffered || _max_total_buffered )
+        _enforceLimits();
+
     return;
 
 exit:
+    if ( _max_buffered || _max_total_buffered )
+        _enforceLimits();
+
     _debugReassemblerBuffer("buffer content");
 }
 
 void Sink::_skip(uint64_t rseq) {
     SPICY_RT_DEBUG_VERBOSE(fmt("skipping sink %p to rseq %" PRIu64, this, rseq));
 
+    _flushFilter();
+
+    if ( _pending_resumes )
+        _resume();
+
     if ( _auto_trim )
         _trim(rseq); // will report undelivered
     else
@@ -239,34 +417,42 @@ void Sink::_trim(uint64_t rseq) {
         SPICY_RT_DEBUG_VERBOSE(fmt("trimming sink %p to EOD", this));
     }
 
-    for ( auto c = _chunks.begin(); c != _chunks.end(); c = _chunks.erase(c) ) {
-        if ( c->rseq >= rseq )
+    for ( auto c = _chunks.begin(); c != _chunks.end(); c = _eraseChunk(c) ) {
+        const auto& chunk = c->second;
+
+        if ( chunk.rseq >= rseq )
             break;
 
-        if ( c->data && _cur_rseq < c->rseq )
-            _reportUndelivered(c->rseq, *c->data);
+        if ( chunk.data && _cur_rseq < chunk.rseq )
+            _reportUndelivered(chunk.rseq, *chunk.data);
     }
 
     _trim_rseq = rseq;
 }
 
-void Sink::_tryDeliver(ChunkList::iterator c) {
+void Sink::_tryDeliver(ChunkMap::iterator c) {
     // Note that a new block may include both some old stuff and some new
     // stuff. _addAndCheck() will have split the new stuff off into its own
     // block(s), but in the following loop we have to take care not to
     // deliver already-delivered data.
 
     for ( ; c != _chunks.end(); c++ ) {
-        if ( c->rseq == _last_reassem_rseq ) {
+        const auto& chunk = c->second;
+
+        if ( chunk.rseq > _last_reassem_rseq )
+            // Hole, nothing further to deliver yet.
+            break;
+
+        if ( chunk.rseq == _last_reassem_rseq ) {
             // New stuff.
-            _last_reassem_rseq += (c->rupper - c->rseq);
-            if ( ! _deliver(c->data, c->rseq, c->rupper) ) {
+            _last_reassem_rseq += (chunk.rupper - chunk.rseq);
+            if ( ! _deliver(chunk.data, chunk.rseq, chunk.rupper) ) {
                 // Hit gap.
                 if ( _auto_trim )
                     // We trim just up to the gap here, excluding the gap itself.
                     // This will prevent future data beyond the gap from being
                     // delivered until we explicitly skip over it.
-                    _trim(c->rseq);
+                    _trim(chunk.rseq);
 
                 break;
             }
@@ -306,8 +492,8 @@ void Sink::_reportUndelivered(uint64_t rseq, const hilti::rt::Bytes& data) const
 }
 
 void Sink::_reportUndeliveredUpTo(uint64_t rupper) const {
-    for ( const auto& c : _chunks ) {
-        if ( c.rseq >= rupper )
+    for ( const auto& [rseq, c] : _chunks ) {
+        if ( rseq >= rupper )
             break;
 
         if ( ! c.data )
@@ -360,35 +546,91 @@ void Sink::_debugReassemblerBuffer(const std::string& msg) const {
             this, msg, _cur_rseq, _last_reassem_rseq, _trim_rseq));
 
     for ( const auto&& [i, c] : hilti::rt::enumerate(_chunks) ) // not auto&, always copied anyways
-        _debugReassembler(fmt("  * chunk %d:", i), c.data, c.rseq, (c.rupper - c.rseq));
+        _debugReassembler(fmt("  * chunk %d:", i), c.second.data, c.second.rseq, (c.second.rupper - c.second.rseq));
+}
+
+// Returns the parsers to connect for a MIME type key from a given linker scope,
+// or null if nothing has been registered for the key.
+static const std::vector<const Parser*>* findMIMEParsersByKey(const std::string& key, const std::string& scope) {
+    const auto& dispatch = detail::globalState()->mime_dispatch;
+
+    auto d = dispatch.find(key);
+    if ( d == dispatch.end() )
+        return nullptr;
+
+    if ( auto x = d->second.scoped_parsers.find(scope); x != d->second.scoped_parsers.end() )
+        return &x->second;
+
+    return &d->second.public_parsers;
+}
+
+// Returns the parsers to connect for a MIME type from a given linker scope.
+static const std::vector<const Parser*>& findMIMEParsers(const MIMEType& mt, const std::string& scope) {
+    static const std::vector<const Parser*> none;
+
+    // Try the type itself first, then its main type, then all types.
+    auto key = mt.asKey();
+
+    while ( true ) {
+        if ( const auto* parsers = findMIMEParsersByKey(key, scope) )
+            return *parsers;
+
+        if ( key.empty() )
+            return none;
+
+        if ( auto i = key.find('/'); i != std::string::npos )
+            key = key.substr(0, i);
+        else
+            key.clear();
+    }
+}
+
+void Sink::connect_filter(std::shared_ptr<filter::Native> filter) {
+    if ( _size || _filter_data )
+        throw SinkError("cannot connect filter after data has been forwarded already");
+
+    SPICY_RT_DEBUG_VERBOSE(fmt("connecting native filter %s [%p] to sink %p", filter->name(), filter.get(), this));
+    spicy::rt::filter::connect(_filter, std::move(filter));
 }
 
 void Sink::connect_mime_type(const MIMEType& mt, const std::string& scope) {
-    auto connect_matching = [&](auto mt) {
-        if ( const auto& x = detail::globalState()->parsers_by_mime_type.find(mt.asKey());
-             x != detail::globalState()->parsers_by_mime_type.end() ) {
-            for ( const auto& p : x->second ) {
-                // We only connect to public parsers or parsers in the same linker scope.
-                if ( ! p->is_public && p->linker_scope != scope )
-                    continue;
-
-                auto m = (*p->__parse_sink)(); // using a structured binding here triggers what seems to be a clang-tidy
-                                               // false positive
-
-                SPICY_RT_DEBUG_VERBOSE(fmt("connecting parser %s [%p] to sink %p for MIME type %s", p->name, &m.first,
-                                           this, std::string(mt)));
-                _units.emplace_back(std::move(m.first));
-                _states.emplace_back(m.second);
-            }
-        }
-    };
+    _connectParsers(findMIMEParsers(mt, scope), mt);
+}
+
+void Sink::connect_mime_type(const std::string& mt, const std::string& scope) {
+    if ( ! (_mime_cache && _mime_cache->mime_type == mt && _mime_cache->scope == scope) ) {
+        // Types given in their normalized form can be looked up directly,
+        // without parsing them first.
+        const std::vector<const Parser*>* parsers = nullptr;
+
+        if ( mt.find('/') != std::string::npos )
+            parsers = findMIMEParsersByKey(mt, scope);
 
-    connect_matching(mt);
-    connect_matching(MIMEType(mt.mainType(), "*"));
-    connect_matching(MIMEType("*", "*"));
+        if ( ! parsers )
+            parsers = &findMIMEParsers(MIMEType(mt), scope);
+
+        _mime_cache = MIMECache{mt, scope, parsers};
+    }
+
+    _connectParsers(*_mime_cache->parsers, mt);
+}
+
+void Sink::_connectParsers(const std::vector<const Parser*>& parsers, const std::string& mt) {
+    for ( const auto& p : parsers ) {
+        auto m = (*p->__parse_sink)(); // using a structured binding here triggers what seems to be a clang-tidy
+                                       // false positive
+
+        SPICY_RT_DEBUG_VERBOSE(
+            fmt("connecting parser %s [%p] to sink %p for MIME type %s", p->name, &m.first, this, mt));
+        _units.emplace_back(std::move(m.first));
+        _states.emplace_back(m.second);
+    }
 }
 
 void Sink::_close(bool orderly) {
+    if ( orderly )
+        _flushFilter();
+
     spicy::rt::filter::disconnect(_filter);
     _filter_data = {};
 
@@ -396,6 +638,9 @@ void Sink::_close(bool orderly) {
         SPICY_RT_DEBUG_VERBOSE(
             fmt("closing sink, disconnecting parsers from sink %p%s", this, (orderly ? "" : " (abort)")));
 
+        if ( orderly && _pending_resumes )
+            _resume();
+
         for ( auto s : _states ) {
             if ( ! s->resumable ) {
                 s->data->freeze();
@@ -465,4 +710,13 @@ std::string to_string(const sink::ReassemblerPolicy& x, tag /*unused*/) {
 
     cannot_be_reached();
 }
+
+std::string to_string(const sink::LimitPolicy& x, tag /*unused*/) {
+    switch ( x ) {
+        case spicy::rt::sink::LimitPolicy::Skip: return "sink::LimitPolicy::Skip";
+        case spicy::rt::sink::LimitPolicy::Drop: return "sink::LimitPolicy::Drop";
+    }
+
+    cannot_be_reached();
+}
 } // namespace hilti::rt::detail::adl
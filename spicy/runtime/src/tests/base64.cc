@@ -1,5 +1,7 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
+#include <string>
+
 #include <hilti/rt/doctest.h>
 #include <hilti/rt/types/bytes.h>
 #include <hilti/rt/types/stream.h>
@@ -140,6 +142,110 @@ TEST_CASE("encode") {
     }
 }
 
+// Straightforward base64 encoding to compare against.
+static std::string referenceEncode(const std::string& data) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string result;
+
+    for ( size_t i = 0; i < data.size(); i += 3 ) {
+        uint32_t x = static_cast<uint8_t>(data[i]) << 16;
+        if ( i + 1 < data.size() )
+            x |= static_cast<uint8_t>(data[i + 1]) << 8;
+        if ( i + 2 < data.size() )
+            x |= static_cast<uint8_t>(data[i + 2]);
+
+        result += alphabet[(x >> 18) & 0x3f];
+        result += alphabet[(x >> 12) & 0x3f];
+        result += (i + 1 < data.size() ? alphabet[(x >> 6) & 0x3f] : '=');
+        result += (i + 2 < data.size() ? alphabet[x & 0x3f] : '=');
+    }
+
+    return result;
+}
+
+TEST_CASE("round-trip") {
+    // Covers all byte values and lengths crossing the sizes of the
+    // vectorized blocks.
+    std::string data;
+    for ( auto i = 0; i < 1000; i++ )
+        data += static_cast<char>((i * 131 + i / 256) % 256);
+
+    for ( size_t len : {0, 1, 2, 3, 11, 12, 13, 16, 23, 24, 27, 28, 29, 31, 32, 33, 47, 48, 100, 999, 1000} ) {
+        CAPTURE(len);
+        auto plain = data.substr(0, len);
+        auto expected = referenceEncode(plain);
+
+        for ( size_t chunk : {1, 2, 5, 17, 64, 1000} ) {
+            CAPTURE(chunk);
+
+            base64::Stream encoder;
+            Bytes encoded;
+            for ( size_t i = 0; i < len; i += chunk )
+                encoded.append(base64::encode(encoder, Bytes(plain.substr(i, chunk))));
+
+            encoded.append(base64::finish(encoder));
+            CHECK_EQ(encoded.str(), expected);
+
+            base64::Stream decoder;
+            Bytes decoded;
+            for ( size_t i = 0; i < expected.size(); i += chunk )
+                decoded.append(base64::decode(decoder, Bytes(expected.substr(i, chunk))));
+
+            decoded.append(base64::finish(decoder));
+            CHECK_EQ(decoded.str(), plain);
+        }
+
+        // Views spanning multiple chunks.
+        Stream input;
+        for ( size_t i = 0; i < len; i += 7 )
+            input.append(plain.substr(i, 7));
+
+        base64::Stream encoder;
+        auto encoded = base64::encode(encoder, input.view());
+        encoded.append(base64::finish(encoder));
+        CHECK_EQ(encoded.str(), expected);
+
+        Stream encoded_input;
+        for ( size_t i = 0; i < expected.size(); i += 7 )
+            encoded_input.append(expected.substr(i, 7));
+
+        base64::Stream decoder;
+        CHECK_EQ(base64::decode(decoder, encoded_input.view()).str(), plain);
+    }
+}
+
+TEST_CASE("decode skips characters outside of alphabet") {
+    std::string plain;
+    for ( auto i = 0; i < 300; i++ )
+        plain += static_cast<char>(i % 256);
+
+    // Break encoded data into lines like MIME does, and add some noise.
+    auto encoded = referenceEncode(plain);
+    std::string wrapped;
+    for ( size_t i = 0; i < encoded.size(); i += 76 )
+        wrapped += encoded.substr(i, 76) + "\r\n";
+
+    wrapped.insert(5, " ");
+    wrapped.insert(50, "\x80");
+
+    base64::Stream stream;
+    CHECK_EQ(base64::decode(stream, Bytes(wrapped.data(), wrapped.size())).str(), plain);
+}
+
+TEST_CASE("large input") {
+    // Previous versions decoded into a stack buffer sized by the input.
+    std::string plain(16 * 1024 * 1024, 'x');
+    auto encoded = referenceEncode(plain);
+
+    base64::Stream encoder;
+    auto result = base64::encode(encoder, Bytes(plain.data(), plain.size()));
+    result.append(base64::finish(encoder));
+    CHECK_EQ(result.str(), encoded);
+
+    base64::Stream decoder;
+    CHECK_EQ(base64::decode(decoder, Bytes(encoded.data(), encoded.size())).size(), plain.size());
+}
+
 TEST_CASE("finish") {
     base64::Stream stream;
     CHECK_EQ(base64::finish(stream), ""_b);
@@ -0,0 +1,108 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#include <doctest/doctest.h>
+
+#include <sstream>
+#include <string>
+
+#include <hilti/rt/json.h>
+
+#include <spicy/rt/driver.h>
+
+using namespace spicy::rt;
+
+TEST_SUITE_BEGIN("Driver");
+
+TEST_CASE("LatencyHistogram") {
+    using driver::LatencyHistogram;
+
+    SUBCASE("buckets") {
+        for ( uint64_t ns : {0ULL, 1ULL, 15ULL, 16ULL, 17ULL, 31ULL, 32ULL, 33ULL, 1000ULL, 123456789ULL,
+                             0xffffffffffffffffULL} ) {
+            CAPTURE(ns);
+            auto bucket = LatencyHistogram::bucket(ns);
+            REQUIRE_LT(bucket, LatencyHistogram::NumBuckets);
+            CHECK_LE(LatencyHistogram::lowerBound(bucket), ns);
+
+            if ( bucket + 1 < LatencyHistogram::NumBuckets )
+                CHECK_GT(LatencyHistogram::lowerBound(bucket + 1), ns);
+        }
+
+        // Small values get exact buckets.
+        CHECK_EQ(LatencyHistogram::bucket(15), 15U);
+        CHECK_EQ(LatencyHistogram::bucket(16), 16U);
+        CHECK_EQ(LatencyHistogram::bucket(17), 17U);
+        CHECK_EQ(LatencyHistogram::bucket(32), LatencyHistogram::bucket(33));
+        CHECK_EQ(LatencyHistogram::bucket(0xffffffffffffffffULL), LatencyHistogram::NumBuckets - 1);
+    }
+
+    SUBCASE("percentiles") {
+        LatencyHistogram h;
+        CHECK_EQ(LatencyHistogram::percentile(h.counts(), 50), 0U);
+
+        for ( uint64_t i = 1; i <= 1000; i++ )
+            h.record(i * 1000);
+
+        auto counts = h.counts();
+        CHECK_EQ(LatencyHistogram::percentile(counts, 50), doctest::Approx(500000).epsilon(0.06));
+        CHECK_EQ(LatencyHistogram::percentile(counts, 99), doctest::Approx(990000).epsilon(0.06));
+        CHECK_EQ(LatencyHistogram::percentile(counts, 100), doctest::Approx(1000000).epsilon(0.06));
+        CHECK_EQ(LatencyHistogram::percentile(counts, 0), doctest::Approx(1000).epsilon(0.06));
+    }
+}
+
+TEST_CASE("ThroughputSnapshot") {
+    driver::ThroughputStats stats;
+    stats.recordInput(10);
+    stats.recordResume(100);
+    auto a = stats.snapshot();
+
+    stats.recordInput(5);
+    stats.recordResume(200);
+    stats.recordUnit();
+    stats.recordError();
+    auto b = stats.snapshot();
+
+    auto delta = b - a;
+    CHECK_EQ(delta.bytes, 5U);
+    CHECK_EQ(delta.units, 1U);
+    CHECK_EQ(delta.errors, 1U);
+    CHECK_EQ(delta.resumes, 1U);
+    CHECK_EQ(delta.latency(50), doctest::Approx(200).epsilon(0.06));
+
+    delta += a;
+    CHECK_EQ(delta.bytes, 15U);
+    CHECK_EQ(delta.resumes, 2U);
+    CHECK_EQ(delta.latency(100), doctest::Approx(200).epsilon(0.06));
+}
+
+TEST_CASE("throughput reporting") {
+    Parser parser;
+    parser.name = "Test::X";
+
+    Driver driver;
+    CHECK_FALSE(driver.throughputStats(parser));
+    driver.reportThroughput(); // no-op
+
+    std::stringstream out;
+    driver.enableThroughputReporting(out, 0, true);
+
+    auto* stats = driver.throughputStats(parser);
+    REQUIRE(stats);
+    CHECK_EQ(driver.throughputStats(parser), stats);
+
+    stats->recordInput(1024);
+    stats->recordResume(1000);
+    stats->recordUnit();
+    driver.reportThroughput();
+
+    auto j = nlohmann::json::parse(out.str());
+    CHECK_EQ(j["report"], "total");
+    CHECK_EQ(j["parsers"]["Test::X"]["bytes"], 1024);
+    CHECK_EQ(j["parsers"]["Test::X"]["units"], 1);
+    CHECK_EQ(j["parsers"]["Test::X"]["errors"], 0);
+    CHECK_EQ(j["parsers"]["Test::X"]["resumes"], 1);
+    CHECK_EQ(j["total"]["bytes"], 1024);
+}
+
+TEST_SUITE_END();
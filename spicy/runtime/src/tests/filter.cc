@@ -0,0 +1,121 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#include <doctest/doctest.h>
+
+#include <memory>
+#include <string>
+
+#include <hilti/rt/init.h>
+#include <hilti/rt/types/bytes.h>
+#include <hilti/rt/types/reference.h>
+#include <hilti/rt/types/stream.h>
+
+#include <spicy/rt/base64.h>
+#include <spicy/rt/filter.h>
+#include <spicy/rt/sink.h>
+
+using namespace hilti::rt::bytes::literals;
+using namespace spicy::rt;
+
+namespace {
+
+// Native filter duplicating each byte of input, and appending a marker at
+// the end.
+class Doubler : public filter::Native {
+public:
+    std::string name() const override { return "doubler"; }
+
+    void process(const hilti::rt::stream::View& input, hilti::rt::Stream& output) override {
+        std::string out;
+        for ( auto block = input.firstBlock(); block; block = input.nextBlock(block) ) {
+            for ( uint64_t i = 0; i < block->size; i++ )
+                out.append(2, static_cast<char>(block->start[i]));
+        }
+
+        output.append(out.data(), out.size());
+        ++calls;
+    }
+
+    void finish(hilti::rt::Stream& output) override { output.append("."); }
+
+    int calls = 0;
+};
+
+const char test_name[] = "test";
+
+} // namespace
+
+TEST_SUITE_BEGIN("Filter");
+
+TEST_CASE("native filter") {
+    hilti::rt::init(); // Noop if already initialized.
+
+    filter::State<test_name> state;
+    auto doubler = std::make_shared<Doubler>();
+    filter::connect(state, doubler);
+    REQUIRE(state);
+
+    auto data = hilti::rt::ValueReference<hilti::rt::Stream>();
+    data->append("ab");
+
+    // Available input gets processed right away.
+    auto output = filter::init(state, data, data->view());
+    REQUIRE(output);
+    CHECK_EQ(output->view().data(), "aabb"_b);
+    CHECK_EQ(doubler->calls, 1);
+
+    // Nothing to do without new input.
+    filter::flush(state);
+    CHECK_EQ(doubler->calls, 1);
+
+    data->append("c");
+    filter::flush(state);
+    CHECK_EQ(output->view().data(), "aabbcc"_b);
+    CHECK_FALSE(output->isFrozen());
+
+    data->freeze();
+    filter::flush(state);
+    CHECK_EQ(output->view().data(), "aabbcc."_b);
+    CHECK(output->isFrozen());
+    CHECK_EQ(doubler->calls, 2);
+
+    filter::disconnect(state);
+}
+
+TEST_CASE("chained native filters") {
+    hilti::rt::init(); // Noop if already initialized.
+
+    filter::State<test_name> state;
+    filter::connect(state, std::make_shared<base64::DecodeFilter>());
+    filter::connect(state, std::make_shared<Doubler>());
+
+    auto data = hilti::rt::ValueReference<hilti::rt::Stream>();
+    auto output = filter::init(state, data, data->view());
+    REQUIRE(output);
+
+    data->append("Zm9");
+    filter::flush(state);
+    CHECK_EQ(output->view().data(), "ffoo"_b);
+
+    data->append("v\n");
+    data->freeze();
+    filter::flush(state);
+    CHECK_EQ(output->view().data(), "ffoooo."_b);
+    CHECK(output->isFrozen());
+}
+
+TEST_CASE("native filter on sink") {
+    hilti::rt::init(); // Noop if already initialized.
+
+    Sink sink;
+    sink.connect_filter(std::make_shared<Doubler>());
+
+    sink.write("abc"_b);
+    CHECK_EQ(sink.size(), 6U);
+
+    // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+    CHECK_THROWS_WITH_AS(sink.connect_filter(std::make_shared<Doubler>()),
+                         "cannot connect filter after data has been forwarded already", const SinkError&);
+}
+
+TEST_SUITE_END();
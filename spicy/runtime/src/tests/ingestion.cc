@@ -0,0 +1,94 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#include <doctest/doctest.h>
+
+#include <string>
+
+#include <spicy/rt/ingestion.h>
+
+using namespace spicy::rt;
+
+TEST_SUITE_BEGIN("Ingestion");
+
+TEST_CASE("back-pressure") {
+    ingestion::Options options;
+    options.queue_size = 4;
+    options.congestion_threshold = 0.5;
+    ingestion::Worker worker(options);
+
+    const std::string data = "abc";
+    CHECK_EQ(worker.data(1, data.data(), data.size()), ingestion::Status::Ok);
+    CHECK_EQ(worker.data(1, data.data(), data.size()), ingestion::Status::Congested);
+    CHECK_EQ(worker.gap(1, 10), ingestion::Status::Congested);
+    CHECK_EQ(worker.end(1), ingestion::Status::Congested);
+    CHECK_EQ(worker.data(1, data.data(), data.size()), ingestion::Status::Full);
+    CHECK_EQ(worker.end(1), ingestion::Status::Full);
+
+    auto stats = worker.statistics();
+    CHECK_EQ(stats.queued, 4U);
+    CHECK_EQ(stats.congested, 3U);
+    CHECK_EQ(stats.rejected, 2U);
+    CHECK_EQ(stats.processed, 0U);
+
+    // Input for unknown flows gets consumed without further effect.
+    CHECK_EQ(worker.poll(), 4U);
+    CHECK_EQ(worker.poll(), 0U);
+    CHECK_EQ(worker.data(1, data.data(), data.size()), ingestion::Status::Ok);
+
+    stats = worker.statistics();
+    CHECK_EQ(stats.processed, 4U);
+    CHECK_EQ(stats.resumes, 0U);
+    CHECK_EQ(stats.flows, 0U);
+}
+
+TEST_CASE("back-pressure-pool") {
+    ingestion::Options options;
+    options.max_flows = 4;
+    options.congestion_threshold = 0.5;
+    ingestion::Pool pool(1, options);
+
+    CHECK_EQ(pool.begin(1, nullptr), ingestion::Status::Ok);
+    CHECK_EQ(pool.begin(2, nullptr), ingestion::Status::Congested);
+    CHECK_EQ(pool.begin(3, nullptr), ingestion::Status::Congested);
+    CHECK_EQ(pool.begin(4, nullptr), ingestion::Status::Congested);
+    CHECK_EQ(pool.begin(5, nullptr), ingestion::Status::Full);
+
+    // Replacing an active flow does not add to the number of flows.
+    CHECK_EQ(pool.begin(4, nullptr), ingestion::Status::Congested);
+
+    CHECK_EQ(pool.end(1), ingestion::Status::Ok);
+    CHECK_EQ(pool.begin(5, nullptr), ingestion::Status::Congested);
+
+    auto stats = pool.statistics();
+    CHECK_EQ(stats.flows, 4U);
+    CHECK_EQ(stats.congested, 5U);
+    CHECK_EQ(stats.rejected, 1U);
+}
+
+TEST_CASE("batch-size") {
+    ingestion::Options options;
+    options.num_producers = 2;
+    options.max_batch_size = 2;
+    ingestion::Worker worker(options);
+
+    for ( int i = 0; i < 3; i++ ) {
+        CHECK_EQ(worker.end(1, 0), ingestion::Status::Ok);
+        CHECK_EQ(worker.end(2, 1), ingestion::Status::Ok);
+    }
+
+    CHECK_EQ(worker.poll(), 4U);
+    CHECK_EQ(worker.poll(), 2U);
+    CHECK_EQ(worker.poll(), 0U);
+}
+
+TEST_CASE("invalid") {
+    ingestion::Options options;
+    options.num_producers = 0;
+    CHECK_THROWS_WITH_AS(ingestion::Worker{options}, "ingestion worker requires at least one producer",
+                         const hilti::rt::UsageError&);
+
+    ingestion::Worker worker;
+    CHECK_THROWS_WITH_AS(worker.end(1, 1), "invalid ingestion producer index 1", const hilti::rt::UsageError&);
+}
+
+TEST_SUITE_END();
@@ -34,6 +34,7 @@ TEST_CASE("init") {
         CHECK_EQ(gs->default_parser, std::nullopt);
         CHECK(gs->parsers_by_name.empty());
         CHECK(gs->parsers_by_mime_type.empty());
+        CHECK_EQ(gs->mime_dispatch.size(), 1U); // just the fallback for all types
 
         init();
 
@@ -122,6 +123,22 @@ TEST_CASE("init") {
         CHECK_EQ(gs->parsers_by_mime_type,
                  std::map<std::string, std::vector<const Parser*>>(
                      {{parser1.mime_types.at(0), {&parser1}}, {parser2.mime_types.at(0).mainType(), {&parser2}}}));
+
+        // Lookups for `foo/bar` include the parser for `foo/*`, which is
+        // not public and hence only available from inside its own scope.
+        CHECK_EQ(gs->mime_dispatch.size(), 3U);
+
+        const auto& foo_bar = gs->mime_dispatch.at("foo/bar");
+        CHECK_EQ(foo_bar.public_parsers, std::vector<const Parser*>({&parser1}));
+        CHECK_EQ(foo_bar.scoped_parsers.at(parser2.linker_scope), std::vector<const Parser*>({&parser1, &parser2}));
+
+        const auto& foo = gs->mime_dispatch.at("foo");
+        CHECK(foo.public_parsers.empty());
+        CHECK_EQ(foo.scoped_parsers.at(parser2.linker_scope), std::vector<const Parser*>({&parser2}));
+
+        const auto& any = gs->mime_dispatch.at("");
+        CHECK(any.public_parsers.empty());
+        CHECK(any.scoped_parsers.at(parser2.linker_scope).empty());
     }
 }
 
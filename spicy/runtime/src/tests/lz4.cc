@@ -0,0 +1,148 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#include <doctest/doctest.h>
+
+#include <string>
+
+#include <hilti/rt/extension-points.h>
+#include <hilti/rt/types/bytes.h>
+#include <hilti/rt/types/stream.h>
+
+#include <spicy/rt/autogen/config.h>
+#include <spicy/rt/lz4_.h>
+
+using namespace hilti::rt;
+using namespace hilti::rt::bytes::literals;
+using namespace spicy::rt;
+
+TEST_SUITE_BEGIN("LZ4");
+
+#ifdef SPICY_HAVE_LZ4
+
+namespace {
+const auto foo = "\x04\x22\x4d\x18\x60\x40\x82\x03\x00\x00\x80\x66\x6f\x6f\x00\x00\x00\x00"_b;
+const auto bar = "\x04\x22\x4d\x18\x60\x40\x82\x03\x00\x00\x80\x62\x61\x72\x00\x00\x00\x00"_b;
+} // namespace
+
+TEST_CASE("decompress") {
+    lz4::Stream stream;
+
+    SUBCASE("nothing") {
+        CHECK_EQ(lz4::decompress(stream, ""_b), ""_b);
+        CHECK_EQ(lz4::finish(stream), ""_b);
+    }
+
+    SUBCASE("single frame") {
+        CHECK_EQ(lz4::decompress(stream, foo), "foo"_b);
+        CHECK_EQ(lz4::finish(stream), ""_b);
+    }
+
+    SUBCASE("multiple frames") {
+        auto data = foo;
+        data.append(bar);
+        CHECK_EQ(lz4::decompress(stream, data), "foobar"_b);
+        CHECK_EQ(lz4::finish(stream), ""_b);
+    }
+
+    SUBCASE("View") {
+        Stream data;
+        data.append(foo.sub(0, 5));
+        data.append(foo.sub(5, foo.size()));
+        CHECK_EQ(lz4::decompress(stream, data.view()), "foo"_b);
+        CHECK_EQ(lz4::finish(stream), ""_b);
+    }
+
+    SUBCASE("into stream") {
+        Stream output;
+        stream.decompress(output, foo.sub(0, 5));
+        stream.decompress(output, foo.sub(5, foo.size()));
+        stream.decompress(output, bar);
+        CHECK_EQ(output.view().data(), "foobar"_b);
+    }
+
+    SUBCASE("error") {
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(lz4::decompress(stream, "invalid data"_b),
+                             "decompression failed: ERROR_frameType_unknown", const lz4::LZ4Error&);
+
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(lz4::decompress(stream, foo), "error'ed lz4 stream cannot be reused",
+                             const lz4::LZ4Error&);
+        CHECK_EQ(lz4::finish(stream), ""_b);
+    }
+
+    SUBCASE("output filling buffer") {
+        // 4096 times 'a', which decompresses exactly into the initial output buffer.
+        const auto compressed = "\x04\x22\x4d\x18\x60\x40\x82\x1a\x00\x00\x00\x1f\x61\x01\x00\xff\xff\xff\xff\xff\xff"
+                            "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xf6\x50\x61\x61\x61\x61\x61\x00\x00\x00\x00"_b;
+        CHECK_EQ(lz4::decompress(stream, compressed), Bytes(std::string(4096, 'a')));
+        CHECK_EQ(lz4::finish(stream), ""_b);
+    }
+
+    SUBCASE("truncated") {
+        CHECK_EQ(lz4::decompress(stream, foo.sub(0, 5)), ""_b);
+
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(lz4::finish(stream), "incomplete compressed data", const lz4::LZ4Error&);
+    }
+}
+
+TEST_CASE("limits") {
+    // 1000 times 'a', compressed into 29 bytes.
+    const auto compressed = "\x04\x22\x4d\x18\x60\x40\x82\x0e\x00\x00\x00\x1f\x61\x01\x00"
+                            "\xff\xff\xff\xd2\x50\x61\x61\x61\x61\x61\x00\x00\x00\x00"_b;
+    const auto decompressed = Bytes(std::string(1000, 'a'));
+
+    lz4::Stream stream;
+
+    SUBCASE("within limits") {
+        lz4::set_limits(stream, 1000, 100);
+        CHECK_EQ(lz4::decompress(stream, compressed), decompressed);
+    }
+
+    SUBCASE("size") {
+        lz4::set_limits(stream, 999, 0);
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(lz4::decompress(stream, compressed), "decompressed data exceeds limit of 999 bytes",
+                             const lz4::LZ4Error&);
+    }
+
+    SUBCASE("ratio") {
+        lz4::set_limits(stream, 0, 10);
+
+        Stream output;
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(stream.decompress(output, compressed), "decompression ratio exceeds limit of 10",
+                             const lz4::LZ4Error&);
+        CHECK_EQ(output.size(), 0U);
+    }
+}
+
+TEST_CASE("native filter") {
+    lz4::Filter filter;
+    Stream output;
+
+    auto data = foo;
+    data.append(bar);
+    filter.process(Stream(data).view(), output);
+    filter.finish(output);
+    CHECK_EQ(output.view().data(), "foobar"_b);
+}
+
+TEST_CASE("to_string") {
+    CHECK(lz4::available());
+    CHECK_EQ(to_string(lz4::Stream()), "<lz4 stream>");
+}
+
+#else
+
+TEST_CASE("unavailable") {
+    CHECK_FALSE(lz4::available());
+
+    // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+    CHECK_THROWS_WITH_AS(lz4::Stream(), "Spicy runtime has been built without LZ4 support", const lz4::LZ4Error&);
+}
+
+#endif
+
+TEST_SUITE_END();
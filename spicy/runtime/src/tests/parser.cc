@@ -212,6 +212,27 @@ TEST_CASE("waitForEod") {
     CHECK(wait2);
 }
 
+TEST_CASE("discardInput") {
+    hilti::rt::test::CaptureIO _(std::cerr); // Suppress output.
+
+    hilti::rt::init(); // Noop if already initialized.
+
+    auto data = hilti::rt::ValueReference<hilti::rt::Stream>();
+    data->append("12"_b);
+    auto view = data->view().advance(1);
+
+    detail::discardInput(data, view, 5);
+    CHECK(data->isDiscarding());
+
+    data->append("345"_b);
+    CHECK(data->isDiscarding());
+
+    data->append("67"_b);
+    CHECK_FALSE(data->isDiscarding());
+    CHECK_EQ(view.size(), 6U);
+    CHECK_EQ(view.advance(5), "7"_b);
+}
+
 TEST_CASE("waitForInput") {
     hilti::rt::test::CaptureIO _(std::cerr); // Suppress output.
 
@@ -0,0 +1,438 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#include <doctest/doctest.h>
+
+#include <cinttypes>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <hilti/rt/fmt.h>
+
+#include <spicy/rt/pcap.h>
+
+using namespace spicy::rt;
+
+namespace {
+
+std::string be16(uint16_t x) { return {static_cast<char>(x >> 8), static_cast<char>(x)}; }
+std::string be32(uint32_t x) { return be16(x >> 16) + be16(x); }
+std::string le16(uint16_t x) { return {static_cast<char>(x), static_cast<char>(x >> 8)}; }
+std::string le32(uint32_t x) { return le16(x) + le16(x >> 16); }
+
+// Returns an IPv4 packet carrying a TCP segment from 10.0.0.<src>:<sport> to 10.0.0.<dst>:<dport>.
+std::string tcp4(uint8_t src, uint16_t sport, uint8_t dst, uint16_t dport, uint32_t seq, uint8_t flags,
+                 const std::string& payload = "") {
+    auto tcp = be16(sport) + be16(dport) + be32(seq) + be32(0) + std::string("\x50", 1) +
+               std::string(1, static_cast<char>(flags)) + be16(1024) + be32(0) + payload;
+
+    return std::string("\x45\x00", 2) + be16(static_cast<uint16_t>(20 + tcp.size())) + be32(0) +
+           std::string("\x40\x06\x00\x00", 4) + std::string("\x0a\x00\x00", 3) + static_cast<char>(src) +
+           std::string("\x0a\x00\x00", 3) + static_cast<char>(dst) + tcp;
+}
+
+std::string ethernet(const std::string& ip) {
+    return std::string(12, '\x01') + std::string(ip[0] == '\x45' ? "\x08\x00" : "\x86\xdd", 2) + ip;
+}
+
+pcap::Packet packet(const std::string& data, uint32_t link_type) {
+    pcap::Packet p;
+    p.link_type = link_type;
+    p.data = reinterpret_cast<const pcap::Byte*>(data.data());
+    p.size = data.size();
+    return p;
+}
+
+// Records the output of a reassembler or connection table.
+struct Output {
+    std::string data;
+    std::vector<std::string> events;
+
+    pcap::Reassembler reassembler(size_t max_buffered = 1024) {
+        return pcap::Reassembler([this](std::vector<pcap::Byte>&& d) { data.append(d.begin(), d.end()); },
+                                 [this](uint64_t size) { data.append(hilti::rt::fmt("[gap %" PRIu64 "]", size)); },
+                                 max_buffered);
+    }
+
+    pcap::ConnectionTable::Callbacks callbacks() {
+        pcap::ConnectionTable::Callbacks callbacks;
+        callbacks.begin = [this](pcap::Connection& c) { events.emplace_back("begin " + c.str()); };
+        callbacks.data = [this](pcap::Connection& c, bool is_orig, std::vector<pcap::Byte>&& d) {
+            events.emplace_back(hilti::rt::fmt("data %" PRIu64 " %s %s", c.id, (is_orig ? "orig" : "resp"),
+                                               std::string(d.begin(), d.end())));
+        };
+        callbacks.gap = [this](pcap::Connection& c, bool is_orig, uint64_t size) {
+            events.emplace_back(
+                hilti::rt::fmt("gap %" PRIu64 " %s %" PRIu64, c.id, (is_orig ? "orig" : "resp"), size));
+        };
+        callbacks.end = [this](pcap::Connection& c) {
+            events.emplace_back(hilti::rt::fmt("%s %" PRIu64, (c.expired ? "expire" : "end"), c.id));
+        };
+        return callbacks;
+    }
+};
+
+void add(pcap::Reassembler* r, uint32_t seq, const std::string& data) {
+    r->add(seq, reinterpret_cast<const pcap::Byte*>(data.data()), data.size());
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("Pcap");
+
+TEST_CASE("reassembly") {
+    Output out;
+
+    SUBCASE("in order") {
+        auto r = out.reassembler();
+        add(&r, 100, "abc");
+        add(&r, 103, "def");
+        CHECK_EQ(out.data, "abcdef");
+        CHECK_EQ(r.offset(), 6U);
+    }
+
+    SUBCASE("out of order") {
+        auto r = out.reassembler();
+        add(&r, 100, "abc");
+        add(&r, 106, "ghi");
+        add(&r, 109, "jkl");
+        CHECK_EQ(out.data, "abc");
+        CHECK_EQ(r.buffered(), 6U);
+
+        add(&r, 103, "def");
+        CHECK_EQ(out.data, "abcdefghijkl");
+        CHECK_EQ(r.buffered(), 0U);
+    }
+
+    SUBCASE("overlaps") {
+        auto r = out.reassembler();
+        add(&r, 100, "abc");
+        add(&r, 100, "abc"); // retransmission
+        add(&r, 101, "bcde");
+        add(&r, 108, "ijk");
+        add(&r, 107, "hijkl");
+        add(&r, 105, "fghi");
+        CHECK_EQ(out.data, "abcdefghijkl");
+    }
+
+    SUBCASE("wrap-around") {
+        auto r = out.reassembler();
+        add(&r, 0xfffffffe, "abc");
+        add(&r, 4, "ghi");
+        add(&r, 1, "def");
+        CHECK_EQ(out.data, "abcdefghi");
+    }
+
+    SUBCASE("flush") {
+        auto r = out.reassembler();
+        add(&r, 100, "abc");
+        add(&r, 110, "xyz");
+        r.flush();
+        CHECK_EQ(out.data, "abc[gap 7]xyz");
+        CHECK_EQ(r.offset(), 13U);
+    }
+
+    SUBCASE("buffer limit") {
+        auto r = out.reassembler(4);
+        add(&r, 100, "a");
+        add(&r, 102, "cd");
+        CHECK_EQ(out.data, "a");
+
+        // Exceeding the limit skips the first hole.
+        add(&r, 105, "fgh");
+        CHECK_EQ(out.data, "a[gap 1]cd");
+        CHECK_EQ(r.buffered(), 3U);
+
+        r.flush();
+        CHECK_EQ(out.data, "a[gap 1]cd[gap 1]fgh");
+    }
+}
+
+TEST_CASE("decode") {
+    pcap::Segment s;
+
+    SUBCASE("ethernet/ipv4/tcp") {
+        auto data = ethernet(tcp4(1, 1234, 2, 80, 1000, pcap::tcp::ACK, "hello"));
+        REQUIRE(pcap::decode(packet(data, pcap::link_type::Ethernet), &s));
+        CHECK_EQ(s.src, hilti::rt::Address("10.0.0.1"));
+        CHECK_EQ(s.dst, hilti::rt::Address("10.0.0.2"));
+        CHECK_EQ(s.src_port, hilti::rt::Port("1234/tcp"));
+        CHECK_EQ(s.dst_port, hilti::rt::Port("80/tcp"));
+        CHECK_EQ(s.seq, 1000U);
+        CHECK_EQ(s.flags, pcap::tcp::ACK);
+        CHECK_EQ(std::string(reinterpret_cast<const char*>(s.payload), s.size), "hello");
+    }
+
+    SUBCASE("vlan") {
+        auto ip = tcp4(1, 1234, 2, 80, 1000, pcap::tcp::ACK, "hello");
+        auto data = std::string(12, '\x01') + std::string("\x81\x00\x00\x01\x08\x00", 6) + ip;
+        REQUIRE(pcap::decode(packet(data, pcap::link_type::Ethernet), &s));
+        CHECK_EQ(s.size, 5U);
+    }
+
+    SUBCASE("ipv6/udp") {
+        auto udp = be16(5353) + be16(53) + be16(12) + be16(0) + "abcd";
+        auto ip = std::string("\x60\x00\x00\x00", 4) + be16(static_cast<uint16_t>(udp.size())) +
+                  std::string("\x11\x40", 2) + std::string(15, '\x00') + "\x01" + std::string(15, '\x00') + "\x02" +
+                  udp;
+
+        REQUIRE(pcap::decode(packet(ip, pcap::link_type::Raw), &s));
+        CHECK_EQ(s.src, hilti::rt::Address("::1"));
+        CHECK_EQ(s.dst, hilti::rt::Address("::2"));
+        CHECK_EQ(s.src_port, hilti::rt::Port("5353/udp"));
+        CHECK_EQ(s.dst_port, hilti::rt::Port("53/udp"));
+        CHECK_EQ(std::string(reinterpret_cast<const char*>(s.payload), s.size), "abcd");
+    }
+
+    SUBCASE("ipv4 without total length") {
+        // As captured with TCP segmentation offload.
+        auto ip = tcp4(1, 1234, 2, 80, 1000, pcap::tcp::ACK, "hello");
+        ip[2] = ip[3] = '\x00';
+        REQUIRE(pcap::decode(packet(ip, pcap::link_type::Raw), &s));
+        CHECK_EQ(std::string(reinterpret_cast<const char*>(s.payload), s.size), "hello");
+    }
+
+    SUBCASE("authentication header") {
+        auto udp = be16(5353) + be16(53) + be16(12) + be16(0) + "abcd";
+        auto ah = std::string("\x11\x04\x00\x00", 4) + be32(1) + be32(1) + std::string(12, '\x00');
+
+        auto ip6 = std::string("\x60\x00\x00\x00", 4) + be16(static_cast<uint16_t>(ah.size() + udp.size())) +
+                   std::string("\x33\x40", 2) + std::string(15, '\x00') + "\x01" + std::string(15, '\x00') + "\x02" +
+                   ah + udp;
+
+        REQUIRE(pcap::decode(packet(ip6, pcap::link_type::Raw), &s));
+        CHECK_EQ(s.dst_port, hilti::rt::Port("53/udp"));
+        CHECK_EQ(std::string(reinterpret_cast<const char*>(s.payload), s.size), "abcd");
+
+        auto ip4 = std::string("\x45\x00", 2) + be16(static_cast<uint16_t>(20 + ah.size() + udp.size())) + be32(0) +
+                   std::string("\x40\x33\x00\x00", 4) + std::string("\x0a\x00\x00\x01\x0a\x00\x00\x02", 8) + ah +
+                   udp;
+
+        REQUIRE(pcap::decode(packet(ip4, pcap::link_type::Raw), &s));
+        CHECK_EQ(s.dst_port, hilti::rt::Port("53/udp"));
+        CHECK_EQ(std::string(reinterpret_cast<const char*>(s.payload), s.size), "abcd");
+    }
+
+    SUBCASE("ethernet padding") {
+        // Trailing bytes beyond the IP packet's length are not payload.
+        auto data = ethernet(tcp4(1, 1234, 2, 80, 1000, pcap::tcp::ACK, "hello")) + std::string(6, '\x00');
+        REQUIRE(pcap::decode(packet(data, pcap::link_type::Ethernet), &s));
+        CHECK_EQ(s.size, 5U);
+    }
+
+    SUBCASE("unsupported") {
+        auto ip = tcp4(1, 1234, 2, 80, 1000, pcap::tcp::ACK, "hello");
+
+        auto fragment = ip;
+        fragment[6] = '\x20'; // more fragments
+        CHECK_FALSE(pcap::decode(packet(fragment, pcap::link_type::Raw), &s));
+
+        auto icmp = ip;
+        icmp[9] = '\x01';
+        CHECK_FALSE(pcap::decode(packet(icmp, pcap::link_type::Raw), &s));
+
+        CHECK_FALSE(pcap::decode(packet(ip.substr(0, 30), pcap::link_type::Raw), &s));
+        CHECK_FALSE(pcap::decode(packet(ip, 12345), &s));
+    }
+}
+
+TEST_CASE("reader") {
+    auto p1 = tcp4(1, 1234, 2, 80, 1000, pcap::tcp::SYN);
+    auto p2 = tcp4(2, 80, 1, 1234, 5000, pcap::tcp::SYN | pcap::tcp::ACK);
+
+    SUBCASE("pcap") {
+        auto trace = le32(0xa1b2c3d4) + le16(2) + le16(4) + le32(0) + le32(0) + le32(65535) + le32(101);
+        trace += le32(10) + le32(500000) + le32(static_cast<uint32_t>(p1.size())) + le32(static_cast<uint32_t>(p1.size())) + p1;
+        trace += le32(11) + le32(0) + le32(static_cast<uint32_t>(p2.size())) + le32(static_cast<uint32_t>(p2.size())) + p2;
+
+        std::istringstream in(trace);
+        pcap::Reader reader(in);
+        REQUIRE(reader.open());
+
+        pcap::Packet p;
+        REQUIRE(reader.next(&p).valueOrThrow());
+        CHECK_EQ(p.time, doctest::Approx(10.5));
+        CHECK_EQ(p.link_type, pcap::link_type::Raw);
+        CHECK_EQ(std::string(reinterpret_cast<const char*>(p.data), p.size), p1);
+
+        REQUIRE(reader.next(&p).valueOrThrow());
+        CHECK_EQ(p.time, doctest::Approx(11));
+        CHECK_EQ(std::string(reinterpret_cast<const char*>(p.data), p.size), p2);
+
+        CHECK_FALSE(reader.next(&p).valueOrThrow());
+    }
+
+    SUBCASE("pcap big-endian nanoseconds") {
+        auto trace = be32(0xa1b23c4d) + be16(2) + be16(4) + be32(0) + be32(0) + be32(65535) + be32(1);
+        auto data = ethernet(p1);
+        trace += be32(10) + be32(250000000) + be32(static_cast<uint32_t>(data.size())) + be32(static_cast<uint32_t>(data.size())) + data;
+
+        std::istringstream in(trace);
+        pcap::Reader reader(in);
+        REQUIRE(reader.open());
+
+        pcap::Packet p;
+        REQUIRE(reader.next(&p).valueOrThrow());
+        CHECK_EQ(p.time, doctest::Approx(10.25));
+        CHECK_EQ(p.link_type, pcap::link_type::Ethernet);
+        CHECK_EQ(p.size, data.size());
+        CHECK_FALSE(reader.next(&p).valueOrThrow());
+    }
+
+    SUBCASE("pcapng") {
+        auto pad = [](std::string s) { return s + std::string((4 - s.size() % 4) % 4, '\0'); };
+        auto block = [](uint32_t type, const std::string& body) {
+            auto length = static_cast<uint32_t>(body.size() + 12);
+            return le32(type) + le32(length) + body + le32(length);
+        };
+
+        auto trace = block(0x0A0D0D0A, le32(0x1A2B3C4D) + le16(1) + le16(0) + le32(0xffffffff) + le32(0xffffffff));
+        trace += block(1, le16(101) + le16(0) + le32(65535) + le16(9) + le16(1) + pad("\x03") + le16(0) + le16(0));
+        trace += block(5, std::string(8, '\0')); // unknown block type, to be skipped
+        trace += block(6, le32(0) + le32(0) + le32(1500) + le32(static_cast<uint32_t>(p1.size())) + le32(static_cast<uint32_t>(p1.size())) + pad(p1));
+        trace += block(3, le32(static_cast<uint32_t>(p2.size())) + pad(p2));
+
+        std::istringstream in(trace);
+        pcap::Reader reader(in);
+        REQUIRE(reader.open());
+
+        pcap::Packet p;
+        REQUIRE(reader.next(&p).valueOrThrow());
+        CHECK_EQ(p.time, doctest::Approx(1.5));
+        CHECK_EQ(p.link_type, pcap::link_type::Raw);
+        CHECK_EQ(std::string(reinterpret_cast<const char*>(p.data), p.size), p1);
+
+        REQUIRE(reader.next(&p).valueOrThrow());
+        CHECK_EQ(std::string(reinterpret_cast<const char*>(p.data), p.size), p2);
+
+        CHECK_FALSE(reader.next(&p).valueOrThrow());
+    }
+
+    SUBCASE("invalid") {
+        std::istringstream in("not a trace");
+        pcap::Reader reader(in);
+        CHECK_EQ(reader.open().error().description(), "input is not a pcap or pcapng trace");
+    }
+
+    SUBCASE("truncated") {
+        auto trace = le32(0xa1b2c3d4) + le16(2) + le16(4) + le32(0) + le32(0) + le32(65535) + le32(101);
+        trace += le32(10) + le32(0) + le32(static_cast<uint32_t>(p1.size())) + le32(static_cast<uint32_t>(p1.size())) + p1.substr(0, 10);
+
+        std::istringstream in(trace);
+        pcap::Reader reader(in);
+        REQUIRE(reader.open());
+
+        pcap::Packet p;
+        CHECK_EQ(reader.next(&p).error().description(), "premature end of pcap record");
+    }
+}
+
+TEST_CASE("connections") {
+    Output out;
+    pcap::ConnectionTable table(out.callbacks());
+
+    auto process = [&](const std::string& ip) {
+        pcap::Segment s;
+        REQUIRE(pcap::decode(packet(ip, pcap::link_type::Raw), &s));
+        table.process(s);
+    };
+
+    SUBCASE("tcp") {
+        process(tcp4(1, 1234, 2, 80, 1000, pcap::tcp::SYN));
+        process(tcp4(2, 80, 1, 1234, 5000, pcap::tcp::SYN | pcap::tcp::ACK));
+        process(tcp4(1, 1234, 2, 80, 1001, pcap::tcp::ACK, "GET "));
+        process(tcp4(1, 1234, 2, 80, 1009, pcap::tcp::ACK, "HTTP"));
+        process(tcp4(1, 1234, 2, 80, 1005, pcap::tcp::ACK, "/ x "));
+        process(tcp4(2, 80, 1, 1234, 5001, pcap::tcp::ACK, "200"));
+        CHECK_EQ(table.size(), 1U);
+
+        process(tcp4(1, 1234, 2, 80, 1013, pcap::tcp::FIN | pcap::tcp::ACK));
+        process(tcp4(2, 80, 1, 1234, 5004, pcap::tcp::FIN | pcap::tcp::ACK));
+        process(tcp4(1, 1234, 2, 80, 1014, pcap::tcp::ACK)); // final ACK doesn't create a new connection
+        CHECK_EQ(table.size(), 0U);
+
+        CHECK_EQ(out.events, std::vector<std::string>{"begin 10.0.0.1:1234-10.0.0.2:80/tcp", "data 0 orig GET ",
+                                                      "data 0 orig / x ", "data 0 orig HTTP", "data 0 resp 200",
+                                                      "end 0"});
+    }
+
+    SUBCASE("tcp from syn-ack") {
+        process(tcp4(2, 80, 1, 1234, 5000, pcap::tcp::SYN | pcap::tcp::ACK));
+        process(tcp4(2, 80, 1, 1234, 5001, pcap::tcp::ACK, "xyz"));
+        process(tcp4(1, 1234, 2, 80, 1000, pcap::tcp::RST));
+
+        CHECK_EQ(out.events, std::vector<std::string>{"begin 10.0.0.1:1234-10.0.0.2:80/tcp", "data 0 resp xyz",
+                                                      "end 0"});
+    }
+
+    SUBCASE("tcp gap at end") {
+        process(tcp4(1, 1234, 2, 80, 1000, pcap::tcp::ACK, "abc"));
+        process(tcp4(1, 1234, 2, 80, 1010, pcap::tcp::ACK, "xyz"));
+        table.finish();
+
+        CHECK_EQ(out.events, std::vector<std::string>{"begin 10.0.0.1:1234-10.0.0.2:80/tcp", "data 0 orig abc",
+                                                      "gap 0 orig 7", "data 0 orig xyz", "end 0"});
+    }
+
+    SUBCASE("inactive") {
+        auto callbacks = out.callbacks();
+        callbacks.begin = [&](pcap::Connection& c) { c.active = (c.resp_port.port() == 80); };
+        pcap::ConnectionTable filtered(std::move(callbacks));
+
+        for ( uint16_t port : {80, 81} ) {
+            auto ip = tcp4(1, 1234, 2, port, 1000, pcap::tcp::ACK, "abc");
+            pcap::Segment s;
+            REQUIRE(pcap::decode(packet(ip, pcap::link_type::Raw), &s));
+            filtered.process(s);
+        }
+
+        CHECK_EQ(filtered.size(), 2U);
+        filtered.finish();
+        CHECK_EQ(out.events, std::vector<std::string>{"data 0 orig abc", "end 0"});
+    }
+
+    SUBCASE("finish in order") {
+        process(tcp4(3, 1234, 2, 80, 1000, pcap::tcp::ACK, "abc"));
+        process(tcp4(1, 1234, 2, 80, 1000, pcap::tcp::ACK, "def"));
+        table.finish();
+        CHECK_EQ(table.size(), 0U);
+
+        CHECK_EQ(out.events,
+                 std::vector<std::string>{"begin 10.0.0.3:1234-10.0.0.2:80/tcp", "data 0 orig abc",
+                                          "begin 10.0.0.1:1234-10.0.0.2:80/tcp", "data 1 orig def", "end 0", "end 1"});
+    }
+
+    SUBCASE("idle timeout") {
+        pcap::ConnectionTable expiring(out.callbacks(), 10);
+
+        auto process_at = [&](double time, const std::string& ip) {
+            auto p = packet(ip, pcap::link_type::Raw);
+            p.time = time;
+            pcap::Segment s;
+            REQUIRE(pcap::decode(p, &s));
+            CHECK_EQ(s.time, time);
+            expiring.process(s);
+        };
+
+        process_at(100, tcp4(1, 1234, 2, 80, 1000, pcap::tcp::ACK, "abc"));
+        process_at(105, tcp4(3, 1234, 2, 80, 1000, pcap::tcp::ACK, "def"));
+        process_at(108, tcp4(1, 1234, 2, 80, 1003, pcap::tcp::ACK, "ghi")); // keeps first connection alive
+        process_at(112, tcp4(3, 1234, 2, 80, 1003, pcap::tcp::ACK));
+        CHECK_EQ(expiring.size(), 2U);
+
+        process_at(119, tcp4(4, 1234, 2, 80, 1000, pcap::tcp::ACK, "jkl")); // first connection expires
+        CHECK_EQ(expiring.size(), 2U);
+
+        process_at(200, tcp4(1, 1234, 2, 80, 1006, pcap::tcp::ACK, "mno")); // all others expire, then new one
+        CHECK_EQ(expiring.size(), 1U);
+
+        CHECK_EQ(out.events,
+                 std::vector<std::string>{"begin 10.0.0.1:1234-10.0.0.2:80/tcp", "data 0 orig abc",
+                                          "begin 10.0.0.3:1234-10.0.0.2:80/tcp", "data 1 orig def", "data 0 orig ghi",
+                                          "expire 0", "begin 10.0.0.4:1234-10.0.0.2:80/tcp", "data 2 orig jkl",
+                                          "expire 1", "expire 2", "begin 10.0.0.1:1234-10.0.0.2:80/tcp",
+                                          "data 3 orig mno"});
+    }
+}
+
+TEST_SUITE_END();
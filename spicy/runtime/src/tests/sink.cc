@@ -2,15 +2,191 @@
 
 #include <doctest/doctest.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
 #include <hilti/rt/extension-points.h>
 
+#include <spicy/rt/configuration.h>
+#include <spicy/rt/global-state.h>
 #include <spicy/rt/sink.h>
 
 using namespace hilti::rt;
+using namespace hilti::rt::bytes;
 using namespace spicy::rt;
 
 TEST_SUITE_BEGIN("Sink");
 
-TEST_CASE("to_string") { CHECK_EQ(to_string(sink::ReassemblerPolicy::First), "sink::ReassemblerPolicy::First"); }
+// Installs a fresh global state using a given configuration for the duration
+// of a test, restoring the previous one afterwards.
+class TestState {
+public:
+    explicit TestState(spicy::rt::Configuration cfg) {
+        _prev = std::exchange(spicy::rt::detail::__global_state, nullptr);
+        spicy::rt::detail::globalState()->configuration = std::make_unique<spicy::rt::Configuration>(std::move(cfg));
+    }
+
+    ~TestState() {
+        delete spicy::rt::detail::__global_state;
+        spicy::rt::detail::__global_state = _prev;
+    }
+
+private:
+    spicy::rt::detail::GlobalState* _prev{nullptr};
+};
+
+TEST_CASE("to_string") {
+    CHECK_EQ(to_string(sink::ReassemblerPolicy::First), "sink::ReassemblerPolicy::First");
+    CHECK_EQ(to_string(sink::LimitPolicy::Skip), "sink::LimitPolicy::Skip");
+    CHECK_EQ(to_string(sink::LimitPolicy::Drop), "sink::LimitPolicy::Drop");
+}
+
+TEST_CASE("reassembly") {
+    // Without any connected units, the sink's size and sequence number
+    // reflect how much data it has reassembled and delivered.
+    Sink sink;
+
+    SUBCASE("in order") {
+        sink.write("abc"_b);
+        sink.write("def"_b);
+        CHECK_EQ(sink.size(), 6U);
+        CHECK_EQ(sink.sequence_number(), 6U);
+    }
+
+    SUBCASE("out of order") {
+        sink.write("ghi"_b, 6);
+        sink.write("def"_b, 3);
+        CHECK_EQ(sink.size(), 0U);
+        CHECK_EQ(sink.sequence_number(), 0U);
+
+        sink.write("abc"_b, 0);
+        CHECK_EQ(sink.size(), 9U);
+        CHECK_EQ(sink.sequence_number(), 9U);
+    }
+
+    SUBCASE("overlaps") {
+        sink.write("cdef"_b, 2);
+        sink.write("abcd"_b, 0);
+        CHECK_EQ(sink.size(), 6U);
+
+        sink.write("bc"_b, 1); // delivered already
+        CHECK_EQ(sink.size(), 6U);
+        CHECK_EQ(sink.sequence_number(), 6U);
+    }
+
+    SUBCASE("retransmission spanning several chunks") {
+        sink.write("bc"_b, 11);
+        sink.write("ef"_b, 14);
+        sink.write("hi"_b, 17);
+        CHECK_EQ(sink.size(), 0U);
+
+        sink.write("abcdefghij"_b, 10);
+        CHECK_EQ(sink.size(), 0U); // still missing the beginning
+
+        sink.write("0123456789"_b, 0);
+        CHECK_EQ(sink.size(), 20U);
+        CHECK_EQ(sink.sequence_number(), 20U);
+    }
+
+    SUBCASE("initial sequence number") {
+        sink.set_initial_sequence_number(1000);
+        sink.write("def"_b, 1003);
+        sink.write("abc"_b, 1000);
+        CHECK_EQ(sink.size(), 6U);
+        CHECK_EQ(sink.sequence_number(), 1006U);
+    }
+
+    SUBCASE("shuffled") {
+        // Deliver segments in random order, some of them twice.
+        std::vector<uint64_t> segments(200);
+        std::iota(segments.begin(), segments.end(), 0);
+        segments.insert(segments.end(), segments.begin(), segments.begin() + 50);
+        std::shuffle(segments.begin(), segments.end(), std::mt19937(42)); // NOLINT
+
+        for ( auto i : segments )
+            sink.write("0123456789"_b, i * 10);
+
+        CHECK_EQ(sink.size(), 2000U);
+        CHECK_EQ(sink.sequence_number(), 2000U);
+    }
+}
+
+TEST_CASE("limits") {
+    spicy::rt::Configuration cfg;
+
+    SUBCASE("skip") {
+        cfg.sink_max_buffered = 10;
+        TestState _(cfg);
+
+        Sink sink;
+        sink.write("0123456789"_b, 10);
+        CHECK_EQ(sink::statistics().buffered, 10U);
+        CHECK_EQ(sink::statistics().skips, 0U);
+
+        // Exceeds the limit, so the sink skips over the leading hole.
+        sink.write("abcde"_b, 30);
+        CHECK_EQ(sink::statistics().skips, 1U);
+        CHECK_EQ(sink::statistics().buffered, 5U);
+        CHECK_EQ(sink.size(), 10U);
+        CHECK_EQ(sink.sequence_number(), 20U);
+
+        sink.write("klmnopqrst"_b, 20);
+        CHECK_EQ(sink::statistics().buffered, 0U);
+        CHECK_EQ(sink.size(), 25U);
+        CHECK_EQ(sink.sequence_number(), 35U);
+    }
+
+    SUBCASE("drop") {
+        cfg.sink_max_buffered = 10;
+        cfg.sink_limit_policy = sink::LimitPolicy::Drop;
+        TestState _(cfg);
+
+        Sink sink;
+        sink.write("0123456789"_b, 10);
+
+        // Exceeds the limit, so the sink drops the new data.
+        sink.write("abcde"_b, 30);
+        CHECK_EQ(sink::statistics().drops, 1U);
+        CHECK_EQ(sink::statistics().dropped_bytes, 5U);
+        CHECK_EQ(sink::statistics().buffered, 10U);
+        CHECK_EQ(sink.sequence_number(), 0U);
+
+        // Data filling the leading hole is always accepted.
+        sink.write("0123456789"_b, 0);
+        CHECK_EQ(sink::statistics().drops, 1U);
+        CHECK_EQ(sink::statistics().buffered, 0U);
+        CHECK_EQ(sink.size(), 20U);
+        CHECK_EQ(sink.sequence_number(), 20U);
+    }
+
+    SUBCASE("total") {
+        cfg.sink_max_total_buffered = 15;
+        TestState _(cfg);
+
+        {
+            Sink sink1;
+            Sink sink2;
+
+            sink1.write("0123456789"_b, 10);
+            CHECK_EQ(sink::statistics().buffered, 10U);
+
+            // Exceeds the global limit, so the sink receiving the data
+            // skips ahead in its own buffer.
+            sink2.write("0123456789"_b, 10);
+            CHECK_EQ(sink::statistics().skips, 1U);
+            CHECK_EQ(sink::statistics().buffered, 10U);
+            CHECK_EQ(sink1.sequence_number(), 0U);
+            CHECK_EQ(sink2.sequence_number(), 20U);
+        }
+
+        // Anything still buffered is released when a sink goes away.
+        CHECK_EQ(sink::statistics().buffered, 0U);
+    }
+}
 
 TEST_SUITE_END();
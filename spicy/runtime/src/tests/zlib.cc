@@ -2,8 +2,11 @@
 
 #include <doctest/doctest.h>
 
+#include <string>
+
 #include <hilti/rt/extension-points.h>
 #include <hilti/rt/types/bytes.h>
+#include <hilti/rt/types/stream.h>
 
 #include <spicy/rt/zlib_.h>
 
@@ -98,6 +101,139 @@ TEST_CASE("decompress") {
     }
 }
 
+TEST_CASE("decompress into stream") {
+    zlib::Stream stream;
+    Stream output;
+
+    SUBCASE("Bytes") {
+        zlib::decompress(stream, ""_b); // no-op
+        CHECK_EQ(output.size(), 0U);
+
+        stream.decompress(output, "x\x01\x01\x03\x00\xfc\xff"_b);
+        stream.decompress(output, "\x00\x01\x02\x00\x07\x00\x04"_b);
+        CHECK_EQ(output.view().data(), "\x00\x01\x02"_b);
+    }
+
+    SUBCASE("View") {
+        Stream data;
+        data.append("x\x01\x01\x03\x00\xfc\xff"_b);
+        data.append("\x00\x01\x02\x00\x07\x00\x04"_b);
+        stream.decompress(output, data.view());
+        CHECK_EQ(output.view().data(), "\x00\x01\x02"_b);
+    }
+
+    SUBCASE("error") {
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(stream.decompress(output, "\x01\x02\x03"_b), "inflate failed", const zlib::ZlibError&);
+        CHECK_EQ(output.size(), 0U);
+    }
+}
+
+TEST_CASE("limits") {
+    // 1000 times 'a', compressed into 17 bytes.
+    const auto compressed = "\x78\xda\x4b\x4c\x1c\x05\xa3\x60\x14\x0c\x77\x00\x00\xf9\xd8\x7a\xf8"_b;
+    const auto decompressed = Bytes(std::string(1000, 'a'));
+
+    zlib::Stream stream;
+
+    SUBCASE("within limits") {
+        zlib::set_limits(stream, 1000, 100);
+        CHECK_EQ(zlib::decompress(stream, compressed), decompressed);
+    }
+
+    SUBCASE("size") {
+        zlib::set_limits(stream, 999, 0);
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(zlib::decompress(stream, compressed), "decompressed data exceeds limit of 999 bytes",
+                             const zlib::ZlibError&);
+
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(zlib::decompress(stream, compressed), "error'ed zlib stream cannot be reused",
+                             const zlib::ZlibError&);
+    }
+
+    SUBCASE("ratio") {
+        zlib::set_limits(stream, 0, 10);
+
+        Stream output;
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(stream.decompress(output, compressed), "decompression ratio exceeds limit of 10",
+                             const zlib::ZlibError&);
+        CHECK_EQ(output.size(), 0U);
+    }
+}
+
+TEST_CASE("gzip members") {
+    const auto foo = "\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03\x4b\xcb\xcf\x07\x00\x21\x65\x73\x8c\x03\x00\x00\x00"_b;
+    const auto bar = "\x1f\x8b\x08\x00\x00\x00\x00\x00\x02\x03\x4b\x4a\x2c\x02\x00\xaa\x8c\xff\x76\x03\x00\x00\x00"_b;
+
+    zlib::Stream stream;
+
+    SUBCASE("concatenated") {
+        auto data = foo;
+        data.append(bar);
+        CHECK_EQ(zlib::decompress(stream, data), "foobar"_b);
+        CHECK_EQ(zlib::finish(stream), ""_b);
+    }
+
+    SUBCASE("separate chunks") {
+        CHECK_EQ(zlib::decompress(stream, foo), "foo"_b);
+        CHECK_EQ(zlib::decompress(stream, bar.sub(0, 5)), ""_b);
+        CHECK_EQ(zlib::decompress(stream, bar.sub(5, bar.size())), "bar"_b);
+        CHECK_EQ(zlib::finish(stream), ""_b);
+    }
+
+    SUBCASE("trailing data") {
+        auto data = foo;
+        data.append("\x00\x00\x00\x00"_b);
+        CHECK_EQ(zlib::decompress(stream, data), "foo"_b);
+        CHECK_EQ(zlib::decompress(stream, bar), ""_b);
+        CHECK_EQ(zlib::finish(stream), ""_b);
+    }
+
+    SUBCASE("not gzip") {
+        // Raw deflate and zlib data end at their first stream.
+        auto raw_stream = zlib::Stream(15);
+        auto data = "\x78\x9c\x4b\xcb\xcf\x07\x00\x02\x82\x01\x45"_b;
+        data.append(foo);
+        CHECK_EQ(zlib::decompress(raw_stream, data), "foo"_b);
+        CHECK_EQ(zlib::finish(raw_stream), ""_b);
+    }
+
+    SUBCASE("limits") {
+        zlib::set_limits(stream, 5, 0);
+        CHECK_EQ(zlib::decompress(stream, foo), "foo"_b);
+
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(zlib::decompress(stream, bar), "decompressed data exceeds limit of 5 bytes",
+                             const zlib::ZlibError&);
+    }
+}
+
+TEST_CASE("finish") {
+    zlib::Stream stream;
+
+    SUBCASE("truncated") {
+        CHECK_EQ(zlib::decompress(stream, "x\x01\x01\x03\x00\xfc\xff"_b), ""_b);
+
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(zlib::finish(stream), "incomplete compressed data", const zlib::ZlibError&);
+
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(zlib::decompress(stream, "\x00"_b), "error'ed zlib stream cannot be reused",
+                             const zlib::ZlibError&);
+    }
+
+    SUBCASE("native filter") {
+        zlib::Filter filter;
+        Stream output;
+        filter.process(Stream("x\x01\x01\x03\x00\xfc\xff"_b).view(), output);
+
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(filter.finish(output), "incomplete compressed data", const zlib::ZlibError&);
+    }
+}
+
 TEST_CASE("to_string") { CHECK_EQ(to_string(zlib::Stream()), "<zlib stream>"); }
 
 TEST_CASE("crc32") {
@@ -0,0 +1,146 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#include <doctest/doctest.h>
+
+#include <string>
+
+#include <hilti/rt/extension-points.h>
+#include <hilti/rt/types/bytes.h>
+#include <hilti/rt/types/stream.h>
+
+#include <spicy/rt/autogen/config.h>
+#include <spicy/rt/zstd_.h>
+
+using namespace hilti::rt;
+using namespace hilti::rt::bytes::literals;
+using namespace spicy::rt;
+
+TEST_SUITE_BEGIN("Zstd");
+
+#ifdef SPICY_HAVE_ZSTD
+
+namespace {
+const auto foo = "\x28\xb5\x2f\xfd\x20\x03\x19\x00\x00\x66\x6f\x6f"_b;
+const auto bar = "\x28\xb5\x2f\xfd\x20\x03\x19\x00\x00\x62\x61\x72"_b;
+} // namespace
+
+TEST_CASE("decompress") {
+    zstd::Stream stream;
+
+    SUBCASE("nothing") {
+        CHECK_EQ(zstd::decompress(stream, ""_b), ""_b);
+        CHECK_EQ(zstd::finish(stream), ""_b);
+    }
+
+    SUBCASE("single frame") {
+        CHECK_EQ(zstd::decompress(stream, foo), "foo"_b);
+        CHECK_EQ(zstd::finish(stream), ""_b);
+    }
+
+    SUBCASE("multiple frames") {
+        auto data = foo;
+        data.append(bar);
+        CHECK_EQ(zstd::decompress(stream, data), "foobar"_b);
+        CHECK_EQ(zstd::finish(stream), ""_b);
+    }
+
+    SUBCASE("View") {
+        Stream data;
+        data.append(foo.sub(0, 5));
+        data.append(foo.sub(5, foo.size()));
+        CHECK_EQ(zstd::decompress(stream, data.view()), "foo"_b);
+        CHECK_EQ(zstd::finish(stream), ""_b);
+    }
+
+    SUBCASE("into stream") {
+        Stream output;
+        stream.decompress(output, foo.sub(0, 5));
+        stream.decompress(output, foo.sub(5, foo.size()));
+        stream.decompress(output, bar);
+        CHECK_EQ(output.view().data(), "foobar"_b);
+    }
+
+    SUBCASE("error") {
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(zstd::decompress(stream, "\x01\x02\x03\x04"_b),
+                             "decompression failed: Unknown frame descriptor", const zstd::ZstdError&);
+
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(zstd::decompress(stream, foo), "error'ed zstd stream cannot be reused",
+                             const zstd::ZstdError&);
+        CHECK_EQ(zstd::finish(stream), ""_b);
+    }
+
+    SUBCASE("output filling buffer") {
+        // 4096 times 'a', which decompresses exactly into the initial output buffer.
+        const auto compressed = "\x28\xb5\x2f\xfd\x60\x00\x0f\x4d\x00\x00\x10\x61\x61\x01\x00\xfb\xf7\x01\x16"_b;
+        CHECK_EQ(zstd::decompress(stream, compressed), Bytes(std::string(4096, 'a')));
+        CHECK_EQ(zstd::finish(stream), ""_b);
+    }
+
+    SUBCASE("truncated") {
+        CHECK_EQ(zstd::decompress(stream, foo.sub(0, 5)), ""_b);
+
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(zstd::finish(stream), "incomplete compressed data", const zstd::ZstdError&);
+    }
+}
+
+TEST_CASE("limits") {
+    // 1000 times 'a', compressed into 19 bytes.
+    const auto compressed = "\x28\xb5\x2f\xfd\x60\xe8\x02\x4d\x00\x00\x10\x61\x61\x01\x00\xe3\x2b\x80\x05"_b;
+    const auto decompressed = Bytes(std::string(1000, 'a'));
+
+    zstd::Stream stream;
+
+    SUBCASE("within limits") {
+        zstd::set_limits(stream, 1000, 100);
+        CHECK_EQ(zstd::decompress(stream, compressed), decompressed);
+    }
+
+    SUBCASE("size") {
+        zstd::set_limits(stream, 999, 0);
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(zstd::decompress(stream, compressed), "decompressed data exceeds limit of 999 bytes",
+                             const zstd::ZstdError&);
+    }
+
+    SUBCASE("ratio") {
+        zstd::set_limits(stream, 0, 10);
+
+        Stream output;
+        // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+        CHECK_THROWS_WITH_AS(stream.decompress(output, compressed), "decompression ratio exceeds limit of 10",
+                             const zstd::ZstdError&);
+        CHECK_EQ(output.size(), 0U);
+    }
+}
+
+TEST_CASE("native filter") {
+    zstd::Filter filter;
+    Stream output;
+
+    auto data = foo;
+    data.append(bar);
+    filter.process(Stream(data).view(), output);
+    filter.finish(output);
+    CHECK_EQ(output.view().data(), "foobar"_b);
+}
+
+TEST_CASE("to_string") {
+    CHECK(zstd::available());
+    CHECK_EQ(to_string(zstd::Stream()), "<zstd stream>");
+}
+
+#else
+
+TEST_CASE("unavailable") {
+    CHECK_FALSE(zstd::available());
+
+    // NOLINTNEXTLINE(bugprone-throw-keyword-missing)
+    CHECK_THROWS_WITH_AS(zstd::Stream(), "Spicy runtime has been built without zstd support", const zstd::ZstdError&);
+}
+
+#endif
+
+TEST_SUITE_END();
@@ -2,19 +2,118 @@
 
 #include <zlib.h>
 
+#include <algorithm>
+#include <cinttypes>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <hilti/rt/fmt.h>
 #include <hilti/rt/types/bytes.h>
 
+#include <spicy/rt/configuration.h>
 #include <spicy/rt/zlib_.h>
 
 using namespace spicy::rt;
 using namespace spicy::rt::zlib;
 
-struct detail::State {
+struct zlib::detail::State {
     z_stream stream;
+    bool gzip = false;     // true if the stream may contain gzip data
+    bool started = false;  // true once we have seen any input
+    bool ended = false;    // true once the current member has been completed
+    bool trailing = false; // true once we are ignoring data following the last member
+    uint64_t total_in = 0;  // input of previous gzip members
+    uint64_t total_out = 0; // output of previous gzip members
+    uint64_t max_output = 0;
+    uint64_t max_ratio = 0;
+
+    uint64_t totalIn() const { return total_in + stream.total_in; }
+    uint64_t totalOut() const { return total_out + stream.total_out; }
 };
 
+// Bounds for how much output space we provide to each call of `inflate()`.
+static const size_t MinOutputStep = 4096;
+static const size_t MaxOutputStep = 256 * 1024;
+
+// Inflates all input currently available in a zlib stream, appending output
+// to a buffer. The buffer grows geometrically, starting from an estimate
+// based on the input size and the compression ratio seen so far; it never
+// grows much beyond any limits.
+//
+// Like gunzip, we continue with the next member if further gzip data
+// follows the end of a gzip member, and otherwise ignore any trailing data.
+template<typename Buffer>
+static void inflateInto(zlib::detail::State* state, Buffer* out) {
+    auto* zs = &state->stream;
+
+    if ( zs->avail_in )
+        state->started = true;
+
+    while ( true ) {
+        if ( state->ended ) {
+            if ( ! zs->avail_in )
+                break;
+
+            if ( state->trailing || ! (state->gzip && zs->next_in[0] == 0x1f) ) {
+                state->trailing = true;
+                zs->avail_in = 0;
+                break;
+            }
+
+            state->total_in += zs->total_in;
+            state->total_out += zs->total_out;
+            state->ended = false;
+
+            if ( inflateReset(zs) != Z_OK )
+                throw ZlibError("inflateReset failed");
+        }
+
+        auto used = out->size();
+        auto ratio = (zs->total_in ? zs->total_out / zs->total_in + 1 : 4);
+        auto step = std::clamp(std::max(static_cast<size_t>(zs->avail_in * ratio), used), MinOutputStep, MaxOutputStep);
+
+        // Don't provide room for more output than the limits allow, plus
+        // one byte to detect going beyond them.
+        if ( state->max_output ) {
+            auto total = state->totalOut();
+            auto remaining = (state->max_output > total ? state->max_output - total : 0);
+            step = std::min<uint64_t>(step, remaining + 1);
+        }
+
+        if ( state->max_ratio ) {
+            auto total = state->totalOut();
+            auto allowed = state->max_ratio * (state->totalIn() + zs->avail_in);
+            auto remaining = (allowed > total ? allowed - total : 0);
+            step = std::min<uint64_t>(step, remaining + 1);
+        }
+
+        out->resize(used + step);
+        zs->next_out = reinterpret_cast<Bytef*>(out->data() + used);
+        zs->avail_out = step;
+
+        int zip_status = inflate(zs, Z_SYNC_FLUSH);
+        out->resize(used + (step - zs->avail_out));
+
+        if ( zip_status != Z_STREAM_END && zip_status != Z_OK && zip_status != Z_BUF_ERROR )
+            throw ZlibError("inflate failed");
+
+        if ( state->max_output && state->totalOut() > state->max_output )
+            throw ZlibError(hilti::rt::fmt("decompressed data exceeds limit of %" PRIu64 " bytes", state->max_output));
+
+        if ( state->max_ratio && state->totalOut() > state->max_ratio * state->totalIn() )
+            throw ZlibError(hilti::rt::fmt("decompression ratio exceeds limit of %" PRIu64, state->max_ratio));
+
+        if ( zip_status == Z_STREAM_END )
+            state->ended = true;
+
+        else if ( zs->avail_out != 0 )
+            break;
+    }
+}
+
 Stream::Stream(int64_t window_bits) {
-    _state = std::shared_ptr<detail::State>(new detail::State(), [](auto p) {
+    _state = std::shared_ptr<zlib::detail::State>(new zlib::detail::State(), [](auto p) {
         inflateEnd(&p->stream);
         delete p; // NOLINT(cppcoreguidelines-owning-memory)
     });
@@ -23,79 +122,92 @@ Stream::Stream(int64_t window_bits) {
         _state = nullptr;
         throw ZlibError("inflateInit2 failed");
     }
+
+    const auto& cfg = configuration::get();
+    _state->gzip = (window_bits > 15);
+    _state->max_output = cfg.decompress_max_output;
+    _state->max_ratio = cfg.decompress_max_ratio;
 }
 
 // Don't finish the stream here, it might be shared with other instances.
 Stream::~Stream() = default;
 
-hilti::rt::Bytes Stream::finish() { return hilti::rt::Bytes(); }
-
-hilti::rt::Bytes Stream::decompress(const hilti::rt::stream::View& data) {
+void Stream::setLimits(uint64_t max_output, uint64_t max_ratio) {
     if ( ! _state )
         throw ZlibError("error'ed zlib stream cannot be reused");
 
-    hilti::rt::Bytes decoded;
-
-    for ( auto block = data.firstBlock(); block; block = data.nextBlock(block) ) {
-        _state->stream.next_in = const_cast<Bytef*>(block->start);
-        _state->stream.avail_in = block->size;
-
-        do {
-            char buf[4096];
-            _state->stream.next_out = reinterpret_cast<unsigned char*>(buf);
-            _state->stream.avail_out = sizeof(buf);
+    _state->max_output = max_output;
+    _state->max_ratio = max_ratio;
+}
 
-            int zip_status = inflate(&_state->stream, Z_SYNC_FLUSH);
+hilti::rt::Bytes Stream::finish() {
+    // A stream that has failed already has reported its error.
+    if ( ! _state )
+        return hilti::rt::Bytes();
 
-            if ( zip_status != Z_STREAM_END && zip_status != Z_OK && zip_status != Z_BUF_ERROR ) {
-                _state = nullptr;
-                throw ZlibError("inflate failed");
-            }
+    if ( _state->started && ! _state->ended ) {
+        _state = nullptr;
+        throw ZlibError("incomplete compressed data");
+    }
 
-            if ( auto len = (sizeof(buf) - _state->stream.avail_out) )
-                decoded.append(hilti::rt::Bytes(buf, static_cast<int>(len)));
+    return hilti::rt::Bytes();
+}
 
-            if ( zip_status == Z_STREAM_END ) {
-                break;
-            }
+template<typename Buffer>
+void Stream::_decompress(Buffer* out, const hilti::rt::stream::View& data) {
+    if ( ! _state )
+        throw ZlibError("error'ed zlib stream cannot be reused");
 
-        } while ( _state->stream.avail_out == 0 );
+    try {
+        for ( auto block = data.firstBlock(); block; block = data.nextBlock(block) ) {
+            _state->stream.next_in = const_cast<Bytef*>(block->start);
+            _state->stream.avail_in = block->size;
+            inflateInto(_state.get(), out);
+        }
+    } catch ( const ZlibError& ) {
+        _state = nullptr;
+        throw;
     }
-
-    return decoded;
 }
 
-hilti::rt::Bytes Stream::decompress(const hilti::rt::Bytes& data) {
+template<typename Buffer>
+void Stream::_decompress(Buffer* out, const hilti::rt::Bytes& data) {
     if ( ! _state )
         throw ZlibError("error'ed zlib stream cannot be reused");
 
-    hilti::rt::Bytes decoded;
-
     _state->stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(data.data()));
     _state->stream.avail_in = data.size();
 
-    do {
-        char buf[4096];
-        _state->stream.next_out = reinterpret_cast<unsigned char*>(buf);
-        _state->stream.avail_out = sizeof(buf);
-
-        int zip_status = inflate(&_state->stream, Z_SYNC_FLUSH);
-
-        if ( zip_status != Z_STREAM_END && zip_status != Z_OK && zip_status != Z_BUF_ERROR ) {
-            _state = nullptr;
-            throw ZlibError("inflate failed");
-        }
+    try {
+        inflateInto(_state.get(), out);
+    } catch ( const ZlibError& ) {
+        _state = nullptr;
+        throw;
+    }
+}
 
-        if ( auto len = (sizeof(buf) - _state->stream.avail_out) )
-            decoded.append(hilti::rt::Bytes(buf, static_cast<int>(len)));
+hilti::rt::Bytes Stream::decompress(const hilti::rt::stream::View& data) {
+    std::string decoded;
+    _decompress(&decoded, data);
+    return hilti::rt::Bytes(std::move(decoded));
+}
 
-        if ( zip_status == Z_STREAM_END ) {
-            break;
-        }
+hilti::rt::Bytes Stream::decompress(const hilti::rt::Bytes& data) {
+    std::string decoded;
+    _decompress(&decoded, data);
+    return hilti::rt::Bytes(std::move(decoded));
+}
 
-    } while ( _state->stream.avail_out == 0 );
+void Stream::decompress(hilti::rt::Stream& output, const hilti::rt::stream::View& data) {
+    std::vector<hilti::rt::stream::Byte> decoded;
+    _decompress(&decoded, data);
+    output.append(std::move(decoded));
+}
 
-    return decoded;
+void Stream::decompress(hilti::rt::Stream& output, const hilti::rt::Bytes& data) {
+    std::vector<hilti::rt::stream::Byte> decoded;
+    _decompress(&decoded, data);
+    output.append(std::move(decoded));
 }
 
 uint64_t zlib::crc32_init() { return ::crc32(0L, Z_NULL, 0); }
@@ -0,0 +1,202 @@
+// Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
+
+#include <spicy/rt/autogen/config.h>
+
+#ifdef SPICY_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <cinttypes>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <hilti/rt/fmt.h>
+#include <hilti/rt/types/bytes.h>
+
+#include <spicy/rt/configuration.h>
+#include <spicy/rt/zstd_.h>
+
+using namespace spicy::rt;
+using namespace spicy::rt::zstd;
+
+struct zstd::detail::State {
+#ifdef SPICY_HAVE_ZSTD
+    ZSTD_DCtx* ctx = nullptr;
+#endif
+    bool ended = true; // false while inside a frame
+    uint64_t total_in = 0;
+    uint64_t total_out = 0;
+    uint64_t max_output = 0;
+    uint64_t max_ratio = 0;
+};
+
+#ifdef SPICY_HAVE_ZSTD
+
+// Bounds for how much output space we provide to each call of
+// `ZSTD_decompressStream()`.
+static const size_t MinOutputStep = 4096;
+static const size_t MaxOutputStep = 256 * 1024;
+
+// Decompresses a chunk of input, appending output to a buffer. The buffer
+// grows the same way as for zlib, see `inflateInto()` there.
+template<typename Buffer>
+static void decompressInto(zstd::detail::State* state, Buffer* out, const void* data, size_t size) {
+    if ( ! size )
+        return;
+
+    ZSTD_inBuffer in = {data, size, 0};
+
+    while ( true ) {
+        auto used = out->size();
+        auto avail_in = in.size - in.pos;
+        auto ratio = (state->total_in ? state->total_out / state->total_in + 1 : 4);
+        auto step = std::clamp(std::max(static_cast<size_t>(avail_in * ratio), used), MinOutputStep, MaxOutputStep);
+
+        // Don't provide room for more output than the limits allow, plus
+        // one byte to detect going beyond them.
+        if ( state->max_output ) {
+            auto remaining = (state->max_output > state->total_out ? state->max_output - state->total_out : 0);
+            step = std::min<uint64_t>(step, remaining + 1);
+        }
+
+        if ( state->max_ratio ) {
+            auto allowed = state->max_ratio * (state->total_in + avail_in);
+            auto remaining = (allowed > state->total_out ? allowed - state->total_out : 0);
+            step = std::min<uint64_t>(step, remaining + 1);
+        }
+
+        out->resize(used + step);
+        ZSTD_outBuffer zout = {out->data() + used, step, 0};
+
+        auto in_pos = in.pos;
+        auto rc = ZSTD_decompressStream(state->ctx, &zout, &in);
+        out->resize(used + zout.pos);
+
+        if ( ZSTD_isError(rc) )
+            throw ZstdError(hilti::rt::fmt("decompression failed: %s", ZSTD_getErrorName(rc)));
+
+        state->total_in += in.pos - in_pos;
+        state->total_out += zout.pos;
+
+        // Without any progress, the return value refers to the next frame.
+        if ( in.pos != in_pos || zout.pos )
+            state->ended = (rc == 0);
+
+        if ( state->max_output && state->total_out > state->max_output )
+            throw ZstdError(hilti::rt::fmt("decompressed data exceeds limit of %" PRIu64 " bytes", state->max_output));
+
+        if ( state->max_ratio && state->total_out > state->max_ratio * state->total_in )
+            throw ZstdError(hilti::rt::fmt("decompression ratio exceeds limit of %" PRIu64, state->max_ratio));
+
+        if ( in.pos == in.size && (zout.pos < zout.size || rc == 0) )
+            break;
+    }
+}
+
+bool zstd::available() { return true; }
+
+Stream::Stream() {
+    _state = std::shared_ptr<zstd::detail::State>(new zstd::detail::State(), [](auto p) {
+        ZSTD_freeDCtx(p->ctx);
+        delete p; // NOLINT(cppcoreguidelines-owning-memory)
+    });
+
+    _state->ctx = ZSTD_createDCtx();
+    if ( ! _state->ctx ) {
+        _state = nullptr;
+        throw ZstdError("cannot create zstd decompression context");
+    }
+
+    const auto& cfg = configuration::get();
+    _state->max_output = cfg.decompress_max_output;
+    _state->max_ratio = cfg.decompress_max_ratio;
+}
+
+#else
+
+template<typename Buffer>
+static void decompressInto(zstd::detail::State* /* state */, Buffer* /* out */, const void* /* data */,
+                           size_t /* size */) {}
+
+bool zstd::available() { return false; }
+
+Stream::Stream() { throw ZstdError("Spicy runtime has been built without zstd support"); }
+
+#endif
+
+// Don't finish the stream here, it might be shared with other instances.
+Stream::~Stream() = default;
+
+void Stream::setLimits(uint64_t max_output, uint64_t max_ratio) {
+    if ( ! _state )
+        throw ZstdError("error'ed zstd stream cannot be reused");
+
+    _state->max_output = max_output;
+    _state->max_ratio = max_ratio;
+}
+
+hilti::rt::Bytes Stream::finish() {
+    // A stream that has failed already has reported its error.
+    if ( ! _state )
+        return hilti::rt::Bytes();
+
+    if ( ! _state->ended ) {
+        _state = nullptr;
+        throw ZstdError("incomplete compressed data");
+    }
+
+    return hilti::rt::Bytes();
+}
+
+template<typename Buffer>
+void Stream::_decompress(Buffer* out, const hilti::rt::stream::View& data) {
+    if ( ! _state )
+        throw ZstdError("error'ed zstd stream cannot be reused");
+
+    try {
+        for ( auto block = data.firstBlock(); block; block = data.nextBlock(block) )
+            decompressInto(_state.get(), out, block->start, block->size);
+    } catch ( const ZstdError& ) {
+        _state = nullptr;
+        throw;
+    }
+}
+
+template<typename Buffer>
+void Stream::_decompress(Buffer* out, const hilti::rt::Bytes& data) {
+    if ( ! _state )
+        throw ZstdError("error'ed zstd stream cannot be reused");
+
+    try {
+        decompressInto(_state.get(), out, data.data(), data.size());
+    } catch ( const ZstdError& ) {
+        _state = nullptr;
+        throw;
+    }
+}
+
+hilti::rt::Bytes Stream::decompress(const hilti::rt::stream::View& data) {
+    std::string decoded;
+    _decompress(&decoded, data);
+    return hilti::rt::Bytes(std::move(decoded));
+}
+
+hilti::rt::Bytes Stream::decompress(const hilti::rt::Bytes& data) {
+    std::string decoded;
+    _decompress(&decoded, data);
+    return hilti::rt::Bytes(std::move(decoded));
+}
+
+void Stream::decompress(hilti::rt::Stream& output, const hilti::rt::stream::View& data) {
+    std::vector<hilti::rt::stream::Byte> decoded;
+    _decompress(&decoded, data);
+    output.append(std::move(decoded));
+}
+
+void Stream::decompress(hilti::rt::Stream& output, const hilti::rt::Bytes& data) {
+    std::vector<hilti::rt::stream::Byte> decoded;
+    _decompress(&decoded, data);
+    output.append(std::move(decoded));
+}
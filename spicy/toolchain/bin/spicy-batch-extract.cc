@@ -1,22 +1,146 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <optional>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 
 #include <hilti/rt/util.h>
 
+#include <spicy/rt/driver.h>
+
 void error(const std::string& msg) {
     std::cerr << "error: " << msg << std::endl;
     exit(1);
 }
 
+// Extracts a flow or connection from a v3 batch, given as `flow:<id>` or
+// `conn:<id>`. If the batch comes with an index and the input is seekable,
+// we use the index to jump directly to where the flow or connection begins,
+// and stop reading once it has ended.
+void extractV3(const std::string& needle, std::istream& in, std::ostream& out) {
+    using spicy::rt::driver::batch::RecordType;
+
+    auto begin = RecordType::BeginFlow;
+    if ( hilti::rt::startsWith(needle, "conn:") )
+        begin = RecordType::BeginConnection;
+    else if ( ! hilti::rt::startsWith(needle, "flow:") )
+        error("IDs for v3 batches must be given as flow:<id> or conn:<id>");
+
+    char* end = nullptr;
+    auto id = std::strtoul(needle.c_str() + 5, &end, 10);
+    if ( *end || end == needle.c_str() + 5 || id > std::numeric_limits<uint32_t>::max() )
+        error(hilti::rt::fmt("invalid ID '%s'", needle));
+
+    spicy::rt::driver::batch::WriterV3 writer(out);
+
+    if ( auto start = in.tellg(); start != -1 ) {
+        std::streamoff offset = start;
+
+        if ( auto index = spicy::rt::driver::batch::readIndex(in) ) {
+            auto e = std::find_if(index->begin(), index->end(),
+                                  [&](const auto& e) { return e.type == begin && e.id == id; });
+
+            if ( e == index->end() ) {
+                // Not in the batch.
+                writer.finish();
+                return;
+            }
+
+            offset = static_cast<std::streamoff>(e->offset);
+        }
+
+        in.clear();
+        in.seekg(offset);
+    }
+
+    auto decode_id = [](const std::string& body, size_t offset) {
+        uint32_t x = 0;
+        for ( size_t i = 0; i < sizeof(x); i++ )
+            x |= static_cast<uint32_t>(static_cast<uint8_t>(body[offset + i])) << (8 * i);
+
+        return x;
+    };
+
+    std::set<uint32_t> flows; // flows to extract once begun
+    bool begun = false;
+    bool done = false;
+
+    RecordType type;
+    uint32_t rid = 0;
+    std::string body; // reused for all records
+
+    while ( ! done ) {
+        auto x = spicy::rt::driver::batch::readRecord(in, &type, &rid, &body);
+        if ( ! x )
+            error(x.error().description());
+
+        if ( ! *x )
+            break;
+
+        switch ( type ) {
+            case RecordType::BeginFlow:
+                if ( begun || begin != type || rid != id )
+                    continue;
+
+                begun = true;
+                flows.insert(rid);
+                break;
+
+            case RecordType::BeginConnection:
+                if ( begun || begin != type || rid != id )
+                    continue;
+
+                if ( body.size() < 9 )
+                    error("invalid begin-conn record");
+
+                begun = true;
+                flows.insert(decode_id(body, 1));
+                flows.insert(decode_id(body, 5));
+                break;
+
+            case RecordType::Data:
+            case RecordType::Gap:
+            case RecordType::EndFlow:
+                if ( flows.find(rid) == flows.end() )
+                    continue;
+
+                done = (type == RecordType::EndFlow && begin == RecordType::BeginFlow);
+                break;
+
+            case RecordType::EndConnection:
+                if ( ! begun || begin != type || rid != id )
+                    continue;
+
+                done = true;
+                break;
+
+            default: error(hilti::rt::fmt("unknown batch record type %d", static_cast<int>(type)));
+        }
+
+        writer.record(type, rid, body);
+    }
+
+    writer.finish();
+}
+
 void processPreBatchedInput(std::string needle, std::istream& in, std::ostream& out) {
     std::string magic;
     std::getline(in, magic);
 
-    if ( magic != std::string("!spicy-batch v2") )
+    if ( magic == spicy::rt::driver::batch::MagicV3 ) {
+        extractV3(needle, in, out);
+        return;
+    }
+
+    if ( magic != spicy::rt::driver::batch::MagicV2 )
         error("input is not a Spicy batch file");
 
     out << magic << std::endl;
@@ -24,6 +148,8 @@ void processPreBatchedInput(std::string needle, std::istream& in, std::ostream&
     std::set<std::string> needles = {std::move(needle)};
     auto is_needle = [&](const std::string& n) { return needles.find(n) != needles.end(); };
 
+    std::string data; // reused for all @data records
+
     while ( in.good() && ! in.eof() ) {
         std::string cmd;
         std::getline(in, cmd);
@@ -67,19 +193,35 @@ void processPreBatchedInput(std::string needle, std::istream& in, std::ostream&
             auto id = std::string(m[1]);
             auto size = std::stoul(std::string(m[2]));
 
-            char data[size];
-            in.read(data, static_cast<std::streamsize>(size));
+            auto needed = is_needle(id);
+
+            if ( needed ) {
+                data.resize(size);
+                in.read(data.data(), static_cast<std::streamsize>(size));
+            }
+            else
+                in.ignore(static_cast<std::streamsize>(size));
+
             in.get(); // Eat newline.
 
             if ( in.eof() || in.fail() )
                 error("premature end of @data");
 
-            if ( is_needle(id) ) {
+            if ( needed ) {
                 out << cmd << std::endl;
-                out.write(data, static_cast<std::streamsize>(size));
+                out.write(data.data(), static_cast<std::streamsize>(size));
                 out.put('\n');
             }
         }
+        else if ( m[0] == "@gap" ) {
+            // @gap <id> <size>
+            if ( m.size() != 3 )
+                error("unexpected number of argument for @gap");
+
+            auto id = std::string(m[1]);
+            if ( is_needle(id) )
+                out << cmd << std::endl;
+        }
         else if ( m[0] == "@end-flow" ) {
             // @end-flow <id>
             if ( m.size() != 2 )
@@ -104,14 +246,164 @@ void processPreBatchedInput(std::string needle, std::istream& in, std::ostream&
     }
 }
 
+// Converts a v2 batch into the binary v3 format. The v3 format identifies
+// flows and connections by integers, which we assign in order of appearance.
+void convertToV3(std::istream& in, std::ostream& out) {
+    using spicy::rt::driver::ParsingType;
+
+    std::string magic;
+    std::getline(in, magic);
+
+    if ( magic != spicy::rt::driver::batch::MagicV2 )
+        error("input is not a v2 Spicy batch file");
+
+    spicy::rt::driver::batch::WriterV3 writer(out);
+
+    std::unordered_map<std::string, uint32_t> flow_ids;
+    std::unordered_map<std::string, uint32_t> conn_ids;
+    uint32_t next_flow_id = 0;
+    uint32_t next_conn_id = 0;
+
+    // Like spicy-driver, we skip commands referring to IDs that haven't
+    // been begun.
+    auto lookup = [](const std::unordered_map<std::string, uint32_t>& ids,
+                     const std::string& id) -> std::optional<uint32_t> {
+        if ( auto i = ids.find(id); i != ids.end() )
+            return i->second;
+        else
+            return {};
+    };
+
+    // The flows of each connection, by their v2 IDs.
+    std::unordered_map<uint32_t, std::array<std::pair<std::string, uint32_t>, 2>> conn_flows;
+
+    auto parse_type = [](std::string_view t) {
+        if ( t == "stream" )
+            return ParsingType::Stream;
+        else if ( t == "block" )
+            return ParsingType::Block;
+        else
+            error(hilti::rt::fmt("unknown session type '%s'", t));
+
+        return ParsingType::Stream; // not reached
+    };
+
+    std::string data;
+
+    while ( in.good() && ! in.eof() ) {
+        std::string cmd;
+        std::getline(in, cmd);
+        cmd = hilti::rt::trim(cmd);
+
+        if ( cmd.empty() )
+            continue;
+
+        auto m = hilti::rt::split(cmd);
+        if ( m[0] == "@begin-flow" ) {
+            // @begin-flow <id> <type> <parser>
+            if ( m.size() != 4 )
+                error("unexpected number of argument for @begin-flow");
+
+            auto id = next_flow_id++;
+            flow_ids[std::string(m[1])] = id;
+            writer.beginFlow(id, parse_type(m[2]), m[3]);
+        }
+        else if ( m[0] == "@begin-conn" ) {
+            // @begin-conn <conn-id> <type> <orig-id> <orig-parser> <resp-id> <resp-parser>
+            if ( m.size() != 7 )
+                error("unexpected number of argument for @begin-conn");
+
+            auto cid = next_conn_id++;
+            auto orig_id = next_flow_id++;
+            auto resp_id = next_flow_id++;
+            conn_ids[std::string(m[1])] = cid;
+            flow_ids[std::string(m[3])] = orig_id;
+            flow_ids[std::string(m[5])] = resp_id;
+            conn_flows[cid] = {std::make_pair(std::string(m[3]), orig_id), std::make_pair(std::string(m[5]), resp_id)};
+            writer.beginConnection(cid, parse_type(m[2]), orig_id, m[4], resp_id, m[6]);
+        }
+        else if ( m[0] == "@data" ) {
+            // @data <id> <size>
+            // [data]\n
+            if ( m.size() != 3 )
+                error("unexpected number of argument for @data");
+
+            auto id = lookup(flow_ids, std::string(m[1]));
+            auto size = std::stoul(std::string(m[2]));
+
+            data.resize(size);
+            in.read(data.data(), static_cast<std::streamsize>(size));
+            in.get(); // Eat newline.
+
+            if ( in.eof() || in.fail() )
+                error("premature end of @data");
+
+            if ( id )
+                writer.data(*id, data.data(), size);
+        }
+        else if ( m[0] == "@gap" ) {
+            // @gap <id> <size>
+            if ( m.size() != 3 )
+                error("unexpected number of argument for @gap");
+
+            if ( auto id = lookup(flow_ids, std::string(m[1])) )
+                writer.gap(*id, std::stoull(std::string(m[2])));
+        }
+        else if ( m[0] == "@end-flow" ) {
+            // @end-flow <id>
+            if ( m.size() != 2 )
+                error("unexpected number of argument for @end-flow");
+
+            auto id = std::string(m[1]);
+            if ( auto x = lookup(flow_ids, id) )
+                writer.endFlow(*x);
+
+            flow_ids.erase(id);
+        }
+        else if ( m[0] == "@end-conn" ) {
+            // @end-conn <cid>
+            if ( m.size() != 2 )
+                error("unexpected number of argument for @end-conn");
+
+            auto cid = std::string(m[1]);
+            auto x = lookup(conn_ids, cid);
+            conn_ids.erase(cid);
+
+            if ( ! x )
+                continue;
+
+            writer.endConnection(*x);
+
+            // Release the flows' IDs unless they have been reused already.
+            if ( auto c = conn_flows.find(*x); c != conn_flows.end() ) {
+                for ( const auto& [id, handle] : c->second ) {
+                    if ( auto f = flow_ids.find(id); f != flow_ids.end() && f->second == handle )
+                        flow_ids.erase(f);
+                }
+
+                conn_flows.erase(c);
+            }
+        }
+        else
+            error(hilti::rt::fmt("unknown command '%s'", m[0]));
+    }
+
+    writer.finish();
+}
+
 // NOLINTNEXTLINE(bugprone-exception-escape)
 int main(int argc, char** argv) {
     if ( argc != 2 ) {
-        std::cerr << "usage: " << argv[0] << " <fid> | <cid>" << std::endl;
+        std::cerr << "usage: " << argv[0] << " <fid> | <cid> | flow:<id> | conn:<id> | --convert-v3" << std::endl;
         exit(1);
     }
 
-    auto id = std::string(argv[1]);
-    processPreBatchedInput(id, std::cin, std::cout);
+    auto arg = std::string(argv[1]);
+
+    if ( arg == "--convert-v3" )
+        convertToV3(std::cin, std::cout);
+    else
+        processPreBatchedInput(arg, std::cin, std::cout);
+
     return 0;
 }
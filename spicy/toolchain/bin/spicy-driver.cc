@@ -2,8 +2,12 @@
 
 #include <getopt.h>
 
+#include <atomic>
+#include <cinttypes>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <vector>
 
 #include <hilti/rt/libhilti.h>
 
@@ -17,6 +21,14 @@
 
 using spicy::rt::fmt;
 
+constexpr int OPT_REPORT_THROUGHPUT_INTERVAL = 1000;
+constexpr int OPT_REPORT_THROUGHPUT_JSON = 1001;
+constexpr int OPT_MAX_FLOWS = 1002;
+constexpr int OPT_MAX_FLOW_BYTES = 1003;
+constexpr int OPT_MAX_TOTAL_BYTES = 1004;
+constexpr int OPT_FLOW_IDLE_TIMEOUT = 1005;
+constexpr int OPT_SKIP_EVICTED_FLOWS = 1006;
+
 static struct option long_driver_options[] = {{"abort-on-exceptions", required_argument, nullptr, 'A'},
                                               {"require-accept", no_argument, nullptr, 'c'},
                                               {"compiler-debug", required_argument, nullptr, 'D'},
@@ -24,25 +36,38 @@ static struct option long_driver_options[] = {{"abort-on-exceptions", required_a
                                               {"debug-addl", required_argument, nullptr, 'X'},
                                               {"enable-profiling", no_argument, nullptr, 'Z'},
                                               {"file", required_argument, nullptr, 'f'},
+                                              {"flow-idle-timeout", required_argument, nullptr, OPT_FLOW_IDLE_TIMEOUT},
                                               {"batch-file", required_argument, nullptr, 'F'},
                                               {"help", no_argument, nullptr, 'h'},
                                               {"increment", required_argument, nullptr, 'i'},
                                               {"library-path", required_argument, nullptr, 'L'},
                                               {"list-parsers", no_argument, nullptr, 'l'},
+                                              {"max-flow-bytes", required_argument, nullptr, OPT_MAX_FLOW_BYTES},
+                                              {"max-flows", required_argument, nullptr, OPT_MAX_FLOWS},
+                                              {"max-total-bytes", required_argument, nullptr, OPT_MAX_TOTAL_BYTES},
                                               {"parser", required_argument, nullptr, 'p'},
+                                              {"pcap-file", required_argument, nullptr, 'P'},
+                                              {"report-throughput", no_argument, nullptr, 't'},
+                                              {"report-throughput-interval", required_argument, nullptr,
+                                               OPT_REPORT_THROUGHPUT_INTERVAL},
+                                              {"report-throughput-json", no_argument, nullptr,
+                                               OPT_REPORT_THROUGHPUT_JSON},
                                               {"report-times", required_argument, nullptr, 'R'},
                                               {"show-backtraces", required_argument, nullptr, 'B'},
                                               {"skip-dependencies", no_argument, nullptr, 'S'},
+                                              {"skip-evicted-flows", no_argument, nullptr, OPT_SKIP_EVICTED_FLOWS},
+                                              {"threads", required_argument, nullptr, 'T'},
                                               {"report-resource-usage", no_argument, nullptr, 'U'},
                                               {"version", no_argument, nullptr, 'v'},
                                               {nullptr, 0, nullptr, 0}};
 
 static bool require_accept = false; // --require-accept
 
-static bool accepted = false; // set by hook_accept_input()
+// These may be set from multiple threads concurrently with --threads.
+static std::atomic<bool> accepted = false; // set by hook_accept_input()
 static void hook_accept_input() { accepted = true; }
 
-static bool declined = false; // set by hook_decline_input()
+static std::atomic<bool> declined = false; // set by hook_decline_input()
 static void hook_decline_input(const std::string& reason) { declined = true; }
 
 class SpicyDriver : public spicy::Driver, public spicy::rt::Driver {
@@ -57,6 +82,12 @@ public:
     bool opt_list_parsers = false;
     int opt_increment = 0;
     bool opt_input_is_batch = false;
+    bool opt_input_is_pcap = false;
+    unsigned int opt_threads = 0;
+    bool opt_report_throughput = false;
+    double opt_report_throughput_interval = 0;
+    bool opt_report_throughput_json = false;
+    spicy::rt::driver::FlowLimits opt_flow_limits;
     std::string opt_file = "/dev/stdin";
     std::string opt_parser;
 
@@ -76,6 +107,15 @@ public:
         exit(1);
     }
 
+    uint64_t parseLimit(const char* arg, const char* option) {
+        char* end = nullptr;
+        auto n = std::strtoull(arg, &end, 10);
+        if ( ! *arg || *arg == '-' || *end )
+            fatalError(fmt("%s requires a non-negative integer", option));
+
+        return n;
+    }
+
 private:
     void hookInitRuntime() override { spicy::rt::init(); }
     void hookFinishRuntime() override { spicy::rt::done(); }
@@ -98,6 +138,7 @@ void SpicyDriver::usage() {
            "  -l | --list-parsers             List available parsers and exit.\n"
            "  -p | --parser <name>            Use parser <name> to process input. Only needed if more than one parser "
            "is available.\n"
+           "  -t | --report-throughput        Print summary of parsing throughput and latencies at exit.\n"
            "  -v | --version                  Print version information.\n"
            "  -A | --abort-on-exceptions      When executing compiled code, abort() instead of throwing HILTI "
            "exceptions.\n"
@@ -107,12 +148,30 @@ void SpicyDriver::usage() {
            "  -F | --batch-file <path>        Read Spicy batch input from <path>; see docs for description of "
            "format.\n"
            "  -L | --library-path <path>      Add path to list of directories to search when importing modules.\n"
+           "  -P | --pcap-file <path>         Read packet trace in pcap or pcapng format from <path>, parsing TCP and UDP "
+           "payload with parsers selected by port.\n"
            "  -R | --report-times             Report a break-down of compiler's execution time.\n"
            "  -S | --skip-dependencies        Do not automatically compile dependencies during JIT.\n"
+           "  -T | --threads <n>              Process flows of batch input in parallel on <n> worker threads. Requires "
+           "-F with a file other than stdin. Source inputs get compiled with dynamic globals, precompiled inputs must "
+           "have been compiled with --cxx-enable-dynamic-globals.\n"
            "  -U | --report-resource-usage    Print summary of runtime resource usage.\n"
            "  -X | --debug-addl <addl>        Implies -d and adds selected additional instrumentation\n"
            "  -Z | --enable-profiling         Report profiling statistics after execution.\n"
            "(comma-separated; see 'help' for list).\n"
+           "       --report-throughput-interval <secs>\n"
+           "                                  Implies -t and also prints throughput periodically while processing "
+           "input.\n"
+           "       --report-throughput-json   Implies -t and prints throughput reports as JSON, one per line.\n"
+           "       --max-flows <n>            Evict least recently active flows of batch or pcap input beyond <n> "
+           "concurrent flows.\n"
+           "       --max-flow-bytes <n>       Evict flows of batch or pcap input buffering more than <n> bytes of "
+           "input.\n"
+           "       --max-total-bytes <n>      Evict least recently active flows of batch or pcap input while all "
+           "flows buffer more than <n> bytes of input.\n"
+           "       --flow-idle-timeout <secs> Evict flows of pcap input whose connection has not seen packets for <secs> "
+           "seconds of capture time.\n"
+           "       --skip-evicted-flows       Discard evicted flows instead of finishing their parsing.\n"
            "\n"
            "Environment variables:\n"
            "\n"
@@ -134,7 +193,7 @@ void SpicyDriver::parseOptions(int argc, char** argv) {
     driver_options.logger = std::make_unique<hilti::Logger>();
 
     while ( true ) {
-        int c = getopt_long(argc, argv, "ABcD:f:F:hdJX:Vlp:i:SRL:UZ", long_driver_options, nullptr);
+        int c = getopt_long(argc, argv, "ABcD:f:F:hdJX:Vlp:P:i:SRL:tT:UZ", long_driver_options, nullptr);
 
         if ( c < 0 )
             break;
@@ -165,6 +224,12 @@ void SpicyDriver::parseOptions(int argc, char** argv) {
                 break;
             }
 
+            case 'P': {
+                opt_file = optarg;
+                opt_input_is_pcap = true;
+                break;
+            }
+
             case 'X': {
                 auto arg = std::string(optarg);
 
@@ -223,6 +288,52 @@ void SpicyDriver::parseOptions(int argc, char** argv) {
 
             case 'S': driver_options.skip_dependencies = true; break;
 
+            case 't': opt_report_throughput = true; break;
+
+            case OPT_REPORT_THROUGHPUT_INTERVAL: {
+                auto interval = atof(optarg); // NOLINT
+                if ( interval <= 0 )
+                    fatalError("throughput reporting interval must be positive");
+
+                opt_report_throughput = true;
+                opt_report_throughput_interval = interval;
+                break;
+            }
+
+            case OPT_REPORT_THROUGHPUT_JSON:
+                opt_report_throughput = true;
+                opt_report_throughput_json = true;
+                break;
+
+            case OPT_MAX_FLOWS: opt_flow_limits.max_flows = parseLimit(optarg, "--max-flows"); break;
+            case OPT_MAX_FLOW_BYTES: opt_flow_limits.max_flow_bytes = parseLimit(optarg, "--max-flow-bytes"); break;
+            case OPT_MAX_TOTAL_BYTES: opt_flow_limits.max_total_bytes = parseLimit(optarg, "--max-total-bytes"); break;
+
+            case OPT_FLOW_IDLE_TIMEOUT: {
+                auto timeout = atof(optarg); // NOLINT
+                if ( timeout <= 0 )
+                    fatalError("flow idle timeout must be positive");
+
+                opt_flow_limits.idle_timeout = timeout;
+                break;
+            }
+
+            case OPT_SKIP_EVICTED_FLOWS: opt_flow_limits.skip_evicted = true; break;
+
+            case 'T': {
+                auto n = atoi(optarg); // NOLINT
+                if ( n <= 0 )
+                    fatalError("number of threads must be positive");
+
+                opt_threads = static_cast<unsigned int>(n);
+
+                // Each worker thread needs its own set of globals. This
+                // covers only code we compile ourselves, processing checks
+                // precompiled modules once loaded.
+                compiler_options.cxx_enable_dynamic_globals = true;
+                break;
+            }
+
             case 'U': driver_options.report_resource_usage = true; break;
 
             case 'v': std::cerr << "spicy-driver v" << hilti::configuration().version_string_long << std::endl; exit(0);
@@ -240,6 +351,17 @@ void SpicyDriver::parseOptions(int argc, char** argv) {
         }
     }
 
+    if ( opt_threads ) {
+        if ( ! opt_input_is_batch )
+            fatalError("--threads is supported only for batch input");
+
+        if ( opt_file == "/dev/stdin" || opt_file == "-" )
+            fatalError("--threads requires batch input from a file, not stdin");
+    }
+
+    if ( opt_flow_limits.idle_timeout > 0 && ! opt_input_is_pcap )
+        fatalError("--flow-idle-timeout is supported only for pcap input");
+
     setCompilerOptions(compiler_options);
     setDriverOptions(std::move(driver_options));
 
@@ -271,17 +393,32 @@ int main(int argc, char** argv) {
         if ( auto x = driver.initRuntime(); ! x )
             driver.fatalError(x.error());
 
+        if ( driver.opt_report_throughput )
+            driver.enableThroughputReporting(std::cerr, driver.opt_report_throughput_interval,
+                                             driver.opt_report_throughput_json);
+
+        driver.setFlowLimits(driver.opt_flow_limits);
+
         if ( driver.opt_list_parsers )
             driver.listParsers(std::cout);
 
         else {
-            std::ifstream in(driver.opt_file, std::ios::in | std::ios::binary);
+            // Read through a large buffer, batch input in particular tends
+            // to come in many small records.
+            std::vector<char> buffer(1024 * 1024);
+            std::ifstream in;
+            in.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            in.open(driver.opt_file, std::ios::in | std::ios::binary);
 
             if ( ! in.is_open() )
                 driver.fatalError("cannot open input for reading");
 
             if ( driver.opt_input_is_batch ) {
-                if ( auto x = driver.processPreBatchedInput(in); ! x )
+                if ( auto x = driver.processPreBatchedInput(in, driver.opt_threads); ! x )
+                    driver.fatalError(x.error());
+            }
+            else if ( driver.opt_input_is_pcap ) {
+                if ( auto x = driver.processPcapInput(in); ! x )
                     driver.fatalError(x.error());
             }
             else {
@@ -294,9 +431,18 @@ int main(int argc, char** argv) {
             }
         }
 
+        if ( driver.opt_flow_limits.any() ) {
+            auto evicted = driver.flowEvictions();
+            std::cerr << fmt("evicted flows: max-flows=%" PRIu64 " max-flow-bytes=%" PRIu64 " max-total-bytes=%" PRIu64
+                             " idle=%" PRIu64 "\n",
+                             evicted.max_flows, evicted.max_flow_bytes, evicted.max_total_bytes, evicted.idle);
+        }
+
+        driver.reportThroughput();
         driver.finishRuntime();
 
     } catch ( const std::exception& e ) {
+        driver.reportThroughput();
         driver.fatalError(hilti::util::fmt("terminating with uncaught exception of type %s: %s",
                                            hilti::util::demangle(typeid(e).name()), e.what()));
     }
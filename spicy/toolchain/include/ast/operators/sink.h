@@ -161,6 +161,25 @@ more information about trimming.
     }
 END_METHOD
 
+BEGIN_METHOD(sink, SetFilterBatch)
+    const auto& signature() const {
+        static auto _signature = hilti::operator_::Signature{.self = spicy::type::Sink(),
+                                                             .result = type::void_,
+                                                             .id = "set_filter_batch",
+                                                             .args = {{"n", type::UnsignedInteger(64)}},
+                                                             .doc = R"(
+Sets how many bytes of in-order data the sink collects for a connected
+filter before letting the filter process them. The default of 0 runs the
+filter on each chunk. Batches reduce the overhead of running the filter
+for input arriving in many small chunks; for decompressors, batches
+beyond a few kilobytes tend to be slower again because of the larger
+output they produce at once. Pending data always passes through the
+filter before gaps and skips are reported, and when the sink closes.
+)"};
+        return _signature;
+    }
+END_METHOD
+
 BEGIN_METHOD(sink, SetInitialSequenceNumber)
     const auto& signature() const {
         static auto _signature = hilti::operator_::Signature{.self = spicy::type::Sink(),
@@ -201,6 +220,23 @@ from the chunk that came first.
     }
 END_METHOD
 
+BEGIN_METHOD(sink, SetResumeBatch)
+    const auto& signature() const {
+        static auto _signature = hilti::operator_::Signature{.self = spicy::type::Sink(),
+                                                             .result = type::void_,
+                                                             .id = "set_resume_batch",
+                                                             .args = {{"n", type::UnsignedInteger(64)}},
+                                                             .doc = R"(
+Sets how many chunks of in-order data the sink passes on to connected
+units before resuming their parsing. The default of 1 resumes them after
+each chunk; larger values reduce the overhead of switching into the
+units' parsers when input arrives in many small chunks. Units always get
+resumed before gaps and skips are reported, and when the sink closes.
+)"};
+        return _signature;
+    }
+END_METHOD
+
 BEGIN_METHOD(sink, Skip)
     const auto& signature() const {
         static auto _signature = hilti::operator_::Signature{.self = spicy::type::Sink(),
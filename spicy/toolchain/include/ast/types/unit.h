@@ -154,6 +154,12 @@ public:
      */
     bool isFilter() const { return propertyItem("%filter").has_value(); }
 
+    /**
+     * Returns true if any of the unit's fields stores a view into its input
+     * instead of a copy (i.e., if a field has the `&view` attribute).
+     */
+    bool hasInputViews() const;
+
     /** Returns the grammar associated with the type. It must have been set
      * before through `setGrammar()`. */
     const spicy::detail::codegen::Grammar& grammar() const {
@@ -160,6 +160,13 @@ struct ParserState {
      * Expression holding the last parse error if any. This field is set only in sync or trial mode.
      */
     Expression error;
+
+    /**
+     * Boolean expression that's true if the input holds all the data for the
+     * current run of fixed-size fields, so that parsing them does not need
+     * to wait for input individually. Set only while parsing such a run.
+     */
+    std::optional<Expression> fixed_size_available;
 };
 
 /** Generates the parsing logic for a unit type. */
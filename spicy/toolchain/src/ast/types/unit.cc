@@ -47,6 +47,17 @@ NodeRef type::Unit::itemRefByName(const ID& id) const {
     return {};
 }
 
+bool type::Unit::hasInputViews() const {
+    const Node root = *this;
+    auto v = hilti::visitor::PreOrder<>();
+    for ( auto i : v.walk(root) ) {
+        if ( auto f = i.node.tryAs<type::unit::item::Field>(); f && AttributeSet::find(f->attributes(), "&view") )
+            return true;
+    }
+
+    return false;
+}
+
 struct AssignFieldIndicesVisitor : public hilti::visitor::PreOrder<void, AssignFieldIndicesVisitor> {
     AssignFieldIndicesVisitor(uint64_t next_index) : next_index(next_index) {}
 
@@ -306,6 +306,11 @@ struct VisitorPass2 : public hilti::visitor::PreOrder<void, VisitorPass2> {
         replaceNode(&p, std::move(x));
     }
 
+    result_t operator()(const operator_::sink::SetFilterBatch& n, position_t p) {
+        auto x = builder::memberCall(n.op0(), "set_filter_batch", {argument(n.op2(), 0)});
+        replaceNode(&p, std::move(x));
+    }
+
     result_t operator()(const operator_::sink::SetInitialSequenceNumber& n, position_t p) {
         auto x = builder::memberCall(n.op0(), "set_initial_sequence_number", {argument(n.op2(), 0)});
         replaceNode(&p, std::move(x));
@@ -316,6 +321,11 @@ struct VisitorPass2 : public hilti::visitor::PreOrder<void, VisitorPass2> {
         replaceNode(&p, std::move(x));
     }
 
+    result_t operator()(const operator_::sink::SetResumeBatch& n, position_t p) {
+        auto x = builder::memberCall(n.op0(), "set_resume_batch", {argument(n.op2(), 0)});
+        replaceNode(&p, std::move(x));
+    }
+
     result_t operator()(const operator_::sink::SizeValue& n, position_t p) {
         auto x = builder::memberCall(n.op0(), "size", {});
         replaceNode(&p, std::move(x));
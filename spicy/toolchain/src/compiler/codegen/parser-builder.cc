@@ -1,12 +1,14 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
 #include <algorithm>
+#include <cctype>
 #include <numeric>
 #include <optional>
 #include <sstream>
 #include <utility>
 
 #include <hilti/ast/builder/all.h>
+#include <hilti/ast/ctors/bytes.h>
 #include <hilti/ast/ctors/regexp.h>
 #include <hilti/ast/declarations/field.h>
 #include <hilti/ast/declarations/local-variable.h>
@@ -16,6 +18,7 @@
 #include <hilti/ast/expressions/type-wrapped.h>
 #include <hilti/ast/expressions/void.h>
 #include <hilti/ast/statements/declaration.h>
+#include <hilti/ast/types/address.h>
 #include <hilti/ast/types/exception.h>
 #include <hilti/ast/types/integer.h>
 #include <hilti/ast/types/stream.h>
@@ -50,6 +53,70 @@ namespace spicy::logging::debug {
 inline const hilti::logging::DebugStream ParserBuilder("parser-builder");
 } // namespace spicy::logging::debug
 
+// Returns a regular expression pattern matching exactly the given bytes.
+static std::string bytesToRegExp(const std::string& data) {
+    std::string re;
+
+    for ( auto c : data ) {
+        if ( std::isalnum(static_cast<unsigned char>(c)) )
+            re += c;
+        else
+            re += fmt("\\x%02x", static_cast<unsigned char>(c));
+    }
+
+    return re;
+}
+
+// Returns the value of a production if it is a non-empty bytes literal.
+static std::optional<std::string> bytesLiteral(const Production& p) {
+    auto c = p.tryAs<production::Ctor>();
+    if ( ! c )
+        return {};
+
+    auto b = c->ctor().tryAs<hilti::ctor::Bytes>();
+    if ( ! b || b->value().empty() )
+        return {};
+
+    return b->value();
+}
+
+// Returns the number of bytes a production parses if it is a field of fixed
+// size that parses directly from the current input, without any hooks,
+// attributes, or conditions affecting that.
+static std::optional<uint64_t> fixedSizeField(const Production& p) {
+    const auto& meta = p.meta();
+    if ( ! p.isA<production::Variable>() || ! meta.field() || ! meta.isFieldProduction() || meta.container() )
+        return {};
+
+    const auto& field = meta.field();
+    if ( field->condition() || field->isContainer() || field->isForwarding() || field->hooks().size() )
+        return {};
+
+    if ( auto attrs = field->attributes() ) {
+        for ( const auto& a : attrs->attributes() ) {
+            if ( a.tag() != "&byte-order" && a.tag() != "&bit-order" && a.tag() != "&ipv4" && a.tag() != "&ipv6" &&
+                 a.tag() != "&convert" && a.tag() != "&requires" )
+                return {};
+        }
+    }
+
+    const auto& t = p.as<production::Variable>().type();
+
+    if ( auto x = t.tryAs<hilti::type::SignedInteger>() )
+        return static_cast<uint64_t>(x->width() / 8);
+
+    if ( auto x = t.tryAs<hilti::type::UnsignedInteger>() )
+        return static_cast<uint64_t>(x->width() / 8);
+
+    if ( auto x = t.tryAs<spicy::type::Bitfield>() )
+        return static_cast<uint64_t>(x->width() / 8);
+
+    if ( t.isA<hilti::type::Address>() )
+        return AttributeSet::find(field->attributes(), "&ipv4") ? 4 : 16;
+
+    return {};
+}
+
 const hilti::Type look_ahead::Type = hilti::type::SignedInteger(64); // TODO(cppcoreguidelines-interfaces-global-init)
 const hilti::Expression look_ahead::None = builder::integer(0);      // TODO(cppcoreguidelines-interfaces-global-init)
 const hilti::Expression look_ahead::Eod = builder::integer(-1);      // TODO(cppcoreguidelines-interfaces-global-init)
@@ -301,6 +368,12 @@ struct ProductionVisitor
                                     builder::id(ID(hilti::rt::fmt("__feat%%%s%%%s", id, "uses_random_access")))),
                                 [&]() { builder()->addAssign(state().trim, builder::bool_(false)); });
 
+                    // Keep the input of units storing views into it from
+                    // getting trimmed for as long as the unit instance exists.
+                    if ( unit->hasInputViews() )
+                        builder()->addAssign(builder::member(state().self, "__pin"),
+                                             builder::call("spicy_rt::pin_input", {state().cur}));
+
                     build_parse_stage1_logic();
 
                     // Call stage 2.
@@ -908,6 +981,26 @@ struct ProductionVisitor
         std::partition_copy(tokens.begin(), tokens.end(), std::back_inserter(regexps), std::back_inserter(other),
                             [](auto& p) { return p.type()->template isA<hilti::type::RegExp>(); });
 
+        // If there's more than one bytes literal, and no regexps, match the
+        // literals through a joint regular expression so that a single pass
+        // over the input determines the token, instead of trying each
+        // literal in turn. Distinct literals cannot match input of the same
+        // length, so the joint matcher cannot hide an ambiguity between
+        // them. That's different for regexps, which we hence continue to
+        // match separately from any literals to detect such conflicts below.
+        // We don't do this when searching for the literals during
+        // synchronization, which needs to find the earliest occurrence of any
+        // of them and hence keeps trying them individually.
+        auto literals = static_cast<size_t>(
+            std::count_if(other.begin(), other.end(), [](auto& p) { return bytesLiteral(p).has_value(); }));
+
+        if ( mode != LiteralMode::Search && regexps.empty() && literals > 1 ) {
+            auto i = std::stable_partition(other.begin(), other.end(),
+                                           [](auto& p) { return ! bytesLiteral(p).has_value(); });
+            regexps.insert(regexps.end(), i, other.end());
+            other.erase(i, other.end());
+        }
+
         auto parse = [&]() {
             bool first_token = true;
 
@@ -943,6 +1036,9 @@ struct ProductionVisitor
 
                 // Create the joint regular expression. The token IDs become the regexps' IDs.
                 auto patterns = hilti::util::transform(regexps, [](const auto& c) {
+                    if ( auto b = bytesLiteral(c) )
+                        return std::make_pair(std::vector<std::string>{bytesToRegExp(*b)}, c.tokenID());
+
                     return std::make_pair(c.template as<production::Ctor>()
                                               .ctor()
                                               .template as<hilti::ctor::RegExp>()
@@ -1014,7 +1110,7 @@ struct ProductionVisitor
                 pb->state().printDebug(builder());
             }
 
-            // Parse non-regexps successively.
+            // Parse remaining literals successively.
             for ( auto& p : other ) {
                 if ( ! p.isLiteral() )
                     continue;
@@ -1650,8 +1746,42 @@ struct ProductionVisitor
     }
 
     void operator()(const production::Sequence& p) {
-        for ( const auto& i : p.sequence() )
-            parseProduction(i);
+        const auto& items = p.sequence();
+
+        for ( auto i = items.begin(); i != items.end(); ) {
+            // Find the run of fixed-size fields starting here, if any.
+            uint64_t size = 0;
+            auto end = i;
+            for ( ; end != items.end(); ++end ) {
+                auto n = fixedSizeField(*end);
+                if ( ! n )
+                    break;
+
+                size += *n;
+            }
+
+            if ( end - i < 2 ) {
+                parseProduction(*i++);
+                continue;
+            }
+
+            // Check once whether all the fields' data is available already.
+            // If so, they skip waiting for input individually. Trimming is
+            // deferred to the end of the run as well.
+            auto pstate = state();
+            pstate.fixed_size_available =
+                builder()->addTmp("fixed_size_available",
+                                  builder::greaterEqual(builder::size(state().cur), builder::integer(size)));
+            pushState(std::move(pstate));
+
+            for ( ; i != end; ++i )
+                parseProduction(*i);
+
+            popState();
+
+            if ( ! state().needs_look_ahead )
+                pb->trimInput();
+        }
     }
 
     void operator()(const production::Skip& p) {
@@ -1671,11 +1801,17 @@ struct ProductionVisitor
 
             if ( size_attr ) {
                 auto n = builder()->addTmp("skip", *size_attr->valueAsExpression());
+
+                // Unless we may need the data later, have the stream discard
+                // it right when it arrives. We then get to see just what's
+                // already there, plus the gap left once the end is reached.
+                pushBuilder(builder()->addIf(state().trim),
+                            [&]() { builder()->addCall("spicy_rt::discardInput", {state().data, state().cur, n}); });
+
                 auto loop = builder()->addWhile(builder::greater(n, builder::integer(0U)));
                 pushBuilder(loop, [&]() {
                     pb->waitForInput(builder::integer(1U), "not enough bytes for skipping", p.location());
-                    auto consume = builder()->addTmp("consume", builder::min(builder::size(state().cur),
-                                                                             *size_attr->valueAsExpression()));
+                    auto consume = builder()->addTmp("consume", builder::min(builder::size(state().cur), n));
                     pb->advanceInput(consume);
                     builder()->addAssign(n, builder::difference(n, consume));
                     builder()->addDebugMsg("spicy-verbose", "- skipped %u bytes (%u left to skip)", {consume, n});
@@ -2416,6 +2552,10 @@ void ParserBuilder::afterHook() {
         else
             advance->addAssign(state().cur, ncur);
 
+        // The hook moved the input, so we no longer know what's available.
+        if ( state().fixed_size_available )
+            advance->addAssign(*state().fixed_size_available, builder::bool_(false));
+
         advance->addAssign(builder::member(state().self, ID("__position_update")),
                            builder::optional(hilti::type::stream::Iterator()));
     });
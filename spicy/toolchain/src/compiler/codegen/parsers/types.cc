@@ -1,5 +1,6 @@
 // Copyright (c) 2020-2023 by the Zeek Project. See LICENSE for details.
 
+#include <optional>
 #include <utility>
 
 #include <hilti/ast/builder/all.h>
@@ -53,12 +54,18 @@ struct Visitor : public hilti::visitor::PreOrder<Expression, Visitor> {
                              const Meta& m, bool is_try) {
         if ( ! is_try ) {
             auto error_msg = fmt("expecting %d bytes for unpacking value", len);
-            pb->waitForInput(builder::integer(len), error_msg, m);
+
+            if ( const auto& available = state().fixed_size_available )
+                pushBuilder(builder()->addIf(builder::not_(*available)),
+                            [&]() { pb->waitForInput(builder::integer(len), error_msg, m); });
+            else
+                pb->waitForInput(builder::integer(len), error_msg, m);
 
             auto unpacked = builder::unpack(t, unpack_args);
             builder()->addAssign(builder::tuple({target, state().cur}), builder::deref(unpacked));
 
-            if ( ! state().needs_look_ahead )
+            // Inside a run of fixed-size fields, the caller trims once at the end.
+            if ( ! state().needs_look_ahead && ! state().fixed_size_available )
                 pb->trimInput();
 
             return target;
@@ -182,6 +189,7 @@ struct Visitor : public hilti::visitor::PreOrder<Expression, Visitor> {
         auto size_attr = AttributeSet::find(meta.field()->attributes(), "&size");
         auto until_attr = AttributeSet::find(meta.field()->attributes(), "&until");
         auto until_including_attr = AttributeSet::find(meta.field()->attributes(), "&until-including");
+        auto view_attr = AttributeSet::find(meta.field()->attributes(), "&view");
 
         bool to_eod = eod_attr.has_value(); // parse to end of input data
         bool parse_attr = false;            // do we have a &parse-* attribute
@@ -256,7 +264,14 @@ struct Visitor : public hilti::visitor::PreOrder<Expression, Visitor> {
             if ( meta.field() && chunked_attr && ! meta.container() )
                 pb->enableDefaultNewValueForField(false);
 
-            builder()->addAssign(target, builder::bytes(""));
+            // With &view, the value is a single view spanning all the input
+            // consumed, which we set once we have found the delimiter.
+            std::optional<Expression> view_begin;
+            if ( view_attr )
+                view_begin = builder()->addTmp("view_begin", builder::begin(state().cur));
+            else
+                builder()->addAssign(target, builder::bytes(""));
+
             auto body = builder()->addWhile(builder::bool_(true));
             pushBuilder(body, [&]() {
                 // Helper to add a new chunk of data to the field's value,
@@ -290,15 +305,21 @@ struct Visitor : public hilti::visitor::PreOrder<Expression, Visitor> {
 
                 Expression match = builder::memberCall(state().cur, "sub", {it});
 
-                auto non_empty_match = builder()->addIf(builder::size(match));
-                pushBuilder(non_empty_match, [&]() { add_match_data(target, match); });
+                if ( ! view_attr ) {
+                    auto non_empty_match = builder()->addIf(builder::size(match));
+                    pushBuilder(non_empty_match, [&]() { add_match_data(target, match); });
+                }
 
                 auto [found_branch, not_found_branch] = builder()->addIfElse(found);
 
                 pushBuilder(found_branch, [&]() {
                     auto new_it = builder::sum(it, until_bytes_size_var);
 
-                    if ( until_including_attr )
+                    if ( view_attr )
+                        builder()->addAssign(target, builder::memberCall(state().cur, "sub",
+                                                                         {*view_begin,
+                                                                          (until_including_attr ? new_it : it)}));
+                    else if ( until_including_attr )
                         add_match_data(target, builder::memberCall(state().cur, "sub", {it, new_it}));
 
                     pb->advanceInput(new_it);
@@ -169,6 +169,10 @@ Type CodeGen::compileUnit(const type::Unit& unit, bool declare_only) {
         v.addField(std::move(f));
     }
 
+    if ( unit.hasInputViews() )
+        v.addField(hilti::declaration::Field(ID("__pin"), builder::typeByID("spicy_rt::InputPin"),
+                                             AttributeSet({Attribute("&internal")})));
+
     add_hook("0x25_init", {});
     add_hook("0x25_done", {});
     add_hook("0x25_error", { builder::parameter("__except", type::String()) });
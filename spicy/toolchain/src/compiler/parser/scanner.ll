@@ -58,7 +58,7 @@ doc_field    [ \t]*##<[^\n]*\n?
 doc_text     [ \t]*##[^\n]*\n?
 comment      [ \t]*#[^#\n]*\n?
 
-attribute \&(bit-order|byte-order|chunked|convert|count|cxxname|default|eod|internal|ipv4|ipv6|hilti_type|length|max-size|no-emit|nosub|on-heap|optional|originator|parse-at|parse-from|priority|requires|responder|size|static|synchronize|transient|try|type|until|until-including|while|have_prototype)
+attribute \&(bit-order|byte-order|chunked|convert|count|cxxname|default|eod|internal|ipv4|ipv6|hilti_type|length|max-size|no-emit|nosub|on-heap|optional|originator|parse-at|parse-from|priority|requires|responder|size|static|synchronize|transient|try|type|until|until-including|view|while|have_prototype)
 blank     [ \t]
 digit     [0-9]
 digits    {digit}+
@@ -15,6 +15,7 @@
 #include <hilti/ast/type.h>
 #include <hilti/ast/types/integer.h>
 #include <hilti/ast/types/reference.h>
+#include <hilti/ast/types/stream.h>
 #include <hilti/ast/types/unresolved-id.h>
 #include <hilti/base/logger.h>
 #include <hilti/compiler/plugin.h>
@@ -87,6 +88,10 @@ std::optional<Type> _fieldType(const type::unit::item::Field& f, const Type& typ
     if ( ! type::isResolved(nt) )
         return {};
 
+    // Bytes fields with &view store a view into the input instead of a copy.
+    if ( ft != FieldType::ParseType && nt.isA<type::Bytes>() && AttributeSet::find(f.attributes(), "&view") )
+        nt = type::stream::View(meta);
+
     if ( is_container )
         return type::Vector(nt, meta);
     else
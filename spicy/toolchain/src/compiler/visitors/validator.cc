@@ -535,6 +535,24 @@ struct VisitorPost : public hilti::visitor::PreOrder<void, VisitorPost>, public
             }
         }
 
+        else if ( a.tag() == "&view" ) {
+            if ( auto f = getAttrField(p) ) {
+                if ( ! f->parseType().isA<type::Bytes>() || f->ctor() || f->isContainer() )
+                    error("&view is only valid for bytes fields", p);
+                else if ( a.hasValue() )
+                    error("&view cannot have an expression", p);
+                else if ( ! (AttributeSet::has(f->attributes(), "&eod") ||
+                             AttributeSet::has(f->attributes(), "&size") ||
+                             AttributeSet::has(f->attributes(), "&until") ||
+                             AttributeSet::has(f->attributes(), "&until-including")) )
+                    error("&view must be used with &eod, &until, &until-including or &size", p);
+                else if ( AttributeSet::has(f->attributes(), "&chunked") ||
+                          AttributeSet::has(f->attributes(), "&convert") ||
+                          AttributeSet::has(f->attributes(), "&parse-from") )
+                    error("&view cannot be combined with &chunked, &convert, or &parse-from", p);
+            }
+        }
+
         else if ( a.tag() == "&convert" ) {
             if ( ! a.hasValue() )
                 error("&convert must provide an expression", p);
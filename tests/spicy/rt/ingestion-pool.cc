@@ -0,0 +1,97 @@
+// Parses flows on a pool of threads that balance the flows between them.
+//
+// @TEST-GROUP: no-jit
+// @TEST-EXEC: spicyc -g -c --cxx-enable-dynamic-globals test.spicy >test.cc
+// @TEST-EXEC: spicyc -g -l --cxx-enable-dynamic-globals test.cc >test-linker.cc
+// @TEST-EXEC: $(spicy-config --cxx) -pthread -o test test.cc test-linker.cc %INPUT $(spicy-config --cxxflags --ldflags)
+// @TEST-EXEC: ./test 4 256 >output
+// @TEST-EXEC: btest-diff output
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <hilti/rt/libhilti.h>
+
+#include <spicy/rt/libspicy.h>
+
+using namespace spicy::rt;
+
+int main(int argc, char** argv) {
+    assert(argc == 3);
+    auto num_threads = std::atoi(argv[1]);
+    auto num_flows = std::atoi(argv[2]);
+
+    hilti::rt::init();
+    spicy::rt::init();
+
+    Driver driver;
+    auto parser = driver.lookupParser("Test::Message");
+    assert(parser);
+
+    std::atomic<int> errors = 0;
+
+    ingestion::Options options;
+    options.queue_size = 1024;
+    options.on_error = [&](ingestion::FlowHandle, const hilti::rt::Exception&) { ++errors; };
+
+    ingestion::Pool pool(num_threads, options);
+    pool.start();
+
+    for ( int i = 0; i < num_flows; ++i )
+        pool.begin(i, *parser);
+
+    // Feed all flows one byte at a time in an interleaved fashion, so that
+    // each flow keeps becoming ready again. The last flow receives invalid
+    // input.
+    std::vector<std::string> msgs;
+
+    for ( int i = 0; i < num_flows; ++i ) {
+        auto payload = hilti::rt::fmt("flow-%d", i);
+        msgs.push_back(std::string("\x00", 1) + static_cast<char>(payload.size()) + payload + "END\n");
+    }
+
+    msgs.back().back() = '?';
+
+    for ( size_t n = 0; n < msgs.back().size(); ++n ) {
+        for ( int i = 0; i < num_flows; ++i ) {
+            if ( n >= msgs[i].size() )
+                continue;
+
+            while ( pool.data(i, &msgs[i][n], 1) == ingestion::Status::Full )
+                std::this_thread::yield();
+        }
+    }
+
+    for ( int i = 0; i < num_flows; ++i )
+        pool.end(i);
+
+    // Leave one flow suspended in the middle of parsing, for `stop()` to
+    // release on its thread.
+    pool.begin(num_flows, *parser);
+    pool.data(num_flows, "\x00\x10", 2);
+
+    pool.stop();
+
+    auto stats = pool.statistics();
+    std::cout << "flows=" << num_flows << " active=" << stats.flows << " errors=" << errors
+              << " processed=" << (stats.processed == stats.queued ? "all" : "some") << std::endl;
+
+    spicy::rt::done();
+    hilti::rt::done();
+
+    return 0;
+}
+
+// @TEST-START-FILE test.spicy
+module Test;
+
+public type Message = unit {
+    length: uint16;
+    payload: bytes &size=self.length;
+    : /END\n/;
+};
+// @TEST-END-FILE
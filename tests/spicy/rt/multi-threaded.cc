@@ -0,0 +1,109 @@
+// Runs parsers concurrently on several threads, each with its own runtime context.
+//
+// @TEST-GROUP: no-jit
+// @TEST-EXEC: spicyc -g -c --cxx-enable-dynamic-globals test.spicy >test.cc
+// @TEST-EXEC: spicyc -g -l --cxx-enable-dynamic-globals test.cc >test-linker.cc
+// @TEST-EXEC: $(spicy-config --cxx) -pthread -o test test.cc test-linker.cc %INPUT $(spicy-config --cxxflags --ldflags)
+// @TEST-EXEC: ./test 8 64 >output
+// @TEST-EXEC: btest-diff output
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <hilti/rt/libhilti.h>
+
+#include <spicy/rt/libspicy.h>
+
+class ParsingState : public spicy::rt::driver::ParsingState {
+public:
+    ParsingState(const spicy::rt::Parser* parser)
+        : spicy::rt::driver::ParsingState(spicy::rt::driver::ParsingType::Stream, parser) {}
+
+protected:
+    void debug(const std::string& msg) override {}
+};
+
+int main(int argc, char** argv) {
+    if ( argc != 3 ) {
+        std::cerr << "usage: " << argv[0] << " <threads> <flows per thread>" << std::endl;
+        return 1;
+    }
+
+    auto num_threads = std::atoi(argv[1]);
+    auto num_flows = std::atoi(argv[2]);
+
+    hilti::rt::init();
+    spicy::rt::init();
+
+    spicy::rt::Driver driver;
+    auto parser = driver.lookupParser("Test::Message");
+    if ( ! parser ) {
+        std::cerr << "error: " << parser.error() << std::endl;
+        return 1;
+    }
+
+    std::atomic<int> parsed = 0;
+    std::atomic<int> errors = 0;
+    std::vector<std::thread> threads;
+
+    for ( int i = 0; i < num_threads; ++i ) {
+        threads.emplace_back([&, i]() {
+            hilti::rt::context::ThreadContext context;
+
+            std::vector<ParsingState> flows;
+            flows.reserve(num_flows);
+
+            for ( int j = 0; j < num_flows; ++j )
+                flows.emplace_back(*parser);
+
+            // Feed all flows one byte at a time in an interleaved fashion,
+            // so that each thread keeps many parsers suspended concurrently.
+            auto payload = hilti::rt::fmt("thread-%d", i);
+            auto msg = std::string("\x00", 1) + static_cast<char>(payload.size()) + payload + "END\n";
+
+            for ( auto c : msg ) {
+                for ( auto& f : flows ) {
+                    try {
+                        f.process(1, &c);
+                    } catch ( const hilti::rt::Exception& e ) {
+                        ++errors;
+                    }
+                }
+            }
+
+            for ( auto& f : flows ) {
+                try {
+                    if ( f.finish() )
+                        ++parsed;
+                } catch ( const hilti::rt::Exception& e ) {
+                    ++errors;
+                }
+            }
+        });
+    }
+
+    for ( auto& t : threads )
+        t.join();
+
+    std::cout << "threads=" << num_threads << " flows=" << num_threads * num_flows << " parsed=" << parsed
+              << " errors=" << errors << std::endl;
+
+    spicy::rt::done();
+    hilti::rt::done();
+
+    return 0;
+}
+
+// @TEST-START-FILE test.spicy
+module Test;
+
+public type Message = unit {
+    length: uint16;
+    payload: bytes &size=self.length;
+    : /END\n/;
+};
+// @TEST-END-FILE